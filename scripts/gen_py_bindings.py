@@ -30,7 +30,7 @@ from pybind.writer import Writer
 from pybind import Module, Class
 from pybind.parameters import (StringParameter, ClassParameter,
                                NumericParameter, ArgvObjects, IntegralArgv,
-                               ListOfStringsParameter)
+                               ListOfStringsParameter, BufferParameter)
 from pybind.retval import (StringViewRetVal, StringRetVal, ListOfStringsRetVal,
                            NumericRetVal, ObjCopyRetval, ObjOwnerRetval,
                            ObjTupleRetVal, IntegralTupleRetVal)
@@ -39,6 +39,7 @@ from pybind.exceptions import CppException
 # Module
 mod = Module('backends')
 mod.AddInclude('python/weights.h')
+mod.AddInclude('python/analysis.h')
 mod.AddInitialization('lczero::InitializeMagicBitboards();')
 ex = mod.AddException(
     CppException('LczeroException', cpp_name='lczero::Exception'))
@@ -101,6 +102,14 @@ backend.constructor.AddParameter(
     StringParameter('options', optional=True, can_be_none=True)).AddEx(ex)
 backend.AddMethod('evaluate').AddParameter(ArgvObjects(
     'inputs', input)).AddRetVal(ObjTupleRetVal(output)).AddEx(ex)
+backend.AddMethod('evaluate_batch').AddParameter(
+    BufferParameter('masks', type='u64'),
+    BufferParameter('values', type='f32'),
+    BufferParameter('q', type='f32', writable=True),
+    BufferParameter('d', type='f32', writable=True),
+    BufferParameter('m', type='f32', writable=True),
+    BufferParameter('policy', type='f32', writable=True),
+).ReleaseGil().AddEx(ex)
 backend.AddMethod('capabilities').AddRetVal(ObjCopyRetval(backend_caps))
 
 # PositionHistory class
@@ -117,6 +126,36 @@ game_state.AddMethod('moves').AddRetVal(ListOfStringsRetVal())
 game_state.AddMethod('policy_indices').AddRetVal(IntegralTupleRetVal('i'))
 game_state.AddMethod('as_string').AddRetVal(StringRetVal())
 
+# SearchResult class
+search_result = mod.AddClass(
+    Class('SearchResult',
+          cpp_name='lczero::python::SearchResult',
+          disable_constructor=True))
+search_result.AddMethod('bestmove').AddRetVal(StringRetVal())
+search_result.AddMethod('ponder').AddRetVal(StringRetVal())
+search_result.AddMethod('pv').AddRetVal(ListOfStringsRetVal())
+search_result.AddMethod('q').AddRetVal(NumericRetVal('f32'))
+search_result.AddMethod('d').AddRetVal(NumericRetVal('f32'))
+search_result.AddMethod('m').AddRetVal(NumericRetVal('f32'))
+search_result.AddMethod('nodes').AddRetVal(NumericRetVal('i'))
+search_result.AddMethod('moves').AddRetVal(ListOfStringsRetVal())
+search_result.AddMethod('visits').AddRetVal(IntegralTupleRetVal('i'))
+search_result.AddMethod('policy').AddRetVal(IntegralTupleRetVal('f32'))
+search_result.AddMethod('move_q').AddRetVal(IntegralTupleRetVal('f32'))
+
+# AnalysisPool class
+analysis_pool = mod.AddClass(
+    Class('AnalysisPool', cpp_name='lczero::python::AnalysisPool'))
+analysis_pool.constructor.AddParameter(
+    ClassParameter(backend, 'backend'),
+    ListOfStringsParameter('options', optional=True)).AddEx(ex)
+analysis_pool.AddMethod('analyze').AddParameter(
+    ListOfStringsParameter('fens'),
+    NumericParameter('nodes', optional=True),
+    NumericParameter('movetime', optional=True),
+).AddRetVal(ObjTupleRetVal(search_result)).ReleaseGil().AddEx(ex)
+analysis_pool.AddMethod('clear_cache')
+
 with open(sys.argv[1], 'wt') as f:
     writer = Writer(f)
     mod.Generate(writer)
\ No newline at end of file
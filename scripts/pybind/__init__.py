@@ -188,6 +188,7 @@ class Module(FunctionContainer):
             w.Write(f'#include "{x}"')
 
         w.Write('\nnamespace {')
+        self._generate_gil_release(w)
         for cls in self.exceptions:
             cls.Generate(w)
         for cls in self.classes:
@@ -200,6 +201,16 @@ class Module(FunctionContainer):
 
         self._generate_main_func(w)
 
+    def _generate_gil_release(self, w):
+        w.Write('// Releases the GIL for the lifetime of the object.')
+        w.Open('class GilRelease {')
+        w.Write(' public:')
+        w.Write('GilRelease() : state_(PyEval_SaveThread()) {}')
+        w.Write('~GilRelease() { PyEval_RestoreThread(state_); }\n')
+        w.Write(' private:')
+        w.Write('PyThreadState* const state_;')
+        w.Close('};\n')
+
     def struct_name(self):
         return f'T{self.name}Module'
 
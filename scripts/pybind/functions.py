@@ -52,6 +52,7 @@ class Function(PyObject):
         self.self_type = self_type
         self.param_typ = param_type
         self.retval = NoneRetVal()
+        self.release_gil = False
 
     def AddParameter(self, *params):
         for param in params:
@@ -70,6 +71,12 @@ class Function(PyObject):
         self.exceptions.append(ex)
         return self
 
+    def ReleaseGil(self):
+        '''Lets other Python threads run during the C++ call. The function
+        must not touch Python objects.'''
+        self.release_gil = True
+        return self
+
     def Generate(self, w):
         w.Open(f'{self._return_cpp_type()} '
                f'{self.gen_function_name}({self._generate_params()}) {{')
@@ -188,6 +195,23 @@ class Function(PyObject):
     def _list_caller_params(self):
         return ', '.join([x.name_at_caller() for x in self.parameters])
 
+    def _generate_call(self, w):
+        call = self._call_expression()
+        if isinstance(self.retval, NoneRetVal):
+            if self.release_gil:
+                w.Open('{')
+                w.Write('GilRelease gil_release;')
+                w.Write(f'{call};')
+                w.Close('}')
+            else:
+                w.Write(f'{call};')
+        elif self.release_gil:
+            w.Write(f'{self.retval.cpp_type()} {self.retval.cpp_val()} = '
+                    f'[&]() {{ GilRelease gil_release; return {call}; }}();')
+        else:
+            w.Write(f'{self.retval.cpp_type()} '
+                    f'{self.retval.cpp_val()} = {call};')
+
     def _success(self):
         return self.retval.ret_val()
 
@@ -212,14 +236,8 @@ class MemberFunction(Function):
         self.cpp_name = cpp_name or name
         super().__init__(name, *args, **kwargs)
 
-    def _generate_call(self, w):
-        if isinstance(self.retval, NoneRetVal):
-            w.Write(
-                f'self->value->{self.cpp_name}({self._list_caller_params()});')
-        else:
-            w.Write(f'{self.retval.cpp_type()} '
-                    f'{self.retval.cpp_val()} = self->value->'
-                    f'{self.cpp_name}({self._list_caller_params()});')
+    def _call_expression(self):
+        return f'self->value->{self.cpp_name}({self._list_caller_params()})'
 
 
 class StaticFunction(Function):
@@ -231,15 +249,9 @@ class StaticFunction(Function):
     def function_meth_flags(self):
         return super().function_meth_flags() + '| METH_STATIC'
 
-    def _generate_call(self, w):
-        if isinstance(self.retval, NoneRetVal):
-            w.Write(f'{self.cpp_type_name}::{self.cpp_name}'
-                    f'({self._list_caller_params()});')
-        else:
-            w.Write(f'{self.retval.cpp_type()} '
-                    f'{self.retval.cpp_val()} = '
-                    f'{self.cpp_type_name}::'
-                    f'{self.cpp_name}({self._list_caller_params()});')
+    def _call_expression(self):
+        return (f'{self.cpp_type_name}::'
+                f'{self.cpp_name}({self._list_caller_params()})')
 
 
 class Constructor(Function):
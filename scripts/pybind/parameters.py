@@ -153,6 +153,54 @@ class NumericParameter(Parameter):
         pass
 
 
+class BufferParameter(Parameter):
+    '''Contiguous array of numbers (e.g. numpy array or bytearray), passed
+    to C++ as BufferView without copying. Writable ones are for outputs.'''
+    def __init__(self, *args, type='f32', writable=False, **kwargs):
+        self.type = type
+        self.writable = writable
+        super().__init__(*args, **kwargs)
+
+    def item_cpp_type(self):
+        item_type = {
+            'u64': 'uint64_t',
+            'f32': 'float',
+        }[self.type]
+        return item_type if self.writable else f'const {item_type}'
+
+    def cpp_type(self):
+        return f'lczero::python::BufferView<{self.item_cpp_type()}>'
+
+    def GenerateParseTupleSinkDeclaration(self, w):
+        # PyBuffer_Release() is a no-op for a buffer that was never filled.
+        w.Write(f'Py_buffer {self.name}{{}};')
+        w.Write(f'std::unique_ptr<Py_buffer, decltype(&PyBuffer_Release)> '
+                f'{self.name}_release(&{self.name}, PyBuffer_Release);')
+
+    def parse_tuple_sink_list(self):
+        return [f'&{self.name}']
+
+    def parse_tuple_format(self):
+        return 'w*' if self.writable else 'y*'
+
+    def GenerateCppParamInitialization(self, w, func):
+        item_type = self.item_cpp_type()
+        w.Open(f'if ({self.name}.len % sizeof({item_type}) != 0 || '
+               f'reinterpret_cast<uintptr_t>({self.name}.buf) % '
+               f'alignof({item_type}) != 0) {{')
+        w.Write('PyErr_SetString(PyExc_ValueError, '
+                f'"Buffer {self.name} must be an aligned array of '
+                f'{self.type}.");')
+        w.Write(f'return {func._failure()};')
+        w.Close('}')
+        w.Write(f'{self.cpp_type()} {self.name_at_caller()}('
+                f'static_cast<{item_type}*>({self.name}.buf), '
+                f'{self.name}.len / sizeof({item_type}));')
+
+    def name_at_caller(self):
+        return f'{self.cpp_name}_cpp'
+
+
 class ArgvParameter(Parameter):
     def __init__(self, name, type, *argv, **kwargs):
         self.type = type
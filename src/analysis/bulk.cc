@@ -0,0 +1,330 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "analysis/bulk.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "chess/callbacks.h"
+#include "mcts/search.h"
+#include "mcts/stoppers/common.h"
+#include "mcts/stoppers/stoppers.h"
+#include "neural/factory.h"
+#include "utils/exception.h"
+#include "utils/filesystem.h"
+#include "utils/logging.h"
+#include "utils/mutex.h"
+#include "utils/optionsparser.h"
+#include "utils/string.h"
+
+namespace lczero {
+namespace {
+const OptionId kInputId{"input", "",
+                        "FEN or EPD file with one position per line."};
+const OptionId kOutputId{
+    "output", "",
+    "File to append JSON lines results to, standard output if empty. "
+    "Positions which already have results in the file are skipped."};
+const OptionId kThreadsId{"threads", "", "Worker threads per search."};
+const OptionId kParallelId{"parallel", "",
+                           "Number of positions searched concurrently."};
+const OptionId kNodesId{"nodes", "", "Number of nodes to search per position."};
+const OptionId kMovetimeId{"movetime", "",
+                           "Time to search per position, in milliseconds."};
+const OptionId kBackendThreadsId{
+    "backend-threads", "", "Number of threads computing merged batches."};
+const OptionId kMaxBatchId{
+    "max-batch", "",
+    "Maximum number of positions from different searches to merge into one "
+    "batch."};
+
+const char kLinePrefix[] = "{\"line\": ";
+
+bool IsNumber(const std::string& str) {
+  return !str.empty() &&
+         std::all_of(str.begin(), str.end(), [](char c) { return isdigit(c); });
+}
+
+// What searches of all positions share.
+struct SearchSetup {
+  Network* network;
+  const OptionsDict* options;
+  NNCache* cache;
+  int threads;
+  int nodes;
+  int movetime;
+};
+
+// Searches the position of input line @line_number and returns the result as
+// a JSON line.
+std::string AnalyzeLine(int line_number, const std::string& line,
+                        const SearchSetup& setup,
+                        SearchThreadPool* thread_pool) {
+  std::ostringstream oss;
+  oss << kLinePrefix << line_number;
+  try {
+    const auto position = ParseEpdLine(line);
+    NodeTree tree;
+    tree.ResetToPosition(position.fen, {});
+
+    auto stopper = std::make_unique<ChainedSearchStopper>();
+    if (setup.nodes > 0) {
+      stopper->AddStopper(std::make_unique<VisitsStopper>(setup.nodes, false));
+    }
+    if (setup.movetime > 0) {
+      stopper->AddStopper(std::make_unique<TimeLimitStopper>(setup.movetime));
+    }
+    BestMoveInfo bestmove(Move{});
+    std::vector<Move> pv;
+    std::unique_ptr<UciResponder> responder =
+        std::make_unique<CallbackUciResponder>(
+            [&](const BestMoveInfo& info) { bestmove = info; },
+            [&](const std::vector<ThinkingInfo>& infos) {
+              for (const auto& info : infos) {
+                if (info.multipv <= 1 && !info.pv.empty()) pv = info.pv;
+              }
+            });
+    responder = std::make_unique<Chess960Transformer>(
+        std::move(responder), tree.HeadPosition().GetBoard());
+
+    const auto start = std::chrono::steady_clock::now();
+    Search search(tree, setup.network, std::move(responder), MoveList(), start,
+                  std::move(stopper), false, *setup.options, setup.cache,
+                  nullptr, thread_pool);
+    search.RunBlocking(setup.threads);
+    const auto time = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    if (pv.empty()) pv.push_back(bestmove.bestmove);
+    std::vector<std::string> pv_strings;
+    for (const auto& move : pv) {
+      pv_strings.push_back(JsonString(move.as_string()));
+    }
+    const auto eval = search.GetBestEval();
+    if (!position.id.empty()) oss << ", \"id\": " << JsonString(position.id);
+    oss << ", \"fen\": " << JsonString(position.fen)
+        << ", \"bestmove\": " << JsonString(bestmove.bestmove.as_string());
+    if (!(bestmove.ponder == Move())) {
+      oss << ", \"ponder\": " << JsonString(bestmove.ponder.as_string());
+    }
+    oss << ", \"pv\": [" << StrJoin(pv_strings, ", ") << "]"
+        << ", \"nodes\": " << search.GetTotalPlayouts()
+        << ", \"q\": " << eval.wl << ", \"d\": " << eval.d
+        << ", \"m\": " << eval.ml << ", \"time_ms\": " << time.count();
+  } catch (Exception& ex) {
+    // Bad positions get an error result too, so that resuming skips them.
+    oss << ", \"error\": " << JsonString(ex.what());
+  }
+  oss << "}";
+  return oss.str();
+}
+}  // namespace
+
+AnalysisPosition ParseEpdLine(const std::string& line) {
+  std::istringstream iss(line);
+  std::string fields[4];
+  for (auto& field : fields) {
+    if (!(iss >> field)) throw Exception("Not a FEN or EPD line: " + line);
+  }
+  AnalysisPosition result;
+  result.fen = StrJoin({fields[0], fields[1], fields[2], fields[3]});
+  std::string rest;
+  std::getline(iss, rest);
+
+  // FEN has move counters after the four fields it shares with EPD.
+  const auto counters = StrSplitAtWhitespace(rest);
+  if (counters.size() == 2 && IsNumber(counters[0]) && IsNumber(counters[1])) {
+    result.fen += " " + StrJoin(counters);
+    return result;
+  }
+
+  std::string halfmove_clock = "0";
+  std::string fullmove_number = "1";
+  auto process_operation = [&](const std::string& operation) {
+    const auto trimmed = Trim(operation);
+    if (trimmed.empty()) return;
+    const auto space = trimmed.find_first_of(" \t");
+    const auto opcode = trimmed.substr(0, space);
+    auto operand =
+        space == std::string::npos ? "" : Trim(trimmed.substr(space));
+    if (operand.size() >= 2 && operand.front() == '"' &&
+        operand.back() == '"') {
+      operand = operand.substr(1, operand.size() - 2);
+    }
+    if (opcode == "id") result.id = operand;
+    if (opcode == "hmvc" && IsNumber(operand)) halfmove_clock = operand;
+    if (opcode == "fmvn" && IsNumber(operand)) fullmove_number = operand;
+  };
+  // EPD operations end with semicolons, which may also appear in quoted
+  // operands.
+  std::string operation;
+  bool quoted = false;
+  for (const char c : rest) {
+    if (c == '"') quoted = !quoted;
+    if (c == ';' && !quoted) {
+      process_operation(operation);
+      operation.clear();
+    } else {
+      operation += c;
+    }
+  }
+  process_operation(operation);
+  result.fen += " " + halfmove_clock + " " + fullmove_number;
+  return result;
+}
+
+std::unordered_set<int> ReadAnalyzedLines(const std::string& filename) {
+  std::unordered_set<int> result;
+  std::ifstream file(filename);
+  const std::string prefix = kLinePrefix;
+  std::string line;
+  while (std::getline(file, line)) {
+    // Lines cut short by an interrupted run are analyzed again.
+    if (line.compare(0, prefix.size(), prefix) != 0 || line.back() != '}') {
+      continue;
+    }
+    result.insert(std::atoi(line.c_str() + prefix.size()));
+  }
+  return result;
+}
+
+void BulkAnalysis::Run() {
+  OptionsParser options;
+  NetworkFactory::PopulateOptions(&options);
+  SearchParams::Populate(&options);
+  options.Add<StringOption>(kInputId) = "";
+  options.Add<StringOption>(kOutputId) = "";
+  options.Add<IntOption>(kThreadsId, 1, 128) = 1;
+  options.Add<IntOption>(kParallelId, 1, 4096) = 64;
+  options.Add<IntOption>(kNodesId, -1, 999999999) = 800;
+  options.Add<IntOption>(kMovetimeId, -1, 999999999) = -1;
+  options.Add<IntOption>(kNNCacheSizeId, 0, 999999999) = 2000000;
+  options.Add<IntOption>(kBackendThreadsId, 1, 128) = 1;
+  options.Add<IntOption>(kMaxBatchId, 1, 65536) = 1024;
+
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    const auto& option_dict = options.GetOptionsDict();
+    const int nodes = option_dict.Get<int>(kNodesId);
+    const int movetime = option_dict.Get<int>(kMovetimeId);
+    if (nodes <= 0 && movetime <= 0) {
+      throw Exception("Either --nodes or --movetime must be set.");
+    }
+
+    const auto input = option_dict.Get<std::string>(kInputId);
+    if (input.empty()) throw Exception("--input is required.");
+    std::ifstream input_file(input);
+    if (!input_file) throw Exception("Unable to open " + input);
+    const auto output = option_dict.Get<std::string>(kOutputId);
+    const auto analyzed =
+        output.empty() ? std::unordered_set<int>() : ReadAnalyzedLines(output);
+    if (!analyzed.empty()) {
+      CERR << "Resuming, " << analyzed.size()
+           << " positions are already analyzed.";
+    }
+    std::vector<std::pair<int, std::string>> lines;
+    std::string line;
+    for (int line_number = 1; std::getline(input_file, line); ++line_number) {
+      line = Trim(line);
+      if (line.empty() || line[0] == '#' || analyzed.count(line_number)) {
+        continue;
+      }
+      lines.emplace_back(line_number, line);
+    }
+
+    std::ofstream output_file;
+    std::ostream* out = &std::cout;
+    if (!output.empty()) {
+      // Terminate a line cut short by an interrupted run.
+      bool needs_newline = false;
+      if (GetFileSize(output) > 0) {
+        std::ifstream existing(output, std::ios::binary);
+        existing.seekg(-1, std::ios::end);
+        needs_newline = existing.get() != '\n';
+      }
+      output_file.open(output, std::ios::app);
+      if (!output_file) throw Exception("Unable to open " + output);
+      if (needs_newline) output_file << '\n';
+      out = &output_file;
+    }
+
+    // Wrap the backend into the multiplexing one, which merges computations
+    // of concurrent searches into large batches.
+    OptionsDict network_options(&option_dict);
+    const auto backend =
+        option_dict.Get<std::string>(NetworkFactory::kBackendId);
+    if (backend != "multiplexing") {
+      auto backend_options =
+          option_dict.Get<std::string>(NetworkFactory::kBackendOptionsId);
+      if (!backend_options.empty()) backend_options += ",";
+      network_options.Set<std::string>(NetworkFactory::kBackendId,
+                                       "multiplexing");
+      network_options.Set<std::string>(
+          NetworkFactory::kBackendOptionsId,
+          backend + "(" + backend_options + "threads=" +
+              std::to_string(option_dict.Get<int>(kBackendThreadsId)) +
+              ",max_batch=" +
+              std::to_string(option_dict.Get<int>(kMaxBatchId)) + ")");
+    }
+    auto network = NetworkFactory::LoadNetwork(network_options);
+    NNCache cache;
+    cache.SetCapacity(option_dict.Get<int>(kNNCacheSizeId));
+    const SearchSetup setup{network.get(), &option_dict,
+                            &cache,        option_dict.Get<int>(kThreadsId),
+                            nodes,         movetime};
+
+    std::atomic<size_t> next_line{0};
+    Mutex output_mutex;
+    auto worker = [&]() {
+      // Search threads are reused between positions.
+      SearchThreadPool thread_pool;
+      for (size_t i; (i = next_line++) < lines.size();) {
+        const auto result =
+            AnalyzeLine(lines[i].first, lines[i].second, setup, &thread_pool);
+        Mutex::Lock lock(output_mutex);
+        *out << result << std::endl;
+      }
+    };
+    std::vector<std::thread> threads;
+    const size_t parallel = std::min(
+        static_cast<size_t>(option_dict.Get<int>(kParallelId)), lines.size());
+    for (size_t i = 0; i < parallel; ++i) threads.emplace_back(worker);
+    for (auto& thread : threads) thread.join();
+    CERR << "Analyzed " << lines.size() << " positions.";
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+}  // namespace lczero
@@ -0,0 +1,62 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <string>
+#include <unordered_set>
+
+namespace lczero {
+
+// Position from a line of the bulk analysis input.
+struct AnalysisPosition {
+  std::string fen;
+  // Operand of the EPD "id" opcode, empty if there is none.
+  std::string id;
+};
+
+// Parses a FEN or EPD line. Move counters missing in EPD are taken from the
+// "hmvc" and "fmvn" opcodes, or default to "0 1". Throws Exception if the line
+// doesn't start with a position.
+AnalysisPosition ParseEpdLine(const std::string& line);
+
+// Returns input line numbers which already have a complete result in the
+// JSON lines @filename (empty if the file doesn't exist).
+std::unordered_set<int> ReadAnalyzedLines(const std::string& filename);
+
+// Searches every position of a FEN/EPD file and writes results as JSON lines.
+// Many positions are searched concurrently, with their NN evaluations merged
+// into large batches by the multiplexing backend. Positions which already
+// have results in the output file are skipped, so interrupted runs resume.
+class BulkAnalysis {
+ public:
+  BulkAnalysis() = default;
+
+  void Run();
+};
+
+}  // namespace lczero
@@ -0,0 +1,76 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "analysis/bulk.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+
+#include "utils/exception.h"
+
+namespace lczero {
+
+TEST(ParseEpdLine, Fen) {
+  const auto position = ParseEpdLine(
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 3 17");
+  EXPECT_EQ(position.fen,
+            "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - "
+            "3 17");
+  EXPECT_EQ(position.id, "");
+}
+
+TEST(ParseEpdLine, EpdOperations) {
+  const auto position = ParseEpdLine(
+      "1k1r4/pp1b1R2/3q2pp/4p3/2B5/4Q3/PPP2B2/2K5 b - - bm Qd1+; "
+      "id \"BK.01; test\"; hmvc 4; fmvn 30;");
+  EXPECT_EQ(position.fen,
+            "1k1r4/pp1b1R2/3q2pp/4p3/2B5/4Q3/PPP2B2/2K5 b - - 4 30");
+  EXPECT_EQ(position.id, "BK.01; test");
+}
+
+TEST(ParseEpdLine, EpdWithoutOperations) {
+  EXPECT_EQ(ParseEpdLine("8/8/8/8/8/8/8/K1k5 w - -").fen,
+            "8/8/8/8/8/8/8/K1k5 w - - 0 1");
+}
+
+TEST(ParseEpdLine, NotAPosition) {
+  EXPECT_THROW(ParseEpdLine("8/8/8 w"), Exception);
+}
+
+TEST(ReadAnalyzedLines, SkipsIncompleteLines) {
+  const std::string filename = "bulk_test.jsonl";
+  {
+    std::ofstream file(filename);
+    file << "{\"line\": 1, \"bestmove\": \"e2e4\"}\n"
+         << "{\"line\": 7, \"error\": \"Bad fen string\"}\n"
+         << "{\"line\": 9, \"bestm";
+  }
+  const auto lines = ReadAnalyzedLines(filename);
+  std::remove(filename.c_str());
+  EXPECT_EQ(lines, (std::unordered_set<int>{1, 7}));
+  EXPECT_TRUE(ReadAnalyzedLines(filename).empty());
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
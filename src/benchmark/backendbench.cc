@@ -27,22 +27,48 @@
 
 #include "benchmark/backendbench.h"
 
+#include <atomic>
+#include <cmath>
+#include <numeric>
+#include <thread>
+
+#include "benchmark/results.h"
 #include "chess/board.h"
 #include "mcts/node.h"
 #include "neural/factory.h"
 #include "utils/optionsparser.h"
+#include "utils/random.h"
+#include "utils/string.h"
 
 namespace lczero {
 namespace {
 const int kDefaultThreads = 1;
 
-const OptionId kThreadsOptionId{"threads", "Threads",
-                                "Number of (CPU) worker threads to use.", 't'};
+const OptionId kThreadsOptionId{
+    "threads", "Threads",
+    "Number of concurrent clients submitting batches. With more than one, the "
+    "concurrent benchmark is run instead of the batch size sweep, with 1 to "
+    "this many clients.",
+    't'};
 const OptionId kBatchesId{"batches", "",
                           "Number of batches to run as a benchmark."};
 const OptionId kMaxBatchSizeId{"max-batch-size", "",
                                "Maximum batch size to benchmark."};
 const OptionId kFenId{"fen", "", "Benchmark initial position FEN."};
+const OptionId kBatchSizeId{"batch-size", "",
+                            "Mean batch size for the concurrent benchmark."};
+const OptionId kBatchSizeDistributionId{
+    "batch-size-distribution", "",
+    "Distribution of batch sizes for the concurrent benchmark: fixed, uniform "
+    "(from 1 to 2 * --batch-size - 1, so that the mean is --batch-size) or "
+    "geometric (mean --batch-size). Sizes are capped at --max-batch-size."};
+const OptionId kArrivalRatesId{
+    "arrival-rates", "",
+    "Comma separated list of batch arrival rates (batches per second) for an "
+    "open-loop concurrent benchmark using all --threads clients. Batches "
+    "arrive at random times regardless of how fast previous ones complete, "
+    "and latency is measured from arrival. Without it, clients submit batches "
+    "back to back."};
 
 const OptionId kClippyId{"clippy", "", "Enable helpful assistant."};
 
@@ -68,9 +94,145 @@ void Clippy(std::string msg) {
   std::cout << " |\\_/|" << std::endl;
   std::cout << " \\___/" << std::endl;
 }
+
+struct BatchRequest {
+  // Seconds since the start of the run, for open-loop runs.
+  double arrival;
+  int size;
+};
+
+std::vector<BatchRequest> MakeRequests(const OptionsDict& options,
+                                       double arrival_rate) {
+  const int count = options.Get<int>(kBatchesId);
+  const int max_size = options.Get<int>(kMaxBatchSizeId);
+  const int mean_size = std::min(options.Get<int>(kBatchSizeId), max_size);
+  const auto distribution =
+      options.Get<std::string>(kBatchSizeDistributionId);
+  auto& random = Random::Get();
+
+  std::vector<BatchRequest> requests;
+  double arrival = 0.0;
+  for (int i = 0; i < count; ++i) {
+    int size = mean_size;
+    if (distribution == "uniform") {
+      size = random.GetInt(1, std::min(2 * mean_size - 1, max_size));
+    } else if (distribution == "geometric" && mean_size > 1) {
+      // Number of trials until the first success with p = 1 / mean.
+      const double u = 1.0 - random.GetDouble(1.0);
+      size = 1 + static_cast<int>(std::log(u) /
+                                  std::log(1.0 - 1.0 / mean_size));
+      size = std::min(size, max_size);
+    }
+    if (arrival_rate > 0) {
+      // Poisson arrivals.
+      arrival -= std::log(1.0 - random.GetDouble(1.0)) / arrival_rate;
+    }
+    requests.push_back({arrival, size});
+  }
+  return requests;
+}
+
+struct LoadResult {
+  double seconds;
+  int64_t positions;
+  std::vector<double> latencies;
+};
+
+// Computes @requests using @clients threads. For open-loop runs batches are
+// submitted no earlier than their arrival time, and latency is measured from
+// it, so time spent waiting for a free client is included.
+LoadResult RunLoad(Network* network, const InputPlanes& planes,
+                   const std::vector<BatchRequest>& requests, int clients,
+                   bool open_loop) {
+  std::atomic<size_t> next_request{0};
+  std::vector<std::vector<double>> latencies(clients);
+  std::vector<std::thread> threads;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < clients; ++i) {
+    threads.emplace_back([&, i]() {
+      size_t idx;
+      while ((idx = next_request.fetch_add(1)) < requests.size()) {
+        const auto& request = requests[idx];
+        auto submitted = std::chrono::steady_clock::now();
+        if (open_loop) {
+          submitted =
+              start + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::duration<double>(request.arrival));
+          std::this_thread::sleep_until(submitted);
+        }
+        auto computation = network->NewComputation();
+        for (int k = 0; k < request.size; k++) {
+          computation->AddInput(InputPlanes(planes));
+        }
+        computation->ComputeBlocking();
+        const std::chrono::duration<double, std::milli> latency =
+            std::chrono::steady_clock::now() - submitted;
+        latencies[i].push_back(latency.count());
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  const std::chrono::duration<double> time =
+      std::chrono::steady_clock::now() - start;
+
+  LoadResult result{time.count(), 0, {}};
+  for (const auto& request : requests) result.positions += request.size;
+  for (const auto& thread_latencies : latencies) {
+    result.latencies.insert(result.latencies.end(), thread_latencies.begin(),
+                            thread_latencies.end());
+  }
+  return result;
+}
+
+// Runs the concurrent benchmark: a closed-loop sweep over the number of
+// clients, or an open-loop run for each arrival rate. Prints one point of the
+// throughput vs latency curve per run.
+void RunConcurrentBenchmark(Network* network, const OptionsDict& options,
+                            const InputPlanes& planes,
+                            BenchmarkResults* results) {
+  const int threads = options.Get<int>(kThreadsOptionId);
+  const auto rates_str = options.Get<std::string>(kArrivalRatesId);
+  const auto rates =
+      rates_str.empty() ? std::vector<int>() : ParseIntList(rates_str);
+
+  auto report = [&](const std::string& key, const LoadResult& load) {
+    const double nps = load.positions / load.seconds;
+    const double batches_per_second = load.latencies.size() / load.seconds;
+    std::cout << key << ": throughput " << nps << " nps, "
+              << batches_per_second << " batches/s, latency p50 "
+              << Percentile(load.latencies, 50) << "ms p95 "
+              << Percentile(load.latencies, 95) << "ms p99 "
+              << Percentile(load.latencies, 99) << "ms." << std::endl;
+
+    using Better = BenchmarkResults::Better;
+    results->Add(key, "nps", nps, Better::kHigher);
+    results->Add(key, "batches_per_second", batches_per_second);
+    results->Add(key, "p50_ms", Percentile(load.latencies, 50),
+                 Better::kLower, PercentileError(load.latencies, 50));
+    results->Add(key, "p95_ms", Percentile(load.latencies, 95),
+                 Better::kLower, PercentileError(load.latencies, 95));
+    results->Add(key, "p99_ms", Percentile(load.latencies, 99),
+                 Better::kLower, PercentileError(load.latencies, 99));
+  };
+
+  if (rates.empty()) {
+    for (int clients = 1; clients <= threads; ++clients) {
+      report("Clients " + std::to_string(clients),
+             RunLoad(network, planes, MakeRequests(options, 0), clients,
+                     false));
+    }
+  } else {
+    for (const int rate : rates) {
+      if (rate <= 0) throw Exception("Arrival rates must be positive.");
+      report("Arrival rate " + std::to_string(rate) + "/s",
+             RunLoad(network, planes, MakeRequests(options, rate), threads,
+                     true));
+    }
+  }
+}
 }  // namespace
 
-void BackendBenchmark::Run() {
+int BackendBenchmark::Run() {
   OptionsParser options;
   NetworkFactory::PopulateOptions(&options);
   options.Add<IntOption>(kThreadsOptionId, 1, 128) = kDefaultThreads;
@@ -78,11 +240,16 @@ void BackendBenchmark::Run() {
   options.Add<IntOption>(kBatchesId, 1, 999999999) = 100;
   options.Add<IntOption>(kMaxBatchSizeId, 1, 1024) = 256;
   options.Add<StringOption>(kFenId) = ChessBoard::kStartposFen;
+  options.Add<IntOption>(kBatchSizeId, 1, 1024) = 32;
+  std::vector<std::string> distributions = {"fixed", "uniform", "geometric"};
+  options.Add<ChoiceOption>(kBatchSizeDistributionId, distributions) = "fixed";
+  options.Add<StringOption>(kArrivalRatesId) = "";
   options.Add<BoolOption>(kClippyId) = false;
   options.Add<FloatOption>(kClippyThresholdId, 0.0f, 1.0f) = 0.05f;
   options.Add<FloatOption>(kClippyToleranceId, 0.0f, 1.0f) = 0.03f;
+  BenchmarkResults::PopulateOptions(&options);
 
-  if (!options.ProcessAllFlags()) return;
+  if (!options.ProcessAllFlags()) return 0;
 
   try {
     auto option_dict = options.GetOptionsDict();
@@ -96,13 +263,26 @@ void BackendBenchmark::Run() {
     int best = 0;
     float best_nps = 0.0f;
     bool run = true;
-    std::optional<std::chrono::time_point<std::chrono::steady_clock>> pending;
+    bool pending = false;
+    std::chrono::time_point<std::chrono::steady_clock> pending_start;
+    BenchmarkResults results;
+
+    if (option_dict.Get<int>(kThreadsOptionId) > 1 ||
+        !option_dict.Get<std::string>(kArrivalRatesId).empty()) {
+      RunConcurrentBenchmark(
+          network.get(), option_dict,
+          EncodePositionForNN(network->GetCapabilities().input_format,
+                              tree.GetPositionHistory(), 8,
+                              FillEmptyHistory::ALWAYS, nullptr),
+          &results);
+      return results.Report(option_dict) > 0 ? 1 : 0;
+    }
 
     for (int i = 1; i <= option_dict.Get<int>(kMaxBatchSizeId); i++) {
+      std::vector<double> latencies;
       const auto start = std::chrono::steady_clock::now();
-      // TODO: support threads not equal to 1 to be able to more sensibly test
-      // multiplexing backend.
       for (int j = 0; j < batches; j++) {
+        const auto batch_start = std::chrono::steady_clock::now();
         // Put i copies of tree root node into computation and compute.
         auto computation = network->NewComputation();
         for (int k = 0; k < i; k++) {
@@ -111,6 +291,9 @@ void BackendBenchmark::Run() {
               tree.GetPositionHistory(), 8, FillEmptyHistory::ALWAYS, nullptr));
         }
         computation->ComputeBlocking();
+        const std::chrono::duration<double, std::milli> latency =
+            std::chrono::steady_clock::now() - batch_start;
+        latencies.push_back(latency.count());
       }
 
       const auto end = std::chrono::steady_clock::now();
@@ -121,6 +304,21 @@ void BackendBenchmark::Run() {
                 << time.count() / batches * 1000 << "ms - throughput " << nps
                 << " nps." << std::endl;
 
+      using Better = BenchmarkResults::Better;
+      const auto key = std::to_string(i);
+      const double mean_latency =
+          std::accumulate(latencies.begin(), latencies.end(), 0.0) / batches;
+      const double latency_error = StandardError(latencies);
+      results.Add(key, "mean_ms", mean_latency, Better::kLower, latency_error);
+      results.Add(key, "p50_ms", Percentile(latencies, 50),
+                  Better::kLower, PercentileError(latencies, 50));
+      results.Add(key, "p95_ms", Percentile(latencies, 95),
+                  Better::kLower, PercentileError(latencies, 95));
+      results.Add(key, "p99_ms", Percentile(latencies, 99),
+                  Better::kLower, PercentileError(latencies, 99));
+      results.Add(key, "nps", nps, Better::kHigher,
+                  mean_latency > 0 ? nps * latency_error / mean_latency : 0);
+
       if (option_dict.Get<bool>(kClippyId)) {
         const float threshold = option_dict.Get<float>(kClippyThresholdId);
         const float tolerance = option_dict.Get<float>(kClippyToleranceId);
@@ -131,16 +329,17 @@ void BackendBenchmark::Run() {
           best = i;
           run = true;
           if (!pending) {
-            pending = std::chrono::steady_clock::now();
+            pending = true;
+            pending_start = std::chrono::steady_clock::now();
           }
         }
         if (pending) {
-          time = std::chrono::steady_clock::now() - *pending;
+          time = std::chrono::steady_clock::now() - pending_start;
           if (time.count() > 10) {
             Clippy(
                 std::to_string(best) +
                 " looks like the best minibatch-size for this net (so far).");
-            pending.reset();
+            pending = false;
           }
         }
         if (nps < best_nps * (1.0f - tolerance)) {
@@ -152,8 +351,12 @@ void BackendBenchmark::Run() {
       Clippy(std::to_string(best) +
              " looks like the best minibatch-size for this net.");
     }
+    results.Add("total", "peak_memory_mb", GetPeakMemoryUsage() / 1e6,
+                BenchmarkResults::Better::kLower);
+    return results.Report(option_dict) > 0 ? 1 : 0;
   } catch (Exception& ex) {
     std::cerr << ex.what() << std::endl;
+    return 1;
   }
 }
 }  // namespace lczero
@@ -33,7 +33,9 @@ class BackendBenchmark {
  public:
   BackendBenchmark() = default;
 
-  void Run();
+  // Returns the exit code of the process: non-zero on errors, or if --compare
+  // found regressions.
+  int Run();
 };
 
 }  // namespace lczero
@@ -29,9 +29,13 @@
 
 #include <numeric>
 
+#include "benchmark/results.h"
 #include "mcts/search.h"
 #include "mcts/stoppers/factory.h"
 #include "mcts/stoppers/stoppers.h"
+#include "neural/network_record.h"
+#include "utils/filesystem.h"
+#include "utils/mutex.h"
 
 namespace lczero {
 namespace {
@@ -45,9 +49,126 @@ const OptionId kMovetimeId{"movetime", "",
 const OptionId kFenId{"fen", "", "Benchmark position FEN."};
 const OptionId kNumPositionsId{"num-positions", "",
                                "The number of benchmark positions to test."};
+const OptionId kSearchOnlyId{
+    "search-only", "",
+    "Benchmark search only: NN evaluations are replayed from the --nn-trace "
+    "file, so that results don't depend on backend speed. If the file doesn't "
+    "exist, it's recorded first using the configured backend. Requires "
+    "--nodes, --movetime is ignored. Use --threads=1 for a fully repeatable "
+    "search."};
+const OptionId kNNTraceId{"nn-trace", "",
+                          "File with recorded NN evaluations for "
+                          "--search-only."};
+const OptionId kRepeatsId{
+    "repeats", "",
+    "Number of times to search each position. Repeats give the noise estimate "
+    "used by --compare."};
+
+// Network wrapper which records how long batches take to compute.
+class BatchTimingNetwork : public Network {
+ public:
+  explicit BatchTimingNetwork(Network* network) : network_(network) {}
+
+  const NetworkCapabilities& GetCapabilities() const override {
+    return network_->GetCapabilities();
+  }
+
+  std::unique_ptr<NetworkComputation> NewComputation() override {
+    return std::make_unique<Computation>(network_->NewComputation(), this);
+  }
+
+  // Returns latencies of batches computed since the previous call, in ms.
+  std::vector<double> TakeLatencies() {
+    Mutex::Lock lock(mutex_);
+    std::vector<double> result;
+    result.swap(latencies_);
+    return result;
+  }
+
+ private:
+  class Computation : public NetworkComputation {
+   public:
+    Computation(std::unique_ptr<NetworkComputation> computation,
+                BatchTimingNetwork* network)
+        : computation_(std::move(computation)), network_(network) {}
+
+    void AddInput(InputPlanes&& input) override {
+      computation_->AddInput(std::move(input));
+    }
+    void ComputeBlocking() override {
+      const auto start = std::chrono::steady_clock::now();
+      computation_->ComputeBlocking();
+      const std::chrono::duration<double, std::milli> latency =
+          std::chrono::steady_clock::now() - start;
+      Mutex::Lock lock(network_->mutex_);
+      network_->latencies_.push_back(latency.count());
+    }
+    int GetBatchSize() const override { return computation_->GetBatchSize(); }
+    float GetQVal(int sample) const override {
+      return computation_->GetQVal(sample);
+    }
+    float GetDVal(int sample) const override {
+      return computation_->GetDVal(sample);
+    }
+    float GetPVal(int sample, int move_id) const override {
+      return computation_->GetPVal(sample, move_id);
+    }
+    float GetMVal(int sample) const override {
+      return computation_->GetMVal(sample);
+    }
+
+   private:
+    std::unique_ptr<NetworkComputation> computation_;
+    BatchTimingNetwork* const network_;
+  };
+
+  Network* const network_;
+  Mutex mutex_;
+  std::vector<double> latencies_ GUARDED_BY(mutex_);
+};
+
+double Mean(const std::vector<double>& values) {
+  if (values.empty()) return 0.0;
+  return std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+}
+
+void AddSearchResults(BenchmarkResults* results, const std::string& key,
+                      double nodes, const std::vector<double>& times,
+                      const std::vector<double>& nps,
+                      const std::vector<double>& latencies,
+                      const SearchStats& stats) {
+  using Better = BenchmarkResults::Better;
+  results->Add(key, "nodes", nodes);
+  results->Add(key, "time_ms", Mean(times), Better::kLower,
+               StandardError(times));
+  results->Add(key, "nps", Mean(nps), Better::kHigher, StandardError(nps));
+  results->Add(key, "batches", latencies.size());
+  results->Add(key, "batch_p50_ms", Percentile(latencies, 50),
+               Better::kLower, PercentileError(latencies, 50));
+  results->Add(key, "batch_p95_ms", Percentile(latencies, 95),
+               Better::kLower, PercentileError(latencies, 95));
+  results->Add(key, "batch_p99_ms", Percentile(latencies, 99),
+               Better::kLower, PercentileError(latencies, 99));
+  const auto queries = stats.Get(SearchWorkerStats::kNNQueries);
+  if (queries > 0) {
+    results->Add(key, "cache_hit_rate",
+                 static_cast<double>(stats.Get(SearchWorkerStats::kCacheHits)) /
+                     queries,
+                 Better::kHigher);
+  }
+  const auto visits = stats.Get(SearchWorkerStats::kVisits) +
+                      stats.Get(SearchWorkerStats::kCollisionVisits);
+  if (visits > 0) {
+    results->Add(key, "collision_rate",
+                 static_cast<double>(
+                     stats.Get(SearchWorkerStats::kCollisionVisits)) /
+                     visits,
+                 Better::kLower);
+  }
+}
 }  // namespace
 
-void Benchmark::Run() {
+int Benchmark::Run() {
   OptionsParser options;
   NetworkFactory::PopulateOptions(&options);
   options.Add<IntOption>(kThreadsOptionId, 1, 128) = kDefaultThreads;
@@ -58,23 +179,32 @@ void Benchmark::Run() {
   options.Add<IntOption>(kMovetimeId, -1, 999999999) = 10000;
   options.Add<StringOption>(kFenId) = "";
   options.Add<IntOption>(kNumPositionsId, 1, 34) = 34;
+  options.Add<BoolOption>(kSearchOnlyId) = false;
+  options.Add<StringOption>(kNNTraceId) = "benchmark.trace";
+  options.Add<IntOption>(kRepeatsId, 1, 100) = 1;
+  BenchmarkResults::PopulateOptions(&options);
 
-  if (!options.ProcessAllFlags()) return;
+  if (!options.ProcessAllFlags()) return 0;
 
   try {
+    // Cache hit rate in the results comes from search stats.
+    if (!options.GetOptionsDict()
+             .Get<std::string>(BenchmarkResults::kResultsFileId)
+             .empty() ||
+        !options.GetOptionsDict()
+             .Get<std::string>(BenchmarkResults::kCompareId)
+             .empty()) {
+      options.GetMutableOptions()->Set<bool>(SearchParams::kSearchStatsId,
+                                             true);
+    }
     auto option_dict = options.GetOptionsDict();
 
-    auto network = NetworkFactory::LoadNetwork(option_dict);
-
     const int visits = option_dict.Get<int>(kNodesId);
-    const int movetime = option_dict.Get<int>(kMovetimeId);
+    const bool search_only = option_dict.Get<bool>(kSearchOnlyId);
+    const int movetime = search_only ? -1 : option_dict.Get<int>(kMovetimeId);
     const std::string fen = option_dict.Get<std::string>(kFenId);
     int num_positions = option_dict.Get<int>(kNumPositionsId);
 
-    std::vector<std::double_t> times;
-    std::vector<std::int64_t> playouts;
-    std::uint64_t cnt = 1;
-
     if (fen.length() > 0) {
       positions = {fen};
       num_positions = 1;
@@ -82,53 +212,147 @@ void Benchmark::Run() {
     std::vector<std::string> testing_positions(
         positions.cbegin(), positions.cbegin() + num_positions);
 
-    for (std::string position : testing_positions) {
-      std::cout << "\nPosition: " << cnt++ << "/" << testing_positions.size()
-                << " " << position << std::endl;
+    const int repeats = option_dict.Get<int>(kRepeatsId);
+    BenchmarkResults results;
+    // Like the engine, reuse search threads between positions.
+    SearchThreadPool thread_pool;
 
-      auto stopper = std::make_unique<ChainedSearchStopper>();
-      if (movetime > -1) {
-        stopper->AddStopper(std::make_unique<TimeLimitStopper>(movetime));
-      }
-      if (visits > -1) {
-        stopper->AddStopper(std::make_unique<VisitsStopper>(visits, false));
+    // Runs all positions, adding per position and total metrics to @results
+    // unless it's nullptr.
+    auto run_positions = [&](Network* network, BenchmarkResults* results) {
+      BatchTimingNetwork timed_network(network);
+      std::vector<std::double_t> times;
+      std::vector<std::int64_t> playouts;
+      // Totals of each repeat, to estimate noise of the total nps.
+      std::vector<double> repeat_times(repeats);
+      std::vector<double> repeat_playouts(repeats);
+      std::vector<double> all_latencies;
+      SearchStats search_stats;
+      std::uint64_t cnt = 1;
+
+      for (std::string position : testing_positions) {
+        std::cout << "\nPosition: " << cnt++ << "/"
+                  << testing_positions.size() << " " << position << std::endl;
+
+        std::vector<double> position_times;
+        std::vector<double> position_nps;
+        int64_t position_playouts = 0;
+        SearchStats position_stats;
+        for (int repeat = 0; repeat < repeats; ++repeat) {
+          auto stopper = std::make_unique<ChainedSearchStopper>();
+          if (movetime > -1) {
+            stopper->AddStopper(std::make_unique<TimeLimitStopper>(movetime));
+          }
+          if (visits > -1) {
+            stopper->AddStopper(
+                std::make_unique<VisitsStopper>(visits, false));
+          }
+
+          NNCache cache;
+          cache.SetCapacity(option_dict.Get<int>(kNNCacheSizeId));
+
+          NodeTree tree;
+          tree.ResetToPosition(position, {});
+
+          const auto start = std::chrono::steady_clock::now();
+          auto search = std::make_unique<Search>(
+              tree, &timed_network,
+              std::make_unique<CallbackUciResponder>(
+                  std::bind(&Benchmark::OnBestMove, this,
+                            std::placeholders::_1),
+                  std::bind(&Benchmark::OnInfo, this, std::placeholders::_1)),
+              MoveList(), start, std::move(stopper), false, option_dict,
+              &cache, nullptr, &thread_pool);
+          search->StartThreads(option_dict.Get<int>(kThreadsOptionId));
+          search->Wait();
+          const auto end = std::chrono::steady_clock::now();
+
+          const auto time =
+              std::chrono::duration_cast<std::chrono::milliseconds>(end -
+                                                                    start);
+          times.push_back(time.count());
+          playouts.push_back(search->GetTotalPlayouts());
+          position_times.push_back(time.count());
+          position_nps.push_back(1000.0 * playouts.back() /
+                                 (time.count() + 1));
+          position_playouts += playouts.back();
+          repeat_times[repeat] += time.count();
+          repeat_playouts[repeat] += playouts.back();
+          position_stats.Add(search->GetSearchStats());
+        }
+        search_stats.Add(position_stats);
+        const auto latencies = timed_network.TakeLatencies();
+        all_latencies.insert(all_latencies.end(), latencies.begin(),
+                             latencies.end());
+        if (results) {
+          AddSearchResults(results, position,
+                           static_cast<double>(position_playouts) / repeats,
+                           position_times, position_nps, latencies,
+                           position_stats);
+        }
       }
 
-      NNCache cache;
-      cache.SetCapacity(option_dict.Get<int>(kNNCacheSizeId));
+      const auto total_playouts =
+          std::accumulate(playouts.begin(), playouts.end(), 0);
+      const auto total_time = std::accumulate(times.begin(), times.end(), 0);
+      std::cout << "\n==========================="
+                << "\nTotal time (ms) : " << total_time
+                << "\nNodes searched  : " << total_playouts
+                << "\nNodes/second    : "
+                << std::lround(1000.0 * total_playouts / (total_time + 1))
+                << std::endl;
+      if (option_dict.Get<bool>(SearchParams::kSearchStatsId)) {
+        std::cout << "Search stats    : " << search_stats.ToString()
+                  << std::endl;
+      }
+      if (results) {
+        std::vector<double> total_nps;
+        for (int i = 0; i < repeats; ++i) {
+          total_nps.push_back(1000.0 * repeat_playouts[i] /
+                              (repeat_times[i] + 1));
+        }
+        AddSearchResults(results, "total",
+                         static_cast<double>(total_playouts) / repeats,
+                         repeat_times, total_nps, all_latencies, search_stats);
+        results->Add("total", "peak_memory_mb", GetPeakMemoryUsage() / 1e6,
+                     BenchmarkResults::Better::kLower);
+      }
+    };
 
-      NodeTree tree;
-      tree.ResetToPosition(position, {});
+    if (!search_only) {
+      run_positions(NetworkFactory::LoadNetwork(option_dict).get(), &results);
+      return results.Report(option_dict) > 0 ? 1 : 0;
+    }
 
-      const auto start = std::chrono::steady_clock::now();
-      auto search = std::make_unique<Search>(
-          tree, network.get(),
-          std::make_unique<CallbackUciResponder>(
-              std::bind(&Benchmark::OnBestMove, this, std::placeholders::_1),
-              std::bind(&Benchmark::OnInfo, this, std::placeholders::_1)),
-          MoveList(), start, std::move(stopper), false, option_dict, &cache,
-          nullptr);
-      search->StartThreads(option_dict.Get<int>(kThreadsOptionId));
-      search->Wait();
-      const auto end = std::chrono::steady_clock::now();
-
-      const auto time =
-          std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-      times.push_back(time.count());
-      playouts.push_back(search->GetTotalPlayouts());
+    if (visits <= 0) throw Exception("--search-only requires --nodes.");
+    const auto trace_file = option_dict.Get<std::string>(kNNTraceId);
+    if (GetFileSize(trace_file) == 0) {
+      std::cout << "Recording NN evaluations to " << trace_file << std::endl;
+      // Wrap the configured backend into the recording one.
+      OptionsDict record_options(&option_dict);
+      record_options.Set<std::string>(NetworkFactory::kBackendId,
+                                      "recordreplay");
+      record_options.Set<std::string>(
+          NetworkFactory::kBackendOptionsId,
+          "record_file=\"" + trace_file + "\"," +
+              option_dict.Get<std::string>(NetworkFactory::kBackendId) + "(" +
+              option_dict.Get<std::string>(NetworkFactory::kBackendOptionsId) +
+              ")");
+      auto network = NetworkFactory::LoadNetwork(record_options);
+      run_positions(network.get(), nullptr);
+      WriteNNTrace(network.get());
     }
 
-    const auto total_playouts =
-        std::accumulate(playouts.begin(), playouts.end(), 0);
-    const auto total_time = std::accumulate(times.begin(), times.end(), 0);
-    std::cout << "\n==========================="
-              << "\nTotal time (ms) : " << total_time
-              << "\nNodes searched  : " << total_playouts
-              << "\nNodes/second    : "
-              << std::lround(1000.0 * total_playouts / (total_time + 1))
-              << std::endl;
+    std::cout << "\nReplaying NN evaluations from " << trace_file << std::endl;
+    OptionsDict replay_options;
+    replay_options.Set<std::string>("replay_file", trace_file);
+    run_positions(
+        NetworkFactory::Get()->Create("recordreplay", {}, replay_options).get(),
+        &results);
+    return results.Report(option_dict) > 0 ? 1 : 0;
   } catch (Exception& ex) {
     std::cerr << ex.what() << std::endl;
+    return 1;
   }
 }
 
@@ -137,6 +361,8 @@ void Benchmark::OnBestMove(const BestMoveInfo& move) {
 }
 
 void Benchmark::OnInfo(const std::vector<ThinkingInfo>& infos) {
+  // Free-form info strings (e.g. search stats) are summarized at the end.
+  if (!infos[0].comment.empty()) return;
   std::string line = "Benchmark time " + std::to_string(infos[0].time);
   line += "ms, " + std::to_string(infos[0].nodes) + " nodes, ";
   line += std::to_string(infos[0].nps) + " nps";
@@ -0,0 +1,301 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "benchmark/corebench.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#include "benchmark/results.h"
+#include "chess/board.h"
+#include "chess/position.h"
+#include "neural/encoder.h"
+#include "utils/exception.h"
+#include "utils/optionsparser.h"
+#include "utils/random.h"
+
+namespace lczero {
+namespace {
+const int kDefaultThreads = 1;
+
+const OptionId kThreadsOptionId{"threads", "Threads",
+                                "Number of threads to run perft and the timed "
+                                "loops with.",
+                                't'};
+const OptionId kPerftDepthId{
+    "perft-depth", "",
+    "Perft depth. Node counts up to depth 5 are checked against the known "
+    "values of the standard positions."};
+const OptionId kMovetimeId{"movetime", "",
+                           "Time to run each of the timed loops, in "
+                           "milliseconds."};
+const OptionId kFenId{"fen", "",
+                      "Position FEN to benchmark instead of the standard "
+                      "perft positions."};
+
+struct PerftPosition {
+  const char* fen;
+  // Node counts for depths 1 to 5.
+  uint64_t nodes[5];
+};
+
+// Positions from https://www.chessprogramming.org/Perft_Results
+const PerftPosition kPerftPositions[] = {
+    {ChessBoard::kStartposFen, {20, 400, 8902, 197281, 4865609}},
+    {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+     {48, 2039, 97862, 4085603, 193690690}},
+    {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+     {14, 191, 2812, 43238, 674624}},
+    {"r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+     {6, 264, 9467, 422333, 15833292}},
+    {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+     {44, 1486, 62379, 2103487, 89941194}},
+    {"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 "
+     "10",
+     {46, 2079, 89890, 3894594, 164075551}},
+};
+
+// Moves are generated into per-depth lists, so that perft doesn't allocate.
+uint64_t Perft(const ChessBoard& board, int depth,
+               std::vector<MoveList>* move_lists) {
+  MoveList& moves = (*move_lists)[depth];
+  moves.clear();
+  board.GenerateLegalMoves(&moves);
+  // Bulk counting: leaf positions are not visited.
+  if (depth == 1) return moves.size();
+  uint64_t nodes = 0;
+  for (const auto move : moves) {
+    ChessBoard new_board = board;
+    new_board.ApplyMove(move);
+    new_board.Mirror();
+    nodes += Perft(new_board, depth - 1, move_lists);
+  }
+  return nodes;
+}
+
+// Splits root moves among @threads threads.
+uint64_t ParallelPerft(const ChessBoard& board, int depth, int threads) {
+  if (depth == 0) return 1;
+  const MoveList root_moves = board.GenerateLegalMoves();
+  if (depth == 1) return root_moves.size();
+  std::atomic<size_t> next_move{0};
+  std::atomic<uint64_t> total_nodes{0};
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back([&]() {
+      std::vector<MoveList> move_lists(depth);
+      uint64_t nodes = 0;
+      size_t idx;
+      while ((idx = next_move.fetch_add(1)) < root_moves.size()) {
+        ChessBoard new_board = board;
+        new_board.ApplyMove(root_moves[idx]);
+        new_board.Mirror();
+        nodes += Perft(new_board, depth - 1, &move_lists);
+      }
+      total_nodes += nodes;
+    });
+  }
+  for (auto& worker : workers) worker.join();
+  return total_nodes;
+}
+
+// A position with its game history, and its legal moves.
+struct Sample {
+  PositionHistory history;
+  MoveList moves;
+};
+
+// Plays random games from @fens to get positions typical for search rather
+// than only the starting ones.
+std::vector<Sample> MakeSamples(const std::vector<std::string>& fens) {
+  const int kPliesPerGame = 60;
+  std::vector<Sample> samples;
+  for (const auto& fen : fens) {
+    ChessBoard board;
+    int rule50_ply;
+    int moves;
+    board.SetFromFen(fen, &rule50_ply, &moves);
+    PositionHistory history;
+    history.Reset(board, rule50_ply, moves * 2 - (board.flipped() ? 1 : 2));
+    for (int ply = 0; ply < kPliesPerGame; ++ply) {
+      MoveList legal_moves = history.Last().GetBoard().GenerateLegalMoves();
+      if (legal_moves.empty()) break;
+      samples.push_back({history, legal_moves});
+      history.Append(
+          legal_moves[Random::Get().GetInt(0, legal_moves.size() - 1)]);
+    }
+  }
+  return samples;
+}
+
+// Runs @loop on all @samples over and over from @threads threads for
+// @movetime_ms, and returns operations per second. @loop returns the number of
+// operations done for a sample.
+double RunTimed(const std::vector<Sample>& samples, int threads,
+                int movetime_ms,
+                const std::function<uint64_t(const Sample&)>& loop) {
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> total_ops{0};
+  std::vector<std::thread> workers;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back([&]() {
+      uint64_t ops = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (const auto& sample : samples) ops += loop(sample);
+      }
+      total_ops += ops;
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(movetime_ms));
+  stop.store(true);
+  for (auto& worker : workers) worker.join();
+  const std::chrono::duration<double> time =
+      std::chrono::steady_clock::now() - start;
+  return total_ops / time.count();
+}
+}  // namespace
+
+int CoreBenchmark::Run() {
+  OptionsParser options;
+  options.Add<IntOption>(kThreadsOptionId, 1, 128) = kDefaultThreads;
+  options.Add<IntOption>(kPerftDepthId, 1, 10) = 4;
+  options.Add<IntOption>(kMovetimeId, 1, 999999999) = 1000;
+  options.Add<StringOption>(kFenId) = "";
+  BenchmarkResults::PopulateOptions(&options);
+
+  if (!options.ProcessAllFlags()) return 0;
+
+  try {
+    auto option_dict = options.GetOptionsDict();
+    const int threads = option_dict.Get<int>(kThreadsOptionId);
+    const int depth = option_dict.Get<int>(kPerftDepthId);
+    const int movetime = option_dict.Get<int>(kMovetimeId);
+    std::vector<PerftPosition> positions(std::begin(kPerftPositions),
+                                         std::end(kPerftPositions));
+    const std::string fen = option_dict.Get<std::string>(kFenId);
+    if (!fen.empty()) positions = {{fen.c_str(), {}}};
+
+    using Better = BenchmarkResults::Better;
+    BenchmarkResults results;
+    uint64_t total_nodes = 0;
+    double total_seconds = 0.0;
+    for (const auto& position : positions) {
+      const ChessBoard board(position.fen);
+      const auto start = std::chrono::steady_clock::now();
+      const uint64_t nodes = ParallelPerft(board, depth, threads);
+      const std::chrono::duration<double> time =
+          std::chrono::steady_clock::now() - start;
+      std::cout << "Perft " << depth << " of " << position.fen << ": " << nodes
+                << " nodes, " << std::lround(nodes / time.count()) << " nps"
+                << std::endl;
+      if (depth <= 5 && position.nodes[depth - 1] != 0 &&
+          position.nodes[depth - 1] != nodes) {
+        throw Exception("Perft of " + std::string(position.fen) +
+                        " is wrong, expected " +
+                        std::to_string(position.nodes[depth - 1]) + " nodes.");
+      }
+      results.Add(position.fen, "perft_nodes", nodes);
+      results.Add(position.fen, "perft_nps", nodes / time.count(),
+                  Better::kHigher);
+      total_nodes += nodes;
+      total_seconds += time.count();
+    }
+
+    std::vector<std::string> fens;
+    for (const auto& position : positions) fens.push_back(position.fen);
+    const auto samples = MakeSamples(fens);
+
+    const std::pair<std::string, std::function<uint64_t(const Sample&)>>
+        loops[] = {
+            {"movegen",
+             [](const Sample& sample) -> uint64_t {
+               thread_local MoveList moves;
+               moves.clear();
+               sample.history.Last().GetBoard().GenerateLegalMoves(&moves);
+               return 1;
+             }},
+            {"applymove",
+             [](const Sample& sample) -> uint64_t {
+               const auto& board = sample.history.Last().GetBoard();
+               for (const auto move : sample.moves) {
+                 ChessBoard new_board = board;
+                 new_board.ApplyMove(move);
+                 new_board.Mirror();
+               }
+               return sample.moves.size();
+             }},
+            {"position",
+             [](const Sample& sample) -> uint64_t {
+               for (const auto move : sample.moves) {
+                 Position position(sample.history.Last(), move);
+               }
+               return sample.moves.size();
+             }},
+            {"hashlast",
+             [](const Sample& sample) -> uint64_t {
+               sample.history.HashLast(8);
+               return 1;
+             }},
+            {"encode",
+             [](const Sample& sample) -> uint64_t {
+               EncodePositionForNN(
+                   pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE,
+                   sample.history, 8, FillEmptyHistory::FEN_ONLY, nullptr);
+               return 1;
+             }},
+            {"encode_canonical",
+             [](const Sample& sample) -> uint64_t {
+               EncodePositionForNN(
+                   pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION,
+                   sample.history, 8, FillEmptyHistory::FEN_ONLY, nullptr);
+               return 1;
+             }},
+        };
+
+    std::cout << "\n==========================="
+              << "\nPerft nps       : "
+              << std::lround(total_nodes / total_seconds) << std::endl;
+    results.Add("total", "perft_nps", total_nodes / total_seconds,
+                Better::kHigher);
+    for (const auto& loop : loops) {
+      const double ops = RunTimed(samples, threads, movetime, loop.second);
+      std::cout << loop.first << std::string(16 - loop.first.size(), ' ')
+                << ": " << std::lround(ops) << " per second" << std::endl;
+      results.Add("total", loop.first + "_per_second", ops, Better::kHigher);
+    }
+    return results.Report(option_dict) > 0 ? 1 : 0;
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+    return 1;
+  }
+}
+
+}  // namespace lczero
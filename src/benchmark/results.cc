@@ -0,0 +1,463 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "benchmark/results.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include "utils/exception.h"
+#include "utils/string.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace lczero {
+namespace {
+// Differences smaller than this many combined standard errors are noise.
+const double kNoiseSigmas = 2.0;
+const char kErrorSuffix[] = "_err";
+
+bool EndsWith(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::string FormatNumber(double value) {
+  if (!std::isfinite(value)) return "";
+  std::ostringstream oss;
+  oss << std::setprecision(10) << value;
+  return oss.str();
+}
+
+std::string CsvString(const std::string& str) {
+  std::string result = "\"";
+  for (const char c : str) {
+    if (c == '"') result += '"';
+    result += c;
+  }
+  return result + "\"";
+}
+
+// Reader of the JSON subset written by BenchmarkResults::Write(): an array of
+// flat objects with string, number or null values.
+class JsonReader {
+ public:
+  explicit JsonReader(const std::string& text) : text_(text) {}
+
+  bool Consume(char c) {
+    SkipWhitespace();
+    if (pos_ < text_.size() && text_[pos_] == c) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  void Expect(char c) {
+    if (!Consume(c)) {
+      throw Exception("Expected '" + std::string(1, c) +
+                      "' in results file at offset " + std::to_string(pos_));
+    }
+  }
+
+  std::string ReadString() {
+    Expect('"');
+    std::string result;
+    while (pos_ < text_.size() && text_[pos_] != '"') {
+      char c = text_[pos_++];
+      if (c == '\\' && pos_ < text_.size()) {
+        c = text_[pos_++];
+        if (c == 'u') {
+          c = static_cast<char>(std::stoi(text_.substr(pos_, 4), nullptr, 16));
+          pos_ += 4;
+        } else if (c == 'n') {
+          c = '\n';
+        } else if (c == 't') {
+          c = '\t';
+        }
+      }
+      result += c;
+    }
+    Expect('"');
+    return result;
+  }
+
+  // Returns NaN for null.
+  double ReadNumber() {
+    SkipWhitespace();
+    if (text_.compare(pos_, 4, "null") == 0) {
+      pos_ += 4;
+      return std::numeric_limits<double>::quiet_NaN();
+    }
+    const char* start = text_.c_str() + pos_;
+    char* end;
+    const double value = std::strtod(start, &end);
+    if (end == start) {
+      throw Exception("Expected number in results file at offset " +
+                      std::to_string(pos_));
+    }
+    pos_ += end - start;
+    return value;
+  }
+
+ private:
+  void SkipWhitespace() {
+    while (pos_ < text_.size() && std::isspace(text_[pos_])) ++pos_;
+  }
+
+  const std::string& text_;
+  size_t pos_ = 0;
+};
+
+std::vector<std::string> SplitCsvLine(const std::string& line) {
+  std::vector<std::string> result(1);
+  bool quoted = false;
+  for (size_t i = 0; i < line.size(); ++i) {
+    const char c = line[i];
+    if (quoted) {
+      if (c != '"') {
+        result.back() += c;
+      } else if (i + 1 < line.size() && line[i + 1] == '"') {
+        result.back() += c;
+        ++i;
+      } else {
+        quoted = false;
+      }
+    } else if (c == '"') {
+      quoted = true;
+    } else if (c == ',') {
+      result.emplace_back();
+    } else if (c != '\r') {
+      result.back() += c;
+    }
+  }
+  return result;
+}
+
+// Turns "<name>_err" fields read from a file back into errors of "<name>".
+void AttachErrors(BenchmarkResults::Row* row) {
+  auto& metrics = row->metrics;
+  for (auto iter = metrics.begin(); iter != metrics.end();) {
+    if (EndsWith(iter->name, kErrorSuffix)) {
+      const auto name =
+          iter->name.substr(0, iter->name.size() - strlen(kErrorSuffix));
+      auto base = std::find_if(metrics.begin(), metrics.end(),
+                               [&](const BenchmarkResults::Metric& metric) {
+                                 return metric.name == name;
+                               });
+      if (base != metrics.end()) {
+        base->error = iter->value;
+        iter = metrics.erase(iter);
+        continue;
+      }
+    }
+    ++iter;
+  }
+}
+}  // namespace
+
+const OptionId BenchmarkResults::kResultsFileId{
+    "results-file", "",
+    "Write benchmark results to this file, as CSV if the name ends with .csv "
+    "and as JSON otherwise."};
+const OptionId BenchmarkResults::kCompareId{
+    "compare", "",
+    "Compare benchmark results to a results file of a previous run and list "
+    "significant changes."};
+const OptionId BenchmarkResults::kCompareThresholdId{
+    "compare-threshold", "",
+    "Relative change below which differences are not reported by --compare. "
+    "Differences within two standard errors of the measurements are not "
+    "reported either."};
+
+void BenchmarkResults::PopulateOptions(OptionsParser* options) {
+  options->Add<StringOption>(kResultsFileId) = "";
+  options->Add<StringOption>(kCompareId) = "";
+  options->Add<FloatOption>(kCompareThresholdId, 0.0f, 1.0f) = 0.03f;
+}
+
+const BenchmarkResults::Metric* BenchmarkResults::Row::Find(
+    const std::string& name) const {
+  for (const auto& metric : metrics) {
+    if (metric.name == name) return &metric;
+  }
+  return nullptr;
+}
+
+void BenchmarkResults::Add(const std::string& key, const std::string& name,
+                           double value, Better better, double error) {
+  auto row = std::find_if(rows_.begin(), rows_.end(),
+                          [&](const Row& row) { return row.key == key; });
+  if (row == rows_.end()) {
+    rows_.push_back({key, {}});
+    row = rows_.end() - 1;
+  }
+  row->metrics.push_back({name, value, error, better});
+}
+
+void BenchmarkResults::Write(const std::string& filename) const {
+  std::ofstream file(filename);
+  if (!file) throw Exception("Unable to write results file " + filename);
+
+  if (EndsWith(filename, ".csv")) {
+    // Columns are the union of metrics of all rows, with an error column for
+    // metrics which have an error in any row.
+    std::vector<std::string> columns;
+    for (const auto& row : rows_) {
+      for (const auto& metric : row.metrics) {
+        if (std::find(columns.begin(), columns.end(), metric.name) ==
+            columns.end()) {
+          columns.push_back(metric.name);
+        }
+        const auto error_name = metric.name + kErrorSuffix;
+        if (metric.error != 0.0 &&
+            std::find(columns.begin(), columns.end(), error_name) ==
+                columns.end()) {
+          columns.push_back(error_name);
+        }
+      }
+    }
+    file << "key";
+    for (const auto& column : columns) file << "," << column;
+    file << "\n";
+    for (const auto& row : rows_) {
+      file << CsvString(row.key);
+      for (const auto& column : columns) {
+        file << ",";
+        if (const auto* metric = row.Find(column)) {
+          file << FormatNumber(metric->value);
+        } else if (EndsWith(column, kErrorSuffix)) {
+          const auto* base = row.Find(
+              column.substr(0, column.size() - strlen(kErrorSuffix)));
+          if (base) file << FormatNumber(base->error);
+        }
+      }
+      file << "\n";
+    }
+  } else {
+    file << "[\n";
+    for (size_t i = 0; i < rows_.size(); ++i) {
+      const auto& row = rows_[i];
+      file << "  {\"key\": " << JsonString(row.key);
+      for (const auto& metric : row.metrics) {
+        const auto value = FormatNumber(metric.value);
+        file << ", " << JsonString(metric.name) << ": "
+             << (value.empty() ? "null" : value);
+        if (metric.error != 0.0) {
+          file << ", " << JsonString(metric.name + kErrorSuffix) << ": "
+               << FormatNumber(metric.error);
+        }
+      }
+      file << "}" << (i + 1 < rows_.size() ? "," : "") << "\n";
+    }
+    file << "]\n";
+  }
+  if (!file) throw Exception("Unable to write results file " + filename);
+}
+
+BenchmarkResults BenchmarkResults::Read(const std::string& filename) {
+  std::ifstream file(filename);
+  if (!file) throw Exception("Unable to open results file " + filename);
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  const std::string text = buffer.str();
+
+  BenchmarkResults results;
+  // Field being parsed, for error messages.
+  std::string field;
+  try {
+    const auto first = text.find_first_not_of(" \t\r\n");
+    if (first != std::string::npos && text[first] == '[') {
+      JsonReader reader(text);
+      reader.Expect('[');
+      while (!reader.Consume(']')) {
+        Row row;
+        reader.Expect('{');
+        while (!reader.Consume('}')) {
+          field.clear();
+          const auto name = reader.ReadString();
+          field = name;
+          reader.Expect(':');
+          if (name == "key") {
+            row.key = reader.ReadString();
+          } else {
+            row.metrics.push_back(
+                {name, reader.ReadNumber(), 0.0, Better::kNone});
+          }
+          reader.Consume(',');
+        }
+        AttachErrors(&row);
+        results.rows_.push_back(std::move(row));
+        reader.Consume(',');
+      }
+    } else {
+      std::string line;
+      std::getline(buffer, line);
+      const auto columns = SplitCsvLine(line);
+      while (std::getline(buffer, line)) {
+        if (line.empty()) continue;
+        const auto cells = SplitCsvLine(line);
+        Row row;
+        row.key = cells[0];
+        for (size_t i = 1; i < cells.size() && i < columns.size(); ++i) {
+          if (cells[i].empty()) continue;
+          field = columns[i] + " of " + row.key;
+          row.metrics.push_back(
+              {columns[i], std::stod(cells[i]), 0.0, Better::kNone});
+        }
+        AttachErrors(&row);
+        results.rows_.push_back(std::move(row));
+      }
+    }
+  } catch (const std::exception& e) {
+    throw Exception("Unable to parse results file " + filename +
+                    (field.empty() ? "" : " at field " + field) + ": " +
+                    e.what());
+  }
+  return results;
+}
+
+int BenchmarkResults::CompareTo(const BenchmarkResults& baseline,
+                                double threshold, std::ostream* out) const {
+  int regressions = 0;
+  int improvements = 0;
+  int unchanged = 0;
+  for (const auto& row : rows_) {
+    const auto base_row =
+        std::find_if(baseline.rows_.begin(), baseline.rows_.end(),
+                     [&](const Row& other) { return other.key == row.key; });
+    if (base_row == baseline.rows_.end()) continue;
+    for (const auto& metric : row.metrics) {
+      if (metric.better == Better::kNone) continue;
+      const auto* base = base_row->Find(metric.name);
+      if (!base || !std::isfinite(base->value)) continue;
+      const double diff = metric.value - base->value;
+      const double noise =
+          kNoiseSigmas * std::sqrt(metric.error * metric.error +
+                                   base->error * base->error);
+      if (std::abs(diff) <= std::max(threshold * std::abs(base->value), noise)) {
+        ++unchanged;
+        continue;
+      }
+      const bool improved = (diff > 0) == (metric.better == Better::kHigher);
+      ++(improved ? improvements : regressions);
+      std::ostringstream line;
+      line << (improved ? "improvement " : "REGRESSION  ") << row.key << " "
+           << metric.name << ": " << base->value << " -> " << metric.value;
+      if (base->value != 0.0) {
+        line << std::showpos << std::fixed << std::setprecision(1) << " ("
+             << 100.0 * diff / std::abs(base->value) << "%)";
+      }
+      *out << line.str() << std::endl;
+    }
+  }
+  *out << "Compared " << regressions + improvements + unchanged
+       << " metrics: " << regressions << " regression(s), " << improvements
+       << " improvement(s), " << unchanged << " within noise." << std::endl;
+  return regressions;
+}
+
+int BenchmarkResults::Report(const OptionsDict& options) const {
+  const auto results_file = options.Get<std::string>(kResultsFileId);
+  if (!results_file.empty()) {
+    Write(results_file);
+    std::cout << "Results written to " << results_file << std::endl;
+  }
+  const auto compare_file = options.Get<std::string>(kCompareId);
+  if (!compare_file.empty()) {
+    std::cout << "\nComparing to " << compare_file << std::endl;
+    return CompareTo(Read(compare_file),
+                     options.Get<float>(kCompareThresholdId), &std::cout);
+  }
+  return 0;
+}
+
+double Percentile(std::vector<double> values, double p) {
+  if (values.empty()) return 0.0;
+  std::sort(values.begin(), values.end());
+  const double rank = p / 100.0 * (values.size() - 1);
+  const size_t lower = static_cast<size_t>(rank);
+  if (lower + 1 >= values.size()) return values.back();
+  return values[lower] + (rank - lower) * (values[lower + 1] - values[lower]);
+}
+
+double PercentileError(const std::vector<double>& values, double p) {
+  if (values.size() < 2) return 0.0;
+  // Distribution-free estimate: the rank of the sample percentile has standard
+  // deviation of sqrt(n * q * (1 - q)).
+  const double q = p / 100.0;
+  const double delta = 100.0 * std::sqrt(q * (1.0 - q) / values.size());
+  return (Percentile(values, std::min(100.0, p + delta)) -
+          Percentile(values, std::max(0.0, p - delta))) /
+         2.0;
+}
+
+double StandardError(const std::vector<double>& values) {
+  if (values.size() < 2) return 0.0;
+  double mean = 0.0;
+  for (const double value : values) mean += value;
+  mean /= values.size();
+  double variance = 0.0;
+  for (const double value : values) variance += (value - mean) * (value - mean);
+  variance /= values.size() - 1;
+  return std::sqrt(variance / values.size());
+}
+
+uint64_t GetPeakMemoryUsage() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+  return counters.PeakWorkingSetSize;
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+  // Bytes on macOS.
+  return usage.ru_maxrss;
+#else
+  // Kilobytes elsewhere.
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+}  // namespace lczero
@@ -0,0 +1,112 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "utils/optionsdict.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+
+// Machine readable results of a benchmark run: a list of rows, each identified
+// by a key (e.g. position FEN or batch size) and holding named metrics. Rows are
+// written to a JSON or CSV file and can be compared against the results of a
+// previous run.
+class BenchmarkResults {
+ public:
+  // Which direction of change is an improvement. Metrics with kNone are
+  // informational and are not compared.
+  enum class Better { kNone, kHigher, kLower };
+
+  struct Metric {
+    std::string name;
+    double value;
+    // Standard error of the value, or 0 if unknown.
+    double error;
+    Better better;
+  };
+
+  struct Row {
+    const Metric* Find(const std::string& name) const;
+
+    std::string key;
+    std::vector<Metric> metrics;
+  };
+
+  // Adds --results-file, --compare and --compare-threshold options.
+  static void PopulateOptions(OptionsParser* options);
+
+  // Adds a metric to the row with the given key, creating the row if needed.
+  void Add(const std::string& key, const std::string& name, double value,
+           Better better = Better::kNone, double error = 0.0);
+
+  const std::vector<Row>& GetRows() const { return rows_; }
+
+  // Writes the results to a file, as CSV if the filename ends with ".csv" and
+  // as JSON otherwise.
+  void Write(const std::string& filename) const;
+  // Reads results written by Write(). Directions of metrics are not stored, so
+  // they are all Better::kNone.
+  static BenchmarkResults Read(const std::string& filename);
+
+  // Prints metrics which differ from @baseline by more than both relative
+  // @threshold and the noise estimated from standard errors. Returns the
+  // number of regressions.
+  int CompareTo(const BenchmarkResults& baseline, double threshold,
+                std::ostream* out) const;
+
+  // Writes and compares the results as requested by the options populated by
+  // PopulateOptions(). Returns the number of regressions.
+  int Report(const OptionsDict& options) const;
+
+  static const OptionId kResultsFileId;
+  static const OptionId kCompareId;
+  static const OptionId kCompareThresholdId;
+
+ private:
+  std::vector<Row> rows_;
+};
+
+// Returns the @p-th percentile (0..100) of @values, or 0 if there are none.
+double Percentile(std::vector<double> values, double p);
+
+// Returns an estimate of the standard error of Percentile(@values, @p).
+double PercentileError(const std::vector<double>& values, double p);
+
+// Returns the standard error of the mean of @values, or 0 if there are fewer
+// than two.
+double StandardError(const std::vector<double>& values);
+
+// Returns peak resident memory of the process in bytes, or 0 if unknown.
+uint64_t GetPeakMemoryUsage();
+
+}  // namespace lczero
@@ -0,0 +1,113 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "benchmark/results.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "utils/exception.h"
+
+namespace lczero {
+
+namespace {
+BenchmarkResults MakeResults(double nps, double nps_error) {
+  using Better = BenchmarkResults::Better;
+  BenchmarkResults results;
+  results.Add("8/8/8/8/8/8/8/K1k5 w - - 0 1", "nodes", 1000);
+  results.Add("8/8/8/8/8/8/8/K1k5 w - - 0 1", "nps", nps, Better::kHigher,
+              nps_error);
+  results.Add("total", "batch_p99_ms", 12.5, Better::kLower);
+  return results;
+}
+
+void ExpectRoundTrip(const std::string& filename) {
+  const auto written = MakeResults(5000.25, 40.5);
+  written.Write(filename);
+  const auto read = BenchmarkResults::Read(filename);
+  std::remove(filename.c_str());
+
+  ASSERT_EQ(read.GetRows().size(), 2u);
+  const auto& row = read.GetRows()[0];
+  EXPECT_EQ(row.key, "8/8/8/8/8/8/8/K1k5 w - - 0 1");
+  ASSERT_EQ(row.metrics.size(), 2u);
+  const auto* nps = row.Find("nps");
+  ASSERT_NE(nps, nullptr);
+  EXPECT_DOUBLE_EQ(nps->value, 5000.25);
+  EXPECT_DOUBLE_EQ(nps->error, 40.5);
+  EXPECT_EQ(row.Find("nps_err"), nullptr);
+  const auto* p99 = read.GetRows()[1].Find("batch_p99_ms");
+  ASSERT_NE(p99, nullptr);
+  EXPECT_DOUBLE_EQ(p99->value, 12.5);
+  EXPECT_EQ(read.GetRows()[1].Find("nodes"), nullptr);
+}
+}  // namespace
+
+TEST(BenchmarkResults, JsonRoundTrip) { ExpectRoundTrip("results_test.json"); }
+
+TEST(BenchmarkResults, CsvRoundTrip) { ExpectRoundTrip("results_test.csv"); }
+
+TEST(BenchmarkResults, ReadReportsBadField) {
+  const std::string filename = "results_test_bad.csv";
+  {
+    std::ofstream file(filename);
+    file << "key,nodes,nps\ntotal,1000,fast\n";
+  }
+  try {
+    BenchmarkResults::Read(filename);
+    ADD_FAILURE() << "Expected an exception";
+  } catch (const Exception& e) {
+    EXPECT_NE(std::string(e.what()).find(filename), std::string::npos);
+    EXPECT_NE(std::string(e.what()).find("nps of total"), std::string::npos);
+  }
+  std::remove(filename.c_str());
+}
+
+TEST(BenchmarkResults, CompareIgnoresNoise) {
+  std::ostringstream out;
+  // 4% drop, but within two combined standard errors.
+  EXPECT_EQ(MakeResults(4800, 100).CompareTo(MakeResults(5000, 100), 0.03,
+                                             &out),
+            0);
+  // 4% drop with precise measurements.
+  EXPECT_EQ(
+      MakeResults(4800, 10).CompareTo(MakeResults(5000, 10), 0.03, &out), 1);
+  // Below relative threshold.
+  EXPECT_EQ(MakeResults(4900, 0).CompareTo(MakeResults(5000, 0), 0.03, &out),
+            0);
+  // Improvements are not regressions.
+  EXPECT_EQ(MakeResults(6000, 0).CompareTo(MakeResults(5000, 0), 0.03, &out),
+            0);
+}
+
+TEST(BenchmarkResults, Percentile) {
+  EXPECT_DOUBLE_EQ(Percentile({}, 50), 0.0);
+  EXPECT_DOUBLE_EQ(Percentile({3, 1, 2}, 50), 2.0);
+  EXPECT_DOUBLE_EQ(Percentile({1, 2, 3, 4, 5}, 100), 5.0);
+  EXPECT_DOUBLE_EQ(Percentile({1, 2}, 75), 1.75);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -125,6 +125,30 @@ static const BitBoard kBishopAttacks[] = {
     0x0005081020408000ULL, 0x000A112040800000ULL, 0x0014224180000000ULL,
     0x0028448201000000ULL, 0x0050880402010000ULL, 0x00A0100804020100ULL,
     0x0040201008040201ULL};
+// Which squares can king attack.
+static const BitBoard kKingAttacks[] = {
+    0x0000000000000302ULL, 0x0000000000000705ULL, 0x0000000000000E0AULL,
+    0x0000000000001C14ULL, 0x0000000000003828ULL, 0x0000000000007050ULL,
+    0x000000000000E0A0ULL, 0x000000000000C040ULL, 0x0000000000030203ULL,
+    0x0000000000070507ULL, 0x00000000000E0A0EULL, 0x00000000001C141CULL,
+    0x0000000000382838ULL, 0x0000000000705070ULL, 0x0000000000E0A0E0ULL,
+    0x0000000000C040C0ULL, 0x0000000003020300ULL, 0x0000000007050700ULL,
+    0x000000000E0A0E00ULL, 0x000000001C141C00ULL, 0x0000000038283800ULL,
+    0x0000000070507000ULL, 0x00000000E0A0E000ULL, 0x00000000C040C000ULL,
+    0x0000000302030000ULL, 0x0000000705070000ULL, 0x0000000E0A0E0000ULL,
+    0x0000001C141C0000ULL, 0x0000003828380000ULL, 0x0000007050700000ULL,
+    0x000000E0A0E00000ULL, 0x000000C040C00000ULL, 0x0000030203000000ULL,
+    0x0000070507000000ULL, 0x00000E0A0E000000ULL, 0x00001C141C000000ULL,
+    0x0000382838000000ULL, 0x0000705070000000ULL, 0x0000E0A0E0000000ULL,
+    0x0000C040C0000000ULL, 0x0003020300000000ULL, 0x0007050700000000ULL,
+    0x000E0A0E00000000ULL, 0x001C141C00000000ULL, 0x0038283800000000ULL,
+    0x0070507000000000ULL, 0x00E0A0E000000000ULL, 0x00C040C000000000ULL,
+    0x0302030000000000ULL, 0x0705070000000000ULL, 0x0E0A0E0000000000ULL,
+    0x1C141C0000000000ULL, 0x3828380000000000ULL, 0x7050700000000000ULL,
+    0xE0A0E00000000000ULL, 0xC040C00000000000ULL, 0x0203000000000000ULL,
+    0x0507000000000000ULL, 0x0A0E000000000000ULL, 0x141C000000000000ULL,
+    0x2838000000000000ULL, 0x5070000000000000ULL, 0xA0E0000000000000ULL,
+    0x40C0000000000000ULL};
 // Which squares can knight attack.
 static const BitBoard kKnightAttacks[] = {
     0x0000000000020400ULL, 0x0000000000050800ULL, 0x00000000000A1100ULL,
@@ -714,7 +738,7 @@ bool ChessBoard::IsUnderAttack(BoardSquare square) const {
     return true;
   }
   // Check pawns.
-  if (kPawnAttacks[square.as_int()].intersects(their_pieces_ & pawns_)) {
+  if (kPawnAttacks[square.as_int()].intersects(their_pieces_ & pawns())) {
     return true;
   }
   // Check knights.
@@ -857,7 +881,7 @@ KingAttackInfo ChessBoard::GenerateKingAttackInfo() const {
   }
   // Check pawns.
   const BitBoard attacking_pawns =
-      kPawnAttacks[our_king_.as_int()] & their_pieces_ & pawns_;
+      kPawnAttacks[our_king_.as_int()] & their_pieces_ & pawns();
   king_attack_info.attack_lines_ =
       king_attack_info.attack_lines_ | attacking_pawns;
 
@@ -957,16 +981,241 @@ bool ChessBoard::IsLegalMove(Move move,
   }
 }
 
+namespace {
+// Squares attacked by all knights of the bitboard at once.
+BitBoard KnightAttacksOf(BitBoard knights) {
+  const uint64_t b = knights.as_int();
+  const uint64_t l1 = (b >> 1) & 0x7F7F7F7F7F7F7F7FULL;
+  const uint64_t l2 = (b >> 2) & 0x3F3F3F3F3F3F3F3FULL;
+  const uint64_t r1 = (b << 1) & 0xFEFEFEFEFEFEFEFEULL;
+  const uint64_t r2 = (b << 2) & 0xFCFCFCFCFCFCFCFCULL;
+  const uint64_t h1 = l1 | r1;
+  const uint64_t h2 = l2 | r2;
+  return (h1 << 16) | (h1 >> 16) | (h2 << 8) | (h2 >> 8);
+}
+
+// Squares attacked by all "their" (black) pawns of the bitboard at once.
+BitBoard TheirPawnAttacksOf(BitBoard pawns) {
+  const uint64_t b = pawns.as_int();
+  return ((b >> 7) & 0xFEFEFEFEFEFEFEFEULL) |
+         ((b >> 9) & 0x7F7F7F7F7F7F7F7FULL);
+}
+}  // namespace
+
 MoveList ChessBoard::GenerateLegalMoves() const {
-  const KingAttackInfo king_attack_info = GenerateKingAttackInfo();
-  MoveList result = GeneratePseudolegalMoves();
-  result.erase(
-      std::remove_if(result.begin(), result.end(),
-                     [&](Move m) { return !IsLegalMove(m, king_attack_info); }),
-      result.end());
+  MoveList result;
+  GenerateLegalMoves(&result);
   return result;
 }
 
+void ChessBoard::GenerateLegalMoves(MoveList* result) const {
+  // Moves are generated in the same order as GeneratePseudolegalMoves() does,
+  // but instead of checking every move for legality, all squares attacked by
+  // "them", the checking pieces and the pins are found once upfront.
+  result->reserve(result->size() + 60);
+  const BitBoard occupied = our_pieces_ | their_pieces_;
+  const BitBoard their_pawns = their_pieces_ & pawns();
+  const BitBoard their_knights =
+      their_pieces_ - their_king_ - rooks_ - bishops_ - their_pawns;
+  const BitBoard their_rooks = their_pieces_ & rooks_;
+  const BitBoard their_bishops = their_pieces_ & bishops_;
+
+  // Our king doesn't block attacks, as it can't hide behind itself.
+  const BitBoard occupied_without_king = occupied - our_king_;
+  BitBoard attacked = kKingAttacks[their_king_.as_int()] |
+                      KnightAttacksOf(their_knights) |
+                      TheirPawnAttacksOf(their_pawns);
+  for (const auto square : their_rooks) {
+    attacked = attacked | GetRookAttacks(square, occupied_without_king);
+  }
+  for (const auto square : their_bishops) {
+    attacked = attacked | GetBishopAttacks(square, occupied_without_king);
+  }
+
+  // Checking pieces, and squares where a check may be resolved by capturing
+  // or interposing.
+  BitBoard checkers = (kPawnAttacks[our_king_.as_int()] & their_pawns) |
+                      (kKnightAttacks[our_king_.as_int()] & their_knights);
+  BitBoard check_mask = checkers;
+  // Pinned pieces and the squares they may move to.
+  BitBoard pinned;
+  struct Pin {
+    BoardSquare square;
+    BitBoard ray;
+  };
+  Pin pins[8];
+  int num_pins = 0;
+  auto find_checks_and_pins = [&](BitBoard sliders, auto get_attacks) {
+    const BitBoard king = our_king_.as_board();
+    for (const auto slider : sliders) {
+      const BitBoard between = get_attacks(our_king_, slider.as_board()) &
+                               get_attacks(slider, king);
+      const BitBoard blockers = between & occupied;
+      if (blockers.empty()) {
+        checkers.set(slider);
+        check_mask = check_mask | between | slider.as_board();
+      } else if (blockers.count_few() == 1 &&
+                 blockers.intersects(our_pieces_)) {
+        pinned = pinned | blockers;
+        pins[num_pins++] = {*blockers.begin(), between | slider.as_board()};
+      }
+    }
+  };
+  find_checks_and_pins(their_rooks & kRookAttacks[our_king_.as_int()],
+                       GetRookAttacks);
+  find_checks_and_pins(their_bishops & kBishopAttacks[our_king_.as_int()],
+                       GetBishopAttacks);
+  const int num_checkers = checkers.count_few();
+  if (num_checkers == 0) check_mask = ~0ULL;
+
+  for (auto source : our_pieces_) {
+    // King
+    if (source == our_king_) {
+      for (const auto destination :
+           kKingAttacks[source.as_int()] - our_pieces_ - attacked) {
+        result->emplace_back(source, destination);
+      }
+      if (num_checkers > 0) continue;
+      // Castlings.
+      auto walk_free = [&](int from, int to, int rook, int king) {
+        for (int i = from; i <= to; ++i) {
+          if (i == rook || i == king) continue;
+          if (occupied.get(i)) return false;
+        }
+        return true;
+      };
+      // @From may be less or greater than @to. @To is not included in check
+      // unless it is the same with @from.
+      auto range_attacked = [&](int from, int to) {
+        if (from == to) return attacked.get(from);
+        const int increment = from < to ? 1 : -1;
+        while (from != to) {
+          if (attacked.get(from)) return true;
+          from += increment;
+        }
+        return false;
+      };
+      // The rook may have shielded the king's destination from a slider on
+      // the first rank (in Chess960), so it's checked with both moved.
+      auto destination_attacked = [&](int rook, int king_to, int rook_to) {
+        const BitBoard after =
+            (occupied - our_king_ - BoardSquare(rook)) |
+            BoardSquare(king_to).as_board() | BoardSquare(rook_to).as_board();
+        return attacked.get(king_to) ||
+               GetRookAttacks(king_to, after).intersects(their_rooks);
+      };
+      const uint8_t king = source.col();
+      if (castlings_.we_can_000()) {
+        const uint8_t qrook = castlings_.queenside_rook();
+        if (walk_free(std::min(static_cast<uint8_t>(C1), qrook),
+                      std::max(static_cast<uint8_t>(D1), king), qrook, king) &&
+            !range_attacked(king, C1) && !destination_attacked(qrook, C1, D1)) {
+          result->emplace_back(source, BoardSquare(RANK_1, qrook));
+        }
+      }
+      if (castlings_.we_can_00()) {
+        const uint8_t krook = castlings_.kingside_rook();
+        if (walk_free(std::min(static_cast<uint8_t>(F1), king),
+                      std::max(static_cast<uint8_t>(G1), krook), krook, king) &&
+            !range_attacked(king, G1) && !destination_attacked(krook, G1, F1)) {
+          result->emplace_back(source, BoardSquare(RANK_1, krook));
+        }
+      }
+      continue;
+    }
+    // Only the king can escape a double check.
+    if (num_checkers > 1) continue;
+    BitBoard allowed = check_mask;
+    if (pinned.get(source)) {
+      for (int i = 0; i < num_pins; ++i) {
+        if (pins[i].square == source) allowed &= pins[i].ray;
+      }
+    }
+    bool processed_piece = false;
+    // Rook (and queen)
+    if (rooks_.get(source)) {
+      processed_piece = true;
+      for (const auto destination :
+           (GetRookAttacks(source, occupied) - our_pieces_) & allowed) {
+        result->emplace_back(source, destination);
+      }
+    }
+    // Bishop (and queen)
+    if (bishops_.get(source)) {
+      processed_piece = true;
+      for (const auto destination :
+           (GetBishopAttacks(source, occupied) - our_pieces_) & allowed) {
+        result->emplace_back(source, destination);
+      }
+    }
+    if (processed_piece) continue;
+    // Pawns.
+    if (pawns().get(source)) {
+      // Moves forward.
+      {
+        const auto dst_row = source.row() + 1;
+        const auto dst_col = source.col();
+        const BoardSquare destination(dst_row, dst_col);
+
+        if (!occupied.get(destination)) {
+          if (dst_row != RANK_8) {
+            if (allowed.get(destination)) {
+              result->emplace_back(source, destination);
+            }
+            if (dst_row == RANK_3) {
+              // Maybe it'll be possible to move two squares.
+              const BoardSquare double_destination(RANK_4, dst_col);
+              if (!occupied.get(double_destination) &&
+                  allowed.get(double_destination)) {
+                result->emplace_back(source, double_destination);
+              }
+            }
+          } else if (allowed.get(destination)) {
+            // Promotions
+            for (auto promotion : kPromotions) {
+              result->emplace_back(source, destination, promotion);
+            }
+          }
+        }
+      }
+      // Captures.
+      {
+        for (auto direction : {-1, 1}) {
+          const auto dst_row = source.row() + 1;
+          const auto dst_col = source.col() + direction;
+          if (dst_col < 0 || dst_col >= 8) continue;
+          const BoardSquare destination(dst_row, dst_col);
+          if (their_pieces_.get(destination)) {
+            if (!allowed.get(destination)) continue;
+            if (dst_row == RANK_8) {
+              // Promotion.
+              for (auto promotion : kPromotions) {
+                result->emplace_back(source, destination, promotion);
+              }
+            } else {
+              // Ordinary capture.
+              result->emplace_back(source, destination);
+            }
+          } else if (dst_row == RANK_6 && pawns_.get(RANK_8, dst_col)) {
+            // En passant. Complex but rare (two pieces leave the rank at
+            // once), so just apply and check that we are not under check.
+            const Move move(source, destination);
+            ChessBoard board(*this);
+            board.ApplyMove(move);
+            if (!board.IsUnderCheck()) result->push_back(move);
+          }
+        }
+      }
+      continue;
+    }
+    // Knight.
+    for (const auto destination :
+         (kKnightAttacks[source.as_int()] - our_pieces_) & allowed) {
+      result->emplace_back(source, destination);
+    }
+  }
+}
+
 void ChessBoard::SetFromFen(std::string fen, int* rule50_ply, int* moves) {
   Clear();
   int row = 7;
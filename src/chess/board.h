@@ -96,6 +96,8 @@ class ChessBoard {
   bool HasMatingMaterial() const;
   // Generates legal moves.
   MoveList GenerateLegalMoves() const;
+  // Appends legal moves to @moves, so that its storage can be reused.
+  void GenerateLegalMoves(MoveList* moves) const;
   // Check whether pseudolegal move is legal.
   bool IsLegalMove(Move move, const KingAttackInfo& king_attack_info) const;
   // Returns whether two moves are actually the same move in the position.
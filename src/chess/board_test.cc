@@ -202,6 +202,16 @@ TEST(ChessBoard, MoveGenPosition6) {
   EXPECT_EQ(Perft(board, 4), 3894594);
 }
 
+TEST(ChessBoard, MoveGenEnPassantNextToBackRankPiece) {
+  // The en passant marker shares the e8 square with the rook, which must not
+  // be mistaken for a pawn checking the king.
+  ChessBoard board;
+  board.SetFromFen("4r3/3K4/8/4pP2/8/8/8/k7 w - e6 0 2");
+
+  EXPECT_FALSE(board.IsUnderCheck());
+  EXPECT_EQ(Perft(board, 1), 6);
+}
+
 namespace {
 const struct {
   const char* const fen;
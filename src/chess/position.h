@@ -93,6 +93,9 @@ class PositionHistory {
  public:
   PositionHistory() = default;
   PositionHistory(const PositionHistory& other) = default;
+  PositionHistory(PositionHistory&& other) = default;
+  PositionHistory& operator=(const PositionHistory& other) = default;
+  PositionHistory& operator=(PositionHistory&& other) = default;
 
   // Returns first position of the game (or fen from which it was initialized).
   const Position& Starting() const { return positions_.front(); }
@@ -33,6 +33,7 @@
 
 #include "mcts/search.h"
 #include "mcts/stoppers/factory.h"
+#include "neural/shared_cache.h"
 #include "utils/configfile.h"
 #include "utils/logging.h"
 
@@ -60,6 +61,49 @@ const OptionId kShowWDL{"show-wdl", "UCI_ShowWDL",
                         "Show win, draw and lose probability."};
 const OptionId kShowMovesleft{"show-movesleft", "UCI_ShowMovesLeft",
                               "Show estimated moves left."};
+const OptionId kNNCacheFileId{
+    "nncache-file", "NNCacheFile",
+    "File to keep the NN cache in between runs. It's loaded in the background "
+    "when the network is loaded, and written on exit. Entries written for "
+    "another network or backend are ignored, and replaced on exit. When set, "
+    "the NN cache is not cleared on new game."};
+const OptionId kNNCacheSaveId{
+    "nncache-save", "NNCacheSave",
+    "Setting this UCI option to true writes the NN cache to NNCacheFile "
+    "immediately. Ignored while search is running."};
+const OptionId kNNCacheSharedId{
+    "nncache-shared", "NNCacheShared",
+    "Number of positions in an NN cache shared by all lc0 processes on this "
+    "host which use the same network and backend, 0 to not use it. It's "
+    "looked up on misses of the private NN cache, which then can be smaller. "
+    "It takes 512 bytes per position, and is created by the first process, "
+    "with its size. The memory stays allocated after the processes exit (on "
+    "Linux, until the cache is removed from /dev/shm)."};
+const OptionId kTreeFileId{
+    "tree-file", "TreeFile",
+    "File to keep the search tree in between runs, for long-running analysis. "
+    "It's loaded when a new position is set up which matches the one it was "
+    "written for, and written on exit."};
+const OptionId kTreeFileMinVisitsId{
+    "tree-file-min-visits", "TreeFileMinVisits",
+    "Only load subtrees of nodes with at least this many visits from "
+    "TreeFile, to fit the tree into less memory."};
+const OptionId kTreeSaveId{
+    "tree-save", "TreeSave",
+    "Setting this UCI option to true writes the search tree to TreeFile "
+    "immediately. Ignored while search is running."};
+const OptionId kDistributedWorkersId{
+    "distributed-workers", "DistributedWorkers",
+    "Comma-separated addresses of `lc0 searchworker` processes to split the "
+    "root moves with: Unix domain socket paths or host:port. Every process "
+    "searches its share of the moves, and the stats of all of them are "
+    "merged for the best move and the info output."};
+const OptionId kIdlePrefetchId{
+    "idle-prefetch", "IdlePrefetch",
+    "After the best move is output, evaluate up to X positions after likely "
+    "replies to it into the cache, in batches of MaxPrefetch, while waiting "
+    "for the next command. It stops when the next position or search is set "
+    "up. 0 to disable."};
 const OptionId kStrictUciTiming{"strict-uci-timing", "StrictTiming",
                                 "The UCI host compensates for lag, waits for "
                                 "the 'readyok' reply before sending 'go' and "
@@ -87,12 +131,37 @@ EngineController::EngineController(std::unique_ptr<UciResponder> uci_responder,
                                    const OptionsDict& options)
     : options_(options), uci_responder_(std::move(uci_responder)) {}
 
+EngineController::~EngineController() {
+  // Make sure search is destructed first, and it still may be running in
+  // a separate thread.
+  ResetSearch();
+  ReportNNCacheHitRate();
+  try {
+    SaveTree();
+  } catch (Exception& e) {
+    CERR << e.what();
+  }
+  try {
+    SaveNNCache();
+  } catch (Exception& e) {
+    CERR << e.what();
+  }
+}
+
 void EngineController::PopulateOptions(OptionsParser* options) {
   using namespace std::placeholders;
 
   NetworkFactory::PopulateOptions(options);
   options->Add<IntOption>(kThreadsOptionId, 1, 128) = kDefaultThreads;
   options->Add<IntOption>(kNNCacheSizeId, 0, 999999999) = 5000000;
+  options->Add<StringOption>(kNNCacheFileId);
+  options->Add<BoolOption>(kNNCacheSaveId) = false;
+  options->Add<IntOption>(kNNCacheSharedId, 0, 999999999) = 0;
+  options->Add<StringOption>(kTreeFileId);
+  options->Add<IntOption>(kTreeFileMinVisitsId, 1, 999999999) = 1;
+  options->Add<BoolOption>(kTreeSaveId) = false;
+  options->Add<StringOption>(kDistributedWorkersId);
+  options->Add<IntOption>(kIdlePrefetchId, 0, 999999999) = 0;
   SearchParams::Populate(options);
 
   options->Add<StringOption>(kSyzygyTablebaseId);
@@ -134,14 +203,58 @@ void EngineController::UpdateFromUciOptions() {
   // Network.
   const auto network_configuration =
       NetworkFactory::BackendConfiguration(options_);
+  bool network_changed = false;
   if (network_configuration_ != network_configuration) {
-    network_ = NetworkFactory::LoadNetwork(options_);
+    network_ = NetworkFactory::LoadNetwork(options_, &network_hash_);
     network_configuration_ = network_configuration;
+    network_changed = true;
   }
 
   // Cache size.
   cache_.SetCapacity(options_.Get<int>(kNNCacheSizeId));
 
+  // Shared cache, which is per network.
+  const int shared_cache_size = options_.Get<int>(kNNCacheSharedId);
+  if (network_changed || shared_cache_size != shared_cache_size_) {
+    cache_.SetSharedCache(nullptr);
+    shared_cache_size_ = shared_cache_size;
+    if (shared_cache_size > 0) {
+      try {
+        auto shared_cache =
+            std::make_shared<SharedNNCache>(network_hash_, shared_cache_size);
+        CERR << "Using shared NN cache "
+             << SharedNNCache::GetSegmentName(network_hash_) << " of "
+             << shared_cache->GetCapacity() << " positions.";
+        cache_.SetSharedCache(std::move(shared_cache));
+      } catch (Exception& e) {
+        CERR << e.what();
+      }
+    }
+  }
+
+  // Distributed search workers.
+  const std::string workers = options_.Get<std::string>(kDistributedWorkersId);
+  if (workers != remote_workers_addresses_) {
+    remote_workers_.reset();
+    remote_workers_addresses_ = workers;
+    if (!workers.empty()) {
+      try {
+        remote_workers_ = std::make_unique<RemoteSearchWorkers>(workers);
+        CERR << "Connected to " << remote_workers_->GetWorkerCount()
+             << " search workers.";
+      } catch (Exception& e) {
+        CERR << e.what();
+      }
+    }
+  }
+
+  // Cache snapshot, loaded after the capacity is known.
+  const std::string cache_file = options_.Get<std::string>(kNNCacheFileId);
+  if (!cache_file.empty() && (network_changed || cache_file != cache_file_)) {
+    StartLoadingNNCache(cache_file);
+  }
+  cache_file_ = cache_file;
+
   // Check whether we can update the move timer in "Go".
   strict_uci_timing_ = options_.Get<bool>(kStrictUciTiming);
 }
@@ -158,8 +271,12 @@ void EngineController::NewGame() {
   // newgame and goes straight into go.
   ResetMoveTimer();
   SharedLock lock(busy_mutex_);
-  cache_.Clear();
-  search_.reset();
+  // The search is destroyed first, as its idle prefetch may be filling the
+  // cache.
+  ResetSearch();
+  // Cache entries don't depend on the game, and with a cache file they are
+  // expected to be reused.
+  if (options_.Get<std::string>(kNNCacheFileId).empty()) cache_.Clear();
   tree_.reset();
   CreateFreshTimeManager();
   current_position_.reset();
@@ -173,13 +290,13 @@ void EngineController::SetPosition(const std::string& fen,
   ResetMoveTimer();
   SharedLock lock(busy_mutex_);
   current_position_ = CurrentPosition{fen, moves_str};
-  search_.reset();
+  ResetSearch();
 }
 
 void EngineController::SetupPosition(
     const std::string& fen, const std::vector<std::string>& moves_str) {
   SharedLock lock(busy_mutex_);
-  search_.reset();
+  ResetSearch();
 
   UpdateFromUciOptions();
 
@@ -189,6 +306,90 @@ void EngineController::SetupPosition(
   for (const auto& move : moves_str) moves.emplace_back(move);
   const bool is_same_game = tree_->ResetToPosition(fen, moves);
   if (!is_same_game) CreateFreshTimeManager();
+  if (remote_workers_) remote_workers_->SetPosition(fen, moves_str);
+
+  const std::string tree_file = options_.Get<std::string>(kTreeFileId);
+  if (!tree_file.empty() && tree_->GetCurrentHead()->GetN() == 0) {
+    try {
+      const uint64_t loaded = tree_->LoadHeadSubtree(
+          tree_file, network_hash_, options_.Get<int>(kTreeFileMinVisitsId));
+      if (loaded > 0) {
+        CERR << "Loaded " << loaded << " tree nodes from " << tree_file;
+      }
+    } catch (Exception& e) {
+      CERR << e.what();
+    }
+  }
+}
+
+void EngineController::StartLoadingNNCache(const std::string& filename) {
+  if (cache_loader_.joinable()) cache_loader_.join();
+  cache_lookups_at_load_ = cache_.GetLookups();
+  cache_hits_at_load_ = cache_.GetHits();
+  cache_entries_loaded_ = 0;
+  cache_hit_rate_reported_ = false;
+  cache_loader_ = std::thread([this, filename, hash = network_hash_]() {
+    try {
+      const int loaded = LoadNNCacheSnapshot(&cache_, hash, filename);
+      CERR << "Loaded " << loaded << " NN cache entries from " << filename;
+      cache_entries_loaded_ = loaded;
+    } catch (Exception& e) {
+      CERR << e.what();
+    }
+  });
+}
+
+void EngineController::ReportNNCacheHitRate() {
+  if (cache_hit_rate_reported_ || cache_entries_loaded_ == 0) return;
+  const int64_t lookups = cache_.GetLookups() - cache_lookups_at_load_;
+  if (lookups == 0) return;
+  const int64_t hits = cache_.GetHits() - cache_hits_at_load_;
+  CERR << "NN cache hit rate of the first search after loading "
+       << cache_entries_loaded_ << " entries: " << 100.0 * hits / lookups
+       << "% of " << lookups << " lookups.";
+  cache_hit_rate_reported_ = true;
+}
+
+void EngineController::SaveNNCache() {
+  if (cache_loader_.joinable()) cache_loader_.join();
+  const std::string filename = options_.Get<std::string>(kNNCacheFileId);
+  if (filename.empty() || !network_) return;
+  if (search_) {
+    // Lookups would wait for the cache while it's written.
+    if (search_->IsSearchActive()) {
+      CERR << "Cannot write the NN cache while search is running.";
+      return;
+    }
+    StopIdlePrefetch();
+  }
+  const int saved = SaveNNCacheSnapshot(cache_, network_hash_, filename);
+  CERR << "Saved " << saved << " NN cache entries to " << filename;
+}
+
+void EngineController::SaveTree() {
+  const std::string filename = options_.Get<std::string>(kTreeFileId);
+  if (filename.empty() || !tree_) return;
+  if (search_) {
+    if (search_->IsSearchActive()) {
+      CERR << "Cannot write the tree while search is running.";
+      return;
+    }
+    StopIdlePrefetch();
+    // Root children searched by remote workers get their local stats back.
+    search_->ReleaseTree();
+  }
+  const uint64_t saved = tree_->SaveHeadSubtree(filename, network_hash_);
+  CERR << "Saved " << saved << " tree nodes to " << filename;
+}
+
+void EngineController::StopIdlePrefetch() {
+  if (search_) search_->Abort();
+  if (idle_prefetch_thread_.joinable()) idle_prefetch_thread_.join();
+}
+
+void EngineController::ResetSearch() {
+  StopIdlePrefetch();
+  search_.reset();
 }
 
 void EngineController::CreateFreshTimeManager() {
@@ -275,16 +476,31 @@ void EngineController::Go(const GoParams& params) {
     responder = std::make_unique<MovesLeftResponseFilter>(std::move(responder));
   }
 
+  // The previous search, if any, is over.
+  if (search_) ReportNNCacheHitRate();
+  ResetSearch();
+
   auto stopper = time_manager_->GetStopper(params, *tree_.get());
   search_ = std::make_unique<Search>(
       *tree_, network_.get(), std::move(responder),
       StringsToMovelist(params.searchmoves, tree_->HeadPosition().GetBoard()),
       *move_start_time_, std::move(stopper), params.infinite || params.ponder,
-      options_, &cache_, syzygy_tb_.get());
+      options_, &cache_, syzygy_tb_.get(), &thread_pool_,
+      remote_workers_.get());
 
   LOGFILE << "Timer started at "
           << FormatTime(SteadyClockToSystemClock(*move_start_time_));
   search_->StartThreads(options_.Get<int>(kThreadsOptionId));
+
+  // The prefetch runs on its own thread, as the search itself is over when
+  // bestmove is sent.
+  const int idle_prefetch = options_.Get<int>(kIdlePrefetchId);
+  if (idle_prefetch > 0) {
+    idle_prefetch_thread_ =
+        std::thread([search = search_.get(), idle_prefetch]() {
+          search->RunIdlePrefetch(idle_prefetch);
+        });
+  }
 }
 
 void EngineController::PonderHit() {
@@ -333,6 +549,16 @@ void EngineLoop::CmdSetOption(const std::string& name, const std::string& value,
   // Set the log filename for the case it was set in UCI option.
   Logging::Get().SetFilename(
       options_.GetOptionsDict().Get<std::string>(kLogFileId));
+  // NNCacheSave works as a button.
+  if (options_.GetOptionsDict().Get<bool>(kNNCacheSaveId)) {
+    options_.GetMutableOptions()->Set<bool>(kNNCacheSaveId, false);
+    engine_.SaveNNCache();
+  }
+  // TreeSave works as a button too.
+  if (options_.GetOptionsDict().Get<bool>(kTreeSaveId)) {
+    options_.GetMutableOptions()->Set<bool>(kTreeSaveId, false);
+    engine_.SaveTree();
+  }
 }
 
 void EngineLoop::CmdUciNewGame() { engine_.NewGame(); }
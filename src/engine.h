@@ -27,7 +27,9 @@
 
 #pragma once
 
+#include <atomic>
 #include <optional>
+#include <thread>
 
 #include "chess/uciloop.h"
 #include "mcts/search.h"
@@ -50,11 +52,7 @@ class EngineController {
   EngineController(std::unique_ptr<UciResponder> uci_responder,
                    const OptionsDict& options);
 
-  ~EngineController() {
-    // Make sure search is destructed first, and it still may be running in
-    // a separate thread.
-    search_.reset();
-  }
+  ~EngineController();
 
   void PopulateOptions(OptionsParser* options);
 
@@ -74,13 +72,26 @@ class EngineController {
   // Must not block.
   void Stop();
 
+  // Writes the NN cache to NNCacheFile, if it's set and search is not running.
+  void SaveNNCache();
+
+  // Writes the search tree under the current position to TreeFile, if it's
+  // set and search is not running.
+  void SaveTree();
+
  private:
   void UpdateFromUciOptions();
+  void StartLoadingNNCache(const std::string& filename);
+  void ReportNNCacheHitRate();
 
   void SetupPosition(const std::string& fen,
                      const std::vector<std::string>& moves);
   void ResetMoveTimer();
   void CreateFreshTimeManager();
+  // Aborts the search and waits for its idle prefetch, if any, to return.
+  void StopIdlePrefetch();
+  // Destroys the search after stopping its idle prefetch.
+  void ResetSearch();
 
   const OptionsDict& options_;
 
@@ -91,11 +102,30 @@ class EngineController {
   using SharedLock = std::shared_lock<RpSharedMutex>;
 
   std::unique_ptr<TimeManager> time_manager_;
+  // Declared before search_, so that they outlive the search borrowing them.
+  SearchThreadPool thread_pool_;
+  std::unique_ptr<RemoteSearchWorkers> remote_workers_;
+  std::string remote_workers_addresses_;
   std::unique_ptr<Search> search_;
+  // Runs Search::RunIdlePrefetch() of search_ after bestmove.
+  std::thread idle_prefetch_thread_;
   std::unique_ptr<NodeTree> tree_;
   std::unique_ptr<SyzygyTablebase> syzygy_tb_;
   std::unique_ptr<Network> network_;
+  uint64_t network_hash_ = 0;
   NNCache cache_;
+  // Requested size of the shared NN cache, which is set up for the network.
+  int shared_cache_size_ = 0;
+
+  // NN cache snapshot file which is loaded for the current network.
+  std::string cache_file_;
+  std::thread cache_loader_;
+  std::atomic<int> cache_entries_loaded_{0};
+  // Cache counters when loading started, to report the hit rate of the first
+  // search after that.
+  int64_t cache_lookups_at_load_ = 0;
+  int64_t cache_hits_at_load_ = 0;
+  bool cache_hit_rate_reported_ = true;
 
   // Store current TB and network settings to track when they change so that
   // they are reloaded.
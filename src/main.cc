@@ -25,11 +25,15 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include "analysis/bulk.h"
 #include "benchmark/benchmark.h"
 #include "benchmark/backendbench.h"
+#include "benchmark/corebench.h"
 #include "chess/board.h"
 #include "engine.h"
 #include "selfplay/loop.h"
+#include "server/nnserver.h"
+#include "server/searchworker.h"
 #include "utils/commandline.h"
 #include "utils/esc_codes.h"
 #include "utils/logging.h"
@@ -52,6 +56,14 @@ int main(int argc, const char** argv) {
     CommandLine::RegisterMode("selfplay", "Play games with itself");
     CommandLine::RegisterMode("benchmark", "Quick benchmark");
     CommandLine::RegisterMode("backendbench", "Quick benchmark of backend only");
+    CommandLine::RegisterMode(
+        "corebench", "Perft and benchmark of move generation and encoding");
+    CommandLine::RegisterMode(
+        "analyze", "Search all positions of a FEN/EPD file, in parallel");
+    CommandLine::RegisterMode(
+        "nnserver", "Serve NN evaluations to other lc0 processes on this host");
+    CommandLine::RegisterMode(
+        "searchworker", "Search root moves assigned by a distributed search");
 
     if (CommandLine::ConsumeCommand("selfplay")) {
       // Selfplay mode.
@@ -60,11 +72,27 @@ int main(int argc, const char** argv) {
     } else if (CommandLine::ConsumeCommand("benchmark")) {
       // Benchmark mode.
       Benchmark benchmark;
-      benchmark.Run();
+      return benchmark.Run();
     } else if (CommandLine::ConsumeCommand("backendbench")) {
       // Backend Benchmark mode.
       BackendBenchmark benchmark;
-      benchmark.Run();
+      return benchmark.Run();
+    } else if (CommandLine::ConsumeCommand("corebench")) {
+      // Chess core benchmark mode.
+      CoreBenchmark benchmark;
+      return benchmark.Run();
+    } else if (CommandLine::ConsumeCommand("analyze")) {
+      // Bulk position analysis mode.
+      BulkAnalysis analysis;
+      analysis.Run();
+    } else if (CommandLine::ConsumeCommand("nnserver")) {
+      // NN evaluation server mode.
+      NNServer server;
+      server.Run();
+    } else if (CommandLine::ConsumeCommand("searchworker")) {
+      // Distributed search worker mode.
+      SearchWorkerServer server;
+      server.Run();
     } else {
       // Consuming optional "uci" mode.
       CommandLine::ConsumeCommand("uci");
@@ -0,0 +1,181 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "mcts/distributed.h"
+
+#include <cstring>
+
+#include "utils/exception.h"
+#include "utils/string.h"
+
+namespace lczero {
+namespace {
+const char kMagic[8] = {'L', 'c', '0', 'S', 'r', 'c', 'h', 'W'};
+const uint32_t kVersion = 1;
+// Limits on what a peer may send, to fail early on garbage.
+const uint32_t kMaxStringSize = 1 << 20;
+const uint32_t kMaxMoves = 256;
+
+void SendString(StreamSocket* socket, const std::string& str) {
+  socket->Write(str.data(), str.size());
+}
+
+std::string ReceiveString(StreamSocket* socket, uint32_t size) {
+  if (size > kMaxStringSize) throw Exception("Search request is too large.");
+  std::string result(size, '\0');
+  if (size > 0 && !socket->Read(&result[0], size)) {
+    throw Exception("Connection closed in the middle of a search request.");
+  }
+  return result;
+}
+}  // namespace
+
+void SendSearchWorkerHello(StreamSocket* socket) {
+  SearchWorkerHello hello = {};
+  memcpy(hello.magic, kMagic, sizeof(kMagic));
+  hello.version = kVersion;
+  socket->Write(&hello, sizeof(hello));
+}
+
+bool ReceiveSearchWorkerCommand(StreamSocket* socket, uint32_t* command) {
+  if (!socket->Read(command, sizeof(*command))) return false;
+  if (*command != kSearchCommand && *command != kStopCommand) {
+    throw Exception("Unknown search worker command " +
+                    std::to_string(*command));
+  }
+  return true;
+}
+
+void ReceiveSearchRequest(StreamSocket* socket, RemoteSearchParams* params) {
+  SearchRequest request;
+  if (!socket->Read(&request, sizeof(request))) {
+    throw Exception("Connection closed in the middle of a search request.");
+  }
+  params->fen = ReceiveString(socket, request.fen_size);
+  params->moves =
+      StrSplitAtWhitespace(ReceiveString(socket, request.moves_size));
+  params->searchmoves =
+      StrSplitAtWhitespace(ReceiveString(socket, request.searchmoves_size));
+  params->report_interval_ms = request.report_interval_ms;
+  if (params->searchmoves.empty() || params->searchmoves.size() > kMaxMoves) {
+    throw Exception("Invalid number of searchmoves.");
+  }
+}
+
+void SendSearchReport(StreamSocket* socket, bool final, uint64_t nodes,
+                      const std::vector<RemoteMoveStats>& stats) {
+  const SearchReport report{final, static_cast<uint32_t>(stats.size()), nodes};
+  std::vector<char> buffer(sizeof(report) +
+                           stats.size() * sizeof(RemoteMoveStats));
+  memcpy(buffer.data(), &report, sizeof(report));
+  memcpy(buffer.data() + sizeof(report), stats.data(),
+         stats.size() * sizeof(RemoteMoveStats));
+  socket->Write(buffer.data(), buffer.size());
+}
+
+RemoteSearchWorkers::RemoteSearchWorkers(const std::string& addresses) {
+  for (auto address : StrSplit(addresses, ",")) {
+    address = Trim(address);
+    if (address.empty()) continue;
+    auto socket = StreamSocket::Connect(address);
+    SearchWorkerHello hello;
+    if (!socket->Read(&hello, sizeof(hello))) {
+      throw Exception("Search worker at " + address +
+                      " closed the connection.");
+    }
+    if (memcmp(hello.magic, kMagic, sizeof(kMagic)) != 0 ||
+        hello.version != kVersion) {
+      throw Exception("Incompatible search worker at " + address);
+    }
+    sockets_.push_back(std::move(socket));
+  }
+}
+
+template <typename Func>
+auto RemoteSearchWorkers::Call(int worker, Func func) {
+  if (!sockets_[worker]) throw Exception("Search worker is disconnected.");
+  try {
+    return func(sockets_[worker].get());
+  } catch (Exception&) {
+    sockets_[worker].reset();
+    throw;
+  }
+}
+
+void RemoteSearchWorkers::SetPosition(const std::string& fen,
+                                      const std::vector<std::string>& moves) {
+  fen_ = fen;
+  moves_ = StrJoin(moves, " ");
+}
+
+void RemoteSearchWorkers::StartSearch(
+    int worker, const std::vector<std::string>& searchmoves,
+    int report_interval_ms) {
+  const std::string searchmoves_str = StrJoin(searchmoves, " ");
+  Call(worker, [&](StreamSocket* socket) {
+    const uint32_t command = kSearchCommand;
+    const SearchRequest request{static_cast<uint32_t>(report_interval_ms),
+                                static_cast<uint32_t>(fen_.size()),
+                                static_cast<uint32_t>(moves_.size()),
+                                static_cast<uint32_t>(searchmoves_str.size())};
+    socket->Write(&command, sizeof(command));
+    socket->Write(&request, sizeof(request));
+    SendString(socket, fen_);
+    SendString(socket, moves_);
+    SendString(socket, searchmoves_str);
+  });
+}
+
+void RemoteSearchWorkers::StopSearch(int worker) {
+  Call(worker, [](StreamSocket* socket) {
+    const uint32_t command = kStopCommand;
+    socket->Write(&command, sizeof(command));
+  });
+}
+
+bool RemoteSearchWorkers::ReceiveReport(int worker, uint64_t* nodes,
+                                        std::vector<RemoteMoveStats>* stats) {
+  return Call(worker, [&](StreamSocket* socket) {
+    SearchReport report;
+    if (!socket->Read(&report, sizeof(report))) {
+      throw Exception("Search worker closed the connection.");
+    }
+    if (report.num_moves > kMaxMoves) {
+      throw Exception("Invalid search worker report.");
+    }
+    stats->resize(report.num_moves);
+    if (report.num_moves > 0 &&
+        !socket->Read(stats->data(),
+                      report.num_moves * sizeof(RemoteMoveStats))) {
+      throw Exception("Search worker closed the connection.");
+    }
+    *nodes = report.nodes;
+    return !report.final;
+  });
+}
+
+}  // namespace lczero
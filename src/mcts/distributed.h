@@ -0,0 +1,135 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils/socket.h"
+
+namespace lczero {
+
+// Root-parallel search over several lc0 processes, possibly on other hosts.
+// The coordinator (engine with DistributedWorkers set) splits the root moves
+// among itself and `lc0 searchworker` processes. Every worker searches its
+// share of the root moves and periodically reports their stats, which the
+// coordinator merges into its own root children.
+//
+// Protocol: after accepting a connection the worker sends SearchWorkerHello.
+// Then the coordinator sends commands, each starting with a uint32 command id.
+// kSearchCommand is followed by SearchRequest and by the FEN, the moves and the
+// searchmoves as space-separated strings. The worker then sends a SearchReport
+// followed by RemoteMoveStats for each of the searchmoves, in the same order,
+// every report_interval_ms until it receives kStopCommand. The report sent
+// after that has `final` set. Workers are expected to run on identical
+// machines, so everything is sent in native byte order.
+struct SearchWorkerHello {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+enum SearchWorkerCommand : uint32_t {
+  kSearchCommand = 1,
+  kStopCommand = 2,
+};
+
+struct SearchRequest {
+  uint32_t report_interval_ms;
+  uint32_t fen_size;
+  uint32_t moves_size;
+  uint32_t searchmoves_size;
+};
+
+struct SearchReport {
+  uint32_t final;
+  uint32_t num_moves;
+  // Playouts of the worker's search so far.
+  uint64_t nodes;
+};
+
+struct RemoteMoveStats {
+  uint32_t n;
+  float wl;
+  float d;
+  float m;
+};
+
+struct RemoteSearchParams {
+  std::string fen;
+  std::vector<std::string> moves;
+  std::vector<std::string> searchmoves;
+  int report_interval_ms;
+};
+
+const char kSearchWorkerDefaultAddress[] = "/tmp/lc0-searchworker.sock";
+
+// Worker side of the protocol.
+void SendSearchWorkerHello(StreamSocket* socket);
+// Returns false if the coordinator has disconnected.
+bool ReceiveSearchWorkerCommand(StreamSocket* socket, uint32_t* command);
+void ReceiveSearchRequest(StreamSocket* socket, RemoteSearchParams* params);
+void SendSearchReport(StreamSocket* socket, bool final, uint64_t nodes,
+                      const std::vector<RemoteMoveStats>& stats);
+
+// Coordinator side: connections to the search workers. Calls for different
+// workers may happen in parallel. A worker whose connection fails is dropped.
+class RemoteSearchWorkers {
+ public:
+  // Connects to workers listening at comma-separated @addresses.
+  explicit RemoteSearchWorkers(const std::string& addresses);
+
+  int GetWorkerCount() const { return sockets_.size(); }
+  bool IsConnected(int worker) const { return sockets_[worker] != nullptr; }
+
+  // Sets the position for the following searches, as given in UCI.
+  void SetPosition(const std::string& fen,
+                   const std::vector<std::string>& moves);
+  // Makes @worker search @searchmoves of the current position.
+  void StartSearch(int worker, const std::vector<std::string>& searchmoves,
+                   int report_interval_ms);
+  // Tells @worker to stop the search. It then sends the final report.
+  void StopSearch(int worker);
+  // Blocks until the next report of @worker. Returns false if it was the final
+  // report of the search.
+  bool ReceiveReport(int worker, uint64_t* nodes,
+                     std::vector<RemoteMoveStats>* stats);
+
+ private:
+  // Drops the worker if @func throws.
+  template <typename Func>
+  auto Call(int worker, Func func);
+
+  std::vector<std::unique_ptr<StreamSocket>> sockets_;
+  std::string fen_;
+  std::string moves_;
+};
+
+}  // namespace lczero
@@ -0,0 +1,116 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "mcts/minibatch.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "utils/logging.h"
+
+namespace lczero {
+
+namespace {
+// Adjustments are made after at least that many iterations and seconds.
+const int kWindowIterations = 8;
+const double kWindowSeconds = 0.05;
+// Multiplier of one tuning step.
+const double kStep = 1.25;
+// Smaller drops of the visit rate are considered noise.
+const double kRateTolerance = 0.02;
+// Range of tuned values, relative to the configured ones.
+const int kRangeFactor = 4;
+const int kMaxValue = 1024;
+
+int Clamp(double value, int base) {
+  const int lo = std::max(1, base / kRangeFactor);
+  const int hi = std::max(lo, std::min(kMaxValue, base * kRangeFactor));
+  return std::clamp(static_cast<int>(std::lround(value)), lo, hi);
+}
+}  // namespace
+
+MinibatchController::MinibatchController(int minibatch_size,
+                                         int max_collision_events)
+    : base_minibatch_size_(minibatch_size),
+      base_max_collision_events_(max_collision_events),
+      minibatch_size_(minibatch_size),
+      max_collision_events_(max_collision_events) {}
+
+void MinibatchController::AddIteration(const Iteration& iteration) {
+  window_.visits += iteration.visits;
+  window_.out_of_order += iteration.out_of_order;
+  window_.collision_events += iteration.collision_events;
+  window_.seconds += iteration.seconds;
+  window_.nn_seconds += iteration.nn_seconds;
+  if (iteration.collision_limit_hit) ++window_collision_limit_hits_;
+  ++window_iterations_;
+  if (window_iterations_ < kWindowIterations ||
+      window_.seconds < kWindowSeconds) {
+    return;
+  }
+  Adjust();
+  window_ = Iteration();
+  window_iterations_ = 0;
+  window_collision_limit_hits_ = 0;
+}
+
+void MinibatchController::Adjust() {
+  const double rate = window_.visits / window_.seconds;
+  // Reverse when the last step made things worse.
+  if (previous_rate_ > 0.0 && rate < previous_rate_ * (1.0 - kRateTolerance)) {
+    direction_ = -direction_;
+  }
+  previous_rate_ = rate;
+
+  const int old_minibatch_size = minibatch_size_;
+  minibatch_size_ = Clamp(minibatch_size_ * std::pow(kStep, direction_),
+                          base_minibatch_size_);
+  // Turn around at the bounds.
+  if (minibatch_size_ == old_minibatch_size) direction_ = -direction_;
+
+  const int old_max_collision_events = max_collision_events_;
+  if (window_.collision_events * 2 > window_.visits) {
+    max_collision_events_ =
+        Clamp(max_collision_events_ / kStep, base_max_collision_events_);
+  } else if (window_collision_limit_hits_ * 2 > window_iterations_ &&
+             window_.collision_events * 4 < window_.visits) {
+    max_collision_events_ =
+        Clamp(max_collision_events_ * kStep, base_max_collision_events_);
+  }
+
+  LOGFILE << "Minibatch controller: " << static_cast<int>(rate)
+          << " visits/s, NN latency "
+          << 1000.0 * window_.nn_seconds / window_iterations_ << "ms, "
+          << window_.collision_events << " collisions and "
+          << window_.out_of_order << " out of order evals in "
+          << window_iterations_ << " batches. Minibatch size "
+          << old_minibatch_size << " -> " << minibatch_size_
+          << ", max collision events " << old_max_collision_events << " -> "
+          << max_collision_events_ << ".";
+}
+
+}  // namespace lczero
@@ -0,0 +1,86 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+namespace lczero {
+
+// Tunes the minibatch size and the collision events limit of one search
+// worker during search. The batch size is hill climbed on the rate of useful
+// (non-collision) visits per second. The collision events limit grows when
+// gathering keeps stopping on it while collisions are rare, and shrinks when
+// collisions outnumber visits.
+class MinibatchController {
+ public:
+  struct Iteration {
+    // Visits gathered, including ones evaluated out of order.
+    int visits = 0;
+    int out_of_order = 0;
+    int collision_events = 0;
+    // Whether gathering stopped because of the collision events limit.
+    bool collision_limit_hit = false;
+    double seconds = 0.0;
+    double nn_seconds = 0.0;
+  };
+
+  // Tuning starts from the configured @minibatch_size and
+  // @max_collision_events, and stays between a quarter and four times them.
+  MinibatchController(int minibatch_size, int max_collision_events);
+
+  int GetMiniBatchSize() const { return minibatch_size_; }
+  int GetMaxCollisionEvents() const { return max_collision_events_; }
+  // Returns whether the controller was created for these configured values.
+  bool IsConfiguredFor(int minibatch_size, int max_collision_events) const {
+    return minibatch_size == base_minibatch_size_ &&
+           max_collision_events == base_max_collision_events_;
+  }
+
+  // Reports a finished search iteration. Settings are adjusted once enough
+  // iterations are collected.
+  void AddIteration(const Iteration& iteration);
+
+ private:
+  void Adjust();
+
+  const int base_minibatch_size_;
+  const int base_max_collision_events_;
+  int minibatch_size_;
+  int max_collision_events_;
+  // +1 or -1, the direction of the next batch size step.
+  int direction_ = 1;
+  // Visits per second of the previous window, 0 if there was none.
+  double previous_rate_ = 0.0;
+
+  // Totals of the current window.
+  Iteration window_;
+  int window_iterations_ = 0;
+  int window_collision_limit_hits_ = 0;
+};
+
+}  // namespace lczero
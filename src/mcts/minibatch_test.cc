@@ -0,0 +1,97 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "mcts/minibatch.h"
+
+#include <gtest/gtest.h>
+
+namespace lczero {
+
+namespace {
+// Batch latency with a fixed overhead and a cost growing faster than the
+// batch, so that visits per second peak at batch size ~32.
+MinibatchController::Iteration MakeIteration(int batch_size) {
+  MinibatchController::Iteration iteration;
+  iteration.visits = batch_size;
+  iteration.nn_seconds = 0.001 + batch_size * batch_size * 1e-6;
+  iteration.seconds = iteration.nn_seconds;
+  return iteration;
+}
+}  // namespace
+
+TEST(MinibatchController, ConvergesToBestBatchSize) {
+  MinibatchController controller(128, 32);
+  for (int i = 0; i < 5000; ++i) {
+    controller.AddIteration(MakeIteration(controller.GetMiniBatchSize()));
+  }
+  EXPECT_GE(controller.GetMiniBatchSize(), 20);
+  EXPECT_LE(controller.GetMiniBatchSize(), 52);
+  EXPECT_EQ(controller.GetMaxCollisionEvents(), 32);
+}
+
+TEST(MinibatchController, StaysWithinBounds) {
+  // Larger batches are always better here.
+  MinibatchController controller(64, 32);
+  for (int i = 0; i < 5000; ++i) {
+    MinibatchController::Iteration iteration;
+    iteration.visits = controller.GetMiniBatchSize();
+    iteration.seconds = 0.01;
+    controller.AddIteration(iteration);
+    EXPECT_GE(controller.GetMiniBatchSize(), 16);
+    EXPECT_LE(controller.GetMiniBatchSize(), 256);
+  }
+}
+
+TEST(MinibatchController, ReducesCollisionEventsWhenCollisionsDominate) {
+  MinibatchController controller(64, 32);
+  for (int i = 0; i < 200; ++i) {
+    auto iteration = MakeIteration(controller.GetMiniBatchSize());
+    iteration.collision_events = iteration.visits;
+    iteration.collision_limit_hit = true;
+    controller.AddIteration(iteration);
+  }
+  EXPECT_EQ(controller.GetMaxCollisionEvents(), 8);
+}
+
+TEST(MinibatchController, RaisesCollisionEventsWhenLimitCutsBatches) {
+  MinibatchController controller(64, 32);
+  for (int i = 0; i < 200; ++i) {
+    auto iteration = MakeIteration(controller.GetMiniBatchSize());
+    iteration.collision_events = controller.GetMaxCollisionEvents() / 8;
+    iteration.collision_limit_hit = true;
+    controller.AddIteration(iteration);
+  }
+  EXPECT_GT(controller.GetMaxCollisionEvents(), 32);
+  EXPECT_LE(controller.GetMaxCollisionEvents(), 128);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
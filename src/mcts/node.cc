@@ -31,13 +31,23 @@
 #include <cassert>
 #include <cmath>
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <new>
+#include <condition_variable>
 #include <sstream>
 #include <thread>
 
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "neural/encoder.h"
 #include "neural/network.h"
 #include "utils/exception.h"
+#include "utils/filesystem.h"
 #include "utils/hashcat.h"
 
 namespace lczero {
@@ -49,73 +59,151 @@ namespace lczero {
 namespace {
 // Periodicity of garbage collection, milliseconds.
 const int kGCIntervalMs = 100;
+// Maximum number of nodes a GC thread frees before giving the rest of its
+// subtree back to the queue, so that other GC threads can share large trees.
+const int64_t kGCChunkNodes = 16384;
+// Maximum number of GC threads.
+const unsigned kMaxGCThreads = 4;
+
+unsigned GetGCThreadCount() {
+  return std::max(1u, std::min(kMaxGCThreads,
+                               std::thread::hardware_concurrency() / 4));
+}
 
-// Every kGCIntervalMs milliseconds release nodes in a separate GC thread.
+// Frees are housekeeping, so they shouldn't compete with search threads.
+void LowerCurrentThreadPriority() {
+#if defined(__linux__)
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+}
+}  // namespace
+
+// Every kGCIntervalMs milliseconds release nodes in separate GC threads.
+// Subtrees are freed iteratively in chunks of kGCChunkNodes nodes.
 class NodeGarbageCollector {
  public:
-  NodeGarbageCollector() : gc_thread_([this]() { Worker(); }) {}
+  NodeGarbageCollector() {
+    for (unsigned i = 0; i < GetGCThreadCount(); ++i) {
+      gc_threads_.emplace_back([this]() { Worker(); });
+    }
+  }
 
-  // Takes ownership of a subtree, to dispose it in a separate thread when
-  // it has time.
-  void AddToGcQueue(std::unique_ptr<Node> node, size_t solid_size = 0) {
-    if (!node) return;
+  // Takes ownership of blocks of nodes and their subtrees, to dispose them in
+  // a separate thread when it has time.
+  void AddToGcQueue(NodeBlock::Ptr blocks) {
+    if (!blocks) return;
+    const int64_t nodes = EstimateNodes(*blocks);
     Mutex::Lock lock(gc_mutex_);
-    subtrees_to_gc_.emplace_back(std::move(node));
-    subtrees_to_gc_solid_size_.push_back(solid_size);
+    backlog_nodes_.fetch_add(nodes, std::memory_order_relaxed);
+    subtrees_to_gc_.push_back(std::move(blocks));
+  }
+
+  int64_t GetBacklog() const {
+    return std::max<int64_t>(0, backlog_nodes_.load(std::memory_order_relaxed));
   }
 
   ~NodeGarbageCollector() {
-    // Flips stop flag and waits for a worker thread to stop.
+    // Flips stop flag and waits for worker threads to stop.
     stop_.store(true);
-    gc_thread_.join();
+    cv_.notify_all();
+    for (auto& thread : gc_threads_) thread.join();
   }
 
  private:
-  void GarbageCollect() {
-    while (!stop_.load()) {
-      // Node will be released in destructor when mutex is not locked.
-      std::unique_ptr<Node> node_to_gc;
-      size_t solid_size = 0;
-      {
-        // Lock the mutex and move last subtree from subtrees_to_gc_ into
-        // node_to_gc.
-        Mutex::Lock lock(gc_mutex_);
-        if (subtrees_to_gc_.empty()) return;
-        node_to_gc = std::move(subtrees_to_gc_.back());
-        subtrees_to_gc_.pop_back();
-        solid_size = subtrees_to_gc_solid_size_.back();
-        subtrees_to_gc_solid_size_.pop_back();
+  using Subtree = NodeBlock::Ptr;
+
+  // Number of nodes in a subtree is about the number of visits to it. Includes
+  // the following blocks, as they are released together. Counting the
+  // allocated nodes would need a walk of the whole subtree.
+  static int64_t EstimateNodes(const NodeBlock& blocks) {
+    int64_t nodes = 0;
+    for (const NodeBlock* block = &blocks; block; block = block->next_.get()) {
+      for (int i = 0; i < block->size(); i++) {
+        nodes += block->nodes()[i].GetN() + 1;
       }
-      // Solid is a hack...
-      if (solid_size != 0) {
-        for (size_t i = 0; i < solid_size; i++) {
-          node_to_gc.get()[i].~Node();
+    }
+    return nodes;
+  }
+
+  // Frees up to kGCChunkNodes nodes of @subtree, and queues what is left.
+  void FreeChunk(Subtree subtree) {
+    std::vector<Subtree> stack;
+    stack.push_back(std::move(subtree));
+    int64_t freed = 0;
+    // The backlog is the sum of the estimates of subtrees still queued. Nodes
+    // of a freed block take their estimate with them, and their children
+    // become subtrees of their own, with their own estimate.
+    int64_t backlog_change = 0;
+    while (!stack.empty() && freed < kGCChunkNodes) {
+      Subtree cur = std::move(stack.back());
+      stack.pop_back();
+      // Moves children and the next block into @stack, so that the block can
+      // be destroyed without recursion.
+      for (int i = 0; i < cur->size(); i++) {
+        Node* node = &cur->nodes()[i];
+        backlog_change -= node->GetN() + 1;
+        if (node->child_) {
+          backlog_change += EstimateNodes(*node->child_);
+          stack.push_back(std::move(node->child_));
         }
-        std::allocator<Node> alloc;
-        alloc.deallocate(node_to_gc.release(), solid_size);
       }
+      if (cur->next_) stack.push_back(std::move(cur->next_));
+      freed += cur->size();
+      cur.reset();
     }
+    backlog_nodes_.fetch_add(backlog_change, std::memory_order_relaxed);
+    if (stack.empty()) return;
+    {
+      Mutex::Lock lock(gc_mutex_);
+      for (auto& rest : stack) subtrees_to_gc_.push_back(std::move(rest));
+    }
+    cv_.notify_all();
   }
 
   void Worker() {
+    LowerCurrentThreadPriority();
     while (!stop_.load()) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(kGCIntervalMs));
-      GarbageCollect();
-    };
+      Subtree subtree;
+      {
+        Mutex::Lock lock(gc_mutex_);
+        if (subtrees_to_gc_.empty()) {
+          // Estimates are not exact, so the backlog is reset when it's known
+          // to be empty.
+          if (busy_threads_ == 0) backlog_nodes_.store(0);
+          cv_.wait_for(lock.get_raw(),
+                       std::chrono::milliseconds(kGCIntervalMs));
+          continue;
+        }
+        subtree = std::move(subtrees_to_gc_.back());
+        subtrees_to_gc_.pop_back();
+        ++busy_threads_;
+      }
+      FreeChunk(std::move(subtree));
+      Mutex::Lock lock(gc_mutex_);
+      --busy_threads_;
+    }
   }
 
   mutable Mutex gc_mutex_;
-  std::vector<std::unique_ptr<Node>> subtrees_to_gc_ GUARDED_BY(gc_mutex_);
-  std::vector<size_t> subtrees_to_gc_solid_size_ GUARDED_BY(gc_mutex_);
+  std::condition_variable cv_;
+  std::vector<Subtree> subtrees_to_gc_ GUARDED_BY(gc_mutex_);
+  // Number of threads which took a subtree from subtrees_to_gc_ and haven't
+  // finished with it yet.
+  int busy_threads_ GUARDED_BY(gc_mutex_) = 0;
+  // Approximate number of nodes queued but not freed yet.
+  std::atomic<int64_t> backlog_nodes_{0};
 
   // When true, Worker() should stop and exit.
   std::atomic<bool> stop_{false};
-  std::thread gc_thread_;
-};  // namespace
+  std::vector<std::thread> gc_threads_;
+};
 
+namespace {
 NodeGarbageCollector gNodeGc;
 }  // namespace
 
+int64_t GetNodeGcBacklog() { return gNodeGc.GetBacklog(); }
+
 /////////////////////////////////////////////////////////////////////////
 // Edge
 /////////////////////////////////////////////////////////////////////////
@@ -187,6 +275,22 @@ std::unique_ptr<Edge[]> Edge::FromMovelist(const MoveList& moves) {
   return edges;
 }
 
+/////////////////////////////////////////////////////////////////////////
+// NodeBlock
+/////////////////////////////////////////////////////////////////////////
+
+NodeBlock::Ptr NodeBlock::Create(Node* parent, int block, int num_edges) {
+  const int first_index = FirstIndexOf(block);
+  const int size = std::min(first_index + 1, num_edges - first_index);
+  assert(size > 0);
+  void* memory = ::operator new(sizeof(NodeBlock) + size * sizeof(Node));
+  Ptr result(new (memory) NodeBlock(size));
+  for (int i = 0; i < size; i++) {
+    new (&result->nodes()[i]) Node(parent, first_index + i);
+  }
+  return result;
+}
+
 /////////////////////////////////////////////////////////////////////////
 // Node
 /////////////////////////////////////////////////////////////////////////
@@ -196,8 +300,19 @@ Node* Node::CreateSingleChildNode(Move move) {
   assert(!child_);
   edges_ = Edge::FromMovelist({move});
   num_edges_ = 1;
-  child_ = std::make_unique<Node>(this, 0);
-  return child_.get();
+  return GetOrSpawnChild(0);
+}
+
+Node* Node::GetOrSpawnChild(uint16_t index) {
+  assert(index < num_edges_);
+  NodeBlock::Ptr* block_ptr = &child_;
+  const int block = NodeBlock::BlockOf(index);
+  for (int i = 0; i < block; i++) {
+    if (!*block_ptr) *block_ptr = NodeBlock::Create(this, i, num_edges_);
+    block_ptr = &(*block_ptr)->next_;
+  }
+  if (!*block_ptr) *block_ptr = NodeBlock::Create(this, block, num_edges_);
+  return &(*block_ptr)->nodes()[index - NodeBlock::FirstIndexOf(block)];
 }
 
 void Node::CreateEdges(const MoveList& moves) {
@@ -207,11 +322,22 @@ void Node::CreateEdges(const MoveList& moves) {
   num_edges_ = moves.size();
 }
 
-Node::ConstIterator Node::Edges() const {
-  return {*this, !solid_children_ ? &child_ : nullptr};
-}
-Node::Iterator Node::Edges() {
-  return {*this, !solid_children_ ? &child_ : nullptr};
+Node::ConstIterator Node::Edges() const { return {*this, &child_}; }
+Node::Iterator Node::Edges() { return {*this, &child_}; }
+
+void Node::MakeSolid() {
+  if (!child_ || child_->children_stats_) return;
+  auto stats = std::make_unique<PuctChildren>();
+  for (const auto& child : Edges()) {
+    const Node* node = child.node();
+    if (node) {
+      stats->Add(node->n_, node->GetNStarted(), node->wl_, node->d_, node->m_,
+                 child.GetP());
+    } else {
+      stats->Add(0, 0, 0.0f, 0.0f, 0.0f, child.GetP());
+    }
+  }
+  child_->children_stats_ = std::move(stats);
 }
 
 float Node::GetVisitedPolicy() const { return visited_policy_; }
@@ -228,61 +354,13 @@ std::string Node::DebugString() const {
   std::ostringstream oss;
   oss << " Term:" << static_cast<int>(terminal_type_) << " This:" << this
       << " Parent:" << parent_ << " Index:" << index_
-      << " Child:" << child_.get() << " Sibling:" << sibling_.get()
-      << " WL:" << wl_ << " N:" << n_ << " N_:" << n_in_flight_
-      << " Edges:" << static_cast<int>(num_edges_)
+      << " Child:" << child_.get() << " WL:" << wl_ << " N:" << n_
+      << " N_:" << n_in_flight_ << " Edges:" << static_cast<int>(num_edges_)
       << " Bounds:" << static_cast<int>(lower_bound_) - 2 << ","
-      << static_cast<int>(upper_bound_) - 2
-      << " Solid:" << solid_children_;
+      << static_cast<int>(upper_bound_) - 2;
   return oss.str();
 }
 
-bool Node::MakeSolid() {
-  if (solid_children_ || num_edges_ == 0 || IsTerminal()) return false;
-  // Can only make solid if no immediate leaf childredn are in flight since we
-  // allow the search code to hold references to leaf nodes across locks.
-  Node* old_child_to_check = child_.get();
-  uint32_t total_in_flight = 0;
-  while (old_child_to_check != nullptr) {
-    if (old_child_to_check->GetN() <= 1 &&
-        old_child_to_check->GetNInFlight() > 0) {
-      return false;
-    }
-    if (old_child_to_check->IsTerminal() &&
-        old_child_to_check->GetNInFlight() > 0) {
-      return false;
-    }
-    total_in_flight += old_child_to_check->GetNInFlight();
-    old_child_to_check = old_child_to_check->sibling_.get();
-  }
-  // If the total of children in flight is not the same as self, then there are
-  // collisions against immediate children (which don't update the GetNInFlight
-  // of the leaf) and its not safe.
-  if (total_in_flight != GetNInFlight()) {
-    return false;
-  }
-  std::allocator<Node> alloc;
-  auto* new_children = alloc.allocate(num_edges_);
-  for (int i = 0; i < num_edges_; i++) {
-    new (&(new_children[i])) Node(this, i);
-  }
-  std::unique_ptr<Node> old_child = std::move(child_);
-  while (old_child) {
-    int index = old_child->index_;
-    new_children[index] = std::move(*old_child.get());
-    // This isn't needed, but it helps crash things faster if something has gone wrong.
-    old_child->parent_ = nullptr;
-    gNodeGc.AddToGcQueue(std::move(old_child));
-    new_children[index].UpdateChildrenParents();
-    old_child = std::move(new_children[index].sibling_);
-  }
-  // This is a hack.
-  child_ = std::unique_ptr<Node>(new_children);
-  best_child_cached_ = nullptr;
-  solid_children_ = true;
-  return true;
-}
-
 void Node::SortEdges() {
   assert(edges_);
   assert(!child_);
@@ -309,6 +387,13 @@ void Node::MakeTerminal(GameResult result, float plies_left, Terminal type) {
     // comparable to another non-loss choice. Force this by clearing the policy.
     if (GetParent() != nullptr) GetOwnEdge()->SetP(0.0f);
   }
+  // Nodes without visits are made terminal when extended, without the lock
+  // that guards the parent's stats. FinalizeScoreUpdate() copies them then.
+  if (n_ > 0) {
+    PuctChildren* stats = GetSolidParentStats();
+    if (stats) stats->SetP(index_, GetOwnEdge()->GetP());
+    UpdateSolidParent();
+  }
 }
 
 void Node::MakeNotTerminal() {
@@ -333,6 +418,7 @@ void Node::MakeNotTerminal() {
     wl_ /= n_;
     d_ /= n_;
   }
+  UpdateSolidParent();
 }
 
 void Node::SetBounds(GameResult lower, GameResult upper) {
@@ -340,15 +426,26 @@ void Node::SetBounds(GameResult lower, GameResult upper) {
   upper_bound_ = upper;
 }
 
+void Node::SetStats(uint32_t n, double wl, float d, float m) {
+  n_ = n;
+  wl_ = wl;
+  d_ = d;
+  m_ = m;
+  best_child_cached_ = nullptr;
+  UpdateSolidParent();
+}
+
 bool Node::TryStartScoreUpdate() {
   if (n_ == 0 && n_in_flight_ > 0) return false;
   ++n_in_flight_;
+  UpdateSolidParentNStarted();
   return true;
 }
 
 void Node::CancelScoreUpdate(int multivisit) {
   n_in_flight_ -= multivisit;
   best_child_cached_ = nullptr;
+  UpdateSolidParentNStarted();
 }
 
 void Node::FinalizeScoreUpdate(float v, float d, float m, int multivisit) {
@@ -359,7 +456,11 @@ void Node::FinalizeScoreUpdate(float v, float d, float m, int multivisit) {
 
   // If first visit, update parent's sum of policies visited at least once.
   if (n_ == 0 && parent_ != nullptr) {
-    parent_->visited_policy_ += parent_->edges_[index_].GetP();
+    const float p = parent_->edges_[index_].GetP();
+    parent_->visited_policy_ += p;
+    // P may have been changed when the node was extended.
+    PuctChildren* stats = GetSolidParentStats();
+    if (stats) stats->SetP(index_, p);
   }
   // Increment N.
   n_ += multivisit;
@@ -367,6 +468,7 @@ void Node::FinalizeScoreUpdate(float v, float d, float m, int multivisit) {
   n_in_flight_ -= multivisit;
   // Best child is potentially no longer valid.
   best_child_cached_ = nullptr;
+  UpdateSolidParent();
 }
 
 void Node::AdjustForTerminal(float v, float d, float m, int multivisit) {
@@ -378,6 +480,7 @@ void Node::AdjustForTerminal(float v, float d, float m, int multivisit) {
   // AdjustForTerminal is always called immediately after FinalizeScoreUpdate,
   // but for safety in case that changes.
   best_child_cached_ = nullptr;
+  UpdateSolidParent();
 }
 
 void Node::RevertTerminalVisits(float v, float d, float m, int multivisit) {
@@ -404,6 +507,29 @@ void Node::RevertTerminalVisits(float v, float d, float m, int multivisit) {
   }
   // Best child is potentially no longer valid.
   best_child_cached_ = nullptr;
+  UpdateSolidParent();
+}
+
+void Node::RecomputeWL() {
+  if (IsTerminal()) return;
+  double children_wl = 0.0;
+  uint32_t children_n = 0;
+  for (const auto& child : Edges()) {
+    const auto n = child.GetN();
+    if (n == 0) continue;
+    children_n += n;
+    // Flip WL for opponent.
+    children_wl -= static_cast<double>(child.GetWL(0.0f)) * n;
+  }
+  if (children_n == 0 || children_n > n_) return;
+  const uint32_t rest_n = n_ - children_n;
+  const double rest_wl =
+      rest_n == 0 ? 0.0
+                  : std::clamp(
+                        (static_cast<double>(wl_) * n_ - children_wl) / rest_n,
+                        -1.0, 1.0);
+  wl_ = (children_wl + rest_wl * rest_n) / n_;
+  UpdateSolidParent();
 }
 
 void Node::UpdateBestChild(const Iterator& best_edge, int visits_allowed) {
@@ -417,57 +543,29 @@ void Node::UpdateBestChild(const Iterator& best_edge, int visits_allowed) {
 }
 
 void Node::UpdateChildrenParents() {
-  if (!solid_children_) {
-    Node* cur_child = child_.get();
-    while (cur_child != nullptr) {
-      cur_child->parent_ = this;
-      cur_child = cur_child->sibling_.get();
-    }
-  } else {
-    Node* child_array = child_.get();
-    for (int i = 0; i < num_edges_; i++) {
-      child_array[i].parent_ = this;
-    }
+  for (NodeBlock* block = child_.get(); block; block = block->next_.get()) {
+    for (int i = 0; i < block->size(); i++) block->nodes()[i].parent_ = this;
   }
 }
 
-void Node::ReleaseChildren() {
-  gNodeGc.AddToGcQueue(std::move(child_), solid_children_ ? num_edges_ : 0);
-}
-
-void Node::ReleaseChildrenExceptOne(Node* node_to_save) {
-  if (solid_children_) {
-    auto new_child = std::make_unique<Node>(this, node_to_save->index_);
-    *new_child = std::move(*node_to_save);
-    gNodeGc.AddToGcQueue(std::move(child_), num_edges_);
-    child_ = std::move(new_child);
-    if (child_) {
-      child_->UpdateChildrenParents();
-    }
-    solid_children_ = false;
-  } else {
-    // Stores node which will have to survive (or nullptr if it's not found).
-    std::unique_ptr<Node> saved_node;
-    // Pointer to unique_ptr, so that we could move from it.
-    for (std::unique_ptr<Node>* node = &child_; *node;
-         node = &(*node)->sibling_) {
-      // If current node is the one that we have to save.
-      if (node->get() == node_to_save) {
-        // Kill all remaining siblings.
-        gNodeGc.AddToGcQueue(std::move((*node)->sibling_));
-        // Save the node, and take the ownership from the unique_ptr.
-        saved_node = std::move(*node);
-        break;
-      }
-    }
-    // Make saved node the only child. (kills previous siblings).
-    gNodeGc.AddToGcQueue(std::move(child_));
-    child_ = std::move(saved_node);
+void Node::ReleaseChildren() { gNodeGc.AddToGcQueue(std::move(child_)); }
+
+Node* Node::ReleaseChildrenExceptOne(Node* node_to_save) {
+  auto old_children = std::move(child_);
+  Node* saved_node = nullptr;
+  if (node_to_save) {
+    // The node is moved into new blocks, so that the old ones with all other
+    // children can be released.
+    saved_node = GetOrSpawnChild(node_to_save->index_);
+    *saved_node = std::move(*node_to_save);
+    saved_node->UpdateChildrenParents();
   }
-  if (!child_) {
+  gNodeGc.AddToGcQueue(std::move(old_children));
+  if (!saved_node) {
     num_edges_ = 0;
     edges_.reset();  // Clear edges list.
   }
+  return saved_node;
 }
 
 V5TrainingData Node::GetV5TrainingData(
@@ -578,6 +676,210 @@ std::string EdgeAndNode::DebugString() const {
          (node_ ? node_->DebugString() : "(no node)");
 }
 
+/////////////////////////////////////////////////////////////////////////
+// Tree file
+/////////////////////////////////////////////////////////////////////////
+
+namespace {
+// Tree file layout: TreeFileHeader, then the nodes in preorder. Every node is
+// a TreeFileNode followed by num_edges TreeFileEdges and then by the subtrees
+// of its num_children visited children, in edge order. The file is read
+// through a memory mapping, with no alignment requirements.
+const char kTreeFileMagic[8] = {'L', 'c', '0', 'T', 'r', 'e', 'e', '\0'};
+const uint32_t kTreeFileVersion = 1;
+
+struct TreeFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t position_hash;
+  uint64_t network_hash;
+  uint64_t num_nodes;
+};
+
+struct TreeFileNode {
+  double wl;
+  float d;
+  float m;
+  uint32_t n;
+  // Index of the node in the parent's edges.
+  uint16_t index;
+  uint8_t num_edges;
+  uint8_t num_children;
+  uint8_t terminal_type;
+  uint8_t lower_bound;
+  uint8_t upper_bound;
+  uint8_t reserved[5];
+};
+
+struct TreeFileEdge {
+  uint16_t move;
+  uint16_t p;
+};
+
+static_assert(sizeof(TreeFileHeader) == 40, "Unexpected TreeFileHeader size");
+static_assert(sizeof(TreeFileNode) == 32, "Unexpected TreeFileNode size");
+static_assert(sizeof(TreeFileEdge) == 4, "Unexpected TreeFileEdge size");
+
+uint64_t HeadPositionHash(const PositionHistory& history) {
+  const auto& position = history.Last();
+  return HashCat({position.Hash(),
+                  static_cast<uint64_t>(position.GetRule50Ply())});
+}
+}  // namespace
+
+class NodeTreeFile {
+ public:
+  // Visits (and their WL and D sums) of the pruned subtrees, from the point of
+  // view of the node they are pruned from.
+  struct Pruned {
+    uint32_t n = 0;
+    double wl = 0.0;
+    double d = 0.0;
+  };
+
+  NodeTreeFile(const char* data, const char* end, uint32_t min_visits)
+      : data_(data), end_(end), min_visits_(min_visits) {}
+
+  static uint64_t WriteNode(const Node& node, std::ostream* output) {
+    TreeFileNode record{};
+    record.wl = node.wl_;
+    record.d = node.d_;
+    record.m = node.m_;
+    record.n = node.n_;
+    record.index = node.index_;
+    record.num_edges = node.num_edges_;
+    record.terminal_type = static_cast<uint8_t>(node.terminal_type_);
+    record.lower_bound = static_cast<uint8_t>(node.lower_bound_);
+    record.upper_bound = static_cast<uint8_t>(node.upper_bound_);
+    for (const auto& child : node.Edges()) {
+      if (child.GetN() > 0) ++record.num_children;
+    }
+    output->write(reinterpret_cast<const char*>(&record), sizeof(record));
+    for (int i = 0; i < node.num_edges_; i++) {
+      const Edge& edge = node.edges_[i];
+      const Move move = edge.move_;
+      const TreeFileEdge edge_record{
+          static_cast<uint16_t>(move.to().as_int() |
+                                (move.from().as_int() << 6) |
+                                (static_cast<int>(move.promotion()) << 12)),
+          edge.p_};
+      output->write(reinterpret_cast<const char*>(&edge_record),
+                    sizeof(edge_record));
+    }
+    uint64_t written = 1;
+    for (const auto& child : node.Edges()) {
+      if (child.GetN() > 0) written += WriteNode(*child.node(), output);
+    }
+    return written;
+  }
+
+  // Fills @node (which must have no edges) from the file, and returns what
+  // was pruned under it.
+  Pruned ReadNode(Node* node) {
+    const TreeFileNode record = ReadRecord();
+    node->wl_ = record.wl;
+    node->d_ = record.d;
+    node->m_ = record.m;
+    node->n_ = record.n;
+    node->terminal_type_ = static_cast<Node::Terminal>(record.terminal_type);
+    node->lower_bound_ = static_cast<GameResult>(record.lower_bound);
+    node->upper_bound_ = static_cast<GameResult>(record.upper_bound);
+    if (record.num_edges > 0) {
+      node->edges_ = std::make_unique<Edge[]>(record.num_edges);
+      node->num_edges_ = record.num_edges;
+      for (int i = 0; i < record.num_edges; i++) {
+        TreeFileEdge edge_record;
+        Read(&edge_record, sizeof(edge_record));
+        Edge& edge = node->edges_[i];
+        edge.move_ = Move(BoardSquare((edge_record.move >> 6) & 63),
+                          BoardSquare(edge_record.move & 63),
+                          Move::Promotion((edge_record.move >> 12) & 7));
+        edge.p_ = edge_record.p;
+      }
+    }
+    ++loaded_;
+
+    Pruned pruned;
+    int min_index = 0;
+    for (int i = 0; i < record.num_children; i++) {
+      const TreeFileNode child = PeekRecord();
+      if (child.index < min_index || child.index >= record.num_edges) {
+        throw Exception("Invalid tree file");
+      }
+      min_index = child.index + 1;
+      if (child.n < min_visits_) {
+        SkipNode();
+        pruned.n += child.n;
+        pruned.wl -= child.wl * child.n;
+        pruned.d += child.d * child.n;
+        continue;
+      }
+      const Pruned child_pruned =
+          ReadNode(node->GetOrSpawnChild(child.index));
+      node->visited_policy_ += node->edges_[child.index].GetP();
+      pruned.n += child_pruned.n;
+      pruned.wl -= child_pruned.wl;
+      pruned.d += child_pruned.d;
+    }
+    // Visits of terminal nodes don't come from their children.
+    if (node->IsTerminal()) return {};
+    if (pruned.n > 0 && pruned.n < node->n_) {
+      const uint32_t n = node->n_ - pruned.n;
+      node->wl_ = (node->wl_ * node->n_ - pruned.wl) / n;
+      node->d_ = static_cast<float>((node->d_ * node->n_ - pruned.d) / n);
+      node->n_ = n;
+    }
+    return pruned;
+  }
+
+  bool AtEnd() const { return data_ == end_; }
+  uint64_t GetLoaded() const { return loaded_; }
+
+ private:
+  void Read(void* dest, size_t size) {
+    if (static_cast<size_t>(end_ - data_) < size) {
+      throw Exception("Invalid tree file");
+    }
+    std::memcpy(dest, data_, size);
+    data_ += size;
+  }
+
+  TreeFileNode ReadRecord() {
+    TreeFileNode record;
+    Read(&record, sizeof(record));
+    if (record.terminal_type > static_cast<uint8_t>(Node::Terminal::TwoFold) ||
+        record.lower_bound > static_cast<uint8_t>(GameResult::WHITE_WON) ||
+        record.upper_bound > static_cast<uint8_t>(GameResult::WHITE_WON) ||
+        record.num_children > record.num_edges) {
+      throw Exception("Invalid tree file");
+    }
+    return record;
+  }
+
+  TreeFileNode PeekRecord() {
+    const char* data = data_;
+    const TreeFileNode record = ReadRecord();
+    data_ = data;
+    return record;
+  }
+
+  void SkipNode() {
+    const TreeFileNode record = ReadRecord();
+    if (static_cast<size_t>(end_ - data_) <
+        record.num_edges * sizeof(TreeFileEdge)) {
+      throw Exception("Invalid tree file");
+    }
+    data_ += record.num_edges * sizeof(TreeFileEdge);
+    for (int i = 0; i < record.num_children; i++) SkipNode();
+  }
+
+  const char* data_;
+  const char* const end_;
+  const uint32_t min_visits_;
+  uint64_t loaded_ = 0;
+};
+
 /////////////////////////////////////////////////////////////////////////
 // NodeTree
 /////////////////////////////////////////////////////////////////////////
@@ -597,21 +899,16 @@ void NodeTree::MakeMove(Move move) {
     }
   }
   move = board.GetModernMove(move);
-  current_head_->ReleaseChildrenExceptOne(new_head);
-  new_head = current_head_->child_.get();
+  new_head = current_head_->ReleaseChildrenExceptOne(new_head);
   current_head_ =
       new_head ? new_head : current_head_->CreateSingleChildNode(move);
   history_.Append(move);
 }
 
 void NodeTree::TrimTreeAtHead() {
-  // If solid, this will be empty before move and will be moved back empty
-  // afterwards which is fine.
-  auto tmp = std::move(current_head_->sibling_);
   // Send dependent nodes for GC instead of destroying them immediately.
   current_head_->ReleaseChildren();
   *current_head_ = Node(current_head_->GetParent(), current_head_->index_);
-  current_head_->sibling_ = std::move(tmp);
 }
 
 bool NodeTree::ResetToPosition(const std::string& starting_fen,
@@ -652,11 +949,64 @@ bool NodeTree::ResetToPosition(const std::string& starting_fen,
 }
 
 void NodeTree::DeallocateTree() {
-  // Same as gamebegin_node_.reset(), but actual deallocation will happen in
-  // GC thread.
-  gNodeGc.AddToGcQueue(std::move(gamebegin_node_));
+  // Same as gamebegin_node_.reset(), but actual deallocation of the children
+  // will happen in GC thread.
+  if (gamebegin_node_) gamebegin_node_->ReleaseChildren();
   gamebegin_node_ = nullptr;
   current_head_ = nullptr;
 }
 
+uint64_t NodeTree::SaveHeadSubtree(const std::string& filename,
+                                   uint64_t network_hash) const {
+  // The previous file is only replaced once the new one is complete.
+  const std::string tmp_filename = filename + ".tmp";
+  std::ofstream output(tmp_filename, std::ios::trunc | std::ios_base::binary);
+  if (!output) throw Exception("Cannot write tree file: " + tmp_filename);
+  TreeFileHeader header{};
+  std::memcpy(header.magic, kTreeFileMagic, sizeof(kTreeFileMagic));
+  header.version = kTreeFileVersion;
+  header.position_hash = HeadPositionHash(history_);
+  header.network_hash = network_hash;
+  // The number of nodes is known only at the end.
+  output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  header.num_nodes = NodeTreeFile::WriteNode(*current_head_, &output);
+  output.seekp(0);
+  output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  output.close();
+  if (!output) throw Exception("Cannot write tree file: " + tmp_filename);
+  RenameFile(tmp_filename, filename);
+  return header.num_nodes;
+}
+
+uint64_t NodeTree::LoadHeadSubtree(const std::string& filename,
+                                   uint64_t network_hash,
+                                   uint32_t min_visits) {
+  if (GetFileSize(filename) < sizeof(TreeFileHeader)) return 0;
+  MappedFile file(filename);
+  TreeFileHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, kTreeFileMagic, sizeof(kTreeFileMagic)) != 0 ||
+      header.version != kTreeFileVersion) {
+    throw Exception("Invalid tree file: " + filename);
+  }
+  if (header.position_hash != HeadPositionHash(history_) ||
+      header.network_hash != network_hash) {
+    return 0;
+  }
+
+  TrimTreeAtHead();
+  NodeTreeFile reader(file.data() + sizeof(header), file.data() + file.size(),
+                      std::max(min_visits, 1u));
+  try {
+    reader.ReadNode(current_head_);
+    if (!reader.AtEnd()) throw Exception("Invalid tree file");
+  } catch (Exception&) {
+    TrimTreeAtHead();
+    throw Exception("Invalid tree file: " + filename);
+  }
+  // As in MakeMove(), the head must not be terminal for search to extend it.
+  if (current_head_->IsTerminal()) current_head_->MakeNotTerminal();
+  return reader.GetLoaded();
+}
+
 }  // namespace lczero
@@ -36,6 +36,7 @@
 #include "chess/board.h"
 #include "chess/callbacks.h"
 #include "chess/position.h"
+#include "mcts/puct.h"
 #include "neural/encoder.h"
 #include "neural/writer.h"
 #include "proto/net.pb.h"
@@ -47,12 +48,22 @@ namespace lczero {
 // * Edges and Nodes edges point to are stored separately.
 // * There may be dangling edges (which don't yet point to any Node object yet)
 // * Edges are stored are a simple array on heap.
-// * Nodes are stored as a linked list, and contain index_ field which shows
-//   which edge of a parent that node points to.
-//   Or they are stored a contiguous array of Node objects on the heap if
-//   solid_children_ is true. If the children have been 'solidified' their
-//   sibling links are unused and left empty. In this state there are no
-//   dangling edges, but the nodes may not have ever received any visits.
+// * Nodes are stored in contiguous blocks (NodeBlock) of 1, 2, 4, 8, ... nodes,
+//   the block number b holding the nodes of edges [2^b - 1, 2^(b+1) - 1)
+//   (the last one is truncated to the number of edges). Blocks form a linked
+//   list and are allocated when a node in them is first needed, together with
+//   all the preceding blocks which are not allocated yet. Nodes in allocated
+//   blocks which have never been visited have N=0, and behave as if their
+//   edges were dangling.
+// * Nodes never move, so pointers to them are valid until the children of
+//   their parent are released.
+// * Solid nodes (the ones with many visits, see Node::MakeSolid()) also keep a
+//   copy of the stats of all their children in arrays (PuctChildren) in their
+//   first block, which the children update, so that node selection reads them
+//   without walking the nodes.
+//
+// As edges are sorted by policy, and search visits unvisited edges in that
+// order, usually at least a half of allocated nodes get visited.
 //
 // Example:
 //                                Parent Node
@@ -60,8 +71,8 @@ namespace lczero {
 //        +-------------+-------------+----------------+--------------+
 //        |              |            |                |              |
 //   Edge 0(Nf3)    Edge 1(Bc5)     Edge 2(a4)     Edge 3(Qxf7)    Edge 4(a3)
-//    (dangling)         |           (dangling)        |           (dangling)
-//                   Node, Q=0.5                    Node, Q=-0.2
+//        |              |            |            (dangling)      (dangling)
+//   Node, Q=0.5    Node, Q=-0.2   Node, N=0
 //
 //  Is represented as:
 // +--------------+
@@ -69,18 +80,23 @@ namespace lczero {
 // +--------------+                                        +--------+
 // | edges_       | -------------------------------------> | Edge[] |
 // |              |    +------------+                      +--------+
-// | child_       | -> | Node       |                      | Nf3    |
+// | child_       | -> | NodeBlock  |                      | Nf3    |
 // +--------------+    +------------+                      | Bc5    |
-//                     | index_ = 1 |                      | a4     |
+//                     | index_ = 0 |                      | a4     |
 //                     | q_ = 0.5   |    +------------+    | Qxf7   |
-//                     | sibling_   | -> | Node       |    | a3     |
-//                     +------------+    +------------+    +--------+
-//                                       | index_ = 3 |
+//                     +------------+    | NodeBlock  |    | a3     |
+//                     | next_      | -> +------------+    +--------+
+//                     +------------+    | index_ = 1 |
 //                                       | q_ = -0.2  |
-//                                       | sibling_   | -> nullptr
+//                                       +------------+
+//                                       | index_ = 2 |
+//                                       | n_ = 0     |
+//                                       +------------+
+//                                       | next_      | -> nullptr
 //                                       +------------+
 
 class Node;
+
 class Edge {
  public:
   // Creates array of edges from the list of moves.
@@ -108,12 +124,54 @@ class Edge {
   // network; compressed to a 16 bit format (5 bits exp, 11 bits significand).
   uint16_t p_ = 0;
   friend class Node;
+  friend class NodeTreeFile;
 };
 
 class EdgeAndNode;
 template <bool is_const>
 class Edge_Iterator;
 
+// Contiguous block of child nodes, see above. The nodes are allocated in the
+// same piece of memory, right after the NodeBlock object.
+class NodeBlock {
+ public:
+  struct Deleter {
+    void operator()(NodeBlock* block) const;
+  };
+  using Ptr = std::unique_ptr<NodeBlock, Deleter>;
+
+  // Returns the number of the block which holds the node of edge @index.
+  static int BlockOf(int index) {
+    int block = 0;
+    while (index >= (2 << block) - 1) ++block;
+    return block;
+  }
+  // Returns the index of the first edge of the block number @block.
+  static int FirstIndexOf(int block) { return (1 << block) - 1; }
+
+  // Allocates the block number @block, truncated to @num_edges edges, with
+  // nodes of @parent.
+  static Ptr Create(Node* parent, int block, int num_edges);
+
+  Node* nodes() { return reinterpret_cast<Node*>(this + 1); }
+  const Node* nodes() const { return reinterpret_cast<const Node*>(this + 1); }
+  int size() const { return size_; }
+
+ private:
+  explicit NodeBlock(uint16_t size) : size_(size) {}
+
+  // Next block, or nullptr if it's not allocated.
+  Ptr next_;
+  // Stats of all children of a solid parent, only kept by its first block.
+  std::unique_ptr<PuctChildren> children_stats_;
+  uint16_t size_;
+
+  friend class Node;
+  friend class NodeGarbageCollector;
+  friend class Edge_Iterator<true>;
+  friend class Edge_Iterator<false>;
+};
+
 class Node {
  public:
   using Iterator = Edge_Iterator<false>;
@@ -127,8 +185,7 @@ class Node {
         index_(index),
         terminal_type_(Terminal::NonTerminal),
         lower_bound_(GameResult::BLACK_WON),
-        upper_bound_(GameResult::WHITE_WON),
-        solid_children_(false) {}
+        upper_bound_(GameResult::WHITE_WON) {}
 
   // We have a custom destructor, but its behavior does not need to be emulated
   // during move operations so default is fine.
@@ -162,6 +219,14 @@ class Node {
   float GetD() const { return d_; }
   float GetM() const { return m_; }
 
+  // Makes the node solid: from then on, its children also keep their stats in
+  // the PuctChildren returned by GetSolidChildren(). Needs a spawned child.
+  void MakeSolid();
+  // Returns stats of the children, or nullptr if the node is not solid.
+  const PuctChildren* GetSolidChildren() const {
+    return child_ ? child_->children_stats_.get() : nullptr;
+  }
+
   // Returns whether the node is known to be draw/lose/win.
   bool IsTerminal() const { return terminal_type_ != Terminal::NonTerminal; }
   bool IsTbTerminal() const { return terminal_type_ == Terminal::Tablebase; }
@@ -176,6 +241,9 @@ class Node {
   // Makes the node not terminal and updates its visits.
   void MakeNotTerminal();
   void SetBounds(GameResult lower, GameResult upper);
+  // Replaces visits and evals of the node, leaving its children as they are.
+  // Used to show stats of root moves searched by other processes.
+  void SetStats(uint32_t n, double wl, float d, float m);
 
   // If this node is not in the process of being expanded by another thread
   // (which can happen only if n==0 and n-in-flight==1), mark the node as
@@ -194,10 +262,18 @@ class Node {
   void AdjustForTerminal(float v, float d, float m, int multivisit);
   // Revert visits to a node which ended in a now reverted terminal.
   void RevertTerminalVisits(float v, float d, float m, int multivisit);
+  // Recomputes WL from the WL and N of the children, which undoes rounding
+  // errors accumulated by running averages of a node with many visits. Visits
+  // not coming from the children (e.g. the node's own eval) keep their total
+  // value, clamped to the range of values.
+  void RecomputeWL();
   // When search decides to treat one visit as several (in case of collisions
   // or visiting terminal nodes several times), it amplifies the visit by
   // incrementing n_in_flight.
-  void IncrementNInFlight(int multivisit) { n_in_flight_ += multivisit; }
+  void IncrementNInFlight(int multivisit) {
+    n_in_flight_ += multivisit;
+    UpdateSolidParentNStarted();
+  }
 
   // Updates max depth, if new depth is larger.
   void UpdateMaxDepth(int depth);
@@ -232,14 +308,16 @@ class Node {
   // Returns range for iterating over edges.
   ConstIterator Edges() const;
   Iterator Edges();
+  // Returns iterator pointing to the edge @index.
+  Iterator GetEdgeAt(uint16_t index);
 
   // Deletes all children.
   void ReleaseChildren();
 
   // Deletes all children except one.
   // The node provided may be moved, so should not be relied upon to exist
-  // afterwards.
-  void ReleaseChildrenExceptOne(Node* node);
+  // afterwards. Returns the new location of the node.
+  Node* ReleaseChildrenExceptOne(Node* node);
 
   // For a child node, returns corresponding edge.
   Edge* GetEdgeToNode(const Node* node) const;
@@ -250,63 +328,64 @@ class Node {
   // Debug information about the node.
   std::string DebugString() const;
 
-  // Reallocates this nodes children to be in a solid block, if possible and not
-  // already done. Returns true if the transformation was performed.
-  bool MakeSolid();
-
   void SortEdges();
 
-  ~Node() {
-    if (solid_children_ && child_) {
-      // As a hack, solid_children is actually storing an array in here, release
-      // so we can correctly invoke the array delete.
-      for (int i = 0; i < num_edges_; i++) {
-        child_.get()[i].~Node();
-      }
-      std::allocator<Node> alloc;
-      alloc.deallocate(child_.release(), num_edges_);
-    }
-  }
-
  private:
-  // Performs construction time type initialization. For use only with a node
-  // that has not been used beyond its construction.
-  void Reinit(Node* parent, uint16_t index) {
-    parent_ = parent;
-    index_ = index;
-  }
+  // Returns the node of the edge @index, allocating the blocks up to the one
+  // holding it if needed.
+  Node* GetOrSpawnChild(uint16_t index);
 
   // For each child, ensures that its parent pointer is pointing to this.
   void UpdateChildrenParents();
 
+  // Returns the PuctChildren of the parent, or nullptr if it is not solid.
+  PuctChildren* GetSolidParentStats() const {
+    if (!parent_ || !parent_->child_) return nullptr;
+    return parent_->child_->children_stats_.get();
+  }
+  // Copies the stats of the node to its parent's PuctChildren, if the parent
+  // is solid. Has to be called whenever N, N-in-flight, WL, D or M change.
+  void UpdateSolidParent() {
+    PuctChildren* stats = GetSolidParentStats();
+    if (stats) stats->Set(index_, n_, n_ + n_in_flight_, wl_, d_, m_);
+  }
+  // Same, when only N-in-flight changed.
+  void UpdateSolidParentNStarted() {
+    PuctChildren* stats = GetSolidParentStats();
+    if (stats) stats->SetNStarted(index_, n_ + n_in_flight_);
+  }
+
   // To minimize the number of padding bytes and to avoid having unnecessary
   // padding when new fields are added, we arrange the fields by size, largest
   // to smallest.
 
   // 8 byte fields.
+#if !defined(USE_COMPACT_STATS)
   // Average value (from value head of neural network) of all visited nodes in
   // subtree. For terminal nodes, eval is stored. This is from the perspective
   // of the player who "just" moved to reach this position, rather than from the
   // perspective of the player-to-move for the position.
   // WL stands for "W minus L". Is equal to Q if draw score is 0.
   double wl_ = 0.0f;
+#endif
 
   // 8 byte fields on 64-bit platforms, 4 byte on 32-bit.
   // Array of edges.
   std::unique_ptr<Edge[]> edges_;
   // Pointer to a parent node. nullptr for the root.
   Node* parent_ = nullptr;
-  // Pointer to a first child. nullptr for a leaf node.
-  // As a 'hack' actually a unique_ptr to Node[] if solid_children.
-  std::unique_ptr<Node> child_;
-  // Pointer to a next sibling. nullptr if there are no further siblings.
-  // Also null in the solid case.
-  std::unique_ptr<Node> sibling_;
+  // Pointer to the first block of children. nullptr for a leaf node.
+  NodeBlock::Ptr child_;
   // Cached pointer to best child, valid while n_in_flight <
   // best_child_cache_in_flight_limit_
   Node* best_child_cached_ = nullptr;
 
   // 4 byte fields.
+#if defined(USE_COMPACT_STATS)
+  // Same as the double wl_ of other builds, with its precision traded for
+  // memory.
+  float wl_ = 0.0f;
+#endif
   // Averaged draw probability. Works similarly to WL, except that D is not
   // flipped depending on the side to move.
   float d_ = 0.0f;
@@ -338,11 +417,11 @@ class Node {
   // Best and worst result for this node.
   GameResult lower_bound_ : 2;
   GameResult upper_bound_ : 2;
-  // Whether the child_ is actually an array of equal length to edges.
-  bool solid_children_ : 1;
 
   // TODO(mooskagh) Unfriend NodeTree.
   friend class NodeTree;
+  friend class NodeGarbageCollector;
+  friend class NodeTreeFile;
   friend class Edge_Iterator<true>;
   friend class Edge_Iterator<false>;
   friend class Edge;
@@ -358,10 +437,25 @@ class Node {
 
 // A basic sanity check. This must be adjusted when Node members are adjusted.
 #if defined(__i386__) || (defined(__arm__) && !defined(__aarch64__))
-static_assert(sizeof(Node) == 56, "Unexpected size of Node for 32bit compile");
+#if defined(USE_COMPACT_STATS)
+static_assert(sizeof(Node) == 48, "Unexpected size of Node for 32bit compile");
+#else
+// 52, or 56 where doubles are 8 byte aligned.
+static_assert(sizeof(Node) <= 56, "Unexpected size of Node for 32bit compile");
+#endif
+#elif defined(USE_COMPACT_STATS)
+static_assert(sizeof(Node) == 64, "Unexpected size of Node");
 #else
-static_assert(sizeof(Node) == 80, "Unexpected size of Node");
+static_assert(sizeof(Node) == 72, "Unexpected size of Node");
 #endif
+static_assert(sizeof(NodeBlock) % alignof(Node) == 0,
+              "Nodes after NodeBlock are misaligned");
+
+inline void NodeBlock::Deleter::operator()(NodeBlock* block) const {
+  for (int i = 0; i < block->size_; ++i) block->nodes()[i].~Node();
+  block->~NodeBlock();
+  ::operator delete(block);
+}
 
 // Contains Edge and Node pair and set of proxy functions to simplify access
 // to them.
@@ -455,26 +549,30 @@ class EdgeAndNode {
 // All functions are not thread safe (must be externally synchronized), but
 // it's fine if GetOrSpawnNode is called between calls to functions of the
 // iterator (e.g. advancing the iterator). Other functions that manipulate
-// child_ of parent or the sibling chain are not safe to call while iterating.
+// child_ of parent are not safe to call while iterating.
 template <bool is_const>
 class Edge_Iterator : public EdgeAndNode {
  public:
-  using Ptr = std::conditional_t<is_const, const std::unique_ptr<Node>*,
-                                 std::unique_ptr<Node>*>;
+  using Ptr = std::conditional_t<is_const, const NodeBlock::Ptr*,
+                                 NodeBlock::Ptr*>;
 
   // Creates "end()" iterator.
   Edge_Iterator() {}
 
   // Creates "begin()" iterator. Also happens to be a range constructor.
-  // child_ptr will be nullptr if parent_node is solid children.
   Edge_Iterator(const Node& parent_node, Ptr child_ptr)
       : EdgeAndNode(parent_node.edges_.get(), nullptr),
-        node_ptr_(child_ptr),
+        block_ptr_(child_ptr),
         total_count_(parent_node.num_edges_) {
-    if (edge_ && child_ptr != nullptr) Actualize();
-    if (edge_ && child_ptr == nullptr) {
-      node_ = parent_node.child_.get();
-    }
+    if (edge_) Actualize();
+  }
+
+  // Creates iterator pointing to the edge @index.
+  Edge_Iterator(const Node& parent_node, Ptr child_ptr, uint16_t index)
+      : Edge_Iterator(parent_node, child_ptr) {
+    edge_ += index;
+    current_idx_ = index;
+    Actualize();
   }
 
   // Function to support range interface.
@@ -489,80 +587,62 @@ class Edge_Iterator : public EdgeAndNode {
       edge_ = nullptr;
     } else {
       ++edge_;
-      if (node_ptr_ != nullptr) {
-        Actualize();
-      } else {
+      if (node_ && current_idx_ < block_end_) {
         ++node_;
+      } else {
+        Actualize();
       }
     }
   }
   Edge_Iterator& operator*() { return *this; }
 
   // If there is node, return it. Otherwise spawn a new one and return it.
-  Node* GetOrSpawnNode(Node* parent,
-                       std::unique_ptr<Node>* node_source = nullptr) {
+  Node* GetOrSpawnNode(Node* parent) {
     if (node_) return node_;  // If there is already a node, return it.
-    // Should never reach here in solid mode.
-    assert(node_ptr_ != nullptr);
     Actualize();              // But maybe other thread already did that.
     if (node_) return node_;  // If it did, return.
-    // Now we are sure we have to create a new node.
-    // Suppose there are nodes with idx 3 and 7, and we want to insert one with
-    // idx 5. Here is how it looks like:
-    //    node_ptr_ -> &Node(idx_.3).sibling_  ->  Node(idx_.7)
-    // Here is how we do that:
-    // 1. Store pointer to a node idx_.7:
-    //    node_ptr_ -> &Node(idx_.3).sibling_  ->  nullptr
-    //    tmp -> Node(idx_.7)
-    std::unique_ptr<Node> tmp = std::move(*node_ptr_);
-    // 2. Create fresh Node(idx_.5):
-    //    node_ptr_ -> &Node(idx_.3).sibling_  ->  Node(idx_.5)
-    //    tmp -> Node(idx_.7)
-    if (node_source && *node_source) {
-      (*node_source)->Reinit(parent, current_idx_);
-      *node_ptr_ = std::move(*node_source);
-    } else {
-      *node_ptr_ = std::make_unique<Node>(parent, current_idx_);
-    }
-    // 3. Attach stored pointer back to a list:
-    //    node_ptr_ ->
-    //         &Node(idx_.3).sibling_ -> Node(idx_.5).sibling_ -> Node(idx_.7)
-    (*node_ptr_)->sibling_ = std::move(tmp);
-    // 4. Actualize:
-    //    node_ -> &Node(idx_.5)
-    //    node_ptr_ -> &Node(idx_.5).sibling_ -> Node(idx_.7)
+    node_ = parent->GetOrSpawnChild(current_idx_);
     Actualize();
     return node_;
   }
 
  private:
   void Actualize() {
-    // This must never be called in solid mode.
-    assert(node_ptr_ != nullptr);
-    // If node_ptr_ is behind, advance it.
+    // If block_ptr_ is behind, advance it.
     // This is needed (and has to be 'while' rather than 'if') as other threads
-    // could spawn new nodes between &node_ptr_ and *node_ptr_ while we didn't
-    // see.
-    while (*node_ptr_ && (*node_ptr_)->index_ < current_idx_) {
-      node_ptr_ = &(*node_ptr_)->sibling_;
+    // could allocate new blocks after *block_ptr_ while we didn't see.
+    while (*block_ptr_ && current_idx_ >= block_end_) {
+      block_ptr_ = &(*block_ptr_)->next_;
+      block_begin_ = block_end_;
+      block_end_ = 2 * block_end_ + 1;
     }
-    // If in the end node_ptr_ points to the node that we need, populate node_
-    // and advance node_ptr_.
-    if (*node_ptr_ && (*node_ptr_)->index_ == current_idx_) {
-      node_ = (*node_ptr_).get();
-      node_ptr_ = &node_->sibling_;
+    if (*block_ptr_ && current_idx_ < block_end_) {
+      node_ = (*block_ptr_)->nodes() + (current_idx_ - block_begin_);
     } else {
       node_ = nullptr;
     }
   }
 
-  // Pointer to a pointer to the next node. Has to be a pointer to pointer
-  // as we'd like to update it when spawning a new node.
-  Ptr node_ptr_;
+  // Pointer to a pointer to the block of the current node (or the first block
+  // which is not allocated yet). Has to be a pointer to pointer as we'd like to
+  // see blocks allocated later.
+  Ptr block_ptr_;
+  // Range of edge indices of the block pointed by block_ptr_.
+  uint16_t block_begin_ = 0;
+  uint16_t block_end_ = 1;
   uint16_t current_idx_ = 0;
   uint16_t total_count_ = 0;
 };
 
+inline Node::Iterator Node::GetEdgeAt(uint16_t index) {
+  assert(index < num_edges_);
+  return {*this, &child_, index};
+}
+
+// Returns approximate number of released nodes which the garbage collector
+// hasn't freed yet.
+int64_t GetNodeGcBacklog();
+
 class NodeTree {
  public:
   ~NodeTree() { DeallocateTree(); }
@@ -586,6 +666,18 @@ class NodeTree {
   Node* GetGameBeginNode() const { return gamebegin_node_.get(); }
   const PositionHistory& GetPositionHistory() const { return history_; }
 
+  // Writes the subtree under the current head to @filename, together with the
+  // head position and @network_hash to check them against when loading.
+  // Nodes without visits are not written. Returns the number of nodes written.
+  uint64_t SaveHeadSubtree(const std::string& filename,
+                           uint64_t network_hash) const;
+  // Replaces the subtree under the current head with the one from @filename,
+  // if it was written for the same head position and network. Subtrees of
+  // nodes with less than @min_visits visits are not loaded, and their visits
+  // are subtracted from the ancestors. Returns the number of nodes loaded.
+  uint64_t LoadHeadSubtree(const std::string& filename, uint64_t network_hash,
+                           uint32_t min_visits = 1);
+
  private:
   void DeallocateTree();
   // A node which to start search from.
@@ -0,0 +1,295 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "mcts/node.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+namespace lczero {
+
+namespace {
+const char kFilename[] = "tree_test.bin";
+
+// Backs up a visit with value @v of the last node of @path, like search does.
+void Backup(const std::vector<Node*>& path, float v, float d) {
+  for (auto it = path.rbegin(); it != path.rend(); ++it) {
+    (*it)->IncrementNInFlight(1);
+    (*it)->FinalizeScoreUpdate(v, d, 20.0f, 1);
+    v = -v;
+  }
+}
+
+// Builds a small tree: the head with visits to its first two children, and
+// one of them with a visited child of its own.
+void BuildTree(NodeTree* tree) {
+  tree->ResetToPosition(ChessBoard::kStartposFen, {});
+  Node* head = tree->GetCurrentHead();
+  head->CreateEdges(tree->HeadPosition().GetBoard().GenerateLegalMoves());
+  float p = 0.5f;
+  for (auto& edge : head->Edges()) {
+    edge.edge()->SetP(p);
+    p /= 2;
+  }
+  Backup({head}, 0.2f, 0.5f);
+  auto it = head->Edges().begin();
+  Node* first = it.GetOrSpawnNode(head);
+  ++it;
+  Node* second = it.GetOrSpawnNode(head);
+  Backup({head, first}, 0.5f, 0.1f);
+  first->CreateEdges({Move("e2e4"), Move("d2d4")});
+  first->Edges().begin().edge()->SetP(0.75f);
+  Node* grandchild = first->Edges().begin().GetOrSpawnNode(first);
+  Backup({head, first, grandchild}, -0.3f, 0.2f);
+  Backup({head, first, grandchild}, -0.1f, 0.3f);
+  Backup({head, second}, -0.4f, 0.4f);
+}
+
+void ExpectSameNode(const Node* a, const Node* b) {
+  EXPECT_EQ(a->GetN(), b->GetN());
+  EXPECT_FLOAT_EQ(a->GetWL(), b->GetWL());
+  EXPECT_FLOAT_EQ(a->GetD(), b->GetD());
+  EXPECT_FLOAT_EQ(a->GetM(), b->GetM());
+  EXPECT_EQ(a->GetBounds(), b->GetBounds());
+  EXPECT_FLOAT_EQ(a->GetVisitedPolicy(), b->GetVisitedPolicy());
+  ASSERT_EQ(a->GetNumEdges(), b->GetNumEdges());
+  auto b_edges = b->Edges().begin();
+  for (const auto& edge : a->Edges()) {
+    EXPECT_EQ(edge.GetMove(), b_edges.GetMove());
+    EXPECT_EQ(edge.GetP(), b_edges.GetP());
+    EXPECT_EQ(edge.GetN(), b_edges.GetN());
+    if (edge.GetN() > 0) ExpectSameNode(edge.node(), b_edges.node());
+    ++b_edges;
+  }
+}
+}  // namespace
+
+TEST(NodeTreeFile, RoundTrip) {
+  NodeTree tree;
+  BuildTree(&tree);
+  EXPECT_EQ(tree.SaveHeadSubtree(kFilename, 42), 4);
+
+  NodeTree loaded;
+  loaded.ResetToPosition(ChessBoard::kStartposFen, {});
+  EXPECT_EQ(loaded.LoadHeadSubtree(kFilename, 42), 4);
+  std::remove(kFilename);
+  ExpectSameNode(tree.GetCurrentHead(), loaded.GetCurrentHead());
+}
+
+TEST(NodeTreeFile, IgnoresOtherPositionOrNetwork) {
+  NodeTree tree;
+  BuildTree(&tree);
+  tree.SaveHeadSubtree(kFilename, 42);
+
+  NodeTree loaded;
+  loaded.ResetToPosition(ChessBoard::kStartposFen, {});
+  EXPECT_EQ(loaded.LoadHeadSubtree(kFilename, 43), 0);
+  loaded.ResetToPosition(ChessBoard::kStartposFen, {Move("e2e4")});
+  EXPECT_EQ(loaded.LoadHeadSubtree(kFilename, 42), 0);
+  std::remove(kFilename);
+  EXPECT_EQ(loaded.GetCurrentHead()->GetN(), 0);
+}
+
+TEST(NodeTreeFile, PrunesRarelyVisitedSubtrees) {
+  NodeTree tree;
+  BuildTree(&tree);
+  tree.SaveHeadSubtree(kFilename, 42);
+
+  NodeTree loaded;
+  loaded.ResetToPosition(ChessBoard::kStartposFen, {});
+  // Drops the second child, with its single visit.
+  EXPECT_EQ(loaded.LoadHeadSubtree(kFilename, 42, 2), 3);
+  std::remove(kFilename);
+  const Node* head = loaded.GetCurrentHead();
+  EXPECT_EQ(head->GetN(), 4);
+  EXPECT_FLOAT_EQ(head->GetWL(), (0.2f - 0.5f - 0.3f - 0.1f) / 4);
+  EXPECT_FLOAT_EQ(head->GetD(), (0.5f + 0.1f + 0.2f + 0.3f) / 4);
+  EXPECT_FLOAT_EQ(head->GetVisitedPolicy(), 0.5f);
+  auto it = head->Edges().begin();
+  EXPECT_EQ(it.GetN(), 3);
+  ++it;
+  EXPECT_EQ(it.GetN(), 0);
+  EXPECT_EQ(it.node(), nullptr);
+}
+
+TEST(Node, SpawnsChildrenInBlocks) {
+  NodeTree tree;
+  tree.ResetToPosition(ChessBoard::kStartposFen, {});
+  Node* head = tree.GetCurrentHead();
+  head->CreateEdges(tree.HeadPosition().GetBoard().GenerateLegalMoves());
+  ASSERT_EQ(head->GetNumEdges(), 20);
+
+  auto edge_at = [head](int idx) {
+    auto it = head->Edges().begin();
+    for (int i = 0; i < idx; ++i) ++it;
+    return it;
+  };
+  // Blocks are of 1, 2 and 4 nodes, up to the one of the edge 5.
+  Node* node = edge_at(5).GetOrSpawnNode(head);
+  int idx = 0;
+  for (const auto& edge : head->Edges()) {
+    if (idx < 7) {
+      ASSERT_NE(edge.node(), nullptr);
+      EXPECT_EQ(edge.node()->GetParent(), head);
+      EXPECT_EQ(edge.node()->GetOwnEdge(), edge.edge());
+      EXPECT_EQ(edge.GetN(), 0);
+    } else {
+      EXPECT_EQ(edge.node(), nullptr);
+    }
+    ++idx;
+  }
+  EXPECT_EQ(edge_at(5).node(), node);
+
+  // The last block is truncated to 20 edges, and nodes don't move.
+  Node* last = edge_at(19).GetOrSpawnNode(head);
+  EXPECT_EQ(last->GetOwnEdge(), edge_at(19).edge());
+  EXPECT_EQ(edge_at(5).node(), node);
+  for (const auto& edge : head->Edges()) EXPECT_NE(edge.node(), nullptr);
+}
+
+TEST(Node, SolidNodeKeepsChildrenStats) {
+  NodeTree tree;
+  BuildTree(&tree);
+  Node* head = tree.GetCurrentHead();
+  EXPECT_EQ(head->GetSolidChildren(), nullptr);
+  head->MakeSolid();
+  const PuctChildren* stats = head->GetSolidChildren();
+  ASSERT_NE(stats, nullptr);
+  ASSERT_EQ(stats->size(), head->GetNumEdges());
+
+  // Q is WL for visited children, FPU for others.
+  PuctChildren::Scoring scoring{1.0f, -2.0f, 0.0f};
+  auto expect_same_stats = [&]() {
+    int idx = 0;
+    for (const auto& edge : head->Edges()) {
+      EXPECT_EQ(stats->n_started(idx), edge.GetNStarted());
+      EXPECT_EQ(stats->p(idx), edge.GetP());
+      EXPECT_FLOAT_EQ(stats->GetScoreWithoutU(idx, scoring),
+                      edge.GetN() > 0 ? edge.node()->GetWL() : -2.0f);
+      ++idx;
+    }
+  };
+  expect_same_stats();
+
+  // Children update the stats of a solid parent.
+  Node* first = head->Edges().begin().node();
+  Node* node = head->GetEdgeAt(5).GetOrSpawnNode(head);
+  EXPECT_EQ(head->GetEdgeAt(5).node(), node);
+  Backup({head, node}, 0.3f, 0.2f);
+  first->IncrementNInFlight(2);
+  expect_same_stats();
+  first->CancelScoreUpdate(2);
+  node->MakeTerminal(GameResult::BLACK_WON);
+  expect_same_stats();
+  EXPECT_LT(stats->p(5), 1e-6f);
+}
+
+TEST(NodeTree, MakeMoveKeepsSubtreeOfMove) {
+  NodeTree tree;
+  BuildTree(&tree);
+  const Move move = tree.GetCurrentHead()->Edges().begin().GetMove();
+  tree.MakeMove(move);
+  const Node* head = tree.GetCurrentHead();
+  EXPECT_EQ(head->GetN(), 3);
+  ASSERT_EQ(head->GetNumEdges(), 2);
+  const Node* grandchild = head->Edges().begin().node();
+  ASSERT_NE(grandchild, nullptr);
+  EXPECT_EQ(grandchild->GetParent(), head);
+  EXPECT_EQ(grandchild->GetN(), 2);
+  // Siblings of the new head are released.
+  const Node* parent = head->GetParent();
+  EXPECT_EQ(parent, tree.GetGameBeginNode());
+  int nodes = 0;
+  for (const auto& edge : parent->Edges()) nodes += edge.HasNode();
+  EXPECT_EQ(nodes, 1);
+}
+
+TEST(Node, KeepsWLAccurateWithManyVisits) {
+  NodeTree tree;
+  tree.ResetToPosition(ChessBoard::kStartposFen, {});
+  Node* head = tree.GetCurrentHead();
+  head->CreateEdges(tree.HeadPosition().GetBoard().GenerateLegalMoves());
+  Backup({head}, 0.1f, 0.3f);
+  // Children with close values, each with 8 children of their own.
+  const int kChildren = 4;
+  const int kGrandchildren = 8;
+  std::vector<Node*> children;
+  std::vector<std::vector<Node*>> grandchildren(kChildren);
+  std::vector<double> sums(kChildren);
+  auto it = head->Edges().begin();
+  for (int i = 0; i < kChildren; ++i, ++it) {
+    children.push_back(it.GetOrSpawnNode(head));
+    Backup({head, children[i]}, 0.2f, 0.0f);
+    sums[i] = 0.2;
+    children[i]->CreateEdges({Move("e2e4"), Move("d2d4"), Move("g1f3"),
+                              Move("c2c4"), Move("b1c3"), Move("f2f4"),
+                              Move("a2a3"), Move("h2h3")});
+    for (auto& edge : children[i]->Edges()) {
+      grandchildren[i].push_back(edge.GetOrSpawnNode(children[i]));
+    }
+  }
+
+  // Visits backed up like search does, with WL recomputed whenever N doubles.
+  std::mt19937 gen(7);
+  for (int i = 0; i < (1 << 23); ++i) {
+    const int child = i % kChildren;
+    const std::vector<Node*> path = {
+        head, children[child],
+        grandchildren[child][i / kChildren % kGrandchildren]};
+    float v = gen() / 4294967296.0f * 0.6f - 0.2f + 0.0001f * child;
+    sums[child] -= v;
+    for (auto node = path.rbegin(); node != path.rend(); ++node) {
+      const uint32_t old_n = (*node)->GetN();
+      (*node)->IncrementNInFlight(1);
+      (*node)->FinalizeScoreUpdate(v, 0.0f, 20.0f, 1);
+      if ((*node)->GetN() >= 1024 && ((*node)->GetN() ^ old_n) > old_n) {
+        (*node)->RecomputeWL();
+      }
+      v = -v;
+    }
+  }
+
+  for (int i = 0; i < kChildren; ++i) {
+    EXPECT_NEAR(children[i]->GetWL(), sums[i] / children[i]->GetN(), 1e-6);
+    // The order of children, i.e. the best move, is the same as with exact
+    // sums.
+    if (i > 0) {
+      EXPECT_LT(children[i]->GetWL(), children[i - 1]->GetWL());
+    }
+  }
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  lczero::InitializeMagicBitboards();
+  return RUN_ALL_TESTS();
+}
@@ -59,6 +59,12 @@ const OptionId SearchParams::kMiniBatchSizeId{
     "How many positions the engine tries to batch together for parallel NN "
     "computation. Larger batches may reduce strength a bit, especially with a "
     "small number of playouts."};
+const OptionId SearchParams::kAdaptiveMinibatchId{
+    "adaptive-minibatch", "AdaptiveMinibatch",
+    "Let each search thread tune its minibatch size and MaxCollisionEvents "
+    "during search, between a quarter and four times the configured values, to "
+    "maximize the number of non-collision visits per second. Decisions are "
+    "written to the log file."};
 const OptionId SearchParams::kMaxPrefetchBatchId{
     "max-prefetch", "MaxPrefetch",
     "When the engine cannot gather a large enough batch for immediate use, try "
@@ -144,6 +150,18 @@ const OptionId SearchParams::kVerboseStatsId{
 const OptionId SearchParams::kLogLiveStatsId{
     "log-live-stats", "LogLiveStats",
     "Do VerboseMoveStats on every info update."};
+const OptionId SearchParams::kSearchStatsId{
+    "search-stats", "SearchStats",
+    "Measure time spent in each stage of search threads, time waiting for "
+    "locks, NN cache hit rate and collision rate, and show them as info string "
+    "on every info update. On NUMA hosts, also samples how many of the visited "
+    "nodes are in memory of another NUMA node."};
+const OptionId SearchParams::kNumaRootPartitionId{
+    "numa-root-partition", "NumaRootPartition",
+    "On NUMA hosts, split the root moves among the NUMA nodes which search "
+    "threads run on, so that threads of each node mostly walk the subtrees "
+    "allocated in their own memory. On Linux, search threads are pinned to "
+    "the CPUs of their node for that."};
 const OptionId SearchParams::kFpuStrategyId{
     "fpu-strategy", "FpuStrategy",
     "How is an eval of unvisited node determined. \"First Play Urgency\" "
@@ -189,6 +207,12 @@ const OptionId SearchParams::kOutOfOrderEvalId{
     "in the cache or is terminal, evaluate it right away without sending the "
     "batch to the NN. When off, this may only happen with the very first node "
     "of a batch; when on, this can happen with any node."};
+const OptionId SearchParams::kBatchedPickId{
+    "batched-pick", "BatchedPick",
+    "Pick the nodes of a whole batch in one descent of the tree, splitting the "
+    "visits among children in proportion to their PUCT scores, instead of "
+    "descending from the root for every node and relying on virtual loss to "
+    "spread them."};
 const OptionId SearchParams::kMaxOutOfOrderEvalsId{
     "max-out-of-order-evals-factor", "MaxOutOfOrderEvalsFactor",
     "Maximum number of out of order evals during gathering of a batch is "
@@ -273,13 +297,15 @@ const OptionId SearchParams::kNpsLimitId{
     "and on the length of the search. Zero to disable."};
 const OptionId SearchParams::kSolidTreeThresholdId{
     "solid-tree-threshold", "SolidTreeThreshold",
-    "Only nodes with at least this number of visits will be considered for "
-    "solidification for improved cache locality."};
+    "Only nodes with at least this number of visits keep the stats of their "
+    "children in contiguous arrays, which makes selecting the child to visit "
+    "faster."};
 
 void SearchParams::Populate(OptionsParser* options) {
   // Here the uci optimized defaults" are set.
   // Many of them are overridden with training specific values in tournament.cc.
   options->Add<IntOption>(kMiniBatchSizeId, 1, 1024) = 256;
+  options->Add<BoolOption>(kAdaptiveMinibatchId) = false;
   options->Add<IntOption>(kMaxPrefetchBatchId, 0, 1024) = 32;
   options->Add<FloatOption>(kCpuctId, 0.0f, 100.0f) = 2.8f;
   options->Add<FloatOption>(kCpuctBaseId, 1.0f, 1000000000.0f) = 19652.0f;
@@ -301,6 +327,8 @@ void SearchParams::Populate(OptionsParser* options) {
   options->Add<FloatOption>(kNoiseAlphaId, 0.0f, 10000000.0f) = 0.3f;
   options->Add<BoolOption>(kVerboseStatsId) = false;
   options->Add<BoolOption>(kLogLiveStatsId) = false;
+  options->Add<BoolOption>(kSearchStatsId) = false;
+  options->Add<BoolOption>(kNumaRootPartitionId) = false;
   std::vector<std::string> fpu_strategy = {"reduction", "absolute"};
   options->Add<ChoiceOption>(kFpuStrategyId, fpu_strategy) = "reduction";
   options->Add<FloatOption>(kFpuValueId, -100.0f, 100.0f) = 0.74;
@@ -312,6 +340,7 @@ void SearchParams::Populate(OptionsParser* options) {
   options->Add<IntOption>(kMaxCollisionEventsId, 1, 1024) = 32;
   options->Add<IntOption>(kMaxCollisionVisitsId, 1, 1000000) = 9999;
   options->Add<BoolOption>(kOutOfOrderEvalId) = true;
+  options->Add<BoolOption>(kBatchedPickId) = false;
   options->Add<FloatOption>(kMaxOutOfOrderEvalsId, 0.0f, 100.0f) = 1.0f;
   options->Add<BoolOption>(kStickyEndgamesId) = true;
   options->Add<BoolOption>(kSyzygyFastPlayId) = true;
@@ -345,6 +374,7 @@ void SearchParams::Populate(OptionsParser* options) {
   options->HideOption(kNoiseEpsilonId);
   options->HideOption(kNoiseAlphaId);
   options->HideOption(kLogLiveStatsId);
+  options->HideOption(kSearchStatsId);
   options->HideOption(kDisplayCacheUsageId);
   options->HideOption(kRootHasOwnCpuctParamsId);
   options->HideOption(kTemperatureId);
@@ -354,6 +384,7 @@ void SearchParams::Populate(OptionsParser* options) {
   options->HideOption(kTemperatureEndgameId);
   options->HideOption(kTemperatureWinpctCutoffId);
   options->HideOption(kTemperatureVisitOffsetId);
+  options->HideOption(kSolidTreeThresholdId);
 }
 
 SearchParams::SearchParams(const OptionsDict& options)
@@ -386,6 +417,7 @@ SearchParams::SearchParams(const OptionsDict& options)
       kMaxCollisionEvents(options.Get<int>(kMaxCollisionEventsId)),
       kMaxCollisionVisits(options.Get<int>(kMaxCollisionVisitsId)),
       kOutOfOrderEval(options.Get<bool>(kOutOfOrderEvalId)),
+      kBatchedPick(options.Get<bool>(kBatchedPickId)),
       kStickyEndgames(options.Get<bool>(kStickyEndgamesId)),
       kSyzygyFastPlay(options.Get<bool>(kSyzygyFastPlayId)),
       kHistoryFill(EncodeHistoryFill(options.Get<std::string>(kHistoryFillId))),
@@ -43,6 +43,9 @@ class SearchParams {
 
   // Parameter getters.
   int GetMiniBatchSize() const { return kMiniBatchSize; }
+  bool GetAdaptiveMinibatch() const {
+    return options_.Get<bool>(kAdaptiveMinibatchId);
+  }
   int GetMaxPrefetchBatch() const {
     return options_.Get<int>(kMaxPrefetchBatchId);
   }
@@ -75,6 +78,10 @@ class SearchParams {
   float GetNoiseAlpha() const { return kNoiseAlpha; }
   bool GetVerboseStats() const { return options_.Get<bool>(kVerboseStatsId); }
   bool GetLogLiveStats() const { return options_.Get<bool>(kLogLiveStatsId); }
+  bool GetSearchStats() const { return options_.Get<bool>(kSearchStatsId); }
+  bool GetNumaRootPartition() const {
+    return options_.Get<bool>(kNumaRootPartitionId);
+  }
   bool GetFpuAbsolute(bool at_root) const {
     return at_root ? kFpuAbsoluteAtRoot : kFpuAbsolute;
   }
@@ -86,6 +93,7 @@ class SearchParams {
   int GetMaxCollisionEvents() const { return kMaxCollisionEvents; }
   int GetMaxCollisionVisitsId() const { return kMaxCollisionVisits; }
   bool GetOutOfOrderEval() const { return kOutOfOrderEval; }
+  bool GetBatchedPick() const { return kBatchedPick; }
   bool GetStickyEndgames() const { return kStickyEndgames; }
   bool GetSyzygyFastPlay() const { return kSyzygyFastPlay; }
   int GetMultiPv() const { return options_.Get<int>(kMultiPvId); }
@@ -110,10 +118,11 @@ class SearchParams {
   float GetBlackDrawDelta() const { return kDrawScoreBlack; }
   int GetMaxOutOfOrderEvals() const { return kMaxOutOfOrderEvals; }
   float GetNpsLimit() const { return kNpsLimit; }
-  int GetSolidTreeThreshold() const { return kSolidTreeThreshold; }
+  uint32_t GetSolidTreeThreshold() const { return kSolidTreeThreshold; }
 
   // Search parameter IDs.
   static const OptionId kMiniBatchSizeId;
+  static const OptionId kAdaptiveMinibatchId;
   static const OptionId kMaxPrefetchBatchId;
   static const OptionId kCpuctId;
   static const OptionId kCpuctAtRootId;
@@ -134,6 +143,8 @@ class SearchParams {
   static const OptionId kNoiseAlphaId;
   static const OptionId kVerboseStatsId;
   static const OptionId kLogLiveStatsId;
+  static const OptionId kSearchStatsId;
+  static const OptionId kNumaRootPartitionId;
   static const OptionId kFpuStrategyId;
   static const OptionId kFpuValueId;
   static const OptionId kFpuStrategyAtRootId;
@@ -143,6 +154,7 @@ class SearchParams {
   static const OptionId kMaxCollisionEventsId;
   static const OptionId kMaxCollisionVisitsId;
   static const OptionId kOutOfOrderEvalId;
+  static const OptionId kBatchedPickId;
   static const OptionId kStickyEndgamesId;
   static const OptionId kSyzygyFastPlayId;
   static const OptionId kMultiPvId;
@@ -190,6 +202,7 @@ class SearchParams {
   const int kMaxCollisionEvents;
   const int kMaxCollisionVisits;
   const bool kOutOfOrderEval;
+  const bool kBatchedPick;
   const bool kStickyEndgames;
   const bool kSyzygyFastPlay;
   const FillEmptyHistory kHistoryFill;
@@ -208,7 +221,7 @@ class SearchParams {
   const float kDrawScoreBlack;
   const int kMaxOutOfOrderEvals;
   const float kNpsLimit;
-  const int kSolidTreeThreshold;
+  const uint32_t kSolidTreeThreshold;
 };
 
 }  // namespace lczero
@@ -0,0 +1,315 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "mcts/puct.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace lczero {
+namespace {
+#if defined(__AVX__)
+constexpr int kLanes = 8;
+#elif defined(__aarch64__)
+constexpr int kLanes = 4;
+#else
+constexpr int kLanes = 1;
+#endif
+
+constexpr float kNeverWins = -std::numeric_limits<float>::infinity();
+
+// Computes Q and M of a child the same way the vector code does.
+void ComputeQAndM(float n, float wl, float d, float m,
+                  const PuctChildren::Scoring& scoring, float* q_out,
+                  float* m_out) {
+  const float q = n > 0.0f ? wl + scoring.draw_score * d : scoring.fpu;
+  *q_out = q;
+  if (!scoring.use_m) {
+    *m_out = 0.0f;
+    return;
+  }
+  const float child_m = n > 0.0f ? m : scoring.parent_m;
+  float result = std::clamp(scoring.m_slope * (child_m - scoring.parent_m),
+                            -scoring.m_cap, scoring.m_cap);
+  result *= std::copysign(1.0f, -q);
+  result *= scoring.a_constant + scoring.a_linear * std::abs(q) +
+            scoring.a_square * q * q;
+  *m_out = result;
+}
+
+#if defined(__AVX__)
+// Returns a vector with the maximum of the lanes of @v in every lane.
+__m256 BroadcastMax(__m256 v) {
+  v = _mm256_max_ps(v, _mm256_permute2f128_ps(v, v, 1));
+  v = _mm256_max_ps(v, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+  return _mm256_max_ps(v, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+__m256 BroadcastMin(__m256 v) {
+  v = _mm256_min_ps(v, _mm256_permute2f128_ps(v, v, 1));
+  v = _mm256_min_ps(v, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+  return _mm256_min_ps(v, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+// Merges per lane top-2 results (@best_idx are child indices).
+PuctChildren::Top2 ReduceLanes(__m256 best, __m256 best_idx,
+                               __m256 second_best) {
+  const __m256 v_never = _mm256_set1_ps(kNeverWins);
+  const __m256 v_max = BroadcastMax(best);
+  const float best_score = _mm256_cvtss_f32(v_max);
+  if (best_score == kNeverWins) return {-1, kNeverWins, kNeverWins};
+  // Of the lanes with the best score, the one of the child added first wins.
+  const __m256 v_idx = BroadcastMin(_mm256_blendv_ps(
+      _mm256_set1_ps(std::numeric_limits<float>::infinity()), best_idx,
+      _mm256_cmp_ps(best, v_max, _CMP_EQ_OQ)));
+  const __m256 others = _mm256_blendv_ps(
+      best, v_never, _mm256_cmp_ps(best_idx, v_idx, _CMP_EQ_OQ));
+  return {static_cast<int>(_mm256_cvtss_f32(v_idx)), best_score,
+          _mm256_cvtss_f32(BroadcastMax(_mm256_max_ps(second_best, others)))};
+}
+#elif defined(__aarch64__)
+// Merges per lane top-2 results (@best_idx are child indices).
+PuctChildren::Top2 ReduceLanes(float32x4_t best, float32x4_t best_idx,
+                               float32x4_t second_best) {
+  const float best_score = vmaxvq_f32(best);
+  if (best_score == kNeverWins) return {-1, kNeverWins, kNeverWins};
+  // Of the lanes with the best score, the one of the child added first wins.
+  const float idx = vminvq_f32(
+      vbslq_f32(vceqq_f32(best, vdupq_n_f32(best_score)), best_idx,
+                vdupq_n_f32(std::numeric_limits<float>::infinity())));
+  const float32x4_t others = vbslq_f32(
+      vceqq_f32(best_idx, vdupq_n_f32(idx)), vdupq_n_f32(kNeverWins), best);
+  return {static_cast<int>(idx), best_score,
+          vmaxvq_f32(vmaxq_f32(second_best, others))};
+}
+#endif
+}  // namespace
+
+void PuctChildren::Add(uint32_t n, int n_started, float wl, float d, float m,
+                       float p) {
+  if (size_ % kLanes == 0) {
+    // Start a new vector of padding.
+    if (n_.size() < static_cast<size_t>(size_ + kLanes)) {
+      n_.resize(size_ + kLanes);
+      n_started_.resize(size_ + kLanes);
+      wl_.resize(size_ + kLanes);
+      d_.resize(size_ + kLanes);
+      m_.resize(size_ + kLanes);
+      p_.resize(size_ + kLanes);
+    }
+    // Padding has the stats of excluded children.
+    for (int i = size_; i < size_ + kLanes; ++i) {
+      Set(i, 1, 0, kNeverWins, 0.0f, 0.0f);
+      p_[i] = 0.0f;
+    }
+  }
+  Set(size_, n, n_started, wl, d, m);
+  p_[size_] = p;
+  ++size_;
+}
+
+void PuctChildren::AddExcluded() { Add(1, 0, kNeverWins, 0.0f, 0.0f, 0.0f); }
+
+int PuctChildren::FirstUnstarted() const {
+  int i = 0;
+#if defined(__AVX__)
+  // Skips whole vectors of started children.
+  const __m256 v_zero = _mm256_setzero_ps();
+  while (i < size_ &&
+         _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(&n_started_[i]),
+                                          v_zero, _CMP_EQ_OQ)) == 0) {
+    i += kLanes;
+  }
+#endif
+  for (; i < size_; ++i) {
+    if (n_started_[i] == 0.0f) return i;
+  }
+  return size_;
+}
+
+float PuctChildren::GetScoreWithoutU(int idx, const Scoring& scoring) const {
+  float q;
+  float m;
+  ComputeQAndM(n_[idx], wl_[idx], d_[idx], m_[idx], scoring, &q, &m);
+  return q + m;
+}
+
+PuctChildren::Top2 PuctChildren::FindTop2(const Scoring& scoring,
+                                          int count) const {
+  const int padded_count = (count + kLanes - 1) / kLanes * kLanes;
+#if defined(__AVX__)
+  const __m256 v_never = _mm256_set1_ps(kNeverWins);
+  const __m256 v_zero = _mm256_setzero_ps();
+  const __m256 v_one = _mm256_set1_ps(1.0f);
+  const __m256 v_sign = _mm256_set1_ps(-0.0f);
+  const __m256 v_count = _mm256_set1_ps(count);
+  const __m256 v_step = _mm256_set1_ps(kLanes);
+  const __m256 v_puct_mult = _mm256_set1_ps(scoring.puct_mult);
+  const __m256 v_fpu = _mm256_set1_ps(scoring.fpu);
+  const __m256 v_draw_score = _mm256_set1_ps(scoring.draw_score);
+  const __m256 v_parent_m = _mm256_set1_ps(scoring.parent_m);
+  const __m256 v_m_slope = _mm256_set1_ps(scoring.m_slope);
+  const __m256 v_m_cap = _mm256_set1_ps(scoring.m_cap);
+  const __m256 v_neg_m_cap = _mm256_set1_ps(-scoring.m_cap);
+  const __m256 v_a_constant = _mm256_set1_ps(scoring.a_constant);
+  const __m256 v_a_linear = _mm256_set1_ps(scoring.a_linear);
+  const __m256 v_a_square = _mm256_set1_ps(scoring.a_square);
+  __m256 v_best = v_never;
+  __m256 v_second = v_never;
+  __m256 v_best_idx = v_zero;
+  __m256 v_idx = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+  for (int i = 0; i < padded_count; i += kLanes) {
+    const __m256 visited =
+        _mm256_cmp_ps(_mm256_loadu_ps(&n_[i]), v_zero, _CMP_GT_OQ);
+    const __m256 q = _mm256_blendv_ps(
+        v_fpu,
+        _mm256_add_ps(_mm256_loadu_ps(&wl_[i]),
+                      _mm256_mul_ps(v_draw_score, _mm256_loadu_ps(&d_[i]))),
+        visited);
+    const __m256 u = _mm256_div_ps(
+        _mm256_mul_ps(v_puct_mult, _mm256_loadu_ps(&p_[i])),
+        _mm256_add_ps(v_one, _mm256_loadu_ps(&n_started_[i])));
+    __m256 score = _mm256_add_ps(u, q);
+    if (scoring.use_m) {
+      const __m256 child_m =
+          _mm256_blendv_ps(v_parent_m, _mm256_loadu_ps(&m_[i]), visited);
+      __m256 m = _mm256_min_ps(
+          _mm256_max_ps(
+              _mm256_mul_ps(v_m_slope, _mm256_sub_ps(child_m, v_parent_m)),
+              v_neg_m_cap),
+          v_m_cap);
+      // copysign(1, -q).
+      m = _mm256_mul_ps(
+          m, _mm256_or_ps(_mm256_andnot_ps(q, v_sign), v_one));
+      const __m256 abs_q = _mm256_andnot_ps(v_sign, q);
+      m = _mm256_mul_ps(
+          m, _mm256_add_ps(
+                 _mm256_add_ps(v_a_constant, _mm256_mul_ps(v_a_linear, abs_q)),
+                 _mm256_mul_ps(_mm256_mul_ps(v_a_square, q), q)));
+      score = _mm256_add_ps(score, m);
+    }
+    // Excluded children, padding and children after @count never win.
+    score = _mm256_blendv_ps(
+        score, v_never,
+        _mm256_or_ps(_mm256_cmp_ps(q, v_never, _CMP_EQ_OQ),
+                     _mm256_cmp_ps(v_idx, v_count, _CMP_GE_OQ)));
+    const __m256 is_better = _mm256_cmp_ps(score, v_best, _CMP_GT_OQ);
+    v_second = _mm256_max_ps(v_second, _mm256_min_ps(score, v_best));
+    v_best = _mm256_blendv_ps(v_best, score, is_better);
+    v_best_idx = _mm256_blendv_ps(v_best_idx, v_idx, is_better);
+    v_idx = _mm256_add_ps(v_idx, v_step);
+  }
+  return ReduceLanes(v_best, v_best_idx, v_second);
+#elif defined(__aarch64__)
+  const float32x4_t v_never = vdupq_n_f32(kNeverWins);
+  const float32x4_t v_zero = vdupq_n_f32(0.0f);
+  const float32x4_t v_one = vdupq_n_f32(1.0f);
+  const uint32x4_t v_sign = vdupq_n_u32(0x80000000u);
+  const float32x4_t v_count = vdupq_n_f32(count);
+  const float32x4_t v_step = vdupq_n_f32(kLanes);
+  const float32x4_t v_puct_mult = vdupq_n_f32(scoring.puct_mult);
+  const float32x4_t v_fpu = vdupq_n_f32(scoring.fpu);
+  const float32x4_t v_draw_score = vdupq_n_f32(scoring.draw_score);
+  const float32x4_t v_parent_m = vdupq_n_f32(scoring.parent_m);
+  const float32x4_t v_m_slope = vdupq_n_f32(scoring.m_slope);
+  const float32x4_t v_m_cap = vdupq_n_f32(scoring.m_cap);
+  const float32x4_t v_neg_m_cap = vdupq_n_f32(-scoring.m_cap);
+  const float32x4_t v_a_constant = vdupq_n_f32(scoring.a_constant);
+  const float32x4_t v_a_linear = vdupq_n_f32(scoring.a_linear);
+  const float32x4_t v_a_square = vdupq_n_f32(scoring.a_square);
+  float32x4_t v_best = v_never;
+  float32x4_t v_second = v_never;
+  float32x4_t v_best_idx = v_zero;
+  const float kFirstIdx[kLanes] = {0, 1, 2, 3};
+  float32x4_t v_idx = vld1q_f32(kFirstIdx);
+  for (int i = 0; i < padded_count; i += kLanes) {
+    const uint32x4_t visited = vcgtq_f32(vld1q_f32(&n_[i]), v_zero);
+    const float32x4_t q = vbslq_f32(
+        visited,
+        vaddq_f32(vld1q_f32(&wl_[i]),
+                  vmulq_f32(v_draw_score, vld1q_f32(&d_[i]))),
+        v_fpu);
+    const float32x4_t u =
+        vdivq_f32(vmulq_f32(v_puct_mult, vld1q_f32(&p_[i])),
+                  vaddq_f32(v_one, vld1q_f32(&n_started_[i])));
+    float32x4_t score = vaddq_f32(u, q);
+    if (scoring.use_m) {
+      const float32x4_t child_m =
+          vbslq_f32(visited, vld1q_f32(&m_[i]), v_parent_m);
+      float32x4_t m = vminq_f32(
+          vmaxq_f32(vmulq_f32(v_m_slope, vsubq_f32(child_m, v_parent_m)),
+                    v_neg_m_cap),
+          v_m_cap);
+      // copysign(1, -q).
+      m = vmulq_f32(m, vbslq_f32(v_sign, vnegq_f32(q), v_one));
+      m = vmulq_f32(
+          m, vaddq_f32(vaddq_f32(v_a_constant,
+                                 vmulq_f32(v_a_linear, vabsq_f32(q))),
+                       vmulq_f32(vmulq_f32(v_a_square, q), q)));
+      score = vaddq_f32(score, m);
+    }
+    // Excluded children, padding and children after @count never win.
+    score = vbslq_f32(
+        vorrq_u32(vceqq_f32(q, v_never), vcgeq_f32(v_idx, v_count)), v_never,
+        score);
+    const uint32x4_t is_better = vcgtq_f32(score, v_best);
+    v_second = vmaxq_f32(v_second, vminq_f32(score, v_best));
+    v_best = vbslq_f32(is_better, score, v_best);
+    v_best_idx = vbslq_f32(is_better, v_idx, v_best_idx);
+    v_idx = vaddq_f32(v_idx, v_step);
+  }
+  return ReduceLanes(v_best, v_best_idx, v_second);
+#else
+  Top2 result{-1, kNeverWins, kNeverWins};
+  for (int i = 0; i < padded_count; ++i) {
+    float q;
+    float m;
+    ComputeQAndM(n_[i], wl_[i], d_[i], m_[i], scoring, &q, &m);
+    if (q == kNeverWins) continue;
+    const float score =
+        scoring.puct_mult * p_[i] / (1 + n_started_[i]) + q + m;
+    if (score > result.best_score) {
+      result.second_best_score = result.best_score;
+      result.best_score = score;
+      result.best = i;
+    } else if (score > result.second_best_score) {
+      result.second_best_score = score;
+    }
+  }
+  return result;
+#endif
+}
+
+}  // namespace lczero
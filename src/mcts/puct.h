@@ -0,0 +1,111 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace lczero {
+
+// Stats of the children of a node in structure of arrays layout, so that PUCT
+// scores of all children are computed with SIMD instructions (AVX or NEON,
+// when the build targets them). Solid nodes (see Node::MakeSolid()) keep one
+// up to date with their children, search also uses it as scratch. Arrays are
+// padded to whole vectors with children that never win.
+class PuctChildren {
+ public:
+  // Parameters of the scores of one node's children.
+  struct Scoring {
+    // cpuct * sqrt(N of the parent).
+    float puct_mult;
+    // Q of children which have no visits yet.
+    float fpu;
+    float draw_score;
+    // Moves left utility, see MEvaluator in search.cc.
+    bool use_m = false;
+    float parent_m = 0.0f;
+    float m_slope = 0.0f;
+    float m_cap = 0.0f;
+    float a_constant = 0.0f;
+    float a_linear = 0.0f;
+    float a_square = 0.0f;
+  };
+
+  struct Top2 {
+    // Index of the child with the highest score, -1 if there are no children.
+    int best;
+    float best_score;
+    // Highest score among the other children, -infinity if there are none.
+    float second_best_score;
+  };
+
+  void Clear() { size_ = 0; }
+  // Appends a child.
+  void Add(uint32_t n, int n_started, float wl, float d, float m, float p);
+  // Appends a child which never wins.
+  void AddExcluded();
+  // Updates the stats of child @idx other than P.
+  void Set(int idx, uint32_t n, int n_started, float wl, float d, float m) {
+    n_[idx] = n;
+    n_started_[idx] = n_started;
+    wl_[idx] = wl;
+    d_[idx] = d;
+    m_[idx] = m;
+  }
+  void SetNStarted(int idx, int n_started) { n_started_[idx] = n_started; }
+  void SetP(int idx, float p) { p_[idx] = p; }
+
+  int size() const { return size_; }
+  float p(int idx) const { return p_[idx]; }
+  // Visits started (or planned) for a child, used in U.
+  float n_started(int idx) const { return n_started_[idx]; }
+  void AddVisits(int idx, int visits) { n_started_[idx] += visits; }
+  // Returns the index of the first child without started visits, or size().
+  int FirstUnstarted() const;
+
+  // Returns Q + M of child @idx, as used in its score.
+  float GetScoreWithoutU(int idx, const Scoring& scoring) const;
+  // Finds the best two of the first @count children. Scores are U + Q + M with
+  // U = puct_mult * P / (1 + n_started), in the operation order of
+  // EdgeAndNode::GetU() + Q + M. Ties are won by the child added first.
+  Top2 FindTop2(const Scoring& scoring, int count) const;
+  Top2 FindTop2(const Scoring& scoring) const {
+    return FindTop2(scoring, size_);
+  }
+
+ private:
+  int size_ = 0;
+  std::vector<float> n_;
+  std::vector<float> n_started_;
+  std::vector<float> wl_;
+  std::vector<float> d_;
+  std::vector<float> m_;
+  std::vector<float> p_;
+};
+
+}  // namespace lczero
@@ -0,0 +1,235 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "mcts/puct.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace lczero {
+
+namespace {
+constexpr float kInf = std::numeric_limits<float>::infinity();
+
+struct Child {
+  uint32_t n;
+  int n_started;
+  float wl;
+  float d;
+  float m;
+  float p;
+};
+
+// Straightforward version of PuctChildren::FindTop2(), written like node
+// selection in search.cc.
+PuctChildren::Top2 FindTop2Reference(const std::vector<Child>& children,
+                                     const PuctChildren::Scoring& scoring,
+                                     int count) {
+  PuctChildren::Top2 result{-1, -kInf, -kInf};
+  for (int i = 0; i < count; ++i) {
+    const auto& child = children[i];
+    if (child.wl == -kInf) continue;
+    const float q =
+        child.n > 0 ? child.wl + scoring.draw_score * child.d : scoring.fpu;
+    float m = 0.0f;
+    if (scoring.use_m) {
+      const float child_m = child.n > 0 ? child.m : scoring.parent_m;
+      m = std::clamp(scoring.m_slope * (child_m - scoring.parent_m),
+                     -scoring.m_cap, scoring.m_cap);
+      m *= std::copysign(1.0f, -q);
+      m *= scoring.a_constant + scoring.a_linear * std::abs(q) +
+           scoring.a_square * q * q;
+    }
+    const float score =
+        scoring.puct_mult * child.p / (1 + child.n_started) + q + m;
+    if (score > result.best_score) {
+      result.second_best_score = result.best_score;
+      result.best_score = score;
+      result.best = i;
+    } else if (score > result.second_best_score) {
+      result.second_best_score = score;
+    }
+  }
+  return result;
+}
+
+PuctChildren MakeChildren(const std::vector<Child>& children) {
+  PuctChildren result;
+  for (const auto& child : children) {
+    if (child.wl == -kInf) {
+      result.AddExcluded();
+    } else {
+      result.Add(child.n, child.n_started, child.wl, child.d, child.m,
+                 child.p);
+    }
+  }
+  return result;
+}
+
+PuctChildren::Scoring MakeScoring(float puct_mult) {
+  PuctChildren::Scoring scoring;
+  scoring.puct_mult = puct_mult;
+  scoring.fpu = -0.3f;
+  scoring.draw_score = 0.0f;
+  return scoring;
+}
+
+void ExpectSameTop2(const std::vector<Child>& children,
+                    const PuctChildren::Scoring& scoring, int count) {
+  const auto expected = FindTop2Reference(children, scoring, count);
+  const auto actual = MakeChildren(children).FindTop2(scoring, count);
+  EXPECT_EQ(actual.best, expected.best);
+  EXPECT_FLOAT_EQ(actual.best_score, expected.best_score);
+  EXPECT_FLOAT_EQ(actual.second_best_score, expected.second_best_score);
+}
+}  // namespace
+
+TEST(PuctChildren, MatchesScalarOnRandomChildren) {
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> wl_dist(-1.0f, 1.0f);
+  std::uniform_real_distribution<float> d_dist(0.0f, 1.0f);
+  std::uniform_real_distribution<float> m_dist(0.0f, 100.0f);
+  std::uniform_real_distribution<float> p_dist(0.0f, 0.3f);
+  std::uniform_int_distribution<int> n_dist(0, 1000);
+  for (int size = 1; size <= 70; ++size) {
+    for (int round = 0; round < 20; ++round) {
+      std::vector<Child> children;
+      for (int i = 0; i < size; ++i) {
+        const int n = round % 3 == 0 ? 0 : n_dist(gen);
+        children.push_back({static_cast<uint32_t>(n), n + round % 2,
+                            wl_dist(gen), d_dist(gen), m_dist(gen),
+                            p_dist(gen)});
+      }
+      auto scoring = MakeScoring(2.5f * (round + 1));
+      scoring.draw_score = round % 4 == 1 ? -0.1f : 0.0f;
+      if (round % 2 == 0) {
+        scoring.use_m = true;
+        scoring.parent_m = m_dist(gen);
+        scoring.m_slope = 0.004f;
+        scoring.m_cap = 0.03f;
+        scoring.a_constant = 0.1f;
+        scoring.a_linear = 0.9f;
+        scoring.a_square = 0.2f;
+      }
+      ExpectSameTop2(children, scoring, size);
+      ExpectSameTop2(children, scoring, 1 + round * size / 20);
+    }
+  }
+}
+
+TEST(PuctChildren, FirstChildWinsTies) {
+  std::vector<Child> children(19, {3, 3, 0.5f, 0.0f, 0.0f, 0.1f});
+  const auto scoring = MakeScoring(1.0f);
+  const auto top2 = MakeChildren(children).FindTop2(scoring);
+  EXPECT_EQ(top2.best, 0);
+  EXPECT_EQ(top2.best_score, top2.second_best_score);
+
+  // Same tie after a lane that wins another tie.
+  children[9].wl = 0.75f;
+  children[13].wl = 0.75f;
+  EXPECT_EQ(MakeChildren(children).FindTop2(scoring).best, 9);
+  ExpectSameTop2(children, scoring, children.size());
+}
+
+TEST(PuctChildren, SkipsExcludedChildren) {
+  std::vector<Child> children;
+  for (int i = 0; i < 11; ++i) {
+    children.push_back({1, 1, -kInf, 0.0f, 0.0f, 0.5f});
+  }
+  children[7] = {100, 100, -0.5f, 0.0f, 0.0f, 0.01f};
+  const auto top2 = MakeChildren(children).FindTop2(MakeScoring(3.0f));
+  EXPECT_EQ(top2.best, 7);
+  EXPECT_EQ(top2.second_best_score, -kInf);
+}
+
+TEST(PuctChildren, NoChildren) {
+  PuctChildren children;
+  EXPECT_EQ(children.FindTop2(MakeScoring(1.0f)).best, -1);
+
+  children.AddExcluded();
+  EXPECT_EQ(children.FindTop2(MakeScoring(1.0f)).best, -1);
+}
+
+TEST(PuctChildren, UnvisitedChildrenUseFpu) {
+  PuctChildren children = MakeChildren({{10, 10, -0.5f, 0.0f, 0.0f, 0.1f},
+                                        {0, 1, 0.9f, 0.0f, 0.0f, 0.1f}});
+  auto scoring = MakeScoring(0.0f);
+  EXPECT_EQ(children.FindTop2(scoring).best, 1);
+  EXPECT_EQ(children.GetScoreWithoutU(1, scoring), scoring.fpu);
+  scoring.fpu = -0.6f;
+  EXPECT_EQ(children.FindTop2(scoring).best, 0);
+  EXPECT_EQ(children.GetScoreWithoutU(0, scoring), -0.5f);
+}
+
+TEST(PuctChildren, CountLimitsChildren) {
+  PuctChildren children = MakeChildren({{5, 5, 0.0f, 0.0f, 0.0f, 0.1f},
+                                        {5, 6, 0.1f, 0.0f, 0.0f, 0.1f},
+                                        {0, 0, 0.0f, 0.0f, 0.0f, 0.1f},
+                                        {9, 9, 0.8f, 0.0f, 0.0f, 0.1f}});
+  EXPECT_EQ(children.FirstUnstarted(), 2);
+  const auto scoring = MakeScoring(1.0f);
+  EXPECT_EQ(children.FindTop2(scoring).best, 3);
+  EXPECT_EQ(children.FindTop2(scoring, 3).best, 1);
+  EXPECT_EQ(children.FindTop2(scoring, 1).second_best_score, -kInf);
+}
+
+TEST(PuctChildren, ClearSetAndAddVisits) {
+  PuctChildren children = MakeChildren({{0, 0, 0.0f, 0.0f, 0.0f, 0.6f},
+                                        {0, 0, 0.0f, 0.0f, 0.0f, 0.4f},
+                                        {5, 5, 0.1f, 0.0f, 0.0f, 0.2f}});
+  auto scoring = MakeScoring(1.0f);
+  scoring.fpu = 0.0f;
+  EXPECT_EQ(children.FindTop2(scoring).best, 0);
+  children.AddVisits(0, 3);
+  EXPECT_EQ(children.n_started(0), 3);
+  EXPECT_EQ(children.FindTop2(scoring).best, 1);
+  children.Set(2, 5, 5, 0.9f, 0.0f, 0.0f);
+  EXPECT_EQ(children.FindTop2(scoring).best, 2);
+  children.Set(2, 5, 5, 0.1f, 0.0f, 0.0f);
+  children.SetP(1, 0.0f);
+  EXPECT_EQ(children.FindTop2(scoring).best, 0);
+
+  // Padding of a reused vector is reset.
+  children.Clear();
+  children.Add(1, 1, -1.0f, 0.0f, 0.0f, 0.1f);
+  EXPECT_EQ(children.size(), 1);
+  const auto top2 = children.FindTop2(scoring);
+  EXPECT_EQ(top2.best, 0);
+  EXPECT_EQ(top2.second_best_score, -kInf);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -48,6 +48,8 @@ namespace lczero {
 namespace {
 // Maximum delay between outputting "uci info" when nothing interesting happens.
 const int kUciInfoMinimumFrequencyMs = 5000;
+// How often remote workers of distributed search report their stats.
+const int kRemoteReportIntervalMs = 100;
 
 MoveList MakeRootMoveFilter(const MoveList& searchmoves,
                             SyzygyTablebase* syzygy_tb,
@@ -102,6 +104,19 @@ class MEvaluator {
     }
   }
 
+  // Sets the moves left utility parameters of @scoring to the same as
+  // GetM() uses.
+  void SetScoring(PuctChildren::Scoring* scoring) const {
+    scoring->use_m = enabled_ && parent_within_threshold_;
+    if (!scoring->use_m) return;
+    scoring->parent_m = parent_m_;
+    scoring->m_slope = m_slope_;
+    scoring->m_cap = m_cap_;
+    scoring->a_constant = a_constant_;
+    scoring->a_linear = a_linear_;
+    scoring->a_square = a_square_;
+  }
+
   float GetM(const EdgeAndNode& child, float q) const {
     if (!enabled_ || !parent_within_threshold_) return 0.0f;
     const float child_m = child.GetM(parent_m_);
@@ -137,15 +152,70 @@ class MEvaluator {
 
 }  // namespace
 
+void SearchStats::Add(const SearchWorkerStats& worker) {
+  for (size_t i = 0; i < values_.size(); ++i) {
+    values_[i] += worker.values[i].load(std::memory_order_relaxed);
+  }
+}
+
+void SearchStats::Add(const SearchStats& other) {
+  for (size_t i = 0; i < values_.size(); ++i) values_[i] += other.values_[i];
+}
+
+std::string SearchStats::ToString() const {
+  using S = SearchWorkerStats;
+  static const std::pair<S::Counter, const char*> kStages[] = {
+      {S::kGatherNs, "gather"},     {S::kCollectCollisionsNs, "collisions"},
+      {S::kPrefetchNs, "prefetch"}, {S::kNNComputationNs, "nn"},
+      {S::kFetchNs, "fetch"},       {S::kBackupNs, "backup"},
+      {S::kUpdateCountersNs, "counters"}};
+  uint64_t total_ns = 0;
+  for (const auto& stage : kStages) total_ns += values_[stage.first];
+  auto percent = [](uint64_t value, uint64_t total) {
+    return total ? 100.0 * value / total : 0.0;
+  };
+
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(1)
+      << "worker time " << total_ns / 1000000 << "ms:";
+  for (const auto& stage : kStages) {
+    oss << " " << stage.second << " "
+        << percent(values_[stage.first], total_ns) << "%";
+  }
+  oss << "; nodes lock wait " << percent(values_[S::kNodesLockWaitNs], total_ns)
+      << "%, picking " << percent(values_[S::kPickNs], total_ns)
+      << "%, cache lock wait "
+      << percent(values_[S::kCacheLockWaitNs], total_ns)
+      << "%; cache hits "
+      << percent(values_[S::kCacheHits], values_[S::kNNQueries])
+      << "%, collisions "
+      << percent(values_[S::kCollisionVisits],
+                 values_[S::kCollisionVisits] + values_[S::kVisits])
+      << "% (" << values_[S::kCollisionEvents] << " events), "
+      << (values_[S::kPickDescents]
+              ? static_cast<double>(values_[S::kVisits]) /
+                    values_[S::kPickDescents]
+              : 0.0)
+      << " visits per descent";
+  if (values_[S::kNumaSamples] > 0 && Numa::GetNodeCount() > 1) {
+    oss << "; remote NUMA memory "
+        << percent(values_[S::kNumaRemoteSamples], values_[S::kNumaSamples])
+        << "% of " << values_[S::kNumaSamples] << " sampled nodes";
+  }
+  return oss.str();
+}
+
 Search::Search(const NodeTree& tree, Network* network,
                std::unique_ptr<UciResponder> uci_responder,
                const MoveList& searchmoves,
                std::chrono::steady_clock::time_point start_time,
                std::unique_ptr<SearchStopper> stopper, bool infinite,
                const OptionsDict& options, NNCache* cache,
-               SyzygyTablebase* syzygy_tb)
+               SyzygyTablebase* syzygy_tb, SearchThreadPool* thread_pool,
+               RemoteSearchWorkers* remote_workers)
     : ok_to_respond_bestmove_(!infinite),
       stopper_(std::move(stopper)),
+      thread_pool_(thread_pool),
       root_node_(tree.GetCurrentHead()),
       cache_(cache),
       syzygy_tb_(syzygy_tb),
@@ -158,6 +228,7 @@ Search::Search(const NodeTree& tree, Network* network,
       root_move_filter_(
           MakeRootMoveFilter(searchmoves_, syzygy_tb_, played_history_,
                              params_.GetSyzygyFastPlay(), &tb_hits_)),
+      remote_workers_(remote_workers),
       uci_responder_(std::move(uci_responder)) {
   if (params_.GetMaxConcurrentSearchers() != 0) {
     pending_searchers_.store(params_.GetMaxConcurrentSearchers(),
@@ -202,7 +273,7 @@ void Search::SendUciInfo() REQUIRES(nodes_mutex_) {
   common_info.seldepth = max_depth_;
   common_info.time = GetTimeSinceStart();
   if (!per_pv_counters) {
-    common_info.nodes = total_playouts_ + initial_visits_;
+    common_info.nodes = total_playouts_ + initial_visits_ + remote_playouts_;
   }
   if (display_cache_usage) {
     common_info.hashfull =
@@ -214,7 +285,8 @@ void Search::SendUciInfo() REQUIRES(nodes_mutex_) {
             std::chrono::steady_clock::now() - *nps_start_time_)
             .count();
     if (time_since_first_batch_ms > 0) {
-      common_info.nps = total_playouts_ * 1000 / time_since_first_batch_ms;
+      common_info.nps = (total_playouts_ + remote_playouts_) * 1000 /
+                        time_since_first_batch_ms;
     }
   }
   common_info.tb_hits = tb_hits_.load(std::memory_order_acquire);
@@ -295,6 +367,7 @@ void Search::MaybeOutputInfo() {
     if (params_.GetLogLiveStats()) {
       SendMovesStats();
     }
+    if (params_.GetSearchStats()) SendSearchStats();
     if (stop_.load(std::memory_order_acquire) && !ok_to_respond_bestmove_) {
       std::vector<ThinkingInfo> info(1);
       info.back().comment =
@@ -480,6 +553,19 @@ void Search::SendMovesStats() const REQUIRES(counters_mutex_) {
   }
 }
 
+void Search::SendSearchStats() const {
+  std::vector<ThinkingInfo> infos(1);
+  infos.back().comment = "search stats: " + GetSearchStats().ToString();
+  uci_responder_->OutputThinkingInfo(&infos);
+}
+
+SearchStats Search::GetSearchStats() const {
+  SearchStats result;
+  Mutex::Lock lock(worker_stats_mutex_);
+  for (const auto& stats : worker_stats_) result.Add(*stats);
+  return result;
+}
+
 NNCacheLock Search::GetCachedNNEval(const Node* node) const {
   if (!node) return {};
 
@@ -516,6 +602,7 @@ void Search::MaybeTriggerStop(const IterationStats& stats,
     SendUciInfo();
     EnsureBestMoveKnown();
     SendMovesStats();
+    if (params_.GetSearchStats()) SendSearchStats();
     BestMoveInfo info(final_bestmove_, final_pondermove_);
     uci_responder_->OutputBestMove(&info);
     stopper_->OnSearchDone(stats);
@@ -771,13 +858,48 @@ void Search::StartThreads(size_t how_many) {
   // First thread is a watchdog thread.
   if (threads_.size() == 0) {
     threads_.emplace_back([this]() { WatchdogThread(); });
+    if (remote_workers_) StartRemoteSearches();
+    if (params_.GetNumaRootPartition()) {
+      std::vector<int> worker_nodes;
+      for (size_t i = 0; i < how_many; i++) {
+        worker_nodes.push_back(
+            Numa::GetThreadNode(thread_pool_ ? pool_workers_started_ + i : i));
+      }
+      PartitionRootMovesByNuma(worker_nodes);
+    }
   }
   // Start working threads.
   for (size_t i = 0; i < how_many; i++) {
-    threads_.emplace_back([this, i]() {
-      SearchWorker worker(this, params_, i);
-      worker.RunBlocking();
-    });
+    SearchWorkerStats* stats = nullptr;
+    if (params_.GetSearchStats()) {
+      Mutex::Lock stats_lock(worker_stats_mutex_);
+      worker_stats_.push_back(std::make_unique<SearchWorkerStats>());
+      stats = worker_stats_.back().get();
+    }
+    if (thread_pool_) {
+      ++pool_workers_running_;
+      const size_t id = pool_workers_started_++;
+      thread_pool_->Run(id, [this, stats, id](SearchWorkerState* state) {
+        // The option may differ from the previous search on this thread.
+        Numa::BindThread(id, params_.GetNumaRootPartition());
+        {
+          SearchWorker worker(this, params_, stats, state,
+                              Numa::GetThreadNode(id));
+          worker.RunBlocking();
+        }
+        Mutex::Lock lock(threads_mutex_);
+        // Notify under the lock, as Wait() may destroy the search as soon as
+        // it can reacquire it.
+        if (--pool_workers_running_ == 0) pool_workers_cv_.notify_all();
+      });
+    } else {
+      threads_.emplace_back([this, i, stats]() {
+        Numa::BindThread(i, params_.GetNumaRootPartition());
+        SearchWorker worker(this, params_, stats, nullptr,
+                            Numa::GetThreadNode(i));
+        worker.RunBlocking();
+      });
+    }
   }
   LOGFILE << "Search started. "
           << std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -851,6 +973,18 @@ void Search::WatchdogThread() {
     MaybeTriggerStop(stats, &hints);
     MaybeOutputInfo();
 
+    // Workers wake the thread up when a stopper may trigger, or halfway
+    // through the estimated remaining playouts, so that smart pruning is
+    // still checked often.
+    const int64_t remaining_playouts = hints.GetEstimatedRemainingPlayouts();
+    remaining_playouts_hint_.store(remaining_playouts,
+                                   std::memory_order_relaxed);
+    const int64_t playouts = published_playouts_.load(std::memory_order_relaxed);
+    const int64_t wakeup_after = std::max<int64_t>(
+        1, std::min(hints.GetPlayoutsUntilCheck(), remaining_playouts / 2));
+    controller_wakeup_playouts_.store(playouts == 0 ? 1 : playouts + wakeup_after,
+                                      std::memory_order_relaxed);
+
     constexpr auto kMaxWaitTimeMs = 100;
     constexpr auto kMinWaitTimeMs = 1;
 
@@ -868,13 +1002,28 @@ void Search::WatchdogThread() {
     // mode during thinking.
     // Minimum wait time is there to prevent busy wait and other threads
     // starvation.
-    watchdog_cv_.wait_for(
-        lock.get_raw(), std::chrono::milliseconds(remaining_time),
-        [this]() { return stop_.load(std::memory_order_acquire); });
+    watchdog_cv_.wait_for(lock.get_raw(),
+                          std::chrono::milliseconds(remaining_time),
+                          [this]() NO_THREAD_SAFETY_ANALYSIS {
+                            return bestmove_is_sent_ ||
+                                   (stop_.load(std::memory_order_acquire) &&
+                                    ok_to_respond_bestmove_) ||
+                                   published_playouts_.load(
+                                       std::memory_order_relaxed) >=
+                                       controller_wakeup_playouts_.load(
+                                           std::memory_order_relaxed);
+                          });
   }
   LOGFILE << "End a watchdog thread.";
 }
 
+void Search::WakeUpController() {
+  // Taking the mutex makes sure that the controller is either waiting already
+  // or will see the new playouts when checking whether to wait.
+  { Mutex::Lock lock(counters_mutex_); }
+  watchdog_cv_.notify_all();
+}
+
 void Search::FireStopInternal() {
   stop_.store(true, std::memory_order_release);
   watchdog_cv_.notify_all();
@@ -888,6 +1037,7 @@ void Search::Stop() {
 }
 
 void Search::Abort() {
+  idle_prefetch_cancelled_.store(true, std::memory_order_release);
   Mutex::Lock lock(counters_mutex_);
   if (!stop_.load(std::memory_order_acquire) ||
       (!bestmove_is_sent_ && !ok_to_respond_bestmove_)) {
@@ -903,6 +1053,19 @@ void Search::Wait() {
     threads_.back().join();
     threads_.pop_back();
   }
+  pool_workers_cv_.wait(lock.get_raw(),
+                        [this]() NO_THREAD_SAFETY_ANALYSIS {
+                          return pool_workers_running_ == 0;
+                        });
+}
+
+void Search::RunIdlePrefetch(int max_positions) {
+  // The watchdog thread only exits after bestmove is sent, so the best move is
+  // known when the search threads are done, unless the search was aborted.
+  Wait();
+  if (idle_prefetch_cancelled_.load(std::memory_order_acquire)) return;
+  SearchWorker worker(this, params_, nullptr, nullptr, 0);
+  worker.RunIdlePrefetch(max_positions);
 }
 
 void Search::CancelSharedCollisions() REQUIRES(nodes_mutex_) {
@@ -916,14 +1079,241 @@ void Search::CancelSharedCollisions() REQUIRES(nodes_mutex_) {
   shared_collisions_.clear();
 }
 
-Search::~Search() {
+MoveList Search::GetRootMovesByPrior() const {
+  std::vector<std::pair<float, Move>> moves;
+  {
+    SharedMutex::SharedLock lock(nodes_mutex_);
+    auto is_allowed = [this](Move move) {
+      return root_move_filter_.empty() ||
+             std::find(root_move_filter_.begin(), root_move_filter_.end(),
+                       move) != root_move_filter_.end();
+    };
+    if (root_node_->HasChildren()) {
+      for (const auto& edge : root_node_->Edges()) {
+        if (is_allowed(edge.GetMove())) {
+          moves.emplace_back(edge.GetP(), edge.GetMove());
+        }
+      }
+    } else {
+      const auto& board = played_history_.Last().GetBoard();
+      for (const auto move : board.GenerateLegalMoves()) {
+        if (is_allowed(move)) moves.emplace_back(0.0f, move);
+      }
+    }
+  }
+  std::stable_sort(
+      moves.begin(), moves.end(),
+      [](const auto& a, const auto& b) { return a.first > b.first; });
+  MoveList result;
+  for (const auto& move : moves) result.push_back(move.second);
+  return result;
+}
+
+void Search::StartRemoteSearches() REQUIRES(threads_mutex_) {
+  // Dealing the moves round robin gives every process a mix of promising and
+  // unlikely moves.
+  const MoveList moves = GetRootMovesByPrior();
+
+  std::vector<int> workers;
+  for (int i = 0; i < remote_workers_->GetWorkerCount(); i++) {
+    if (remote_workers_->IsConnected(i)) workers.push_back(i);
+  }
+  if (workers.empty() || moves.size() < 2) return;
+  std::vector<MoveList> shares(workers.size() + 1);
+  for (size_t i = 0; i < moves.size(); i++) {
+    shares[i % shares.size()].push_back(moves[i]);
+  }
+
+  MoveList local_moves = shares[0];
+  const bool flip = played_history_.IsBlackToMove();
+  for (size_t i = 0; i < workers.size(); i++) {
+    const MoveList& share = shares[i + 1];
+    if (share.empty()) continue;
+    std::vector<std::string> searchmoves;
+    for (Move move : share) {
+      if (flip) move.Mirror();
+      searchmoves.push_back(move.as_string());
+    }
+    try {
+      remote_workers_->StartSearch(workers[i], searchmoves,
+                                   kRemoteReportIntervalMs);
+      remote_shares_.push_back({workers[i], share});
+    } catch (Exception& e) {
+      // The moves of a failed worker are searched locally.
+      CERR << "Search worker " << workers[i] << " failed: " << e.what();
+      local_moves.insert(local_moves.end(), share.begin(), share.end());
+    }
+  }
+  if (remote_shares_.empty()) return;
+  local_root_moves_ = local_moves;
+  for (size_t i = 0; i < remote_shares_.size(); i++) {
+    threads_.emplace_back([this, i]() { RemoteWorkerThread(i); });
+  }
+  LOGFILE << "Distributed search: " << local_root_moves_.size()
+          << " root moves searched locally, "
+          << moves.size() - local_root_moves_.size() << " by "
+          << remote_shares_.size() << " workers.";
+}
+
+void Search::PartitionRootMovesByNuma(const std::vector<int>& worker_nodes) {
+  std::vector<int> nodes(worker_nodes);
+  std::sort(nodes.begin(), nodes.end());
+  nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+  if (nodes.size() < 2) return;
+  // As for remote workers, every node gets a mix of promising and unlikely
+  // moves.
+  const MoveList moves =
+      local_root_moves_.empty() ? GetRootMovesByPrior() : local_root_moves_;
+  if (moves.size() < nodes.size()) return;
+  numa_root_moves_.assign(Numa::GetNodeCount(), MoveList());
+  for (size_t i = 0; i < moves.size(); i++) {
+    numa_root_moves_[nodes[i % nodes.size()]].push_back(moves[i]);
+  }
+  LOGFILE << "Root moves split among " << nodes.size() << " NUMA nodes.";
+}
+
+const MoveList& Search::GetWorkerRootMoves(int numa_node) const {
+  if (!numa_root_moves_.empty() && !numa_root_moves_[numa_node].empty()) {
+    return numa_root_moves_[numa_node];
+  }
+  return local_root_moves_.empty() ? root_move_filter_ : local_root_moves_;
+}
+
+void Search::RemoteWorkerThread(int share) {
+  const int worker = remote_shares_[share].worker;
+  std::vector<RemoteMoveStats> stats;
+  uint64_t nodes = 0;
+  bool stop_sent = false;
+  try {
+    while (true) {
+      const bool final =
+          !remote_workers_->ReceiveReport(worker, &nodes, &stats);
+      ApplyRemoteStats(share, nodes, stats);
+      if (final) break;
+      if (!stop_sent && !IsSearchActive()) {
+        remote_workers_->StopSearch(worker);
+        stop_sent = true;
+      }
+    }
+  } catch (Exception& e) {
+    // The last stats of the worker stay in the tree.
+    CERR << "Search worker " << worker << " failed: " << e.what();
+  }
+}
+
+void Search::ApplyRemoteStats(int share, uint64_t nodes,
+                              const std::vector<RemoteMoveStats>& stats) {
+  SharedMutex::Lock lock(nodes_mutex_);
+  auto& remote_share = remote_shares_[share];
+  remote_playouts_ += nodes - remote_share.playouts;
+  remote_share.playouts = nodes;
+  if (!root_node_->HasChildren()) return;
+  const size_t count = std::min(stats.size(), remote_share.moves.size());
+  for (size_t i = 0; i < count; i++) {
+    const Move move = remote_share.moves[i];
+    for (auto& edge : root_node_->Edges()) {
+      if (!(edge.GetMove() == move)) continue;
+      Node* node = edge.GetOrSpawnNode(root_node_);
+      // Terminal stats are exact already.
+      if (node->IsTerminal()) break;
+      if (std::none_of(
+              remote_overridden_stats_.begin(), remote_overridden_stats_.end(),
+              [move](const RootChildStats& s) { return s.move == move; })) {
+        remote_overridden_stats_.push_back({move, node->GetN(), node->GetWL(),
+                                            node->GetD(), node->GetM()});
+      }
+      node->SetStats(stats[i].n, stats[i].wl, stats[i].d, stats[i].m);
+      break;
+    }
+  }
+  current_best_edge_ = GetBestChildNoTemperature(root_node_, 0);
+}
+
+void Search::RestoreRemoteStats() REQUIRES(nodes_mutex_) {
+  for (const auto& original : remote_overridden_stats_) {
+    for (auto& edge : root_node_->Edges()) {
+      if (!(edge.GetMove() == original.move)) continue;
+      edge.node()->SetStats(original.n, original.wl, original.d, original.m);
+      break;
+    }
+  }
+  remote_overridden_stats_.clear();
+}
+
+std::vector<RemoteMoveStats> Search::GetRootMoveStats(
+    const MoveList& moves) const {
+  std::vector<RemoteMoveStats> result(moves.size(), RemoteMoveStats{});
+  SharedMutex::SharedLock lock(nodes_mutex_);
+  for (const auto& edge : root_node_->Edges()) {
+    const auto it = std::find(moves.begin(), moves.end(), edge.GetMove());
+    if (it == moves.end() || edge.GetN() == 0) continue;
+    result[it - moves.begin()] = {edge.GetN(), edge.GetWL(0.0f),
+                                  edge.GetD(0.0f), edge.GetM(0.0f)};
+  }
+  return result;
+}
+
+void Search::ReleaseTree() {
   Abort();
   Wait();
+  SharedMutex::Lock lock(nodes_mutex_);
+  CancelSharedCollisions();
+  RestoreRemoteStats();
+}
+
+Search::~Search() {
+  ReleaseTree();
+  LOGFILE << "Search destroyed.";
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// SearchThreadPool
+//////////////////////////////////////////////////////////////////////////////
+
+SearchThreadPool::~SearchThreadPool() {
+  std::vector<std::unique_ptr<Thread>> threads;
   {
-    SharedMutex::Lock lock(nodes_mutex_);
-    CancelSharedCollisions();
+    Mutex::Lock lock(mutex_);
+    stop_ = true;
+    threads.swap(threads_);
+  }
+  cv_.notify_all();
+  for (auto& thread : threads) thread->thread.join();
+}
+
+void SearchThreadPool::Run(size_t id,
+                           std::function<void(SearchWorkerState*)> task) {
+  {
+    Mutex::Lock lock(mutex_);
+    while (threads_.size() <= id) {
+      threads_.push_back(std::make_unique<Thread>());
+      Thread* thread = threads_.back().get();
+      const int thread_id = threads_.size() - 1;
+      thread->thread = std::thread([this, thread, thread_id]() {
+        Numa::BindThread(thread_id);
+        ThreadLoop(thread);
+      });
+    }
+    threads_[id]->tasks.push_back(std::move(task));
+  }
+  cv_.notify_all();
+}
+
+void SearchThreadPool::ThreadLoop(Thread* thread) {
+  while (true) {
+    std::function<void(SearchWorkerState*)> task;
+    {
+      Mutex::Lock lock(mutex_);
+      cv_.wait(lock.get_raw(), [this, thread]() NO_THREAD_SAFETY_ANALYSIS {
+        return stop_ || !thread->tasks.empty();
+      });
+      // Queued tasks still run when the pool is being destroyed.
+      if (thread->tasks.empty()) return;
+      task = std::move(thread->tasks.front());
+      thread->tasks.pop_front();
+    }
+    task(&thread->state);
   }
-  LOGFILE << "Search destroyed.";
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -931,6 +1321,10 @@ Search::~Search() {
 //////////////////////////////////////////////////////////////////////////////
 
 void SearchWorker::ExecuteOneIteration() {
+  stage_start_ = StatsNow();
+  const auto iteration_start = minibatch_controller_
+                                   ? std::chrono::steady_clock::now()
+                                   : std::chrono::steady_clock::time_point();
   // 1. Initialize internal structures.
   InitializeIteration(search_->network_->NewComputation());
 
@@ -958,9 +1352,11 @@ void SearchWorker::ExecuteOneIteration() {
 
   // 2. Gather minibatch.
   GatherMinibatch();
+  EndStage(SearchWorkerStats::kGatherNs);
 
   // 2b. Collect collisions.
   CollectCollisions();
+  EndStage(SearchWorkerStats::kCollectCollisionsNs);
 
   // 3. Prefetch into cache.
   MaybePrefetchIntoCache();
@@ -969,17 +1365,47 @@ void SearchWorker::ExecuteOneIteration() {
     search_->pending_searchers_.fetch_add(1, std::memory_order_acq_rel);
   }
 
+  EndStage(SearchWorkerStats::kPrefetchNs);
+
   // 4. Run NN computation.
+  const auto nn_start = minibatch_controller_
+                            ? std::chrono::steady_clock::now()
+                            : std::chrono::steady_clock::time_point();
   RunNNComputation();
+  EndStage(SearchWorkerStats::kNNComputationNs);
+  if (minibatch_controller_) {
+    iteration_.nn_seconds = std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - nn_start)
+                                .count();
+  }
 
   // 5. Retrieve NN computations (and terminal values) into nodes.
   FetchMinibatchResults();
+  EndStage(SearchWorkerStats::kFetchNs);
 
   // 6. Propagate the new nodes' information to all their parents in the tree.
   DoBackupUpdate();
+  EndStage(SearchWorkerStats::kBackupNs);
 
   // 7. Update the Search's status and progress information.
   UpdateCounters();
+  EndStage(SearchWorkerStats::kUpdateCountersNs);
+  AddStatsCount(SearchWorkerStats::kCacheLockWaitNs,
+                computation_->GetCacheLockWaitNs());
+
+  if (minibatch_controller_) {
+    iteration_.visits = number_out_of_order_;
+    for (const auto& node_to_process : minibatch_) {
+      if (!node_to_process.IsCollision()) {
+        iteration_.visits += node_to_process.multivisit;
+      }
+    }
+    iteration_.out_of_order = number_out_of_order_;
+    iteration_.seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - iteration_start)
+                             .count();
+    minibatch_controller_->AddIteration(iteration_);
+  }
 
   // If required, waste time to limit nps.
   if (params_.GetNpsLimit() > 0) {
@@ -1002,8 +1428,8 @@ void SearchWorker::ExecuteOneIteration() {
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void SearchWorker::InitializeIteration(
     std::unique_ptr<NetworkComputation> computation) {
-  computation_ = std::make_unique<CachingComputation>(std::move(computation),
-                                                      search_->cache_);
+  computation_ = std::make_unique<CachingComputation>(
+      std::move(computation), search_->cache_, stats_ != nullptr);
   minibatch_.clear();
 }
 
@@ -1012,65 +1438,52 @@ void SearchWorker::InitializeIteration(
 void SearchWorker::GatherMinibatch() {
   // Total number of nodes to process.
   int minibatch_size = 0;
-  int collision_events_left = params_.GetMaxCollisionEvents();
+  const int max_minibatch_size = minibatch_controller_
+                                     ? minibatch_controller_->GetMiniBatchSize()
+                                     : params_.GetMiniBatchSize();
+  int collision_events_left =
+      minibatch_controller_ ? minibatch_controller_->GetMaxCollisionEvents()
+                            : params_.GetMaxCollisionEvents();
   int collisions_left = params_.GetMaxCollisionVisitsId();
+  iteration_ = MinibatchController::Iteration();
 
   // Number of nodes processed out of order.
   number_out_of_order_ = 0;
 
+  if (params_.GetBatchedPick()) {
+    GatherMinibatchBatched(max_minibatch_size, collision_events_left,
+                           collisions_left);
+    return;
+  }
+
   // Gather nodes to process in the current batch.
   // If we had too many nodes out of order, also interrupt the iteration so
   // that search can exit.
-  while (minibatch_size < params_.GetMiniBatchSize() &&
+  while (minibatch_size < max_minibatch_size &&
          number_out_of_order_ < params_.GetMaxOutOfOrderEvals()) {
     // If there's something to process without touching slow neural net, do it.
     if (minibatch_size > 0 && computation_->GetCacheMisses() == 0) return;
     // Pick next node to extend.
+    const auto pick_start = StatsNow();
     minibatch_.emplace_back(PickNodeToExtend(collisions_left));
+    AddStatsTime(SearchWorkerStats::kPickNs, pick_start);
+    AddStatsCount(SearchWorkerStats::kPickDescents, 1);
     auto& picked_node = minibatch_.back();
-    auto* node = picked_node.node;
 
     // There was a collision. If limit has been reached, return, otherwise
     // just start search of another node.
     if (picked_node.IsCollision()) {
-      if (--collision_events_left <= 0) return;
-      if ((collisions_left -= picked_node.multivisit) <= 0) return;
+      if (!CountCollision(picked_node, &collision_events_left,
+                          &collisions_left)) {
+        return;
+      }
       if (search_->stop_.load(std::memory_order_acquire)) return;
       continue;
     }
     ++minibatch_size;
 
-    // If node is already known as terminal (win/loss/draw according to rules
-    // of the game), it means that we already visited this node before.
-    if (picked_node.IsExtendable()) {
-      // Node was never visited, extend it.
-      ExtendNode(node, picked_node.depth);
-
-      // Only send non-terminal nodes to a neural network.
-      if (!node->IsTerminal()) {
-        picked_node.nn_queried = true;
-        int transform;
-        picked_node.is_cache_hit = AddNodeToComputation(node, true, &transform);
-        picked_node.probability_transform = transform;
-      }
-    }
-
-    // If out of order eval is enabled and the node to compute we added last
-    // doesn't require NN eval (i.e. it's a cache hit or terminal node), do
-    // out of order eval for it.
-    if (params_.GetOutOfOrderEval() && picked_node.CanEvalOutOfOrder()) {
-      // Perform out of order eval for the last entry in minibatch_.
-      FetchSingleNodeResult(&picked_node, computation_->GetBatchSize() - 1);
-      {
-        // Nodes mutex for doing node updates.
-        SharedMutex::Lock lock(search_->nodes_mutex_);
-        DoBackupUpdateSingleNode(picked_node);
-      }
-
-      // Remove last entry in minibatch_, as it has just been
-      // processed.
-      // If NN eval was already processed out of order, remove it.
-      if (picked_node.nn_queried) computation_->PopCacheHit();
+    if (ProcessPickedNode(&picked_node)) {
+      // Remove last entry in minibatch_, as it has just been processed.
       minibatch_.pop_back();
       --minibatch_size;
       ++number_out_of_order_;
@@ -1080,6 +1493,99 @@ void SearchWorker::GatherMinibatch() {
   }
 }
 
+void SearchWorker::GatherMinibatchBatched(int max_minibatch_size,
+                                          int collision_events_left,
+                                          int collisions_left) {
+  int minibatch_size = 0;
+  // Usually one descent fills the batch. Another one is needed when there
+  // were collisions or out of order evals.
+  while (minibatch_size < max_minibatch_size &&
+         number_out_of_order_ < params_.GetMaxOutOfOrderEvals()) {
+    const size_t first_picked = minibatch_.size();
+    PickNodesToExtend(max_minibatch_size - minibatch_size);
+
+    bool collision_limit_hit = false;
+    bool picked_visits = false;
+    size_t kept = first_picked;
+    for (size_t i = first_picked; i < minibatch_.size(); ++i) {
+      auto& picked_node = minibatch_[i];
+      if (picked_node.IsCollision()) {
+        // All collisions of the descent are kept, they are in flight already.
+        collision_limit_hit |= !CountCollision(
+            picked_node, &collision_events_left, &collisions_left);
+      } else {
+        picked_visits = true;
+        if (ProcessPickedNode(&picked_node)) {
+          ++number_out_of_order_;
+          continue;
+        }
+        ++minibatch_size;
+      }
+      if (kept != i) minibatch_[kept] = picked_node;
+      ++kept;
+    }
+    minibatch_.erase(minibatch_.begin() + kept, minibatch_.end());
+
+    if (collision_limit_hit || !picked_visits) return;
+    if (search_->stop_.load(std::memory_order_acquire)) return;
+  }
+}
+
+bool SearchWorker::CountCollision(const NodeToProcess& collision,
+                                  int* events_left, int* visits_left) {
+  AddStatsCount(SearchWorkerStats::kCollisionEvents, 1);
+  AddStatsCount(SearchWorkerStats::kCollisionVisits, collision.multivisit);
+  ++iteration_.collision_events;
+  if (--*events_left <= 0) {
+    iteration_.collision_limit_hit = true;
+    return false;
+  }
+  return (*visits_left -= collision.multivisit) > 0;
+}
+
+bool SearchWorker::ProcessPickedNode(NodeToProcess* picked_node) {
+  Node* node = picked_node->node;
+  AddStatsCount(SearchWorkerStats::kVisits, picked_node->multivisit);
+
+  // If node is already known as terminal (win/loss/draw according to rules
+  // of the game), it means that we already visited this node before.
+  if (picked_node->IsExtendable()) {
+    // Node was never visited, extend it.
+    ExtendNode(node, picked_node->depth);
+
+    // Only send non-terminal nodes to a neural network.
+    if (!node->IsTerminal()) {
+      picked_node->nn_queried = true;
+      int transform;
+      picked_node->is_cache_hit = AddNodeToComputation(node, true, &transform);
+      picked_node->probability_transform = transform;
+      AddStatsCount(SearchWorkerStats::kNNQueries, 1);
+      if (picked_node->is_cache_hit) {
+        AddStatsCount(SearchWorkerStats::kCacheHits, 1);
+      }
+    }
+  }
+
+  // If out of order eval is enabled and the node to compute we added last
+  // doesn't require NN eval (i.e. it's a cache hit or terminal node), do
+  // out of order eval for it.
+  if (!params_.GetOutOfOrderEval() || !picked_node->CanEvalOutOfOrder()) {
+    return false;
+  }
+  // Perform out of order eval for the last entry in computation_.
+  FetchSingleNodeResult(picked_node, computation_->GetBatchSize() - 1);
+  {
+    // Nodes mutex for doing node updates.
+    const auto wait_start = StatsNow();
+    SharedMutex::Lock lock(search_->nodes_mutex_);
+    AddStatsTime(SearchWorkerStats::kNodesLockWaitNs, wait_start);
+    DoBackupUpdateSingleNode(*picked_node);
+  }
+  // If NN eval was already processed out of order, remove it.
+  if (picked_node->nn_queried) computation_->PopCacheHit();
+  return true;
+}
+
 namespace {
 void IncrementNInFlight(Node* node, Node* root, int amount) {
   if (amount == 0) return;
@@ -1091,6 +1597,21 @@ void IncrementNInFlight(Node* node, Node* root, int amount) {
 }
 }  // namespace
 
+void SearchWorker::MaybeSampleNumaNode(const Node* node) {
+  // Asking the kernel for every node would be too slow.
+  constexpr int kNumaSampleInterval = 256;
+  if (--numa_sample_countdown_ > 0) return;
+  numa_sample_countdown_ = kNumaSampleInterval;
+  // Threads run on their NUMA node only with root partition.
+  if (!params_.GetNumaRootPartition()) return;
+  const int memory_node = Numa::GetMemoryNode(node);
+  if (memory_node < 0) return;
+  AddStatsCount(SearchWorkerStats::kNumaSamples, 1);
+  if (memory_node != numa_node_) {
+    AddStatsCount(SearchWorkerStats::kNumaRemoteSamples, 1);
+  }
+}
+
 // Returns node and whether there's been a search collision on the node.
 SearchWorker::NodeToProcess SearchWorker::PickNodeToExtend(
     int collision_limit) {
@@ -1100,24 +1621,17 @@ SearchWorker::NodeToProcess SearchWorker::PickNodeToExtend(
 
   Node* node = search_->root_node_;
   Node::Iterator best_edge;
-  Node::Iterator second_best_edge;
-
-  // Precache a newly constructed node to avoid memory allocations being
-  // performed while the mutex is held.
-  if (!precached_node_) {
-    precached_node_ = std::make_unique<Node>(nullptr, 0);
-  }
 
+  const auto wait_start = StatsNow();
   SharedMutex::Lock lock(search_->nodes_mutex_);
+  AddStatsTime(SearchWorkerStats::kNodesLockWaitNs, wait_start);
 
-  // Fetch the current best root node visits for possible smart pruning.
-  const int64_t best_node_n = search_->current_best_edge_.GetN();
+  const auto root_filter = GetRootPickFilter();
 
   // True on first iteration, false as we dive deeper.
   bool is_root_node = true;
   const float even_draw_score = search_->GetDrawScore(false);
   const float odd_draw_score = search_->GetDrawScore(true);
-  const auto& root_move_filter = search_->root_move_filter_;
   uint16_t depth = 0;
   bool node_already_updated = true;
   auto m_evaluator = moves_left_support_ ? MEvaluator(params_) : MEvaluator();
@@ -1131,8 +1645,9 @@ SearchWorker::NodeToProcess SearchWorker::PickNodeToExtend(
     //            (!is_root_node)"), but that would mean extra mutex lock.
     //            Will revisit that after rethinking locking strategy.
     if (!node_already_updated) {
-      node = best_edge.GetOrSpawnNode(/* parent */ node, &precached_node_);
+      node = best_edge.GetOrSpawnNode(/* parent */ node);
     }
+    if (stats_) MaybeSampleNumaNode(node);
     best_edge.Reset();
     depth++;
 
@@ -1150,38 +1665,7 @@ SearchWorker::NodeToProcess SearchWorker::PickNodeToExtend(
     if (node->IsTerminal()) {
       // Probably best place to check for two-fold draws consistently.
       // Depth starts with 1 at root, so real depth is depth - 1.
-      // Check whether first repetition was before root. If yes, remove
-      // terminal status of node and revert all visits in the tree.
-      // Length of repetition was stored in m_. This code will only do
-      // something when tree is reused and twofold visits need to be reverted.
-      if (node->IsTwoFoldTerminal() && depth - 1 < node->GetM()) {
-        int depth_counter = 0;
-        // Cache node's values as we reset them in the process. We could
-        // manually set wl and d, but if we want to reuse this for reverting
-        // other terminal nodes this is the way to go.
-        const auto wl = node->GetWL();
-        const auto d = node->GetD();
-        const auto m = node->GetM();
-        const auto terminal_visits = node->GetN();
-        for (Node* node_to_revert = node; node_to_revert != nullptr;
-             node_to_revert = node_to_revert->GetParent()) {
-          // Revert all visits on twofold draw when making it non terminal.
-          node_to_revert->RevertTerminalVisits(wl, d, m + (float)depth_counter,
-                                               terminal_visits);
-          depth_counter++;
-          // Even if original tree still exists, we don't want to revert more
-          // than until new root.
-          if (depth_counter > depth - 1) break;
-          // If wl != 0, we would have to switch signs at each depth.
-        }
-        // Mark the prior twofold draw as non terminal to extend it again.
-        node->MakeNotTerminal();
-        // When reverting the visits, we also need to revert the initial
-        // visits, as we reused fewer nodes than anticipated.
-        search_->initial_visits_ -= terminal_visits;
-        // Max depth doesn't change when reverting the visits, and cum_depth_
-        // only counts the average depth of new nodes, not reused ones.
-      } else {
+      if (!MaybeRevertTwoFoldDraw(node, depth)) {
         return NodeToProcess::Visit(node, depth);
       }
     }
@@ -1207,9 +1691,6 @@ SearchWorker::NodeToProcess SearchWorker::PickNodeToExtend(
     const float cpuct = ComputeCpuct(params_, node->GetN(), is_root_node);
     const float puct_mult =
         cpuct * std::sqrt(std::max(node->GetChildrenVisits(), 1u));
-    float best = std::numeric_limits<float>::lowest();
-    float best_without_u = std::numeric_limits<float>::lowest();
-    float second_best = std::numeric_limits<float>::lowest();
     // Root depth is 1 here, while for GetDrawScore() it's 0-based, that's why
     // the weirdness.
     const float draw_score =
@@ -1217,53 +1698,61 @@ SearchWorker::NodeToProcess SearchWorker::PickNodeToExtend(
     const float fpu = GetFpu(params_, node, is_root_node, draw_score);
 
     m_evaluator.SetParent(node);
-    bool can_exit = false;
-    for (auto child : node->Edges()) {
-      if (is_root_node) {
-        // If there's no chance to catch up to the current best node with
-        // remaining playouts, don't consider it.
-        // best_move_node_ could have changed since best_node_n was retrieved.
-        // To ensure we have at least one node to expand, always include
-        // current best node.
-        if (child != search_->current_best_edge_ &&
-            latest_time_manager_hints_.GetEstimatedRemainingPlayouts() <
-                best_node_n - child.GetN()) {
-          continue;
+    float best_without_u = std::numeric_limits<float>::lowest();
+    float second_best = std::numeric_limits<float>::lowest();
+    int num_scored = 0;
+    // Nodes with many visits keep the stats of their children in arrays, which
+    // are scored all at once. They don't know which root moves are excluded.
+    const PuctChildren* solid_children = node->GetSolidChildren();
+    if (!solid_children && node->GetN() >= params_.GetSolidTreeThreshold()) {
+      node->MakeSolid();
+      solid_children = node->GetSolidChildren();
+    }
+    if (solid_children &&
+        (!is_root_node || !MayExcludeRootEdges(root_filter))) {
+      PuctChildren::Scoring scoring{puct_mult, fpu, draw_score};
+      m_evaluator.SetScoring(&scoring);
+      // The same children as the loop below scores.
+      num_scored = std::min(solid_children->size(),
+                            solid_children->FirstUnstarted() + 2);
+      const auto top2 = solid_children->FindTop2(scoring, num_scored);
+      assert(top2.best >= 0);
+      best_edge = node->GetEdgeAt(top2.best);
+      best_without_u = solid_children->GetScoreWithoutU(top2.best, scoring);
+      second_best = top2.second_best_score;
+    } else {
+      float best = std::numeric_limits<float>::lowest();
+      bool can_exit = false;
+      for (auto child : node->Edges()) {
+        if (is_root_node && IsRootEdgeExcluded(child, root_filter)) continue;
+
+        const float Q = child.GetQ(fpu, draw_score);
+        const float M = m_evaluator.GetM(child, Q);
+
+        const float score = child.GetU(puct_mult) + Q + M;
+        if (score > best) {
+          second_best = best;
+          best = score;
+          best_without_u = Q + M;
+          best_edge = child;
+        } else if (score > second_best) {
+          second_best = score;
         }
-        // If root move filter exists, make sure move is in the list.
-        if (!root_move_filter.empty() &&
-            std::find(root_move_filter.begin(), root_move_filter.end(),
-                      child.GetMove()) == root_move_filter.end()) {
-          continue;
+        ++num_scored;
+        if (can_exit) break;
+        if (child.GetNStarted() == 0) {
+          // One more loop will get 2 unvisited nodes, which is sufficient to
+          // ensure second best is correct. This relies upon the fact that
+          // edges are sorted in policy decreasing order.
+          can_exit = true;
         }
       }
-
-      const float Q = child.GetQ(fpu, draw_score);
-      const float M = m_evaluator.GetM(child, Q);
-
-      const float score = child.GetU(puct_mult) + Q + M;
-      if (score > best) {
-        second_best = best;
-        second_best_edge = best_edge;
-        best = score;
-        best_without_u = Q + M;
-        best_edge = child;
-      } else if (score > second_best) {
-        second_best = score;
-        second_best_edge = child;
-      }
-      if (can_exit) break;
-      if (child.GetNStarted() == 0) {
-        // One more loop will get 2 unvisited nodes, which is sufficient to
-        // ensure second best is correct. This relies upon the fact that edges
-        // are sorted in policy decreasing order.
-        can_exit = true;
-      }
     }
 
-    if (second_best_edge) {
-      int estimated_visits_to_change_best =
-          best_edge.GetVisitsToReachU(second_best, puct_mult, best_without_u);
+    // Whether there's a second child.
+    if (num_scored > 1) {
+      int estimated_visits_to_change_best = best_edge.GetVisitsToReachU(
+          second_best, puct_mult, best_without_u);
       // Only cache for n-2 steps as the estimate created by GetVisitsToReachU
       // has potential rounding errors and some conservative logic that can push
       // it up to 2 away from the real value.
@@ -1272,13 +1761,193 @@ SearchWorker::NodeToProcess SearchWorker::PickNodeToExtend(
       collision_limit =
           std::min(collision_limit, estimated_visits_to_change_best);
       assert(collision_limit >= 1);
-      second_best_edge.Reset();
     }
 
     is_root_node = false;
   }
 }
 
+SearchWorker::RootPickFilter SearchWorker::GetRootPickFilter() const {
+  // Root moves may be split among processes and among NUMA nodes.
+  const auto& moves = search_->GetWorkerRootMoves(numa_node_);
+  // Fetch the current best root node visits for possible smart pruning.
+  return {search_->current_best_edge_.GetN(), moves,
+          &moves != &search_->root_move_filter_};
+}
+
+bool SearchWorker::MayExcludeRootEdges(const RootPickFilter& filter) const {
+  // See IsRootEdgeExcluded(), edges have at least 0 visits.
+  if (!filter.moves.empty()) return true;
+  return !filter.partitioned &&
+         search_->remaining_playouts_hint_.load(std::memory_order_relaxed) <
+             filter.best_node_n;
+}
+
+bool SearchWorker::IsRootEdgeExcluded(const EdgeAndNode& edge,
+                                      const RootPickFilter& filter) const {
+  // If there's no chance to catch up to the current best node with
+  // remaining playouts, don't consider it.
+  // best_move_node_ could have changed since best_node_n was retrieved.
+  // To ensure we have at least one node to expand, always include
+  // current best node.
+  // Not done with split root moves, where other playouts catch up too.
+  if (!filter.partitioned && edge != search_->current_best_edge_ &&
+      search_->remaining_playouts_hint_.load(std::memory_order_relaxed) <
+          filter.best_node_n - edge.GetN()) {
+    return true;
+  }
+  // If root move filter exists, make sure move is in the list.
+  return !filter.moves.empty() &&
+         std::find(filter.moves.begin(), filter.moves.end(), edge.GetMove()) ==
+             filter.moves.end();
+}
+
+bool SearchWorker::MaybeRevertTwoFoldDraw(Node* node, int depth) {
+  // Check whether first repetition was before root. If yes, remove
+  // terminal status of node and revert all visits in the tree.
+  // Length of repetition was stored in m_. This code will only do
+  // something when tree is reused and twofold visits need to be reverted.
+  if (!node->IsTwoFoldTerminal() || depth - 1 >= node->GetM()) return false;
+  int depth_counter = 0;
+  // Cache node's values as we reset them in the process. We could
+  // manually set wl and d, but if we want to reuse this for reverting
+  // other terminal nodes this is the way to go.
+  const auto wl = node->GetWL();
+  const auto d = node->GetD();
+  const auto m = node->GetM();
+  const auto terminal_visits = node->GetN();
+  for (Node* node_to_revert = node; node_to_revert != nullptr;
+       node_to_revert = node_to_revert->GetParent()) {
+    // Revert all visits on twofold draw when making it non terminal.
+    node_to_revert->RevertTerminalVisits(wl, d, m + (float)depth_counter,
+                                         terminal_visits);
+    depth_counter++;
+    // Even if original tree still exists, we don't want to revert more
+    // than until new root.
+    if (depth_counter > depth - 1) break;
+    // If wl != 0, we would have to switch signs at each depth.
+  }
+  // Mark the prior twofold draw as non terminal to extend it again.
+  node->MakeNotTerminal();
+  // When reverting the visits, we also need to revert the initial
+  // visits, as we reused fewer nodes than anticipated.
+  search_->initial_visits_ -= terminal_visits;
+  // Max depth doesn't change when reverting the visits, and cum_depth_
+  // only counts the average depth of new nodes, not reused ones.
+  return true;
+}
+
+void SearchWorker::PickNodesToExtend(int visits) {
+  const auto pick_start = StatsNow();
+  SharedMutex::Lock lock(search_->nodes_mutex_);
+  AddStatsTime(SearchWorkerStats::kNodesLockWaitNs, pick_start);
+  PickNodesToExtendFrom(search_->root_node_, visits, 1, GetRootPickFilter());
+  AddStatsTime(SearchWorkerStats::kPickNs, pick_start);
+  AddStatsCount(SearchWorkerStats::kPickDescents, 1);
+}
+
+void SearchWorker::PickNodesToExtendFrom(Node* node, int visits,
+                                         uint16_t depth,
+                                         const RootPickFilter& root_filter) {
+  if (stats_) MaybeSampleNumaNode(node);
+  // Like in Node::TryStartScoreUpdate(), a node which is being extended is a
+  // collision. The visits stay in flight in the ancestors until collisions
+  // are cancelled.
+  if (node->GetN() == 0 && node->GetNInFlight() > 0) {
+    minibatch_.push_back(NodeToProcess::Collision(node, depth, visits));
+    return;
+  }
+  node->IncrementNInFlight(visits);
+  // A terminal node takes all the visits at once.
+  if (node->IsTerminal() && !MaybeRevertTwoFoldDraw(node, depth)) {
+    minibatch_.push_back(NodeToProcess::Visit(node, depth, visits));
+    return;
+  }
+  // An unexamined leaf is extended once, other visits to it are collisions.
+  if (!node->HasChildren()) {
+    minibatch_.push_back(NodeToProcess::Visit(node, depth));
+    if (visits > 1) {
+      node->CancelScoreUpdate(visits - 1);
+      minibatch_.push_back(NodeToProcess::Collision(node, depth, visits - 1));
+    }
+    return;
+  }
+
+  const bool is_root_node = node == search_->root_node_;
+  const float cpuct = ComputeCpuct(params_, node->GetN(), is_root_node);
+  const float puct_mult =
+      cpuct * std::sqrt(std::max(node->GetChildrenVisits(), 1u));
+  // Root depth is 1 here, while for GetDrawScore() it's 0-based.
+  const float draw_score = search_->GetDrawScore(depth % 2 == 0);
+  const float fpu = GetFpu(params_, node, is_root_node, draw_score);
+  const auto m_evaluator =
+      moves_left_support_ ? MEvaluator(params_, node) : MEvaluator();
+  PuctChildren::Scoring scoring{puct_mult, fpu, draw_score};
+  m_evaluator.SetScoring(&scoring);
+
+  if (pick_children_.size() < depth) pick_children_.resize(depth);
+  auto& children = pick_children_[depth - 1].stats;
+  auto& children_visits = pick_children_[depth - 1].visits;
+  children.Clear();
+  int unvisited = 0;
+  for (auto child : node->Edges()) {
+    const bool excluded =
+        is_root_node && IsRootEdgeExcluded(child, root_filter);
+    if (excluded) {
+      children.AddExcluded();
+    } else {
+      children.Add(child.GetN(), child.GetNStarted(), child.GetWL(0.0f),
+                   child.GetD(0.0f), child.GetM(0.0f), child.GetP());
+    }
+    // Edges are sorted by policy, so each visit can only go to the first
+    // unvisited edge. Those after the (visits + 1)-th don't matter.
+    if (!excluded && child.GetNStarted() == 0 && ++unvisited > visits) break;
+  }
+
+  // Give the best child visits until it would stop being the best, as
+  // estimated by EdgeAndNode::GetVisitsToReachU(), and repeat.
+  int visits_left = visits;
+  children_visits.assign(children.size(), 0);
+  while (visits_left > 0) {
+    const auto top2 = children.FindTop2(scoring);
+    if (top2.best < 0) break;
+    const int best = top2.best;
+    const float second_best = top2.second_best_score;
+    // n_started() includes the visits assigned so far.
+    const float best_without_u = children.GetScoreWithoutU(best, scoring);
+    int new_visits = visits_left;
+    if (second_best > std::numeric_limits<float>::lowest() &&
+        best_without_u < second_best) {
+      const float visits_to_change_best =
+          std::floor(children.p(best) * puct_mult /
+                         (second_best - best_without_u) -
+                     (children.n_started(best) + 1)) +
+          1;
+      new_visits = std::clamp(static_cast<int>(std::min(
+                                  visits_to_change_best,
+                                  static_cast<float>(visits_left))),
+                              1, visits_left);
+    }
+    children.AddVisits(best, new_visits);
+    children_visits[best] += new_visits;
+    visits_left -= new_visits;
+  }
+  if (visits_left > 0) {
+    // No child may be picked, e.g. all root moves were pruned.
+    node->CancelScoreUpdate(visits_left);
+    minibatch_.push_back(NodeToProcess::Collision(node, depth, visits_left));
+  }
+
+  size_t idx = 0;
+  for (auto child : node->Edges()) {
+    if (idx == children_visits.size()) break;
+    const int child_visits = children_visits[idx++];
+    if (child_visits == 0) continue;
+    PickNodesToExtendFrom(child.GetOrSpawnNode(node),
+                          child_visits, depth + 1, root_filter);
+  }
+}
+
 void SearchWorker::ExtendNode(Node* node, int depth) {
   // Initialize position sequence with pre-move position.
   history_.Trim(search_->played_history_.GetLength());
@@ -1286,16 +1955,12 @@ void SearchWorker::ExtendNode(Node* node, int depth) {
   // Could instead reserve one more than the difference between history_.size()
   // and history_.capacity().
   to_add.reserve(60);
-  // Need a lock to walk parents of leaf in case MakeSolid is concurrently
-  // adjusting parent chain.
-  {
-    SharedMutex::SharedLock lock(search_->nodes_mutex_);
-    Node* cur = node;
-    while (cur != search_->root_node_) {
-      Node* prev = cur->GetParent();
-      to_add.push_back(prev->GetEdgeToNode(cur)->GetMove());
-      cur = prev;
-    }
+  // Nodes don't move during the search, so parents can be walked without a
+  // lock.
+  for (Node* cur = node; cur != search_->root_node_;) {
+    Node* prev = cur->GetParent();
+    to_add.push_back(prev->GetEdgeToNode(cur)->GetMove());
+    cur = prev;
   }
   for (int i = to_add.size() - 1; i >= 0; i--) {
     history_.Append(to_add[i]);
@@ -1304,7 +1969,9 @@ void SearchWorker::ExtendNode(Node* node, int depth) {
   // We don't need the mutex because other threads will see that N=0 and
   // N-in-flight=1 and will not touch this node.
   const auto& board = history_.Last().GetBoard();
-  auto legal_moves = board.GenerateLegalMoves();
+  auto& legal_moves = legal_moves_;
+  legal_moves.clear();
+  board.GenerateLegalMoves(&legal_moves);
 
   // Check whether it's a draw/lose by position. Importantly, we must check
   // these before doing the by-rule checks below.
@@ -1360,7 +2027,7 @@ void SearchWorker::ExtendNode(Node* node, int depth) {
       if (state != FAIL) {
         // TB nodes don't have NN evaluation, assign M from parent node.
         float m = 0.0f;
-        // Need a lock to access parent, in case MakeSolid is in progress.
+        // Need a lock to read the stats of the parent, which backups update.
         {
           SharedMutex::SharedLock lock(search_->nodes_mutex_);
           auto parent = node->GetParent();
@@ -1402,7 +2069,11 @@ bool SearchWorker::AddNodeToComputation(Node* node, bool add_if_cached,
       return true;
     }
   } else {
-    if (search_->cache_->ContainsKey(hash)) {
+    int64_t lock_wait_ns = 0;
+    const bool cached =
+        search_->cache_->ContainsKey(hash, stats_ ? &lock_wait_ns : nullptr);
+    AddStatsCount(SearchWorkerStats::kCacheLockWaitNs, lock_wait_ns);
+    if (cached) {
       if (transform_out) {
         *transform_out = TransformForPosition(
             search_->network_->GetCapabilities().input_format, history_);
@@ -1424,13 +2095,13 @@ bool SearchWorker::AddNodeToComputation(Node* node, bool add_if_cached,
       moves.emplace_back(edge.GetMove().as_nn_index(transform));
     }
   } else {
-    // Cache pseudolegal moves. A bit of a waste, but faster.
-    const auto& pseudolegal_moves =
-        history_.Last().GetBoard().GeneratePseudolegalMoves();
-    moves.reserve(pseudolegal_moves.size());
-    for (auto iter = pseudolegal_moves.begin(), end = pseudolegal_moves.end();
-         iter != end; ++iter) {
-      moves.emplace_back(iter->as_nn_index(transform));
+    // Legal move generation is about as cheap as pseudolegal now, and keeps
+    // the cached policy smaller.
+    legal_moves_.clear();
+    history_.Last().GetBoard().GenerateLegalMoves(&legal_moves_);
+    moves.reserve(legal_moves_.size());
+    for (const auto move : legal_moves_) {
+      moves.emplace_back(move.as_nn_index(transform));
     }
   }
 
@@ -1441,7 +2112,9 @@ bool SearchWorker::AddNodeToComputation(Node* node, bool add_if_cached,
 
 // 2b. Copy collisions into shared collisions.
 void SearchWorker::CollectCollisions() {
+  const auto wait_start = StatsNow();
   SharedMutex::Lock lock(search_->nodes_mutex_);
+  AddStatsTime(SearchWorkerStats::kNodesLockWaitNs, wait_start);
 
   for (const NodeToProcess& node_to_process : minibatch_) {
     if (node_to_process.IsCollision()) {
@@ -1461,7 +2134,9 @@ void SearchWorker::MaybePrefetchIntoCache() {
   if (computation_->GetCacheMisses() > 0 &&
       computation_->GetCacheMisses() < params_.GetMaxPrefetchBatch()) {
     history_.Trim(search_->played_history_.GetLength());
+    const auto wait_start = StatsNow();
     SharedMutex::SharedLock lock(search_->nodes_mutex_);
+    AddStatsTime(SearchWorkerStats::kNodesLockWaitNs, wait_start);
     PrefetchIntoCache(
         search_->root_node_,
         params_.GetMaxPrefetchBatch() - computation_->GetCacheMisses(), false);
@@ -1557,6 +2232,111 @@ int SearchWorker::PrefetchIntoCache(Node* node, int budget, bool is_odd_depth) {
   return total_budget_spent;
 }
 
+void SearchWorker::RunIdlePrefetch(int max_positions) {
+  // Unvisited positions under the best move, ranked by the probability to
+  // reach them, from visits of their ancestors and the policy of their edge.
+  struct Leaf {
+    float probability;
+    Node* parent;
+    Move move;
+  };
+  std::vector<Leaf> leaves;
+  {
+    SharedMutex::SharedLock nodes_lock(search_->nodes_mutex_);
+    Node* best_node = nullptr;
+    {
+      Mutex::Lock counters_lock(search_->counters_mutex_);
+      const bool is_black_to_move = search_->played_history_.IsBlackToMove();
+      for (auto& edge : search_->root_node_->Edges()) {
+        if (edge.GetMove(is_black_to_move) == search_->final_bestmove_) {
+          best_node = edge.node();
+          break;
+        }
+      }
+    }
+    if (!best_node || best_node->GetN() == 0 || best_node->IsTerminal()) {
+      return;
+    }
+    // Best-first expansion: nodes are expanded from the most likely one, and
+    // @leaves keeps the @max_positions most likely leaves as a min-heap. A node
+    // can't lead to more likely leaves than itself, so the expansion stops
+    // when no node to expand beats the least likely kept leaf.
+    const auto more_likely_leaf = [](const Leaf& a, const Leaf& b) {
+      return a.probability > b.probability;
+    };
+    const auto less_likely_node = [](const std::pair<float, Node*>& a,
+                                     const std::pair<float, Node*>& b) {
+      return a.first < b.first;
+    };
+    const size_t max_leaves = max_positions;
+    const auto is_worth_keeping = [&](float probability) {
+      return leaves.size() < max_leaves ||
+             probability > leaves.front().probability;
+    };
+    std::vector<std::pair<float, Node*>> nodes = {{1.0f, best_node}};
+    while (!nodes.empty() && is_worth_keeping(nodes.front().first)) {
+      if (search_->idle_prefetch_cancelled_.load(std::memory_order_acquire)) {
+        return;
+      }
+      std::pop_heap(nodes.begin(), nodes.end(), less_likely_node);
+      const auto [probability, node] = nodes.back();
+      nodes.pop_back();
+      const float children_visits = node->GetChildrenVisits();
+      for (auto& edge : node->Edges()) {
+        if (edge.GetN() > 0) {
+          if (edge.IsTerminal()) continue;
+          const float child_probability =
+              probability * edge.GetN() / children_visits;
+          if (!is_worth_keeping(child_probability)) continue;
+          nodes.emplace_back(child_probability, edge.node());
+          std::push_heap(nodes.begin(), nodes.end(), less_likely_node);
+        } else if (edge.GetNStarted() == 0) {
+          const float leaf_probability = probability * edge.GetP();
+          if (!is_worth_keeping(leaf_probability)) continue;
+          leaves.push_back({leaf_probability, node, edge.GetMove()});
+          std::push_heap(leaves.begin(), leaves.end(), more_likely_leaf);
+          if (leaves.size() > max_leaves) {
+            std::pop_heap(leaves.begin(), leaves.end(), more_likely_leaf);
+            leaves.pop_back();
+          }
+        }
+      }
+    }
+    std::sort_heap(leaves.begin(), leaves.end(), more_likely_leaf);
+  }
+  LOGFILE << "Started idle prefetch of " << leaves.size() << " positions.";
+
+  const int batch_size = std::max(params_.GetMaxPrefetchBatch(), 1);
+  int prefetched = 0;
+  std::vector<Move> moves;
+  const auto last = leaves.end();
+  auto leaf = leaves.begin();
+  while (leaf != last &&
+         !search_->idle_prefetch_cancelled_.load(std::memory_order_acquire)) {
+    InitializeIteration(search_->network_->NewComputation());
+    {
+      SharedMutex::SharedLock lock(search_->nodes_mutex_);
+      for (; leaf != last && computation_->GetCacheMisses() < batch_size;
+           ++leaf) {
+        moves.assign(1, leaf->move);
+        for (Node* node = leaf->parent; node != search_->root_node_;
+             node = node->GetParent()) {
+          moves.push_back(node->GetOwnEdge()->GetMove());
+        }
+        history_.Trim(search_->played_history_.GetLength());
+        for (auto move = moves.rbegin(); move != moves.rend(); ++move) {
+          history_.Append(*move);
+        }
+        // Positions in the cache already are skipped.
+        AddNodeToComputation(nullptr, false, nullptr);
+      }
+    }
+    prefetched += computation_->GetCacheMisses();
+    RunNNComputation();
+  }
+  LOGFILE << "Idle prefetch done, " << prefetched << " positions evaluated.";
+}
+
 // 4. Run NN computation.
 // ~~~~~~~~~~~~~~~~~~~~~~
 void SearchWorker::RunNNComputation() { computation_->ComputeBlocking(); }
@@ -1629,7 +2409,9 @@ void SearchWorker::FetchSingleNodeResult(NodeToProcess* node_to_process,
 // ~~~~~~~~~~~~~~
 void SearchWorker::DoBackupUpdate() {
   // Nodes mutex for doing node updates.
+  const auto wait_start = StatsNow();
   SharedMutex::Lock lock(search_->nodes_mutex_);
+  AddStatsTime(SearchWorkerStats::kNodesLockWaitNs, wait_start);
 
   bool work_done = number_out_of_order_ > 0;
   for (const NodeToProcess& node_to_process : minibatch_) {
@@ -1663,8 +2445,6 @@ void SearchWorker::DoBackupUpdateSingleNode(
   float v_delta = 0.0f;
   float d_delta = 0.0f;
   float m_delta = 0.0f;
-  uint32_t solid_threshold =
-      static_cast<uint32_t>(params_.GetSolidTreeThreshold());
   for (Node *n = node, *p; n != search_->root_node_->GetParent(); n = p) {
     p = n->GetParent();
 
@@ -1679,14 +2459,12 @@ void SearchWorker::DoBackupUpdateSingleNode(
     if (n_to_fix > 0 && !n->IsTerminal()) {
       n->AdjustForTerminal(v_delta, d_delta, m_delta, n_to_fix);
     }
-    if (n->GetN() >= solid_threshold) {
-      if (n->MakeSolid() && n == search_->root_node_) {
-        // If we make the root solid, the current_best_edge_ becomes invalid and
-        // we should repopulate it.
-        search_->current_best_edge_ =
-            search_->GetBestChildNoTemperature(search_->root_node_, 0);
-      }
-    }
+#if defined(USE_COMPACT_STATS)
+    // Single precision running averages drift with many visits, so WL is
+    // recomputed from the children every time N doubles, from 1024 visits.
+    const uint32_t old_n = n->GetN() - node_to_process.multivisit;
+    if (n->GetN() >= 1024 && (n->GetN() ^ old_n) > old_n) n->RecomputeWL();
+#endif
 
     // Nothing left to do without ancestors to update.
     if (!p) break;
@@ -1721,6 +2499,8 @@ void SearchWorker::DoBackupUpdateSingleNode(
     }
   }
   search_->total_playouts_ += node_to_process.multivisit;
+  search_->published_playouts_.store(search_->total_playouts_,
+                                     std::memory_order_relaxed);
   search_->cum_depth_ += node_to_process.depth * node_to_process.multivisit;
   search_->max_depth_ = std::max(search_->max_depth_, node_to_process.depth);
 }
@@ -1797,9 +2577,13 @@ bool SearchWorker::MaybeSetBounds(Node* p, float m, int* n_to_fix,
 // 7. Update the Search's status and progress information.
 //~~~~~~~~~~~~~~~~~~~~
 void SearchWorker::UpdateCounters() {
-  search_->PopulateCommonIterationStats(&iteration_stats_);
-  search_->MaybeTriggerStop(iteration_stats_, &latest_time_manager_hints_);
-  search_->MaybeOutputInfo();
+  // Stoppers and info output are run by the controller thread, so that workers
+  // don't take nodes_mutex_ exclusively after every minibatch. It only needs
+  // to be woken up early when the playouts it asked for are done.
+  if (search_->published_playouts_.load(std::memory_order_relaxed) >=
+      search_->controller_wakeup_playouts_.load(std::memory_order_relaxed)) {
+    search_->WakeUpController();
+  }
 
   // If this thread had no work, not even out of order, then sleep for some
   // milliseconds. Collisions don't count as work, so have to enumerate to find
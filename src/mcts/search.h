@@ -27,15 +27,23 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <limits>
 #include <optional>
 #include <shared_mutex>
 #include <thread>
 
 #include "chess/callbacks.h"
 #include "chess/uciloop.h"
+#include "mcts/distributed.h"
+#include "mcts/minibatch.h"
 #include "mcts/node.h"
 #include "mcts/params.h"
+#include "mcts/puct.h"
 #include "mcts/stoppers/timemgr.h"
 #include "neural/cache.h"
 #include "neural/network.h"
@@ -46,15 +54,113 @@
 
 namespace lczero {
 
+// Hot path counters of a single SearchWorker, collected with --search-stats.
+// Only the owning worker writes them, while other threads may read them at
+// any time. Aligned to a cache line so that workers don't invalidate each
+// other's lines.
+struct alignas(64) SearchWorkerStats {
+  enum Counter {
+    // Time spent in the stages of SearchWorker::ExecuteOneIteration(), ns.
+    kGatherNs,
+    kCollectCollisionsNs,
+    kPrefetchNs,
+    kNNComputationNs,
+    kFetchNs,
+    kBackupNs,
+    kUpdateCountersNs,
+    // Time spent acquiring nodes_mutex_, picking nodes to extend (including
+    // the lock wait) and acquiring the NN cache lock, ns. Overlaps with the
+    // stage times.
+    kNodesLockWaitNs,
+    kPickNs,
+    kCacheLockWaitNs,
+    // Event counts. A descent is a walk down the tree picking nodes for one
+    // visit, or for the whole minibatch with --batched-pick.
+    kPickDescents,
+    kVisits,
+    kCollisionEvents,
+    kCollisionVisits,
+    kNNQueries,
+    kCacheHits,
+    // Sampled visited nodes, and how many of them were in memory of another
+    // NUMA node than the worker runs on.
+    kNumaSamples,
+    kNumaRemoteSamples,
+    kCounterCount
+  };
+
+  void Add(Counter counter, uint64_t value) {
+    // There is a single writer, so no atomic read-modify-write is needed.
+    values[counter].store(
+        values[counter].load(std::memory_order_relaxed) + value,
+        std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> values[kCounterCount] = {};
+};
+
+// SearchWorkerStats summed over workers and possibly over several searches.
+class SearchStats {
+ public:
+  void Add(const SearchWorkerStats& worker);
+  void Add(const SearchStats& other);
+  uint64_t Get(SearchWorkerStats::Counter counter) const {
+    return values_[counter];
+  }
+  // Returns a one line human readable summary.
+  std::string ToString() const;
+
+ private:
+  std::array<uint64_t, SearchWorkerStats::kCounterCount> values_{};
+};
+
+// Buffers of a SearchWorker which a SearchThreadPool thread keeps between
+// searches, so that workers of a new search don't start cold.
+struct SearchWorkerState {
+  PositionHistory history;
+  std::unique_ptr<MinibatchController> minibatch_controller;
+};
+
+// Long-lived threads which searches borrow instead of starting their own
+// worker threads on every move. Thread i is bound to its processor (see
+// Numa::BindThread()) once, when it's started.
+class SearchThreadPool {
+ public:
+  SearchThreadPool() = default;
+  ~SearchThreadPool();
+
+  // Queues @task to run on thread @id, starting threads up to @id if needed.
+  // Tasks of one thread run one by one in the order they were queued.
+  void Run(size_t id, std::function<void(SearchWorkerState*)> task);
+
+ private:
+  struct Thread {
+    std::deque<std::function<void(SearchWorkerState*)>> tasks;
+    SearchWorkerState state;
+    std::thread thread;
+  };
+  void ThreadLoop(Thread* thread);
+
+  Mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ GUARDED_BY(mutex_) = false;
+  std::vector<std::unique_ptr<Thread>> threads_ GUARDED_BY(mutex_);
+};
+
 class Search {
  public:
+  // If @thread_pool is not null, workers run on its threads rather than on
+  // threads started for this search. The pool must outlive the search.
+  // If @remote_workers is not null, root moves are split among this search
+  // and the remote workers, which must have the position set already.
   Search(const NodeTree& tree, Network* network,
          std::unique_ptr<UciResponder> uci_responder,
          const MoveList& searchmoves,
          std::chrono::steady_clock::time_point start_time,
          std::unique_ptr<SearchStopper> stopper, bool infinite,
          const OptionsDict& options, NNCache* cache,
-         SyzygyTablebase* syzygy_tb);
+         SyzygyTablebase* syzygy_tb, SearchThreadPool* thread_pool = nullptr,
+         RemoteSearchWorkers* remote_workers = nullptr);
 
   ~Search();
 
@@ -67,10 +173,20 @@ class Search {
   // Stops search. At the end bestmove will be returned. The function is not
   // blocking, so it returns before search is actually done.
   void Stop();
-  // Stops search, but does not return bestmove. The function is not blocking.
+  // Stops search, but does not return bestmove. Also stops the idle prefetch
+  // which runs after bestmove. The function is not blocking.
   void Abort();
   // Blocks until all worker thread finish.
   void Wait();
+  // Aborts the search, waits for it and takes back its changes to the tree
+  // which are not local visits: collisions in flight and stats of root
+  // children searched by remote workers. Called before the tree is used
+  // while the search still exists, and on destruction.
+  void ReleaseTree();
+  // Waits for the search to finish, then evaluates up to @max_positions
+  // likely continuations of the best move into the cache. Returns early when
+  // the search is aborted. Must return before the search is destroyed.
+  void RunIdlePrefetch(int max_positions);
   // Returns whether search is active. Workers check that to see whether another
   // search iteration is needed.
   bool IsSearchActive() const;
@@ -92,6 +208,12 @@ class Search {
   std::int64_t GetTotalPlayouts() const;
   // Returns the search parameters.
   const SearchParams& GetParams() const { return params_; }
+  // Returns stats of the root children for @moves, zero for unvisited ones.
+  // Used by search workers to report to the distributed search coordinator.
+  std::vector<RemoteMoveStats> GetRootMoveStats(const MoveList& moves) const;
+  // Returns hot path statistics of all workers so far. Empty unless
+  // --search-stats is enabled.
+  SearchStats GetSearchStats() const;
 
   // If called after GetBestMove, another call to GetBestMove will have results
   // from temperature having been applied again.
@@ -118,9 +240,13 @@ class Search {
   void FireStopInternal();
 
   void SendMovesStats() const;
+  void SendSearchStats() const;
   // Function which runs in a separate thread and watches for time and
-  // uci `stop` command;
+  // uci `stop` command. It's also the only thread which runs stoppers and
+  // outputs info, workers just publish their playouts.
   void WatchdogThread();
+  // Wakes up the watchdog thread before its timeout.
+  void WakeUpController();
 
   // Fills IterationStats with global (rather than per-thread) portion of search
   // statistics. Currently all stats there (in IterationStats) are global
@@ -142,9 +268,31 @@ class Search {
   // Ensure that all shared collisions are cancelled and clear them out.
   void CancelSharedCollisions();
 
+  // Returns root moves allowed by root_move_filter_, the largest prior first
+  // if the root is already extended.
+  MoveList GetRootMovesByPrior() const;
+  // Splits the root moves among this search and the remote workers, and
+  // starts the remote searches.
+  void StartRemoteSearches();
+  // Splits the local root moves among the NUMA nodes of workers.
+  void PartitionRootMovesByNuma(const std::vector<int>& worker_nodes);
+  // Returns root moves which workers on @numa_node may pick.
+  const MoveList& GetWorkerRootMoves(int numa_node) const;
+  // Function which runs in a separate thread for every remote worker, merges
+  // its reports and stops it when the search is over.
+  void RemoteWorkerThread(int share);
+  // Sets stats of the root children searched by a remote worker.
+  void ApplyRemoteStats(int share, uint64_t nodes,
+                        const std::vector<RemoteMoveStats>& stats);
+  // Puts back stats which the root children had before remote stats were
+  // applied.
+  void RestoreRemoteStats();
+
   mutable Mutex counters_mutex_ ACQUIRED_AFTER(nodes_mutex_);
   // Tells all threads to stop.
   std::atomic<bool> stop_{false};
+  // Tells RunIdlePrefetch() not to start or to stop the idle prefetch.
+  std::atomic<bool> idle_prefetch_cancelled_{false};
   // Condition variable used to watch stop_ variable.
   std::condition_variable watchdog_cv_;
   // Tells whether it's ok to respond bestmove when limits are reached.
@@ -162,6 +310,16 @@ class Search {
 
   Mutex threads_mutex_;
   std::vector<std::thread> threads_ GUARDED_BY(threads_mutex_);
+  SearchThreadPool* const thread_pool_;
+  // Workers started on thread_pool_, and how many of them are still running.
+  size_t pool_workers_started_ GUARDED_BY(threads_mutex_) = 0;
+  size_t pool_workers_running_ GUARDED_BY(threads_mutex_) = 0;
+  std::condition_variable pool_workers_cv_;
+
+  mutable Mutex worker_stats_mutex_ ACQUIRED_AFTER(counters_mutex_);
+  // Allocated per worker only when --search-stats is enabled.
+  std::vector<std::unique_ptr<SearchWorkerStats>> worker_stats_
+      GUARDED_BY(worker_stats_mutex_);
 
   Node* root_node_;
   NNCache* cache_;
@@ -183,6 +341,13 @@ class Search {
   Edge* last_outputted_info_edge_ GUARDED_BY(nodes_mutex_) = nullptr;
   ThinkingInfo last_outputted_uci_info_ GUARDED_BY(nodes_mutex_);
   int64_t total_playouts_ GUARDED_BY(nodes_mutex_) = 0;
+  // Copy of total_playouts_ which can be read without nodes_mutex_.
+  std::atomic<int64_t> published_playouts_{0};
+  // When published_playouts_ reaches it, workers wake up the watchdog thread.
+  std::atomic<int64_t> controller_wakeup_playouts_{1};
+  // Remaining playouts estimated by the stoppers at the latest check.
+  std::atomic<int64_t> remaining_playouts_hint_{
+      std::numeric_limits<int64_t>::max()};
   int64_t total_batches_ GUARDED_BY(nodes_mutex_) = 0;
   // Maximum search depth = length of longest path taken in PickNodetoExtend.
   uint16_t max_depth_ GUARDED_BY(nodes_mutex_) = 0;
@@ -195,6 +360,31 @@ class Search {
   std::vector<std::pair<Node*, int>> shared_collisions_
       GUARDED_BY(nodes_mutex_);
 
+  RemoteSearchWorkers* const remote_workers_;
+  // Root moves searched by this process when some are searched remotely. Set
+  // before workers start.
+  MoveList local_root_moves_;
+  // Root moves searched by a remote worker.
+  struct RemoteShare {
+    int worker;
+    MoveList moves;
+    uint64_t playouts = 0;
+  };
+  std::vector<RemoteShare> remote_shares_;
+  // Stats of root children before remote stats were applied to them.
+  struct RootChildStats {
+    Move move;
+    uint32_t n;
+    double wl;
+    float d;
+    float m;
+  };
+  std::vector<RootChildStats> remote_overridden_stats_ GUARDED_BY(nodes_mutex_);
+  int64_t remote_playouts_ GUARDED_BY(nodes_mutex_) = 0;
+  // Root moves of each NUMA node, with --numa-root-partition. Set before
+  // workers start.
+  std::vector<MoveList> numa_root_moves_;
+
   std::unique_ptr<UciResponder> uci_responder_;
 
   friend class SearchWorker;
@@ -205,13 +395,42 @@ class Search {
 // within one thread, have to split into stages.
 class SearchWorker {
  public:
-  SearchWorker(Search* search, const SearchParams& params, int id)
+  // If @state is not null, the worker takes its buffers from there and puts
+  // them back when destroyed. @numa_node is the NUMA node the worker's thread
+  // is bound to.
+  SearchWorker(Search* search, const SearchParams& params,
+               SearchWorkerStats* stats, SearchWorkerState* state,
+               int numa_node)
       : search_(search),
-        history_(search_->played_history_),
         params_(params),
+        stats_(stats),
+        state_(state),
+        numa_node_(numa_node),
         moves_left_support_(search_->network_->GetCapabilities().moves_left !=
                             pblczero::NetworkFormat::MOVES_LEFT_NONE) {
-    Numa::BindThread(id);
+    if (state_) {
+      history_ = std::move(state_->history);
+      minibatch_controller_ = std::move(state_->minibatch_controller);
+    }
+    // Reuses the capacity of the history taken from @state.
+    history_ = search_->played_history_;
+    // A controller kept from the previous search continues tuning from where
+    // it stopped, unless the configured values changed.
+    if (!params_.GetAdaptiveMinibatch()) {
+      minibatch_controller_.reset();
+    } else if (!minibatch_controller_ ||
+               !minibatch_controller_->IsConfiguredFor(
+                   params_.GetMiniBatchSize(),
+                   params_.GetMaxCollisionEvents())) {
+      minibatch_controller_ = std::make_unique<MinibatchController>(
+          params_.GetMiniBatchSize(), params_.GetMaxCollisionEvents());
+    }
+  }
+
+  ~SearchWorker() {
+    if (!state_) return;
+    state_->history = std::move(history_);
+    state_->minibatch_controller = std::move(minibatch_controller_);
   }
 
   // Runs iterations while needed.
@@ -230,6 +449,11 @@ class SearchWorker {
     }
   }
 
+  // Evaluates up to @max_positions unvisited positions under the best move,
+  // which are the most likely to be reached, into the cache. Runs after
+  // bestmove is sent, until the search is aborted.
+  void RunIdlePrefetch(int max_positions);
+
   // Does one full iteration of MCTS search:
   // 1. Initialize internal structures.
   // 2. Gather minibatch.
@@ -293,8 +517,9 @@ class SearchWorker {
                                    int collision_count) {
       return NodeToProcess(node, depth, true, collision_count);
     }
-    static NodeToProcess Visit(Node* node, uint16_t depth) {
-      return NodeToProcess(node, depth, false, 1);
+    static NodeToProcess Visit(Node* node, uint16_t depth,
+                               int multivisit = 1) {
+      return NodeToProcess(node, depth, false, multivisit);
     }
 
    private:
@@ -305,7 +530,40 @@ class SearchWorker {
           is_collision(is_collision) {}
   };
 
+  // Root moves which this worker may pick.
+  struct RootPickFilter {
+    // Visits of the current best root move, for smart pruning.
+    int64_t best_node_n;
+    // This worker's share of the root moves, all moves if empty.
+    const MoveList& moves;
+    // Whether root moves are split among processes or NUMA nodes.
+    bool partitioned;
+  };
+  RootPickFilter GetRootPickFilter() const;
+  // Returns whether IsRootEdgeExcluded() may be true for any root edge.
+  bool MayExcludeRootEdges(const RootPickFilter& filter) const;
+  bool IsRootEdgeExcluded(const EdgeAndNode& edge,
+                          const RootPickFilter& filter) const;
+
   NodeToProcess PickNodeToExtend(int collision_limit);
+  // Picks nodes for @visits playouts in one descent from the root (see
+  // --batched-pick) and appends them to minibatch_.
+  void PickNodesToExtend(int visits);
+  // Splits @visits among children of @node by PUCT and recurses. Ancestors of
+  // @node already count the visits in flight.
+  void PickNodesToExtendFrom(Node* node, int visits, uint16_t depth,
+                             const RootPickFilter& root_filter);
+  // Reverts a twofold draw whose first repetition is before the root, so that
+  // it is extended again. Returns whether it did.
+  bool MaybeRevertTwoFoldDraw(Node* node, int depth);
+  // Extends a picked node and adds it to the NN computation. Returns whether
+  // it was evaluated and backed up out of order, so it's not needed anymore.
+  bool ProcessPickedNode(NodeToProcess* picked_node);
+  // Counts a picked collision. Returns false if collision limits are reached.
+  bool CountCollision(const NodeToProcess& collision, int* events_left,
+                      int* visits_left);
+  void GatherMinibatchBatched(int max_minibatch_size,
+                              int collision_events_left, int collisions_left);
   void ExtendNode(Node* node, int depth);
   bool AddNodeToComputation(Node* node, bool add_if_cached, int* transform_out);
   int PrefetchIntoCache(Node* node, int budget, bool is_odd_depth);
@@ -315,18 +573,63 @@ class SearchWorker {
   // Returns whether a node's bounds were set based on its children.
   bool MaybeSetBounds(Node* p, float m, int* n_to_fix, float* v_delta, float* d_delta, float* m_delta) const;
 
+  // Counts whether @node is in memory of the worker's NUMA node, for every
+  // kNumaSampleInterval-th call.
+  void MaybeSampleNumaNode(const Node* node);
+
+  // Instrumentation helpers, no-ops unless stats_ is set.
+  std::chrono::steady_clock::time_point StatsNow() const {
+    return stats_ ? std::chrono::steady_clock::now()
+                  : std::chrono::steady_clock::time_point();
+  }
+  void AddStatsTime(SearchWorkerStats::Counter counter,
+                    std::chrono::steady_clock::time_point since) {
+    if (!stats_) return;
+    stats_->Add(counter, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - since)
+                             .count());
+  }
+  void AddStatsCount(SearchWorkerStats::Counter counter, uint64_t value) {
+    if (stats_) stats_->Add(counter, value);
+  }
+  // Attributes the time since the previous stage ended to @stage.
+  void EndStage(SearchWorkerStats::Counter stage) {
+    if (!stats_) return;
+    const auto now = std::chrono::steady_clock::now();
+    stats_->Add(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           now - stage_start_)
+                           .count());
+    stage_start_ = now;
+  }
+
   Search* const search_;
   // List of nodes to process.
   std::vector<NodeToProcess> minibatch_;
   std::unique_ptr<CachingComputation> computation_;
   // History is reset and extended by PickNodeToExtend().
   PositionHistory history_;
+  // Reused to avoid an allocation for every generated move list.
+  MoveList legal_moves_;
   int number_out_of_order_ = 0;
   const SearchParams& params_;
-  std::unique_ptr<Node> precached_node_;
+  SearchWorkerStats* const stats_;
+  SearchWorkerState* const state_;
+  const int numa_node_;
+  int numa_sample_countdown_ = 1;
+  std::chrono::steady_clock::time_point stage_start_;
+  // Set with --adaptive-minibatch.
+  std::unique_ptr<MinibatchController> minibatch_controller_;
+  // Counts of the current iteration for minibatch_controller_.
+  MinibatchController::Iteration iteration_;
+  // Children stats of --batched-pick, one entry per depth. A deque doesn't
+  // move entries of lower depths when a deeper one is added.
+  struct PickChildren {
+    PuctChildren stats;
+    // Visits assigned to each child.
+    std::vector<int> visits;
+  };
+  std::deque<PickChildren> pick_children_;
   const bool moves_left_support_;
-  IterationStats iteration_stats_;
-  StoppersHints latest_time_manager_hints_;
 };
 
 }  // namespace lczero
@@ -62,6 +62,7 @@ bool VisitsStopper::ShouldStop(const IterationStats& stats,
     hints->UpdateEstimatedRemainingRemainingPlayouts(nodes_limit_ -
                                                      stats.total_nodes);
   }
+  hints->UpdatePlayoutsUntilCheck(nodes_limit_ - stats.total_nodes);
   if (stats.total_nodes >= nodes_limit_) {
     LOGFILE << "Stopped search: Reached visits limit: " << stats.total_nodes
             << ">=" << nodes_limit_;
@@ -80,6 +81,7 @@ bool PlayoutsStopper::ShouldStop(const IterationStats& stats,
     hints->UpdateEstimatedRemainingRemainingPlayouts(
         nodes_limit_ - stats.nodes_since_movestart);
   }
+  hints->UpdatePlayoutsUntilCheck(nodes_limit_ - stats.nodes_since_movestart);
   if (stats.nodes_since_movestart >= nodes_limit_) {
     LOGFILE << "Stopped search: Reached playouts limit: "
             << stats.nodes_since_movestart << ">=" << nodes_limit_;
@@ -113,6 +115,15 @@ MemoryWatchingStopper::MemoryWatchingStopper(int cache_size, int ram_limit_mb,
           << " nodes.";
 }
 
+bool MemoryWatchingStopper::ShouldStop(const IterationStats& stats,
+                                       StoppersHints* hints) {
+  const int64_t gc_backlog = GetNodeGcBacklog();
+  if (gc_backlog == 0) return VisitsStopper::ShouldStop(stats, hints);
+  IterationStats adjusted_stats = stats;
+  adjusted_stats.total_nodes += gc_backlog;
+  return VisitsStopper::ShouldStop(adjusted_stats, hints);
+}
+
 ///////////////////////////
 // TimelimitStopper
 ///////////////////////////
@@ -151,10 +162,15 @@ bool DepthStopper::ShouldStop(const IterationStats& stats, StoppersHints*) {
 KldGainStopper::KldGainStopper(float min_gain, int average_interval)
     : min_gain_(min_gain), average_interval_(average_interval) {}
 
-bool KldGainStopper::ShouldStop(const IterationStats& stats, StoppersHints*) {
+bool KldGainStopper::ShouldStop(const IterationStats& stats,
+                                StoppersHints* hints) {
   Mutex::Lock lock(mutex_);
   const auto new_child_nodes = stats.total_nodes - 1.0;
-  if (new_child_nodes < prev_child_nodes_ + average_interval_) return false;
+  if (new_child_nodes < prev_child_nodes_ + average_interval_) {
+    hints->UpdatePlayoutsUntilCheck(static_cast<int64_t>(
+        prev_child_nodes_ + average_interval_ - new_child_nodes));
+    return false;
+  }
 
   const auto new_visits = stats.edge_n;
   if (!prev_visits_.empty()) {
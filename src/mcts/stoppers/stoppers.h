@@ -86,6 +86,8 @@ class MemoryWatchingStopper : public VisitsStopper {
   static constexpr size_t kAvgMovesPerPosition = 30;
   MemoryWatchingStopper(int cache_size, int ram_limit_mb,
                         bool populate_remaining_playouts);
+  // Also counts nodes which are released but not freed by GC yet.
+  bool ShouldStop(const IterationStats&, StoppersHints*) override;
 };
 
 // Stops after time budget is gone.
@@ -48,6 +48,13 @@ int64_t StoppersHints::GetEstimatedRemainingPlayouts() const {
   return std::max(decltype(remaining_playouts_){1}, remaining_playouts_);
 }
 
+void StoppersHints::UpdatePlayoutsUntilCheck(int64_t v) {
+  if (v < playouts_until_check_) playouts_until_check_ = v;
+}
+int64_t StoppersHints::GetPlayoutsUntilCheck() const {
+  return std::max(decltype(playouts_until_check_){1}, playouts_until_check_);
+}
+
 void StoppersHints::UpdateEstimatedNps(float v) { estimated_nps_ = v; }
 
 std::optional<float> StoppersHints::GetEstimatedNps() const {
@@ -60,6 +67,7 @@ void StoppersHints::Reset() {
   // Type for N in nodes is currently uint32_t, so set limit in order not to
   // overflow it.
   remaining_playouts_ = 4000000000;
+  playouts_until_check_ = 4000000000;
   // NPS is not known.
   estimated_nps_.reset();
 }
@@ -62,6 +62,9 @@ struct IterationStats {
 // expect running out of time.
 // 2. EstimatedPlayouts -- for smart pruning at root (not pick root nodes that
 // cannot potentially become good).
+// 3. PlayoutsUntilCheck -- for search watchdog thread to know after how many
+// playouts a stopper may trigger (e.g. a node limit is reached). Unlike
+// EstimatedPlayouts, it doesn't affect the search itself.
 class StoppersHints {
  public:
   StoppersHints();
@@ -70,12 +73,15 @@ class StoppersHints {
   int64_t GetEstimatedRemainingTimeMs() const;
   void UpdateEstimatedRemainingRemainingPlayouts(int64_t v);
   int64_t GetEstimatedRemainingPlayouts() const;
+  void UpdatePlayoutsUntilCheck(int64_t v);
+  int64_t GetPlayoutsUntilCheck() const;
   void UpdateEstimatedNps(float v);
   std::optional<float> GetEstimatedNps() const;
 
  private:
   int64_t remaining_time_ms_;
   int64_t remaining_playouts_;
+  int64_t playouts_until_check_;
   std::optional<float> estimated_nps_;
 };
 
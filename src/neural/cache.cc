@@ -25,13 +25,143 @@
   Program grant you additional permission to convey the resulting work.
 */
 #include "neural/cache.h"
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <limits>
+
+#include "neural/shared_cache.h"
+#include "utils/exception.h"
+#include "utils/filesystem.h"
 
 namespace lczero {
+
+namespace {
+// Snapshot file layout: SnapshotHeader, then for every entry from the oldest
+// to the newest a SnapshotEntry followed by num_moves float probabilities and
+// num_moves uint16_t move indices. The file is read through a memory mapping,
+// with no alignment requirements.
+const char kSnapshotMagic[8] = {'L', 'c', '0', 'C', 'a', 'c', 'h', 'e'};
+const uint32_t kSnapshotVersion = 1;
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t network_hash;
+  uint64_t num_entries;
+};
+
+struct SnapshotEntry {
+  uint64_t hash;
+  float q;
+  float d;
+  float m;
+  uint32_t num_moves;
+};
+
+static_assert(sizeof(SnapshotHeader) == 32, "Unexpected SnapshotHeader size");
+static_assert(sizeof(SnapshotEntry) == 24, "Unexpected SnapshotEntry size");
+}  // namespace
+
+int SaveNNCacheSnapshot(const NNCache& cache, uint64_t network_hash,
+                        const std::string& filename) {
+  // The previous snapshot is only replaced once the new one is complete.
+  const std::string tmp_filename = filename + ".tmp";
+  std::ofstream output(tmp_filename, std::ios::trunc | std::ios_base::binary);
+  if (!output) throw Exception("Cannot write NN cache file: " + tmp_filename);
+  SnapshotHeader header{};
+  std::memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+  header.version = kSnapshotVersion;
+  header.network_hash = network_hash;
+  // The number of entries is known only at the end.
+  output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  std::vector<float> probabilities;
+  std::vector<uint16_t> indices;
+  cache.ForEach([&](uint64_t hash, const CachedNNRequest& request) {
+    SnapshotEntry entry{hash, request.q, request.d, request.m,
+                        static_cast<uint32_t>(request.p.size())};
+    probabilities.clear();
+    indices.clear();
+    for (int i = 0; i < request.p.size(); i++) {
+      indices.push_back(request.p[i].first);
+      probabilities.push_back(CachedNNRequest::UnpackP(request.p[i].second));
+    }
+    output.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+    output.write(reinterpret_cast<const char*>(probabilities.data()),
+                 probabilities.size() * sizeof(float));
+    output.write(reinterpret_cast<const char*>(indices.data()),
+                 indices.size() * sizeof(uint16_t));
+    ++header.num_entries;
+  });
+  output.seekp(0);
+  output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  output.close();
+  if (!output) throw Exception("Cannot write NN cache file: " + tmp_filename);
+  RenameFile(tmp_filename, filename);
+  return header.num_entries;
+}
+
+int LoadNNCacheSnapshot(NNCache* cache, uint64_t network_hash,
+                        const std::string& filename) {
+  if (GetFileSize(filename) < sizeof(SnapshotHeader)) return 0;
+  MappedFile file(filename);
+  const char* data = file.data();
+  const char* const end = data + file.size();
+  SnapshotHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  data += sizeof(header);
+  if (std::memcmp(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0 ||
+      header.version != kSnapshotVersion) {
+    throw Exception("Invalid NN cache file: " + filename);
+  }
+  if (header.network_hash != network_hash) return 0;
+
+  // Older entries would be evicted by newer ones anyway.
+  const uint64_t capacity = cache->GetCapacity();
+  const uint64_t skip =
+      header.num_entries > capacity ? header.num_entries - capacity : 0;
+  int loaded = 0;
+  for (uint64_t i = 0; i < header.num_entries; i++) {
+    SnapshotEntry entry;
+    if (end - data < static_cast<ptrdiff_t>(sizeof(entry))) break;
+    std::memcpy(&entry, data, sizeof(entry));
+    data += sizeof(entry);
+    const size_t moves_size =
+        entry.num_moves * (sizeof(float) + sizeof(uint16_t));
+    if (entry.num_moves > 255 ||
+        static_cast<size_t>(end - data) < moves_size) {
+      break;
+    }
+    if (i >= skip) {
+      auto request = std::make_unique<CachedNNRequest>(entry.num_moves);
+      request->q = entry.q;
+      request->d = entry.d;
+      request->m = entry.m;
+      const char* indices = data + entry.num_moves * sizeof(float);
+      for (uint32_t j = 0; j < entry.num_moves; j++) {
+        float p;
+        std::memcpy(&p, data + j * sizeof(float), sizeof(float));
+        request->p[j].second = CachedNNRequest::PackP(p);
+        std::memcpy(&request->p[j].first, indices + j * sizeof(uint16_t),
+                    sizeof(uint16_t));
+      }
+      cache->Insert(entry.hash, std::move(request));
+      ++loaded;
+    }
+    data += moves_size;
+  }
+  if (data != end) throw Exception("Invalid NN cache file: " + filename);
+  return loaded;
+}
 CachingComputation::CachingComputation(
-    std::unique_ptr<NetworkComputation> parent, NNCache* cache)
-    : parent_(std::move(parent)), cache_(cache) {}
+    std::unique_ptr<NetworkComputation> parent, NNCache* cache,
+    bool measure_lock_wait)
+    : parent_(std::move(parent)),
+      cache_(cache),
+      measure_lock_wait_(measure_lock_wait) {}
 
 int CachingComputation::GetCacheMisses() const {
   return parent_->GetBatchSize();
@@ -40,7 +170,16 @@ int CachingComputation::GetCacheMisses() const {
 int CachingComputation::GetBatchSize() const { return batch_.size(); }
 
 bool CachingComputation::AddInputByHash(uint64_t hash) {
-  NNCacheLock lock(cache_, hash);
+  NNCacheLock lock(cache_, hash, LockWaitCounter());
+  if (!lock && cache_->GetSharedCache()) {
+    // Entries are pinned in the local cache while used, so shared ones are
+    // copied there.
+    auto request = cache_->GetSharedCache()->Lookup(hash);
+    if (request) {
+      cache_->Insert(hash, std::move(request), LockWaitCounter());
+      lock = NNCacheLock(cache_, hash, LockWaitCounter());
+    }
+  }
   if (!lock) return false;
   batch_.emplace_back();
   batch_.back().lock = std::move(lock);
@@ -84,12 +223,25 @@ void CachingComputation::ComputeBlocking() {
     req->q = parent_->GetQVal(item.idx_in_parent);
     req->d = parent_->GetDVal(item.idx_in_parent);
     req->m = parent_->GetMVal(item.idx_in_parent);
+    // Compact storage is the most precise around 0, so policy logits are
+    // shifted for the largest one to be 0 there. Softmax is not changed.
+    float shift = 0.0f;
+#if defined(USE_COMPACT_STATS)
+    shift = std::numeric_limits<float>::lowest();
+    for (auto x : item.probabilities_to_cache) {
+      shift = std::max(shift, parent_->GetPVal(item.idx_in_parent, x));
+    }
+#endif
     int idx = 0;
     for (auto x : item.probabilities_to_cache) {
-      req->p[idx++] =
-          std::make_pair(x, parent_->GetPVal(item.idx_in_parent, x));
+      req->p[idx++] = std::make_pair(
+          x, CachedNNRequest::PackP(parent_->GetPVal(item.idx_in_parent, x) -
+                                    shift));
+    }
+    if (cache_->GetSharedCache()) {
+      cache_->GetSharedCache()->Insert(item.hash, *req);
     }
-    cache_->Insert(item.hash, std::move(req));
+    cache_->Insert(item.hash, std::move(req), LockWaitCounter());
   }
 }
 
@@ -122,7 +274,7 @@ float CachingComputation::GetPVal(int sample, int move_id) const {
     // Optimization: usually moves are stored in the same order as queried.
     const auto& move = moves[item.last_idx++];
     if (item.last_idx == moves.size()) item.last_idx = 0;
-    if (move.first == move_id) return move.second;
+    if (move.first == move_id) return CachedNNRequest::UnpackP(move.second);
     ++total_count;
   }
   assert(false);  // Move not found.
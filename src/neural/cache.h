@@ -28,13 +28,24 @@
 
 #include "neural/network.h"
 #include "utils/cache.h"
+#include "utils/fp16_utils.h"
 #include "utils/smallarray.h"
 
 namespace lczero {
 
 struct CachedNNRequest {
   CachedNNRequest(size_t size) : p(size) {}
+#if defined(USE_COMPACT_STATS)
+  // Policy logits are stored as fp16, shifted for the largest one to be 0 (see
+  // CachingComputation::ComputeBlocking()).
+  typedef std::pair<uint16_t, uint16_t> IdxAndProb;
+  static uint16_t PackP(float p) { return FP32toFP16(p); }
+  static float UnpackP(uint16_t p) { return FP16toFP32(p); }
+#else
   typedef std::pair<uint16_t, float> IdxAndProb;
+  static float PackP(float p) { return p; }
+  static float UnpackP(float p) { return p; }
+#endif
   float q;
   float d;
   float m;
@@ -42,16 +53,49 @@ struct CachedNNRequest {
   SmallArray<IdxAndProb> p;
 };
 
-typedef LruCache<uint64_t, CachedNNRequest> NNCache;
+class SharedNNCache;
+
+// Cache of NN evaluations of this process. It can have a SharedNNCache as a
+// second level, which is looked up on misses and receives all new entries.
+class NNCache : public LruCache<uint64_t, CachedNNRequest> {
+ public:
+  using LruCache::LruCache;
+
+  // Sets the second level cache, nullptr for none. Must not be called while
+  // the cache is used by a search.
+  void SetSharedCache(std::shared_ptr<SharedNNCache> shared_cache) {
+    shared_cache_ = std::move(shared_cache);
+  }
+  SharedNNCache* GetSharedCache() const { return shared_cache_.get(); }
+
+ private:
+  std::shared_ptr<SharedNNCache> shared_cache_;
+};
 typedef LruCacheLock<uint64_t, CachedNNRequest> NNCacheLock;
 
+// Writes all entries of @cache to @filename, tagged with @network_hash so that
+// they are only loaded for the same network. Returns the number of entries
+// written. Throws exception if the file cannot be written.
+int SaveNNCacheSnapshot(const NNCache& cache, uint64_t network_hash,
+                        const std::string& filename);
+
+// Inserts entries of the snapshot @filename into @cache, keeping their
+// recency order. Only the newest entries are loaded when the snapshot is
+// larger than the cache. Returns the number of entries loaded, 0 if the file
+// doesn't exist or was written for another network. Throws exception if the
+// file is corrupt.
+int LoadNNCacheSnapshot(NNCache* cache, uint64_t network_hash,
+                        const std::string& filename);
+
 // Wraps around NetworkComputation and caches result.
 // While it mostly repeats NetworkComputation interface, it's not derived
 // from it, as AddInput() needs hash and index of probabilities to store.
 class CachingComputation {
  public:
+  // With @measure_lock_wait, the time spent waiting for the lock of @cache is
+  // summed up for GetCacheLockWaitNs().
   CachingComputation(std::unique_ptr<NetworkComputation> parent,
-                     NNCache* cache);
+                     NNCache* cache, bool measure_lock_wait = false);
 
   // How many inputs are not found in cache and will be forwarded to a wrapped
   // computation.
@@ -82,8 +126,14 @@ class CachingComputation {
   // Pops last input from the computation. Only allowed for inputs which were
   // cached.
   void PopCacheHit();
+  // Time spent waiting for the cache lock in lookups and inserts so far, ns.
+  int64_t GetCacheLockWaitNs() const { return lock_wait_ns_; }
 
  private:
+  int64_t* LockWaitCounter() {
+    return measure_lock_wait_ ? &lock_wait_ns_ : nullptr;
+  }
+
   struct WorkItem {
     uint64_t hash;
     NNCacheLock lock;
@@ -95,6 +145,8 @@ class CachingComputation {
   std::unique_ptr<NetworkComputation> parent_;
   NNCache* cache_;
   std::vector<WorkItem> batch_;
+  const bool measure_lock_wait_;
+  int64_t lock_wait_ns_ = 0;
 };
 
 }  // namespace lczero
@@ -0,0 +1,201 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/cache.h"
+#include "neural/shared_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace lczero {
+
+namespace {
+const char kFilename[] = "nncache_test.bin";
+
+std::unique_ptr<CachedNNRequest> MakeEntry(uint64_t hash, int moves) {
+  auto request = std::make_unique<CachedNNRequest>(moves);
+  request->q = 0.25f + hash;
+  request->d = 0.5f;
+  request->m = 30.0f;
+  for (int i = 0; i < moves; i++) {
+    request->p[i] = {static_cast<uint16_t>(i * 7),
+                     CachedNNRequest::PackP(1.0f / (i + 1))};
+  }
+  return request;
+}
+
+void InsertEntry(NNCache* cache, uint64_t hash, int moves) {
+  cache->Insert(hash, MakeEntry(hash, moves));
+}
+}  // namespace
+
+TEST(NNCacheSnapshot, RoundTrip) {
+  NNCache cache(10);
+  InsertEntry(&cache, 1, 3);
+  InsertEntry(&cache, 2, 0);
+  InsertEntry(&cache, 3, 255);
+  EXPECT_EQ(SaveNNCacheSnapshot(cache, 42, kFilename), 3);
+
+  NNCache loaded(10);
+  EXPECT_EQ(LoadNNCacheSnapshot(&loaded, 42, kFilename), 3);
+  std::remove(kFilename);
+  EXPECT_EQ(loaded.GetSize(), 3);
+  for (uint64_t hash : {1, 2, 3}) {
+    NNCacheLock original(&cache, hash);
+    NNCacheLock copy(&loaded, hash);
+    ASSERT_TRUE(copy);
+    EXPECT_EQ(copy->q, original->q);
+    EXPECT_EQ(copy->d, original->d);
+    EXPECT_EQ(copy->m, original->m);
+    ASSERT_EQ(copy->p.size(), original->p.size());
+    for (int i = 0; i < copy->p.size(); i++) {
+      EXPECT_EQ(copy->p[i], original->p[i]);
+    }
+  }
+}
+
+TEST(NNCacheSnapshot, IgnoresOtherNetwork) {
+  NNCache cache(10);
+  InsertEntry(&cache, 1, 3);
+  SaveNNCacheSnapshot(cache, 42, kFilename);
+  NNCache loaded(10);
+  EXPECT_EQ(LoadNNCacheSnapshot(&loaded, 43, kFilename), 0);
+  std::remove(kFilename);
+  EXPECT_EQ(loaded.GetSize(), 0);
+}
+
+TEST(NNCacheSnapshot, KeepsNewestEntriesWhenCacheIsSmaller) {
+  NNCache cache(10);
+  for (uint64_t hash = 1; hash <= 5; hash++) InsertEntry(&cache, hash, 2);
+  SaveNNCacheSnapshot(cache, 42, kFilename);
+  NNCache loaded(2);
+  EXPECT_EQ(LoadNNCacheSnapshot(&loaded, 42, kFilename), 2);
+  std::remove(kFilename);
+  EXPECT_FALSE(loaded.ContainsKey(3));
+  EXPECT_TRUE(loaded.ContainsKey(4));
+  EXPECT_TRUE(loaded.ContainsKey(5));
+}
+
+TEST(NNCacheSnapshot, MissingFileLoadsNothing) {
+  NNCache cache(10);
+  EXPECT_EQ(LoadNNCacheSnapshot(&cache, 42, "nonexistent_nncache.bin"), 0);
+}
+
+// Logits are stored shifted to be at most 0, where even fp16 keeps policy
+// priors within a percent.
+TEST(CachedNNRequest, PackedPolicyIsPrecise) {
+  std::vector<float> logits;
+  for (float x = -16.0f; x <= 0.0f; x += 0.0137f) logits.push_back(x);
+  double sum = 0.0;
+  double packed_sum = 0.0;
+  for (const float x : logits) {
+    const float unpacked = CachedNNRequest::UnpackP(CachedNNRequest::PackP(x));
+    EXPECT_NEAR(unpacked, x, std::abs(x) / 1024.0f + 1e-7f);
+    sum += std::exp(x);
+    packed_sum += std::exp(unpacked);
+  }
+  for (const float x : logits) {
+    const float p = std::exp(x) / sum;
+    const float packed_p =
+        std::exp(CachedNNRequest::UnpackP(CachedNNRequest::PackP(x))) /
+        packed_sum;
+    EXPECT_NEAR(packed_p, p, p * 0.01f);
+  }
+}
+
+// Shared caches of one network are the same memory, tests remove it at start
+// and at exit.
+class SharedNNCacheTest : public ::testing::Test {
+ protected:
+  static constexpr uint64_t kNetworkHash = 0x5ca1ab1e0ddba11;
+  void SetUp() override {
+    SharedMemory::Remove(SharedNNCache::GetSegmentName(kNetworkHash));
+  }
+  void TearDown() override { SetUp(); }
+};
+
+TEST_F(SharedNNCacheTest, EntriesAreSharedBetweenInstances) {
+  SharedNNCache writer(kNetworkHash, 100);
+  // The existing segment keeps its size.
+  SharedNNCache reader(kNetworkHash, 1000);
+  EXPECT_EQ(reader.GetCapacity(), 100);
+  EXPECT_EQ(reader.Lookup(3), nullptr);
+
+  writer.Insert(3, *MakeEntry(3, 40));
+  const auto entry = reader.Lookup(3);
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(entry->q, 3.25f);
+  EXPECT_EQ(entry->d, 0.5f);
+  EXPECT_EQ(entry->m, 30.0f);
+  ASSERT_EQ(entry->p.size(), 40);
+  for (int i = 0; i < 40; i++) {
+    EXPECT_EQ(entry->p[i].first, i * 7);
+    EXPECT_EQ(CachedNNRequest::UnpackP(entry->p[i].second),
+              CachedNNRequest::UnpackP(CachedNNRequest::PackP(1.0f / (i + 1))));
+  }
+  // Hashes of other networks are in other segments.
+  SharedNNCache other(kNetworkHash + 1, 100);
+  EXPECT_EQ(other.Lookup(3), nullptr);
+  SharedMemory::Remove(SharedNNCache::GetSegmentName(kNetworkHash + 1));
+}
+
+TEST_F(SharedNNCacheTest, NewEntriesReplaceOldOnes) {
+  SharedNNCache cache(kNetworkHash, 100);
+  cache.Insert(3, *MakeEntry(3, 20));
+  cache.Insert(103, *MakeEntry(103, 20));
+  EXPECT_EQ(cache.Lookup(3), nullptr);
+  ASSERT_NE(cache.Lookup(103), nullptr);
+  EXPECT_EQ(cache.Lookup(103)->q, 103.25f);
+  // Positions with too many moves for a slot are not stored.
+  cache.Insert(4, *MakeEntry(4, 218));
+  EXPECT_EQ(cache.Lookup(4), nullptr);
+}
+
+TEST_F(SharedNNCacheTest, ComputationUsesSharedEntries) {
+  auto shared = std::make_shared<SharedNNCache>(kNetworkHash, 100);
+  shared->Insert(5, *MakeEntry(5, 10));
+  NNCache cache(10);
+  cache.SetSharedCache(shared);
+  // Cache hits don't need the network.
+  CachingComputation computation(nullptr, &cache);
+  EXPECT_FALSE(computation.AddInputByHash(6));
+  ASSERT_TRUE(computation.AddInputByHash(5));
+  EXPECT_EQ(computation.GetQVal(0), 5.25f);
+  EXPECT_EQ(computation.GetPVal(0, 14),
+            CachedNNRequest::UnpackP(CachedNNRequest::PackP(1.0f / 3)));
+  EXPECT_TRUE(cache.ContainsKey(5));
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -28,9 +28,12 @@
 #include "neural/factory.h"
 
 #include <algorithm>
+#include <cstring>
+#include <fstream>
 
 #include "neural/loader.h"
 #include "utils/commandline.h"
+#include "utils/hashcat.h"
 #include "utils/logging.h"
 
 namespace lczero {
@@ -109,8 +112,31 @@ bool NetworkFactory::BackendConfiguration::operator==(
           backend_options == other.backend_options);
 }
 
+namespace {
+// Unlike std::hash, stays the same between builds, as it's stored in files.
+uint64_t HashBytes(uint64_t hash, const char* data, size_t size) {
+  for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+    uint64_t word = 0;
+    std::memcpy(&word, data + i, std::min(sizeof(word), size - i));
+    hash = HashCat(hash, word);
+  }
+  return hash;
+}
+
+uint64_t HashFileContents(const std::string& filename) {
+  std::ifstream input(filename, std::ios_base::binary);
+  std::vector<char> buffer(1 << 20);
+  uint64_t hash = 0;
+  while (input) {
+    input.read(buffer.data(), buffer.size());
+    hash = HashBytes(hash, buffer.data(), input.gcount());
+  }
+  return hash;
+}
+}  // namespace
+
 std::unique_ptr<Network> NetworkFactory::LoadNetwork(
-    const OptionsDict& options) {
+    const OptionsDict& options, uint64_t* network_hash) {
   std::string net_path = options.Get<std::string>(kWeightsId);
   const std::string backend = options.Get<std::string>(kBackendId);
   const std::string backend_options =
@@ -133,6 +159,12 @@ std::unique_ptr<Network> NetworkFactory::LoadNetwork(
 
   auto ptr = NetworkFactory::Get()->Create(backend, weights, network_options);
   network_options.CheckAllOptionsRead(backend);
+  if (network_hash) {
+    uint64_t hash = net_path.empty() ? 0 : HashFileContents(net_path);
+    hash = HashBytes(hash, backend.data(), backend.size());
+    *network_hash = HashBytes(hash, backend_options.data(),
+                              backend_options.size());
+  }
   return ptr;
 }
 
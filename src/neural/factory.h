@@ -68,7 +68,10 @@ class NetworkFactory {
 
   // Helper function to load the network from the options. Returns nullptr
   // if no network options changed since the previous call.
-  static std::unique_ptr<Network> LoadNetwork(const OptionsDict& options);
+  // If @network_hash is not null, it's set to a hash of the weights file
+  // contents, backend and backend options.
+  static std::unique_ptr<Network> LoadNetwork(const OptionsDict& options,
+                                              uint64_t* network_hash = nullptr);
 
   // Parameter IDs.
   static const OptionId kWeightsId;
@@ -25,8 +25,11 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <condition_variable>
-#include <queue>
+#include <deque>
 #include <thread>
 
 #include "neural/factory.h"
@@ -36,6 +39,9 @@
 namespace lczero {
 namespace {
 
+// Weight of the latest measurement in the backend throughput estimate.
+const double kThroughputDecay = 0.1;
+
 class DemuxingNetwork;
 class DemuxingComputation : public NetworkComputation {
  public:
@@ -48,27 +54,20 @@ class DemuxingComputation : public NetworkComputation {
   int GetBatchSize() const override { return planes_.size(); }
 
   float GetQVal(int sample) const override {
-    const int idx = sample / partial_size_;
-    const int offset = sample % partial_size_;
-    return parents_[idx]->GetQVal(offset);
+    return parents_[split_of_sample_[sample]]->GetQVal(Offset(sample));
   }
 
   float GetDVal(int sample) const override {
-    int idx = sample / partial_size_;
-    int offset = sample % partial_size_;
-    return parents_[idx]->GetDVal(offset);
+    return parents_[split_of_sample_[sample]]->GetDVal(Offset(sample));
   }
 
   float GetMVal(int sample) const override {
-    int idx = sample / partial_size_;
-    int offset = sample % partial_size_;
-    return parents_[idx]->GetMVal(offset);
+    return parents_[split_of_sample_[sample]]->GetMVal(Offset(sample));
   }
 
   float GetPVal(int sample, int move_id) const override {
-    const int idx = sample / partial_size_;
-    const int offset = sample % partial_size_;
-    return parents_[idx]->GetPVal(offset, move_id);
+    return parents_[split_of_sample_[sample]]->GetPVal(Offset(sample),
+                                                       move_id);
   }
 
   void NotifyComplete() {
@@ -79,28 +78,46 @@ class DemuxingComputation : public NetworkComputation {
     }
   }
 
-  NetworkComputation* AddParentFromNetwork(Network* network) {
-    std::unique_lock<std::mutex> lock(mutex_);
-    parents_.emplace_back(network->NewComputation());
-    const int cur_idx = (parents_.size() - 1) * partial_size_;
-    for (int i = cur_idx; i < std::min(GetBatchSize(), cur_idx + partial_size_);
-         i++) {
-      parents_.back()->AddInput(std::move(planes_[i]));
+  // Computes samples [start, start + size) of the batch, which are split
+  // number @split, on @network.
+  void ComputeSplit(int split, int start, int size, Network* network) {
+    auto computation = network->NewComputation();
+    for (int i = start; i < start + size; i++) {
+      computation->AddInput(std::move(planes_[i]));
     }
-    return parents_.back().get();
+    computation->ComputeBlocking();
+    // Each split has its own slot, so no locking is needed.
+    parents_[split] = std::move(computation);
+  }
+
+  // Registers samples [start, start + size) as split number @split.
+  void AddSplit(int split, int start, int size) {
+    split_start_.push_back(start);
+    split_of_sample_.insert(split_of_sample_.end(), size, split);
   }
 
  private:
+  int Offset(int sample) const {
+    return sample - split_start_[split_of_sample_[sample]];
+  }
+
   std::vector<InputPlanes> planes_;
   DemuxingNetwork* network_;
   std::vector<std::unique_ptr<NetworkComputation>> parents_;
+  std::vector<int> split_start_;
+  std::vector<int> split_of_sample_;
 
   std::mutex mutex_;
   std::condition_variable dataready_cv_;
   int dataready_ = 0;
-  int partial_size_ = 0;
+
+  friend class DemuxingNetwork;
 };
 
+// Splits each batch between child backends in proportion to their measured
+// throughput. Every backend has its own queue of splits, and its threads
+// steal from other queues when their own queue is empty and they'd finish a
+// split earlier than its owner.
 class DemuxingNetwork : public Network {
  public:
   DemuxingNetwork(const std::optional<WeightsFile>& weights,
@@ -122,20 +139,24 @@ class DemuxingNetwork : public Network {
   void AddBackend(const std::string& name,
                   const std::optional<WeightsFile>& weights,
                   const OptionsDict& opts) {
-    const int nn_threads = opts.GetOrDefault<int>("threads", 1);
+    const int nn_threads = std::max(1, opts.GetOrDefault<int>("threads", 1));
     const std::string backend = opts.GetOrDefault<std::string>("backend", name);
 
-    networks_.emplace_back(
-        NetworkFactory::Get()->Create(backend, weights, opts));
+    auto child = std::make_unique<Backend>();
+    child->network = NetworkFactory::Get()->Create(backend, weights, opts);
+    child->threads = nn_threads;
 
-    if (networks_.size() == 1) {
-      capabilities_ = networks_.back()->GetCapabilities();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (backends_.empty()) {
+      capabilities_ = child->network->GetCapabilities();
     } else {
-      capabilities_.Merge(networks_.back()->GetCapabilities());
+      capabilities_.Merge(child->network->GetCapabilities());
     }
+    backends_.emplace_back(std::move(child));
+    const int backend_idx = backends_.size() - 1;
 
     for (int i = 0; i < nn_threads; ++i) {
-      threads_.emplace_back([this, i]() { Worker(i); });
+      threads_.emplace_back([this, backend_idx, i]() { Worker(backend_idx, i); });
     }
   }
 
@@ -147,51 +168,84 @@ class DemuxingNetwork : public Network {
     return capabilities_;
   }
 
-  void Enqueue(DemuxingComputation* computation) {
+  // Splits @computation between backends and queues the splits. Returns the
+  // number of splits.
+  int Enqueue(DemuxingComputation* computation) {
+    const int batch_size = computation->GetBatchSize();
     std::lock_guard<std::mutex> lock(mutex_);
-    queue_.push(computation);
-    cv_.notify_one();
+    double total_rate = 0.0;
+    for (const auto& backend : backends_) total_rate += BackendRate(*backend);
+
+    int start = 0;
+    int split = 0;
+    for (size_t i = 0; i < backends_.size() && start < batch_size; ++i) {
+      Backend* backend = backends_[i].get();
+      // The last backend takes rounding leftovers.
+      int share = i + 1 == backends_.size()
+                      ? batch_size - start
+                      : std::lround(batch_size * BackendRate(*backend) /
+                                    total_rate);
+      share = std::min(share, batch_size - start);
+      if (share <= 0) continue;
+      // One split per thread of the backend, but not smaller than
+      // minimum_split_size_.
+      const int split_size =
+          std::max(minimum_split_size_,
+                   (share + backend->threads - 1) / backend->threads);
+      for (int end = start + share; start < end; start += split_size) {
+        const int size = std::min(split_size, batch_size - start);
+        computation->AddSplit(split, start, size);
+        backend->queue.push_back({computation, split++, start, size});
+        backend->queued_samples += size;
+      }
+    }
+    computation->parents_.resize(split);
+    cv_.notify_all();
+    return split;
   }
 
   ~DemuxingNetwork() {
     Abort();
     Wait();
     // Unstuck waiting computations.
-    while (!queue_.empty()) {
-      queue_.front()->NotifyComplete();
-      queue_.pop();
+    for (auto& backend : backends_) {
+      for (const auto& split : backend->queue) {
+        split.computation->NotifyComplete();
+      }
+      backend->queue.clear();
     }
   }
 
-  void Worker(int id) {
+  void Worker(int backend_idx, int id) {
     // Add one to the id in order to leave space for an active search thread.
     Numa::BindThread(id + 1);
     // While Abort() is not called (and it can only be called from destructor).
-    while (!abort_) {
+    while (true) {
+      Split split;
+      Backend* backend;
       {
-        {
-          std::unique_lock<std::mutex> lock(mutex_);
-          // Wait until there's come work to compute.
-          cv_.wait(lock, [&] { return abort_ || !queue_.empty(); });
-          if (abort_) break;
-        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        backend = backends_[backend_idx].get();
+        // Wait until there's some work to compute.
+        cv_.wait(lock, [&] { return abort_ || TakeSplit(backend, &split); });
+        if (abort_) break;
+      }
 
-        // While there is a work in queue, process it.
-        while (true) {
-          DemuxingComputation* to_notify;
-          {
-            std::unique_lock<std::mutex> lock(mutex_);
-            if (queue_.empty()) break;
-            to_notify = queue_.front();
-            queue_.pop();
-          }
-          long long net_idx = ++(counter_) % networks_.size();
-          NetworkComputation* to_compute =
-              to_notify->AddParentFromNetwork(networks_[net_idx].get());
-          to_compute->ComputeBlocking();
-          to_notify->NotifyComplete();
-        }
+      const auto start = std::chrono::steady_clock::now();
+      split.computation->ComputeSplit(split.idx, split.start, split.size,
+                                      backend->network.get());
+      const double seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const double rate = split.size / std::max(seconds, 1e-6);
+        backend->rate = backend->rate == 0.0
+                            ? rate
+                            : backend->rate * (1.0 - kThroughputDecay) +
+                                  rate * kThroughputDecay;
       }
+      split.computation->NotifyComplete();
     }
   }
 
@@ -210,11 +264,73 @@ class DemuxingNetwork : public Network {
     }
   }
 
-  std::vector<std::unique_ptr<Network>> networks_;
+ private:
+  struct Split {
+    DemuxingComputation* computation;
+    int idx;
+    int start;
+    int size;
+  };
+
+  struct Backend {
+    std::unique_ptr<Network> network;
+    int threads = 1;
+    std::deque<Split> queue;
+    int queued_samples = 0;
+    // Measured samples per second of one thread, 0 until the first split is
+    // computed.
+    double rate = 0.0;
+  };
+
+  // Returns throughput of all threads of @backend. Backends which haven't
+  // computed anything yet are assumed to be as fast as the average one.
+  double BackendRate(const Backend& backend) const {
+    double rate = backend.rate;
+    if (rate == 0.0) {
+      int measured = 0;
+      for (const auto& other : backends_) {
+        if (other->rate == 0.0) continue;
+        rate += other->rate;
+        ++measured;
+      }
+      rate = measured ? rate / measured : 1.0;
+    }
+    return rate * backend.threads;
+  }
+
+  // Takes the next split of @backend, or steals the last split of another
+  // backend if @backend would compute it sooner. Requires mutex_ to be held.
+  bool TakeSplit(Backend* backend, Split* split) {
+    Backend* victim = backend;
+    if (backend->queue.empty()) {
+      victim = nullptr;
+      double victim_time = 0.0;
+      for (auto& other : backends_) {
+        if (other->queue.empty()) continue;
+        // Time for the owner to drain its queue.
+        const double time = other->queued_samples / BackendRate(*other);
+        if (!victim || time > victim_time) {
+          victim = other.get();
+          victim_time = time;
+        }
+      }
+      if (!victim) return false;
+      const double steal_time =
+          victim->queue.back().size * backend->threads / BackendRate(*backend);
+      if (steal_time >= victim_time) return false;
+      *split = victim->queue.back();
+      victim->queue.pop_back();
+    } else {
+      *split = backend->queue.front();
+      backend->queue.pop_front();
+    }
+    victim->queued_samples -= split->size;
+    return true;
+  }
+
+  std::vector<std::unique_ptr<Backend>> backends_;
   NetworkCapabilities capabilities_;
-  std::queue<DemuxingComputation*> queue_;
   int minimum_split_size_ = 0;
-  std::atomic<long long> counter_;
   bool abort_ = false;
 
   std::mutex mutex_;
@@ -225,18 +341,8 @@ class DemuxingNetwork : public Network {
 
 void DemuxingComputation::ComputeBlocking() {
   if (GetBatchSize() == 0) return;
-  partial_size_ = (GetBatchSize() + network_->threads_.size() - 1) /
-                  network_->threads_.size();
-  if (partial_size_ < network_->minimum_split_size_) {
-    partial_size_ = std::min(GetBatchSize(), network_->minimum_split_size_);
-  }
-  const int splits = (GetBatchSize() + partial_size_ - 1) / partial_size_;
-
   std::unique_lock<std::mutex> lock(mutex_);
-  dataready_ = splits;
-  for (int j = 0; j < splits; j++) {
-    network_->Enqueue(this);
-  }
+  dataready_ = network_->Enqueue(this);
   dataready_cv_.wait(lock, [this]() { return dataready_ == 0; });
 }
 
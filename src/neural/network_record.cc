@@ -25,19 +25,218 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include "neural/network_record.h"
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <unordered_map>
 
 #include "neural/factory.h"
+#include "utils/filesystem.h"
 #include "utils/hashcat.h"
+#include "utils/logging.h"
+#include "utils/mutex.h"
 
 namespace lczero {
 namespace {
 
+// Trace file layout: TraceHeader, then an open addressing hash table of
+// TraceHeader::table_size TraceSlot entries (size is a power of two), then all
+// recorded values as floats. The whole file is meant to be memory mapped, so
+// lookups during replay don't allocate or copy anything.
+const char kTraceMagic[8] = {'L', 'c', '0', 'T', 'r', 'a', 'c', 'e'};
+const uint32_t kTraceVersion = 1;
+
+struct TraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t input_format;
+  uint32_t moves_left;
+  uint32_t reserved;
+  uint64_t table_size;
+  uint64_t num_values;
+};
+
+struct TraceSlot {
+  uint64_t hash;
+  // Index of the first value in the value section.
+  uint64_t offset;
+  // Number of values, 0 for an empty slot.
+  uint32_t length;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(TraceHeader) == 40, "Unexpected TraceHeader size");
+static_assert(sizeof(TraceSlot) == 24, "Unexpected TraceSlot size");
+
+using TraceRecords = std::unordered_map<uint64_t, std::vector<float>>;
+
+// Serializes @records in the trace file format.
+void WriteTrace(std::ostream* output, const TraceRecords& records,
+                const NetworkCapabilities& capabilities) {
+  uint64_t table_size = 16;
+  // Keep load factor at most 1/2 so that probe sequences stay short.
+  while (table_size < records.size() * 2) table_size *= 2;
+  std::vector<TraceSlot> table(table_size);
+  std::vector<float> values;
+  for (const auto& entry : records) {
+    if (entry.second.empty()) continue;
+    uint64_t idx = entry.first & (table_size - 1);
+    while (table[idx].length != 0) idx = (idx + 1) & (table_size - 1);
+    table[idx].hash = entry.first;
+    table[idx].offset = values.size();
+    table[idx].length = static_cast<uint32_t>(entry.second.size());
+    values.insert(values.end(), entry.second.begin(), entry.second.end());
+  }
+  TraceHeader header{};
+  std::memcpy(header.magic, kTraceMagic, sizeof(kTraceMagic));
+  header.version = kTraceVersion;
+  header.input_format = capabilities.input_format;
+  header.moves_left = capabilities.moves_left;
+  header.table_size = table_size;
+  header.num_values = values.size();
+  output->write(reinterpret_cast<const char*>(&header), sizeof(header));
+  output->write(reinterpret_cast<const char*>(table.data()),
+                table.size() * sizeof(TraceSlot));
+  output->write(reinterpret_cast<const char*>(values.data()),
+                values.size() * sizeof(float));
+}
+
+// Collects records from all computations of the network, and writes them to
+// the trace file on WriteNNTrace() or when the network is destroyed.
+class TraceWriter {
+ public:
+  TraceWriter(const std::string& filename) : filename_(filename) {}
+
+  // Only the first record for every hash is kept.
+  void Add(uint64_t hash, std::vector<float>&& values) {
+    Mutex::Lock lock(mutex_);
+    records_.emplace(hash, std::move(values));
+  }
+
+  void Write(const NetworkCapabilities& capabilities) {
+    Mutex::Lock lock(mutex_);
+    std::ofstream output(filename_, std::ios::trunc | std::ios_base::binary);
+    if (!output) throw Exception("Cannot write trace file: " + filename_);
+    WriteTrace(&output, records_, capabilities);
+    CERR << "Recorded " << records_.size() << " NN evaluations to "
+         << filename_;
+  }
+
+ private:
+  const std::string filename_;
+  Mutex mutex_;
+  TraceRecords records_ GUARDED_BY(mutex_);
+};
+
+// Read-only view of a trace file.
+class TraceReader {
+ public:
+  TraceReader(const std::string& filename) {
+    const auto size = GetFileSize(filename);
+    TraceHeader header;
+    bool indexed = false;
+    if (size >= sizeof(header)) {
+      std::ifstream input(filename, std::ios_base::binary);
+      input.read(reinterpret_cast<char*>(&header), sizeof(header));
+      indexed =
+          std::memcmp(header.magic, kTraceMagic, sizeof(kTraceMagic)) == 0;
+    }
+    if (indexed) {
+      mapped_ = std::make_unique<MappedFile>(filename);
+      Init(mapped_->data(), mapped_->size());
+      has_capabilities_ = true;
+    } else {
+      // Streamed format of older versions: convert to an in-memory image.
+      std::ostringstream image;
+      WriteTrace(&image, LoadLegacy(filename), {});
+      legacy_image_ = image.str();
+      Init(legacy_image_.data(), legacy_image_.size());
+    }
+  }
+
+  // Returns whether the trace file contains network capabilities.
+  bool HasCapabilities() const { return has_capabilities_; }
+  NetworkCapabilities GetCapabilities() const {
+    NetworkCapabilities capabilities;
+    capabilities.input_format =
+        static_cast<pblczero::NetworkFormat::InputFormat>(
+            header_->input_format);
+    capabilities.moves_left =
+        static_cast<pblczero::NetworkFormat::MovesLeftFormat>(
+            header_->moves_left);
+    return capabilities;
+  }
+
+  // Returns slot for a given hash, or nullptr if the hash was not recorded.
+  const TraceSlot* Find(uint64_t hash) const {
+    const uint64_t mask = header_->table_size - 1;
+    for (uint64_t idx = hash & mask; table_[idx].length != 0;
+         idx = (idx + 1) & mask) {
+      if (table_[idx].hash == hash) return &table_[idx];
+    }
+    return nullptr;
+  }
+  const float* Values(const TraceSlot* slot) const {
+    return values_ + slot->offset;
+  }
+
+ private:
+  void Init(const char* data, uint64_t size) {
+    header_ = reinterpret_cast<const TraceHeader*>(data);
+    if (size < sizeof(TraceHeader) || header_->version != kTraceVersion ||
+        header_->table_size == 0 ||
+        (header_->table_size & (header_->table_size - 1)) != 0 ||
+        size != sizeof(TraceHeader) + header_->table_size * sizeof(TraceSlot) +
+                    header_->num_values * sizeof(float)) {
+      throw Exception("Invalid trace file.");
+    }
+    table_ = reinterpret_cast<const TraceSlot*>(data + sizeof(TraceHeader));
+    values_ = reinterpret_cast<const float*>(
+        data + sizeof(TraceHeader) + header_->table_size * sizeof(TraceSlot));
+  }
+
+  static TraceRecords LoadLegacy(const std::string& filename) {
+    TraceRecords records;
+    std::ifstream input(filename, std::ios_base::binary);
+    input.seekg(0, input.end);
+    auto file_length = input.tellg();
+    input.seekg(0, input.beg);
+    while (input.tellg() < file_length) {
+      uint64_t value = 0;
+      input.read(reinterpret_cast<char*>(&value), sizeof(value));
+      int32_t length = 0;
+      input.read(reinterpret_cast<char*>(&length), sizeof(length));
+      auto& entry = records[value];
+      // Only use the first recorded value for any hash collisions.
+      bool fill = entry.size() == 0;
+      for (int j = 0; j < length; j++) {
+        float recorded = 0.0f;
+        input.read(reinterpret_cast<char*>(&recorded), sizeof(recorded));
+        if (fill) {
+          entry.push_back(recorded);
+        }
+      }
+    }
+    return records;
+  }
+
+  std::unique_ptr<MappedFile> mapped_;
+  std::string legacy_image_;
+  bool has_capabilities_ = false;
+  const TraceHeader* header_ = nullptr;
+  const TraceSlot* table_ = nullptr;
+  const float* values_ = nullptr;
+};
+
 class RecordComputation : public NetworkComputation {
  public:
   RecordComputation(std::unique_ptr<NetworkComputation>&& inner,
-                    const std::string& record_file)
-      : inner_(std::move(inner)), record_file_(record_file) {}
+                    TraceWriter* writer)
+      : inner_(std::move(inner)), writer_(writer) {}
   static uint64_t make_hash(const InputPlanes& input) {
     std::uint64_t hash = 0x2134435D4534LL;
     for (const auto& plane : input) {
@@ -83,63 +282,50 @@ class RecordComputation : public NetworkComputation {
     return Capture(inner_->GetMVal(sample), sample);
   }
   virtual ~RecordComputation() {
-    Mutex::Lock lock(mutex_);
-    std::fstream output(record_file_, std::ios::app | std::ios_base::binary);
     for (size_t i = 0; i < hashes_.size(); i++) {
-      uint64_t value = hashes_[i];
-      output.write(reinterpret_cast<const char*>(&value), sizeof(value));
-      int32_t length = static_cast<int32_t>(requests_[i].size());
-      output.write(reinterpret_cast<const char*>(&length), sizeof(length));
-      for (int j = 0; j < length; j++) {
-        float recorded = requests_[i][j];
-        output.write(reinterpret_cast<const char*>(&recorded),
-                     sizeof(recorded));
-      }
+      writer_->Add(hashes_[i], std::move(requests_[i]));
     }
   }
   std::unique_ptr<NetworkComputation> inner_;
-  std::string record_file_;
+  TraceWriter* writer_;
   std::vector<uint64_t> hashes_;
   mutable std::vector<int> q_count_;
   mutable std::vector<std::vector<float>> requests_;
-  static Mutex mutex_;
 };
 
-Mutex RecordComputation::mutex_;
-
 class ReplayComputation : public NetworkComputation {
  public:
-  ReplayComputation(std::unordered_map<uint64_t, std::vector<float>>* lookup)
-      : lookup_(lookup) {}
+  ReplayComputation(const TraceReader* trace, std::atomic<int64_t>* misses)
+      : trace_(trace), misses_(misses) {}
   // Adds a sample to the batch.
   void AddInput(InputPlanes&& input) override {
-    hashes_.push_back(RecordComputation::make_hash(input));
+    const auto* slot = trace_->Find(RecordComputation::make_hash(input));
+    if (!slot) misses_->fetch_add(1, std::memory_order_relaxed);
+    slots_.push_back(slot);
     replay_counter_.push_back(0);
   }
   // Do the computation.
   void ComputeBlocking() override {}
   // Returns how many times AddInput() was called.
-  int GetBatchSize() const override { return static_cast<int>(hashes_.size()); }
+  int GetBatchSize() const override { return static_cast<int>(slots_.size()); }
   float Replay(int index) const {
-    const auto& entry_ptr = lookup_->find(hashes_[index]);
-    if (entry_ptr == lookup_->end()) {
-      return 0.0f;
-    }
-    const auto& entry = entry_ptr->second;
+    const auto* slot = slots_[index];
+    if (!slot) return 0.0f;
+    const size_t length = slot->length;
     size_t counter = replay_counter_[index];
-    if (counter >= entry.size()) {
+    if (counter >= length) {
       // Second pass reads the same things in the same order as first.
-      counter = counter - entry.size();
-      if (counter >= entry.size()) {
+      counter = counter - length;
+      if (counter >= length) {
         // Third pass skips the first 3, then reads the rest in the same order.
-        counter = counter - entry.size() + 3;
-        if (counter >= entry.size()) {
+        counter = counter - length + 3;
+        if (counter >= length) {
           return 0.0f;
         }
       }
     }
     replay_counter_[index]++;
-    return entry[counter];
+    return trace_->Values(slot)[counter];
   }
   // Returns Q value of @sample.
   float GetQVal(int sample) const override { return Replay(sample); }
@@ -149,16 +335,29 @@ class ReplayComputation : public NetworkComputation {
   float GetMVal(int sample) const override { return Replay(sample); }
   virtual ~ReplayComputation() {}
 
-  std::unique_ptr<NetworkComputation> inner_;
-  std::vector<uint64_t> hashes_;
+  const TraceReader* const trace_;
+  std::atomic<int64_t>* const misses_;
+  std::vector<const TraceSlot*> slots_;
   mutable std::vector<size_t> replay_counter_;
-  std::unordered_map<uint64_t, std::vector<float>>* lookup_;
 };
 
 class RecordReplayNetwork : public Network {
  public:
   RecordReplayNetwork(const std::optional<WeightsFile>& weights,
                       const OptionsDict& options) {
+    replay_file_ = options.GetOrDefault<std::string>("replay_file", "");
+    record_file_ = options.GetOrDefault<std::string>("record_file", "");
+    if (replay_file_.size() > 0) {
+      trace_ = std::make_unique<TraceReader>(replay_file_);
+      // Traces with known capabilities are replayed without any backend.
+      if (trace_->HasCapabilities()) {
+        capabilities_ = trace_->GetCapabilities();
+        return;
+      }
+    } else if (record_file_.size() > 0) {
+      writer_ = std::make_unique<TraceWriter>(record_file_);
+    }
+
     const auto parents = options.ListSubdicts();
     if (parents.empty()) {
       // If options are empty, or multiplexer configured in root object,
@@ -170,32 +369,6 @@ class RecordReplayNetwork : public Network {
     for (const auto& name : parents) {
       AddBackend(name, weights, options.GetSubdict(name));
     }
-    replay_file_ = options.GetOrDefault<std::string>("replay_file", "");
-    record_file_ = options.GetOrDefault<std::string>("record_file", "");
-    if (replay_file_.size() > 0) {
-      lookup_ =
-          std::make_unique<std::unordered_map<uint64_t, std::vector<float>>>();
-      std::ifstream input(replay_file_, std::ios_base::binary);
-      input.seekg(0, input.end);
-      auto file_length = input.tellg();
-      input.seekg(0, input.beg);
-      while (input.tellg() < file_length) {
-        uint64_t value = 0;
-        input.read(reinterpret_cast<char*>(&value), sizeof(value));
-        int32_t length = 0;
-        input.read(reinterpret_cast<char*>(&length), sizeof(length));
-        auto& entry = (*lookup_)[value];
-        // Only use the first recorded value for any hash collisions.
-        bool fill = entry.size() == 0;
-        for (int j = 0; j < length; j++) {
-          float recorded = 0.0f;
-          input.read(reinterpret_cast<char*>(&recorded), sizeof(recorded));
-          if (fill) {
-            entry.push_back(recorded);
-          }
-        }
-      }
-    }
   }
 
   void AddBackend(const std::string& name,
@@ -214,27 +387,50 @@ class RecordReplayNetwork : public Network {
   }
 
   std::unique_ptr<NetworkComputation> NewComputation() override {
-    if (!lookup_) {
-      const long long val = ++counter_;
-      return std::make_unique<RecordComputation>(
-          networks_[val % networks_.size()]->NewComputation(), record_file_);
+    if (trace_) {
+      return std::make_unique<ReplayComputation>(trace_.get(), &misses_);
     }
-    return std::make_unique<ReplayComputation>(lookup_.get());
+    const long long val = ++counter_;
+    auto computation = networks_[val % networks_.size()]->NewComputation();
+    if (!writer_) return computation;
+    return std::make_unique<RecordComputation>(std::move(computation),
+                                               writer_.get());
   }
 
   const NetworkCapabilities& GetCapabilities() const override {
     return capabilities_;
   }
 
-  ~RecordReplayNetwork() {}
+  void WriteTrace() {
+    if (!writer_) throw Exception("The network doesn't record a trace.");
+    trace_written_ = true;
+    writer_->Write(capabilities_);
+  }
+
+  ~RecordReplayNetwork() {
+    if (writer_ && !trace_written_) {
+      try {
+        writer_->Write(capabilities_);
+      } catch (Exception& e) {
+        CERR << e.what();
+      }
+    }
+    if (trace_ && misses_.load() > 0) {
+      CERR << "Replay: " << misses_.load()
+           << " NN evaluations were not found in " << replay_file_;
+    }
+  }
 
  private:
   std::vector<std::unique_ptr<Network>> networks_;
-  std::atomic<long long> counter_;
+  std::atomic<long long> counter_{0};
   NetworkCapabilities capabilities_;
   std::string replay_file_;
   std::string record_file_;
-  std::unique_ptr<std::unordered_map<uint64_t, std::vector<float>>> lookup_;
+  std::unique_ptr<TraceReader> trace_;
+  std::unique_ptr<TraceWriter> writer_;
+  bool trace_written_ = false;
+  std::atomic<int64_t> misses_{0};
 };
 
 std::unique_ptr<Network> MakeRecordReplayNetwork(
@@ -245,4 +441,13 @@ std::unique_ptr<Network> MakeRecordReplayNetwork(
 REGISTER_NETWORK("recordreplay", MakeRecordReplayNetwork, -999)
 
 }  // namespace
+
+void WriteNNTrace(Network* network) {
+  auto* record_network = dynamic_cast<RecordReplayNetwork*>(network);
+  if (!record_network) {
+    throw Exception("The network is not a recordreplay network.");
+  }
+  record_network->WriteTrace();
+}
+
 }  // namespace lczero
@@ -0,0 +1,235 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/network_socket.h"
+
+#include <cstring>
+
+#include "neural/factory.h"
+#include "utils/exception.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+namespace {
+const char kMagic[8] = {'L', 'c', '0', 'N', 'N', 'S', 'r', 'v'};
+const uint32_t kVersion = 1;
+const uint32_t kMaxBatchSize = 65536;
+// Serialized InputPlane: uint64 mask and float value.
+const size_t kPlaneSize = sizeof(uint64_t) + sizeof(float);
+}  // namespace
+
+void SendHello(StreamSocket* socket, const NetworkCapabilities& capabilities) {
+  NNServerHello hello = {};
+  memcpy(hello.magic, kMagic, sizeof(kMagic));
+  hello.version = kVersion;
+  hello.input_format = capabilities.input_format;
+  hello.moves_left = capabilities.moves_left;
+  socket->Write(&hello, sizeof(hello));
+}
+
+NetworkCapabilities ReceiveHello(StreamSocket* socket) {
+  NNServerHello hello;
+  if (!socket->Read(&hello, sizeof(hello))) {
+    throw Exception("NN server closed the connection.");
+  }
+  if (memcmp(hello.magic, kMagic, sizeof(kMagic)) != 0 ||
+      hello.version != kVersion) {
+    throw Exception("Incompatible NN server.");
+  }
+  NetworkCapabilities capabilities;
+  capabilities.input_format =
+      static_cast<pblczero::NetworkFormat::InputFormat>(hello.input_format);
+  capabilities.moves_left =
+      static_cast<pblczero::NetworkFormat::MovesLeftFormat>(hello.moves_left);
+  return capabilities;
+}
+
+void SendBatch(StreamSocket* socket, const std::vector<InputPlanes>& batch) {
+  std::vector<char> buffer(sizeof(uint32_t) +
+                           batch.size() * kInputPlanes * kPlaneSize);
+  const uint32_t batch_size = batch.size();
+  memcpy(buffer.data(), &batch_size, sizeof(batch_size));
+  char* ptr = buffer.data() + sizeof(batch_size);
+  for (const auto& planes : batch) {
+    if (planes.size() != kInputPlanes) {
+      throw Exception("Unexpected number of input planes.");
+    }
+    for (const auto& plane : planes) {
+      memcpy(ptr, &plane.mask, sizeof(plane.mask));
+      memcpy(ptr + sizeof(plane.mask), &plane.value, sizeof(plane.value));
+      ptr += kPlaneSize;
+    }
+  }
+  socket->Write(buffer.data(), buffer.size());
+}
+
+bool ReceiveBatch(StreamSocket* socket, std::vector<InputPlanes>* batch) {
+  uint32_t batch_size;
+  if (!socket->Read(&batch_size, sizeof(batch_size))) return false;
+  if (batch_size > kMaxBatchSize) {
+    throw Exception("Batch of " + std::to_string(batch_size) +
+                    " is too large.");
+  }
+  std::vector<char> buffer(batch_size * kInputPlanes * kPlaneSize);
+  if (!socket->Read(buffer.data(), buffer.size()) && batch_size > 0) {
+    throw Exception("Connection closed in the middle of a batch.");
+  }
+  batch->assign(batch_size, InputPlanes(kInputPlanes));
+  const char* ptr = buffer.data();
+  for (auto& planes : *batch) {
+    for (auto& plane : planes) {
+      memcpy(&plane.mask, ptr, sizeof(plane.mask));
+      memcpy(&plane.value, ptr + sizeof(plane.mask), sizeof(plane.value));
+      ptr += kPlaneSize;
+    }
+  }
+  return true;
+}
+
+void SendResults(StreamSocket* socket, const NetworkComputation& computation) {
+  const int batch_size = computation.GetBatchSize();
+  std::vector<float> results(batch_size * kNNServerResultSize);
+  for (int i = 0; i < batch_size; ++i) {
+    float* sample = results.data() + i * kNNServerResultSize;
+    sample[0] = computation.GetQVal(i);
+    sample[1] = computation.GetDVal(i);
+    sample[2] = computation.GetMVal(i);
+    for (int j = 0; j < kNNServerPolicySize; ++j) {
+      sample[3 + j] = computation.GetPVal(i, j);
+    }
+  }
+  socket->Write(results.data(), results.size() * sizeof(float));
+}
+
+void ReceiveResults(StreamSocket* socket, int batch_size,
+                    std::vector<float>* results) {
+  results->resize(batch_size * kNNServerResultSize);
+  if (!socket->Read(results->data(), results->size() * sizeof(float)) &&
+      batch_size > 0) {
+    throw Exception("NN server closed the connection.");
+  }
+}
+
+namespace {
+
+class SocketNetwork;
+class SocketComputation : public NetworkComputation {
+ public:
+  SocketComputation(SocketNetwork* network) : network_(network) {}
+
+  void AddInput(InputPlanes&& input) override {
+    batch_.emplace_back(std::move(input));
+  }
+
+  void ComputeBlocking() override;
+
+  int GetBatchSize() const override { return batch_.size(); }
+
+  float GetQVal(int sample) const override {
+    return results_[sample * kNNServerResultSize];
+  }
+
+  float GetDVal(int sample) const override {
+    return results_[sample * kNNServerResultSize + 1];
+  }
+
+  float GetMVal(int sample) const override {
+    return results_[sample * kNNServerResultSize + 2];
+  }
+
+  float GetPVal(int sample, int move_id) const override {
+    return results_[sample * kNNServerResultSize + 3 + move_id];
+  }
+
+ private:
+  SocketNetwork* const network_;
+  std::vector<InputPlanes> batch_;
+  std::vector<float> results_;
+};
+
+// Client of `lc0 nnserver`. Each batch is sent over its own connection, so
+// that the server can merge concurrent batches; idle connections are reused.
+class SocketNetwork : public Network {
+ public:
+  SocketNetwork(const OptionsDict& options)
+      : path_(options.GetOrDefault<std::string>("socket",
+                                                kNNServerDefaultSocket)) {
+    auto socket = StreamSocket::Connect(path_);
+    capabilities_ = ReceiveHello(socket.get());
+    idle_.push_back(std::move(socket));
+  }
+
+  std::unique_ptr<NetworkComputation> NewComputation() override {
+    return std::make_unique<SocketComputation>(this);
+  }
+
+  const NetworkCapabilities& GetCapabilities() const override {
+    return capabilities_;
+  }
+
+  void Compute(const std::vector<InputPlanes>& batch,
+               std::vector<float>* results) {
+    std::unique_ptr<StreamSocket> socket;
+    {
+      Mutex::Lock lock(mutex_);
+      if (!idle_.empty()) {
+        socket = std::move(idle_.back());
+        idle_.pop_back();
+      }
+    }
+    if (!socket) {
+      socket = StreamSocket::Connect(path_);
+      ReceiveHello(socket.get());
+    }
+    SendBatch(socket.get(), batch);
+    ReceiveResults(socket.get(), batch.size(), results);
+    Mutex::Lock lock(mutex_);
+    idle_.push_back(std::move(socket));
+  }
+
+ private:
+  const std::string path_;
+  NetworkCapabilities capabilities_;
+  Mutex mutex_;
+  std::vector<std::unique_ptr<StreamSocket>> idle_ GUARDED_BY(mutex_);
+};
+
+void SocketComputation::ComputeBlocking() {
+  if (batch_.empty()) return;
+  network_->Compute(batch_, &results_);
+}
+
+std::unique_ptr<Network> MakeSocketNetwork(
+    const std::optional<WeightsFile>& /*weights*/,
+    const OptionsDict& options) {
+  return std::make_unique<SocketNetwork>(options);
+}
+
+REGISTER_NETWORK("nnclient", MakeSocketNetwork, -500)
+
+}  // namespace
+}  // namespace lczero
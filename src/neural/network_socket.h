@@ -0,0 +1,69 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "neural/network.h"
+#include "utils/socket.h"
+
+namespace lczero {
+
+// Protocol between `lc0 nnserver` and the nnclient backend. Both ends run on
+// the same host, so everything is sent in native byte order.
+//
+// After accepting a connection the server sends NNServerHello. Then the client
+// sends batches: uint32 batch size followed by kInputPlanes (uint64 mask,
+// float value) pairs per sample. The server replies to each batch with
+// kNNServerResultSize floats per sample: Q, D, M and then the policy.
+struct NNServerHello {
+  char magic[8];
+  uint32_t version;
+  int32_t input_format;
+  int32_t moves_left;
+  uint32_t reserved;
+};
+
+const char kNNServerDefaultSocket[] = "/tmp/lc0-nnserver.sock";
+constexpr int kNNServerPolicySize = 1858;
+constexpr int kNNServerResultSize = 3 + kNNServerPolicySize;
+
+void SendHello(StreamSocket* socket, const NetworkCapabilities& capabilities);
+// Throws if the server speaks a different protocol.
+NetworkCapabilities ReceiveHello(StreamSocket* socket);
+
+void SendBatch(StreamSocket* socket, const std::vector<InputPlanes>& batch);
+// Returns false if the client has disconnected.
+bool ReceiveBatch(StreamSocket* socket, std::vector<InputPlanes>* batch);
+
+void SendResults(StreamSocket* socket, const NetworkComputation& computation);
+void ReceiveResults(StreamSocket* socket, int batch_size,
+                    std::vector<float>* results);
+
+}  // namespace lczero
@@ -0,0 +1,135 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/shared_cache.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace lczero {
+namespace {
+// Changes whenever the slot layout does, for old segments not to be used.
+#if defined(USE_COMPACT_STATS)
+const char kSegmentPrefix[] = "/lc0-nncache-v1c-";
+#else
+const char kSegmentPrefix[] = "/lc0-nncache-v1-";
+#endif
+
+uint64_t PackFloats(float a, float b) {
+  uint32_t bits[2];
+  std::memcpy(&bits[0], &a, sizeof(a));
+  std::memcpy(&bits[1], &b, sizeof(b));
+  return bits[0] | (static_cast<uint64_t>(bits[1]) << 32);
+}
+
+float UnpackFloat(uint64_t word, int half) {
+  const uint32_t bits = static_cast<uint32_t>(word >> (half * 32));
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+}  // namespace
+
+SharedNNCache::SharedNNCache(uint64_t network_hash, int capacity)
+    : memory_(GetSegmentName(network_hash),
+              static_cast<uint64_t>(capacity) * sizeof(Slot)),
+      slots_(reinterpret_cast<Slot*>(memory_.data())),
+      num_slots_(memory_.size() / sizeof(Slot)) {}
+
+std::string SharedNNCache::GetSegmentName(uint64_t network_hash) {
+  char hash[17];
+  std::snprintf(hash, sizeof(hash), "%016llx",
+                static_cast<unsigned long long>(network_hash));
+  return kSegmentPrefix + std::string(hash);
+}
+
+std::unique_ptr<CachedNNRequest> SharedNNCache::Lookup(uint64_t hash) const {
+  if (num_slots_ == 0) return nullptr;
+  const auto& words = slots_[hash % num_slots_].words;
+  // Zero is an empty slot, odd is a slot being written.
+  const uint64_t seq = words[0].load(std::memory_order_acquire);
+  if (seq == 0 || (seq & 1)) return nullptr;
+  if (words[1].load(std::memory_order_relaxed) != hash) return nullptr;
+  const uint64_t qd = words[2].load(std::memory_order_relaxed);
+  const uint64_t m_and_size = words[3].load(std::memory_order_relaxed);
+  const uint32_t num_moves = m_and_size >> 32;
+  if (num_moves > kMaxMoves) return nullptr;
+  uint64_t moves[kSlotWords - kHeaderWords];
+  const int moves_words = GetMovesWords(num_moves);
+  for (int i = 0; i < moves_words; i++) {
+    moves[i] = words[kHeaderWords + i].load(std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (words[0].load(std::memory_order_relaxed) != seq) return nullptr;
+
+  auto request = std::make_unique<CachedNNRequest>(num_moves);
+  request->q = UnpackFloat(qd, 0);
+  request->d = UnpackFloat(qd, 1);
+  request->m = UnpackFloat(m_and_size, 0);
+  const char* indices = reinterpret_cast<const char*>(moves);
+  const char* probabilities = indices + num_moves * sizeof(Idx);
+  for (uint32_t i = 0; i < num_moves; i++) {
+    std::memcpy(&request->p[i].first, indices + i * sizeof(Idx), sizeof(Idx));
+    std::memcpy(&request->p[i].second, probabilities + i * sizeof(Prob),
+                sizeof(Prob));
+  }
+  return request;
+}
+
+void SharedNNCache::Insert(uint64_t hash, const CachedNNRequest& request) {
+  const int num_moves = request.p.size();
+  if (num_slots_ == 0 || num_moves > kMaxMoves) return;
+  uint64_t moves[kSlotWords - kHeaderWords] = {};
+  char* indices = reinterpret_cast<char*>(moves);
+  char* probabilities = indices + num_moves * sizeof(Idx);
+  for (int i = 0; i < num_moves; i++) {
+    std::memcpy(indices + i * sizeof(Idx), &request.p[i].first, sizeof(Idx));
+    std::memcpy(probabilities + i * sizeof(Prob), &request.p[i].second,
+                sizeof(Prob));
+  }
+  const int moves_words = GetMovesWords(num_moves);
+
+  auto& words = slots_[hash % num_slots_].words;
+  uint64_t seq = words[0].load(std::memory_order_relaxed);
+  if ((seq & 1) ||
+      !words[0].compare_exchange_strong(seq, seq + 1,
+                                        std::memory_order_relaxed)) {
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  words[1].store(hash, std::memory_order_relaxed);
+  words[2].store(PackFloats(request.q, request.d), std::memory_order_relaxed);
+  words[3].store(PackFloats(request.m, 0.0f) |
+                     (static_cast<uint64_t>(num_moves) << 32),
+                 std::memory_order_relaxed);
+  for (int i = 0; i < moves_words; i++) {
+    words[kHeaderWords + i].store(moves[i], std::memory_order_relaxed);
+  }
+  words[0].store(seq + 2, std::memory_order_release);
+}
+
+}  // namespace lczero
@@ -0,0 +1,94 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "neural/cache.h"
+#include "utils/filesystem.h"
+
+namespace lczero {
+
+// NN evaluations in shared memory, reused by all processes on the host which
+// open it for the same network. It's a table of fixed-size slots indexed by
+// position hash, where new entries replace old ones. Readers don't lock:
+// every slot has a sequence number which writers make odd while writing, and
+// readers discard entries which were being written while they read them.
+// Entries with more moves than fit into a slot are not stored, and a process
+// killed while writing a slot leaves it unused.
+class SharedNNCache {
+ public:
+  static constexpr int kSlotBytes = 512;
+
+  // Opens the cache of the network with @network_hash, creating it with
+  // @capacity entries if no process has it yet. Throws exception if cannot.
+  SharedNNCache(uint64_t network_hash, int capacity);
+
+  // Returns a copy of the entry of @hash, or nullptr if there is none.
+  std::unique_ptr<CachedNNRequest> Lookup(uint64_t hash) const;
+  // Stores @request as the entry of @hash. Does nothing if the slot is being
+  // written by another thread or process, or the entry doesn't fit.
+  void Insert(uint64_t hash, const CachedNNRequest& request);
+
+  int GetCapacity() const { return num_slots_; }
+  // Name of the shared memory segment of the network with @network_hash.
+  static std::string GetSegmentName(uint64_t network_hash);
+
+ private:
+  static constexpr int kSlotWords = kSlotBytes / sizeof(uint64_t);
+  // Sequence number, hash, q and d, m and number of moves. They are followed
+  // by move indices, and then by probabilities.
+  static constexpr int kHeaderWords = 4;
+  typedef CachedNNRequest::IdxAndProb::first_type Idx;
+  typedef CachedNNRequest::IdxAndProb::second_type Prob;
+  static constexpr int kMaxMoves = (kSlotWords - kHeaderWords) *
+                                   sizeof(uint64_t) /
+                                   (sizeof(Idx) + sizeof(Prob));
+
+  // Returns the number of words taken by @num_moves moves.
+  static int GetMovesWords(int num_moves) {
+    return (num_moves * (sizeof(Idx) + sizeof(Prob)) + sizeof(uint64_t) - 1) /
+           sizeof(uint64_t);
+  }
+
+  // Slot contents are atomic, for readers racing with writers to be defined.
+  struct Slot {
+    std::atomic<uint64_t> words[kSlotWords];
+  };
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "Shared memory requires lock free atomics");
+  static_assert(sizeof(Slot) == kSlotBytes, "Unexpected Slot size");
+
+  SharedMemory memory_;
+  Slot* const slots_;
+  const int num_slots_;
+};
+
+}  // namespace lczero
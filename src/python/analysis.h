@@ -0,0 +1,206 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chess/callbacks.h"
+#include "mcts/search.h"
+#include "mcts/stoppers/common.h"
+#include "mcts/stoppers/stoppers.h"
+#include "python/weights.h"
+#include "utils/exception.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+namespace python {
+
+inline const OptionId kAnalysisThreadsId{"threads", "",
+                                         "Worker threads per search."};
+inline const OptionId kAnalysisSearchesId{
+    "searches", "", "Number of positions searched concurrently."};
+
+class SearchResult {
+ public:
+  // Exported methods. Moves are in UCI notation.
+  std::string bestmove() const { return bestmove_; }
+  std::string ponder() const { return ponder_; }
+  std::vector<std::string> pv() const { return pv_; }
+  float q() const { return q_; }
+  float d() const { return d_; }
+  float m() const { return m_; }
+  int nodes() const { return nodes_; }
+  // Root edge stats, in the same order as moves().
+  std::vector<std::string> moves() const { return moves_; }
+  std::vector<int> visits() const { return visits_; }
+  std::vector<float> policy() const { return policy_; }
+  std::vector<float> move_q() const { return move_q_; }
+
+  // Not exposed. Collects results of the finished @search of @tree.
+  SearchResult(Search* search, const NodeTree& tree,
+               const BestMoveInfo& bestmove, std::vector<Move> pv)
+      : bestmove_(bestmove.bestmove.as_string()),
+        ponder_(bestmove.ponder == Move() ? "" : bestmove.ponder.as_string()),
+        nodes_(search->GetTotalPlayouts()) {
+    if (pv.empty()) pv.push_back(bestmove.bestmove);
+    for (const auto& move : pv) pv_.push_back(move.as_string());
+    const auto eval = search->GetBestEval();
+    q_ = eval.wl;
+    d_ = eval.d;
+    m_ = eval.ml;
+    const bool is_black = tree.IsBlackToMove();
+    const ChessBoard& board = tree.HeadPosition().GetBoard();
+    for (const auto& edge : tree.GetCurrentHead()->Edges()) {
+      Move move = board.GetLegacyMove(edge.GetMove());
+      if (is_black) move.Mirror();
+      moves_.push_back(move.as_string());
+      visits_.push_back(edge.GetN());
+      policy_.push_back(edge.GetP());
+      move_q_.push_back(edge.GetQ(0.0f, 0.0f));
+    }
+  }
+
+ private:
+  std::string bestmove_;
+  std::string ponder_;
+  std::vector<std::string> pv_;
+  float q_;
+  float d_;
+  float m_;
+  int nodes_;
+  std::vector<std::string> moves_;
+  std::vector<int> visits_;
+  std::vector<float> policy_;
+  std::vector<float> move_q_;
+};
+
+// Runs independent searches of many positions concurrently, sharing the
+// backend and the NN cache.
+class AnalysisPool {
+ public:
+  // Exported methods.
+  // @options are lc0 search flags, e.g. "--cpuct=2.0", plus --threads (per
+  // search), --searches (concurrent searches) and --nncache.
+  AnalysisPool(const Backend& backend, const std::vector<std::string>& options)
+      : network_(backend.network()) {
+    SearchParams::Populate(&options_);
+    options_.Add<IntOption>(kAnalysisThreadsId, 1, 128) = 1;
+    options_.Add<IntOption>(kAnalysisSearchesId, 1, 1024) = 4;
+    options_.Add<IntOption>(kNNCacheSizeId, 0, 999999999) = 200000;
+    if (!options_.ProcessFlags(options)) {
+      throw Exception("Invalid analysis options.");
+    }
+    const auto& dict = options_.GetOptionsDict();
+    threads_ = dict.Get<int>(kAnalysisThreadsId);
+    searches_ = dict.Get<int>(kAnalysisSearchesId);
+    cache_.SetCapacity(dict.Get<int>(kNNCacheSizeId));
+  }
+
+  // Searches every FEN until @nodes visits or @movetime milliseconds
+  // (whichever comes first, zero is no limit) and returns results in the
+  // same order. Called without the Python GIL held.
+  std::vector<std::unique_ptr<SearchResult>> analyze(
+      const std::vector<std::string>& fens, int nodes, int movetime) {
+    if (nodes <= 0 && movetime <= 0) {
+      throw Exception("Either nodes or movetime must be set.");
+    }
+    std::vector<std::unique_ptr<SearchResult>> results(fens.size());
+    std::atomic<size_t> next_fen{0};
+    Mutex error_mutex;
+    std::string error;
+    auto worker = [&]() {
+      // Search threads are reused between positions.
+      SearchThreadPool thread_pool;
+      for (size_t i; (i = next_fen++) < fens.size();) {
+        try {
+          results[i] = SearchPosition(fens[i], nodes, movetime, &thread_pool);
+        } catch (const Exception& ex) {
+          Mutex::Lock lock(error_mutex);
+          if (error.empty()) error = fens[i] + ": " + ex.what();
+          next_fen = fens.size();
+        }
+      }
+    };
+    std::vector<std::thread> threads;
+    const size_t concurrency =
+        std::min(static_cast<size_t>(searches_), fens.size());
+    for (size_t i = 1; i < concurrency; ++i) threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads) thread.join();
+    if (!error.empty()) throw Exception(error);
+    return results;
+  }
+
+  void clear_cache() { cache_.Clear(); }
+
+ private:
+  std::unique_ptr<SearchResult> SearchPosition(const std::string& fen,
+                                               int nodes, int movetime,
+                                               SearchThreadPool* thread_pool) {
+    NodeTree tree;
+    tree.ResetToPosition(fen, {});
+    auto stopper = std::make_unique<ChainedSearchStopper>();
+    if (nodes > 0) {
+      stopper->AddStopper(std::make_unique<VisitsStopper>(nodes, false));
+    }
+    if (movetime > 0) {
+      stopper->AddStopper(std::make_unique<TimeLimitStopper>(movetime));
+    }
+    BestMoveInfo bestmove(Move{});
+    std::vector<Move> pv;
+    std::unique_ptr<UciResponder> responder =
+        std::make_unique<CallbackUciResponder>(
+            [&](const BestMoveInfo& info) { bestmove = info; },
+            [&](const std::vector<ThinkingInfo>& infos) {
+              for (const auto& info : infos) {
+                if (info.multipv <= 1 && !info.pv.empty()) pv = info.pv;
+              }
+            });
+    responder = std::make_unique<Chess960Transformer>(
+        std::move(responder), tree.HeadPosition().GetBoard());
+    Search search(tree, network_.get(), std::move(responder), MoveList(),
+                  std::chrono::steady_clock::now(), std::move(stopper), false,
+                  options_.GetOptionsDict(), &cache_, nullptr, thread_pool);
+    search.RunBlocking(threads_);
+    return std::make_unique<SearchResult>(&search, tree, bestmove,
+                                          std::move(pv));
+  }
+
+  const std::shared_ptr<::lczero::Network> network_;
+  OptionsParser options_;
+  NNCache cache_;
+  int threads_;
+  int searches_;
+};
+
+}  // namespace python
+}  // namespace lczero
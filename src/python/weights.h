@@ -84,6 +84,21 @@ class Weights {
   const WeightsFile weights_;
 };
 
+// Contiguous array owned by the caller (e.g. a numpy array), accessed without
+// copying.
+template <typename T>
+class BufferView {
+ public:
+  BufferView(T* data, size_t size) : data_(data), size_(size) {}
+  T* data() const { return data_; }
+  size_t size() const { return size_; }
+  T& operator[](size_t idx) const { return data_[idx]; }
+
+ private:
+  T* const data_;
+  const size_t size_;
+};
+
 inline std::vector<std::string> GetAvailableBackends() {
   return NetworkFactory::Get()->GetBackendsList();
 }
@@ -212,6 +227,9 @@ class Backend {
     return BackendCapabilities(network_->GetCapabilities());
   }
 
+  // Not exposed.
+  std::shared_ptr<::lczero::Network> network() const { return network_; }
+
   std::vector<std::unique_ptr<Output>> evaluate(
       const std::vector<Input*>& inputs) const {
     if (inputs.empty()) return {};
@@ -228,8 +246,46 @@ class Backend {
     return result;
   }
 
+  // Evaluates a batch given as plane masks and values (kInputPlanes of each
+  // per sample) and writes q, d, m (one per sample) and raw policy (1858 per
+  // sample) into the caller's buffers. Called without the Python GIL held.
+  void evaluate_batch(BufferView<const uint64_t> masks,
+                      BufferView<const float> values, BufferView<float> q,
+                      BufferView<float> d, BufferView<float> m,
+                      BufferView<float> policy) const {
+    if (masks.size() % kInputPlanes != 0 || values.size() != masks.size()) {
+      throw Exception("Masks and values must have " +
+                      std::to_string(kInputPlanes) + " items per sample.");
+    }
+    const size_t batch_size = masks.size() / kInputPlanes;
+    if (q.size() < batch_size || d.size() < batch_size ||
+        m.size() < batch_size || policy.size() < batch_size * 1858) {
+      throw Exception("Output buffers are too small for " +
+                      std::to_string(batch_size) + " samples.");
+    }
+    if (batch_size == 0) return;
+    auto computation = network_->NewComputation();
+    for (size_t i = 0; i < batch_size; ++i) {
+      InputPlanes planes(kInputPlanes);
+      for (int j = 0; j < kInputPlanes; ++j) {
+        planes[j].mask = masks[i * kInputPlanes + j];
+        planes[j].value = values[i * kInputPlanes + j];
+      }
+      computation->AddInput(std::move(planes));
+    }
+    computation->ComputeBlocking();
+    for (size_t i = 0; i < batch_size; ++i) {
+      q[i] = computation->GetQVal(i);
+      d[i] = computation->GetDVal(i);
+      m[i] = computation->GetMVal(i);
+      for (int j = 0; j < 1858; ++j) {
+        policy[i * 1858 + j] = computation->GetPVal(i, j);
+      }
+    }
+  }
+
  private:
-  std::unique_ptr<::lczero::Network> network_;
+  std::shared_ptr<::lczero::Network> network_;
 };
 
 class GameState {
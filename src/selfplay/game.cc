@@ -97,7 +97,8 @@ SelfPlayGame::SelfPlayGame(PlayerOptions white, PlayerOptions black,
 }
 
 void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
-                        SyzygyTablebase* syzygy_tb, bool enable_resign) {
+                        SyzygyTablebase* syzygy_tb, bool enable_resign,
+                        SearchThreadPool* thread_pool) {
   bool blacks_move = tree_[0]->IsBlackToMove();
 
   // Take syzygy tablebases from player1 options.
@@ -144,7 +145,7 @@ void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
           /* searchmoves */ MoveList(), std::chrono::steady_clock::now(),
           std::move(stoppers),
           /* infinite */ false, *options_[idx].uci_options, options_[idx].cache,
-          syzygy_tb);
+          syzygy_tb, thread_pool);
     }
 
     // Do search.
@@ -77,9 +77,11 @@ class SelfPlayGame {
   // Populate command line options that it uses.
   static void PopulateUciParams(OptionsParser* options);
   
-  // Starts the game and blocks until the game is finished.
+  // Starts the game and blocks until the game is finished. Searches run on
+  // @thread_pool if it's not null.
   void Play(int white_threads, int black_threads, bool training,
-	  SyzygyTablebase* syzygy_tb, bool enable_resign = true);
+	  SyzygyTablebase* syzygy_tb, bool enable_resign = true,
+	  SearchThreadPool* thread_pool = nullptr);
   // Aborts the game currently played, doesn't matter if it's synchronous or
   // not.
   void Abort();
@@ -230,7 +230,8 @@ SelfPlayTournament::SelfPlayTournament(
 
 }
 
-void SelfPlayTournament::PlayOneGame(int game_number) {
+void SelfPlayTournament::PlayOneGame(int game_number,
+                                     SearchThreadPool* thread_pool) {
   bool player1_black;  // Whether player1 will player as black in this game.
   Opening opening;
   {
@@ -350,7 +351,7 @@ void SelfPlayTournament::PlayOneGame(int game_number) {
   auto player1_threads = player_options_[0][color_idx[0]].Get<int>(kThreadsId);
   auto player2_threads = player_options_[1][color_idx[1]].Get<int>(kThreadsId);
   game.Play(player1_threads, player2_threads, kTraining, syzygy_tb_.get(),
-            enable_resign);
+            enable_resign, thread_pool);
   
   // If game was aborted, it's still undecided.
   if (game.GetGameResult() != GameResult::UNDECIDED) {
@@ -395,6 +396,8 @@ void SelfPlayTournament::PlayOneGame(int game_number) {
 }
 
 void SelfPlayTournament::Worker() {
+  // Search threads are kept for all games played by this worker.
+  SearchThreadPool thread_pool;
   // Play games while game limit is not reached (or while not aborted).
   while (true) {
     int game_id;
@@ -409,7 +412,7 @@ void SelfPlayTournament::Worker() {
         break;
       game_id = games_count_++;
     }
-    PlayOneGame(game_id);
+    PlayOneGame(game_id, &thread_pool);
   }
 }
 
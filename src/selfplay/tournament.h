@@ -70,7 +70,7 @@ class SelfPlayTournament {
 
  private:
   void Worker();
-  void PlayOneGame(int game_id);
+  void PlayOneGame(int game_id, SearchThreadPool* thread_pool);
 
   Mutex mutex_;
   // Whether first game will be black for player1.
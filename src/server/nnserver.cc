@@ -0,0 +1,113 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "server/nnserver.h"
+
+#include <iostream>
+#include <thread>
+
+#include "neural/factory.h"
+#include "neural/network_socket.h"
+#include "utils/logging.h"
+#include "utils/optionsparser.h"
+#include "utils/socket.h"
+
+namespace lczero {
+namespace {
+const OptionId kSocketId{"socket", "",
+                         "Path of the Unix domain socket to listen at."};
+const OptionId kThreadsId{"threads", "",
+                          "Number of threads computing merged batches."};
+const OptionId kMaxBatchId{
+    "max-batch", "",
+    "Maximum number of positions from different clients to merge into one "
+    "batch."};
+
+void ServeConnection(std::unique_ptr<StreamSocket> socket,
+                     std::shared_ptr<Network> network) {
+  LOGFILE << "NN client connected.";
+  try {
+    SendHello(socket.get(), network->GetCapabilities());
+    std::vector<InputPlanes> batch;
+    while (ReceiveBatch(socket.get(), &batch)) {
+      auto computation = network->NewComputation();
+      for (auto& planes : batch) computation->AddInput(std::move(planes));
+      if (!batch.empty()) computation->ComputeBlocking();
+      SendResults(socket.get(), *computation);
+    }
+    LOGFILE << "NN client disconnected.";
+  } catch (Exception& ex) {
+    CERR << "NN client connection dropped: " << ex.what();
+  }
+}
+}  // namespace
+
+void NNServer::Run() {
+  OptionsParser options;
+  NetworkFactory::PopulateOptions(&options);
+  options.Add<StringOption>(kSocketId) = kNNServerDefaultSocket;
+  options.Add<IntOption>(kThreadsId, 1, 128) = 1;
+  options.Add<IntOption>(kMaxBatchId, 1, 65536) = 1024;
+
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    const auto& option_dict = options.GetOptionsDict();
+
+    // Wrap the backend into the multiplexing one, which merges concurrent
+    // computations (one per client connection) into large batches.
+    OptionsDict server_options(&option_dict);
+    const auto backend = option_dict.Get<std::string>(NetworkFactory::kBackendId);
+    if (backend != "multiplexing") {
+      auto backend_options =
+          option_dict.Get<std::string>(NetworkFactory::kBackendOptionsId);
+      if (!backend_options.empty()) backend_options += ",";
+      server_options.Set<std::string>(NetworkFactory::kBackendId,
+                                      "multiplexing");
+      server_options.Set<std::string>(
+          NetworkFactory::kBackendOptionsId,
+          backend + "(" + backend_options +
+              "threads=" + std::to_string(option_dict.Get<int>(kThreadsId)) +
+              ",max_batch=" +
+              std::to_string(option_dict.Get<int>(kMaxBatchId)) + ")");
+    }
+    std::shared_ptr<Network> network =
+        NetworkFactory::LoadNetwork(server_options);
+
+    const auto path = option_dict.Get<std::string>(kSocketId);
+    StreamSocketServer server(path);
+    CERR << "Serving NN evaluations at " << path;
+    while (true) {
+      // Connection threads are detached, they share ownership of the network.
+      std::thread(ServeConnection, server.Accept(), network).detach();
+    }
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+}  // namespace lczero
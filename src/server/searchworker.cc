@@ -0,0 +1,208 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "server/searchworker.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <iostream>
+#include <thread>
+
+#include "mcts/distributed.h"
+#include "mcts/search.h"
+#include "mcts/stoppers/stoppers.h"
+#include "neural/factory.h"
+#include "utils/logging.h"
+#include "utils/mutex.h"
+#include "utils/optionsparser.h"
+#include "utils/socket.h"
+
+namespace lczero {
+namespace {
+const OptionId kListenId{
+    "listen", "",
+    "Address to accept the coordinator at: a Unix domain socket path, or "
+    "host:port for TCP (the host may be empty to listen on all interfaces)."};
+const OptionId kThreadsId{"threads", "",
+                          "Number of (CPU) worker threads to use."};
+const OptionId kNNCacheSizeId{"nncache", "",
+                              "Number of positions to store in a memory cache."};
+
+MoveList ParseSearchmoves(const std::vector<std::string>& moves,
+                          const ChessBoard& board) {
+  MoveList result;
+  const auto legal_moves = board.GenerateLegalMoves();
+  for (const auto& move : moves) {
+    const auto m = board.GetModernMove({move, board.flipped()});
+    if (std::find(legal_moves.begin(), legal_moves.end(), m) !=
+        legal_moves.end()) {
+      result.push_back(m);
+    }
+  }
+  if (result.empty()) throw Exception("No legal searchmoves.");
+  return result;
+}
+
+class CoordinatorConnection {
+ public:
+  CoordinatorConnection(std::unique_ptr<StreamSocket> socket, Network* network,
+                        const OptionsDict& options, NNCache* cache,
+                        SearchThreadPool* thread_pool)
+      : socket_(std::move(socket)),
+        network_(network),
+        options_(options),
+        cache_(cache),
+        thread_pool_(thread_pool) {}
+
+  // Serves search requests until the coordinator disconnects.
+  void Run() {
+    SendSearchWorkerHello(socket_.get());
+    uint32_t command;
+    while (ReceiveSearchWorkerCommand(socket_.get(), &command)) {
+      // Nothing to stop if the search is over already.
+      if (command == kStopCommand) continue;
+      RemoteSearchParams params;
+      ReceiveSearchRequest(socket_.get(), &params);
+      if (!RunSearch(params)) break;
+    }
+  }
+
+ private:
+  // Returns false if the coordinator has disconnected.
+  bool RunSearch(const RemoteSearchParams& params) {
+    std::vector<Move> moves;
+    for (const auto& move : params.moves) moves.emplace_back(move);
+    // The tree is kept between searches, as positions of a game follow each
+    // other.
+    tree_.ResetToPosition(params.fen, moves);
+    const MoveList searchmoves =
+        ParseSearchmoves(params.searchmoves, tree_.HeadPosition().GetBoard());
+    LOGFILE << "Searching " << searchmoves.size() << " root moves.";
+
+    auto search = std::make_unique<Search>(
+        tree_, network_,
+        std::make_unique<CallbackUciResponder>(
+            [](const BestMoveInfo&) {},
+            [](const std::vector<ThinkingInfo>&) {}),
+        searchmoves, std::chrono::steady_clock::now(),
+        std::make_unique<ChainedSearchStopper>(), /* infinite= */ true,
+        options_, cache_, nullptr, thread_pool_);
+    search->StartThreads(options_.Get<int>(kThreadsId));
+
+    // The stop command arrives while reports are being sent.
+    bool connected = true;
+    Mutex mutex;
+    std::condition_variable cv;
+    bool stop = false;
+    std::thread reader([&]() {
+      uint32_t command;
+      bool got_command = false;
+      try {
+        got_command = ReceiveSearchWorkerCommand(socket_.get(), &command);
+      } catch (Exception& e) {
+        CERR << "Coordinator connection dropped: " << e.what();
+      }
+      Mutex::Lock lock(mutex);
+      // Anything but stop is a protocol violation, drop the connection then.
+      connected = got_command && command == kStopCommand;
+      stop = true;
+      cv.notify_all();
+    });
+
+    const auto interval = std::chrono::milliseconds(params.report_interval_ms);
+    bool report_failed = false;
+    try {
+      while (true) {
+        {
+          Mutex::Lock lock(mutex);
+          cv.wait_for(lock.get_raw(), interval,
+                      [&]() NO_THREAD_SAFETY_ANALYSIS { return stop; });
+          if (stop) break;
+        }
+        SendSearchReport(socket_.get(), false, search->GetTotalPlayouts(),
+                         search->GetRootMoveStats(searchmoves));
+      }
+    } catch (Exception& e) {
+      // The reader returns too, as the connection is broken.
+      CERR << "Coordinator connection dropped: " << e.what();
+      report_failed = true;
+    }
+    reader.join();
+    search->Stop();
+    search->Wait();
+    // The reader has finished, connected needs no lock anymore.
+    if (report_failed || !connected) return false;
+    SendSearchReport(socket_.get(), true, search->GetTotalPlayouts(),
+                     search->GetRootMoveStats(searchmoves));
+    return true;
+  }
+
+  const std::unique_ptr<StreamSocket> socket_;
+  Network* const network_;
+  const OptionsDict& options_;
+  NNCache* const cache_;
+  SearchThreadPool* const thread_pool_;
+  NodeTree tree_;
+};
+}  // namespace
+
+void SearchWorkerServer::Run() {
+  OptionsParser options;
+  NetworkFactory::PopulateOptions(&options);
+  SearchParams::Populate(&options);
+  options.Add<StringOption>(kListenId) = kSearchWorkerDefaultAddress;
+  options.Add<IntOption>(kThreadsId, 1, 128) = 2;
+  options.Add<IntOption>(kNNCacheSizeId, 0, 999999999) = 2000000;
+
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    const auto& option_dict = options.GetOptionsDict();
+    auto network = NetworkFactory::LoadNetwork(option_dict);
+    NNCache cache(option_dict.Get<int>(kNNCacheSizeId));
+    SearchThreadPool thread_pool;
+
+    const auto address = option_dict.Get<std::string>(kListenId);
+    StreamSocketServer server(address);
+    CERR << "Waiting for the search coordinator at " << address;
+    while (true) {
+      CoordinatorConnection connection(server.Accept(), network.get(),
+                                       option_dict, &cache, &thread_pool);
+      LOGFILE << "Search coordinator connected.";
+      try {
+        connection.Run();
+        LOGFILE << "Search coordinator disconnected.";
+      } catch (Exception& ex) {
+        CERR << "Search coordinator connection dropped: " << ex.what();
+      }
+    }
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+}  // namespace lczero
@@ -28,6 +28,8 @@
 #pragma once
 
 #include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <cstring>
 #include <memory>
 #include <string>
@@ -58,10 +60,14 @@ class LruCache {
 
   // Inserts the element under key @key with value @val.
   // Puts element to front of the queue (makes it last to evict).
-  void Insert(K key, std::unique_ptr<V> val) {
+  // The time spent waiting for the lock is added to @lock_wait_ns if given,
+  // same for the lookups below.
+  void Insert(K key, std::unique_ptr<V> val, int64_t* lock_wait_ns = nullptr) {
     if (capacity_.load(std::memory_order_relaxed) == 0) return;
 
+    LockWaitTimer wait_timer(lock_wait_ns);
     Mutex::Lock lock(mutex_);
+    wait_timer.Stop();
 
     auto hash = hasher_(key) % hash_.size();
     auto& hash_head = hash_[hash];
@@ -83,10 +89,12 @@ class LruCache {
 
   // Checks whether a key exists. Doesn't lock. Of course the next moment the
   // key may be evicted.
-  bool ContainsKey(K key) {
+  bool ContainsKey(K key, int64_t* lock_wait_ns = nullptr) {
     if (capacity_.load(std::memory_order_relaxed) == 0) return false;
 
+    LockWaitTimer wait_timer(lock_wait_ns);
     Mutex::Lock lock(mutex_);
+    wait_timer.Stop();
     auto hash = hasher_(key) % hash_.size();
     for (Item* iter = hash_[hash]; iter; iter = iter->next_in_hash) {
       if (key == iter->key) return true;
@@ -98,16 +106,20 @@ class LruCache {
   // If found, brings the element to the head of the queue (makes it last to
   // evict); furthermore, a call to Unpin must be made for each such element.
   // Use of LruCacheLock is recommended to automate this pin management.
-  V* LookupAndPin(K key) {
+  V* LookupAndPin(K key, int64_t* lock_wait_ns = nullptr) {
     if (capacity_.load(std::memory_order_relaxed) == 0) return nullptr;
 
+    LockWaitTimer wait_timer(lock_wait_ns);
     Mutex::Lock lock(mutex_);
+    wait_timer.Stop();
+    ++lookups_;
 
     auto hash = hasher_(key) % hash_.size();
     for (Item* iter = hash_[hash]; iter; iter = iter->next_in_hash) {
       if (key == iter->key) {
         // BringToFront(iter);
         ++iter->pins;
+        ++hits_;
         return iter->value.get();
       }
     }
@@ -184,6 +196,26 @@ class LruCache {
   int GetCapacity() const { 
 	return capacity_.load(std::memory_order_relaxed);
   }
+  // Number of LookupAndPin() calls, and how many of them found the key, since
+  // the cache was created.
+  int64_t GetLookups() const {
+    Mutex::Lock lock(mutex_);
+    return lookups_;
+  }
+  int64_t GetHits() const {
+    Mutex::Lock lock(mutex_);
+    return hits_;
+  }
+
+  // Calls @func(key, value) for every element, from the oldest to the newest.
+  // The cache is locked meanwhile, so @func must not access it.
+  template <class F>
+  void ForEach(F func) const {
+    Mutex::Lock lock(mutex_);
+    for (const Item* iter = lru_tail_; iter; iter = iter->prev_in_queue) {
+      func(iter->key, *iter->value);
+    }
+  }
   static constexpr size_t GetItemStructSize() { return sizeof(Item); }
 
  private:
@@ -268,10 +300,31 @@ class LruCache {
     }
   }
 
+  // Adds the time from construction to Stop() to @wait_ns, unless it's
+  // nullptr.
+  class LockWaitTimer {
+   public:
+    explicit LockWaitTimer(int64_t* wait_ns) : wait_ns_(wait_ns) {
+      if (wait_ns_) start_ = std::chrono::steady_clock::now();
+    }
+    void Stop() {
+      if (!wait_ns_) return;
+      *wait_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - start_)
+                       .count();
+    }
+
+   private:
+    int64_t* const wait_ns_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
   // Fresh in front, stale on back.
   std::atomic<int> capacity_;
   int size_ GUARDED_BY(mutex_) = 0;
   int allocated_ GUARDED_BY(mutex_) = 0;
+  int64_t lookups_ GUARDED_BY(mutex_) = 0;
+  int64_t hits_ GUARDED_BY(mutex_) = 0;
   Item* lru_head_ GUARDED_BY(mutex_) = nullptr;  // Newest elements.
   Item* lru_tail_ GUARDED_BY(mutex_) = nullptr;  // Oldest elements.
   Item* evicted_head_ GUARDED_BY(mutex_) =
@@ -286,9 +339,12 @@ class LruCache {
 template <class K, class V>
 class LruCacheLock {
  public:
-  // Looks up the value in @cache by @key and pins it if found.
-  LruCacheLock(LruCache<K, V>* cache, K key)
-      : cache_(cache), key_(key), value_(cache->LookupAndPin(key_)) {}
+  // Looks up the value in @cache by @key and pins it if found. The time spent
+  // waiting for the cache lock is added to @lock_wait_ns if given.
+  LruCacheLock(LruCache<K, V>* cache, K key, int64_t* lock_wait_ns = nullptr)
+      : cache_(cache),
+        key_(key),
+        value_(cache->LookupAndPin(key_, lock_wait_ns)) {}
 
   // Unpins the cache entry (if holds).
   ~LruCacheLock() {
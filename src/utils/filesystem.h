@@ -28,6 +28,7 @@
 #pragma once
 
 #include <time.h>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -47,6 +48,9 @@ uint64_t GetFileSize(const std::string& filename);
 // Returns modification time of a file, 0 if file doesn't exist or can't be read.
 time_t GetFileTime(const std::string& filename);
 
+// Renames @from to @to, replacing @to if it exists. Throws exception if cannot.
+void RenameFile(const std::string& from, const std::string& to);
+
 // Returns the base directory relative to which user specific non-essential data
 // files are stored or an empty string if unspecified.
 std::string GetUserCacheDirectory();
@@ -65,4 +69,52 @@ std::vector<std::string> GetSystemConfigDirectoryList();
 // Returns a vector of base directories to search for data files.
 std::vector<std::string> GetSystemDataDirectoryList();
 
+// Read-only memory mapping of a whole file. The mapping is released in the
+// destructor.
+class MappedFile {
+ public:
+  // Maps @filename into memory. Throws exception if cannot.
+  MappedFile(const std::string& filename);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return data_; }
+  uint64_t size() const { return size_; }
+
+ private:
+  const char* data_ = nullptr;
+  uint64_t size_ = 0;
+  // Platform specific mapping handle (unused on posix).
+  void* handle_ = nullptr;
+};
+
+// Read-write memory shared by all processes which open the same @name. The
+// segment is created zero-filled if it doesn't exist yet, and outlives the
+// processes using it (on posix, until it's removed from /dev/shm).
+class SharedMemory {
+ public:
+  // Maps the segment @name (which starts with a '/'), creating it with @size
+  // bytes if it doesn't exist. An existing segment is mapped with its own
+  // size. Throws exception if cannot.
+  SharedMemory(const std::string& name, uint64_t size);
+  ~SharedMemory();
+
+  SharedMemory(const SharedMemory&) = delete;
+  SharedMemory& operator=(const SharedMemory&) = delete;
+
+  // Removes the segment @name, processes which have it mapped keep using it.
+  static void Remove(const std::string& name);
+
+  char* data() const { return data_; }
+  uint64_t size() const { return size_; }
+
+ private:
+  char* data_ = nullptr;
+  uint64_t size_ = 0;
+  // Platform specific mapping handle (unused on posix).
+  void* handle_ = nullptr;
+};
+
 }  // namespace lczero
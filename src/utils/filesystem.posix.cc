@@ -31,7 +31,14 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
 
 namespace lczero {
 
@@ -85,6 +92,12 @@ time_t GetFileTime(const std::string& filename) {
 #endif
 }
 
+void RenameFile(const std::string& from, const std::string& to) {
+  if (rename(from.c_str(), to.c_str()) < 0) {
+    throw Exception("Cannot rename " + from + " to " + to);
+  }
+}
+
 namespace {
 bool CheckDir(const std::string& dirname) {
   struct stat s;
@@ -172,4 +185,63 @@ std::vector<std::string> GetSystemDataDirectoryList() {
 #endif
 }
 
+MappedFile::MappedFile(const std::string& filename) {
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd == -1) throw Exception("Cannot open file: " + filename);
+  struct stat s;
+  if (fstat(fd, &s) < 0) {
+    ::close(fd);
+    throw Exception("Cannot stat file: " + filename);
+  }
+  size_ = s.st_size;
+  if (size_ == 0) {
+    ::close(fd);
+    return;
+  }
+  void* addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) throw Exception("Cannot mmap file: " + filename);
+  data_ = static_cast<const char*>(addr);
+}
+
+MappedFile::~MappedFile() {
+  if (data_) munmap(const_cast<char*>(data_), size_);
+}
+
+SharedMemory::SharedMemory(const std::string& name, uint64_t size) {
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd != -1) {
+    if (ftruncate(fd, size) < 0) {
+      ::close(fd);
+      shm_unlink(name.c_str());
+      throw Exception("Cannot allocate shared memory: " + name);
+    }
+    size_ = size;
+  } else {
+    fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd == -1) throw Exception("Cannot open shared memory: " + name);
+    // The process which created the segment may not have sized it yet.
+    for (int i = 0; i < 1000 && size_ == 0; i++) {
+      struct stat s;
+      if (fstat(fd, &s) < 0) break;
+      size_ = s.st_size;
+      if (size_ == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (size_ == 0) {
+      ::close(fd);
+      throw Exception("Cannot stat shared memory: " + name);
+    }
+  }
+  void* addr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) throw Exception("Cannot mmap shared memory: " + name);
+  data_ = static_cast<char*>(addr);
+}
+
+SharedMemory::~SharedMemory() {
+  if (data_) munmap(data_, size_);
+}
+
+void SharedMemory::Remove(const std::string& name) { shm_unlink(name.c_str()); }
+
 }  // namespace lczero
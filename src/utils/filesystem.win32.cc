@@ -71,6 +71,12 @@ time_t GetFileTime(const std::string& filename) {
          s.ftLastWriteTime.dwLowDateTime;
 }
 
+void RenameFile(const std::string& from, const std::string& to) {
+  if (!MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+    throw Exception("Cannot rename " + from + " to " + to);
+  }
+}
+
 std::string GetUserCacheDirectory() {
   return std::string();
 }
@@ -91,5 +97,67 @@ std::vector<std::string> GetSystemDataDirectoryList() {
   return {};
 }
 
+MappedFile::MappedFile(const std::string& filename) {
+  const HANDLE fd =
+      CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (fd == INVALID_HANDLE_VALUE) {
+    throw Exception("Cannot open file: " + filename);
+  }
+  DWORD size_high;
+  DWORD size_low = ::GetFileSize(fd, &size_high);
+  size_ = (static_cast<uint64_t>(size_high) << 32) + size_low;
+  if (size_ == 0) {
+    CloseHandle(fd);
+    return;
+  }
+  HANDLE mapping = CreateFileMapping(fd, nullptr, PAGE_READONLY, size_high,
+                                     size_low, nullptr);
+  CloseHandle(fd);
+  if (!mapping) throw Exception("Cannot map file: " + filename);
+  data_ = static_cast<const char*>(
+      MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  if (!data_) {
+    CloseHandle(mapping);
+    throw Exception("Cannot map file: " + filename);
+  }
+  handle_ = mapping;
+}
+
+MappedFile::~MappedFile() {
+  if (data_) UnmapViewOfFile(data_);
+  if (handle_) CloseHandle(handle_);
+}
+
+SharedMemory::SharedMemory(const std::string& name, uint64_t size) {
+  // Backed by the paging file, the mapping exists while any process has it
+  // open.
+  const std::string object_name = "Local\\" + name.substr(1);
+  HANDLE mapping = CreateFileMappingA(
+      INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+      static_cast<DWORD>(size >> 32), static_cast<DWORD>(size),
+      object_name.c_str());
+  if (!mapping) throw Exception("Cannot open shared memory: " + name);
+  data_ = static_cast<char*>(
+      MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+  if (!data_) {
+    CloseHandle(mapping);
+    throw Exception("Cannot map shared memory: " + name);
+  }
+  // An existing mapping keeps its size.
+  MEMORY_BASIC_INFORMATION info;
+  VirtualQuery(data_, &info, sizeof(info));
+  size_ = info.RegionSize;
+  handle_ = mapping;
+}
+
+SharedMemory::~SharedMemory() {
+  if (data_) UnmapViewOfFile(data_);
+  if (handle_) CloseHandle(handle_);
+}
+
+// Mappings are removed when the last process closes them.
+void SharedMemory::Remove(const std::string&) {}
+
 
 }  // namespace lczero
@@ -28,11 +28,14 @@
 #include <cstdint>
 #include <cstring>
 
+#include "utils/fp16_utils.h"
+
 // Define NO_F16C to avoid the F16C intrinsics. Also disabled with NO_POPCNT
-// since it catches most processors without F16C instructions.
+// since it catches most processors without F16C instructions. GCC and clang
+// only have them when the target has F16C.
 
-#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
-    defined(__x86_64__)
+#if defined(_M_IX86) || defined(_M_X64) ||                \
+    ((defined(__i386__) || defined(__x86_64__)) && defined(__F16C__))
 #include <immintrin.h>
 #else
 #define NO_F16C
@@ -25,6 +25,9 @@
   Program grant you additional permission to convey the resulting work.
 */
 #pragma once
+
+#include <cstdint>
+
 namespace lczero {
 
 uint16_t FP32toFP16(float f32);
@@ -27,16 +27,56 @@
 
 #include "utils/numa.h"
 
+#include <algorithm>
+#include <fstream>
+#include <string>
+
 #include "chess/bitboard.h"
 #include "utils/logging.h"
+#include "utils/string.h"
 
 #ifdef _WIN32
 #include <windows.h>
 #endif
 
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace lczero {
 
 int Numa::threads_per_core_ = 1;
+std::vector<std::vector<int>> Numa::node_cpus_;
+std::vector<int> Numa::node_ids_;
+std::vector<int> Numa::process_cpus_;
+
+#ifdef __linux__
+namespace {
+// Flags of get_mempolicy(2), from <linux/mempolicy.h>.
+const unsigned long kMpolFNode = 1;
+const unsigned long kMpolFAddr = 2;
+
+// Parses a sysfs list like "0-3,8-11". Returns an empty list if the file
+// can't be read.
+std::vector<int> ReadCpuList(const std::string& filename) {
+  std::ifstream file(filename);
+  std::string line;
+  std::vector<int> cpus;
+  if (!std::getline(file, line)) return cpus;
+  for (const auto& range : StrSplit(Trim(line), ",")) {
+    if (range.empty()) continue;
+    const auto dash = range.find('-');
+    const int first = std::stoi(range.substr(0, dash));
+    const int last =
+        dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+    for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+}  // namespace
+#endif
 
 void Numa::Init() {
 #if defined(_WIN64) && _WIN32_WINNT >= 0x0601
@@ -61,10 +101,41 @@ void Numa::Init() {
     CERR << "Group " << group_id << " has " << group_cores
          << " core(s) and " << group_threads << " thread(s).";
   }
+#elif defined(__linux__)
+  const auto siblings = ReadCpuList(
+      "/sys/devices/system/cpu/cpu0/topology/thread_siblings_list");
+  if (!siblings.empty()) threads_per_core_ = siblings.size();
+  // Node ids may be sparse, and nodes may have no CPUs.
+  std::vector<std::vector<int>> nodes;
+  std::vector<int> node_ids;
+  for (int id : ReadCpuList("/sys/devices/system/node/online")) {
+    auto cpus = ReadCpuList("/sys/devices/system/node/node" +
+                            std::to_string(id) + "/cpulist");
+    if (cpus.empty()) continue;
+    nodes.push_back(std::move(cpus));
+    node_ids.push_back(id);
+  }
+  if (nodes.size() > 1) {
+    CERR << "Detected " << nodes.size() << " NUMA nodes.";
+    for (size_t node = 0; node < nodes.size(); node++) {
+      CERR << "Node " << node_ids[node] << " has "
+           << nodes[node].size() / threads_per_core_ << " core(s) and "
+           << nodes[node].size() << " thread(s).";
+    }
+    node_cpus_ = std::move(nodes);
+    node_ids_ = std::move(node_ids);
+    // Pinned threads stay within the CPUs the process was started with.
+    cpu_set_t cpus;
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &cpus)) process_cpus_.push_back(cpu);
+      }
+    }
+  }
 #endif
 }
 
-void Numa::BindThread(int id) {
+void Numa::BindThread(int id, bool pin_to_node) {
 #if defined(_WIN64) && _WIN32_WINNT >= 0x0601
   int group_count = GetActiveProcessorGroupCount();
   int thread_count = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
@@ -85,9 +156,64 @@ void Numa::BindThread(int id) {
     }
     core_id -= group_cores;
   }
+  (void)pin_to_node;
+#elif defined(__linux__)
+  if (node_cpus_.empty() || process_cpus_.empty()) return;
+  // A thread which was pinned before gets all CPUs of the process back.
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  const auto& node_cpus = node_cpus_[GetThreadNode(id)];
+  int count = 0;
+  for (int cpu : process_cpus_) {
+    if (pin_to_node &&
+        std::find(node_cpus.begin(), node_cpus.end(), cpu) == node_cpus.end()) {
+      continue;
+    }
+    CPU_SET(cpu, &cpus);
+    count++;
+  }
+  if (count > 0) sched_setaffinity(0, sizeof(cpus), &cpus);
 #else
   // Silence warning.
   (void)id;
+  (void)pin_to_node;
+#endif
+}
+
+int Numa::GetNodeCount() {
+  return node_cpus_.empty() ? 1 : node_cpus_.size();
+}
+
+int Numa::GetThreadNode(int id) {
+  if (node_cpus_.empty()) return 0;
+  // Same as threads are distributed to processor groups on Windows: cores of
+  // each node in order, and the remaining threads to all nodes.
+  int core_count = 0;
+  for (const auto& cpus : node_cpus_) {
+    core_count += cpus.size() / threads_per_core_;
+  }
+  if (id >= core_count) return (id - core_count) % node_cpus_.size();
+  for (size_t node = 0; node < node_cpus_.size(); node++) {
+    const int node_cores = node_cpus_[node].size() / threads_per_core_;
+    if (id < node_cores) return node;
+    id -= node_cores;
+  }
+  return 0;
+}
+
+int Numa::GetMemoryNode(const void* ptr) {
+#ifdef __linux__
+  if (node_cpus_.empty()) return 0;
+  int node = -1;
+  if (syscall(SYS_get_mempolicy, &node, nullptr, 0, ptr,
+              kMpolFNode | kMpolFAddr) != 0) {
+    return -1;
+  }
+  const auto it = std::find(node_ids_.begin(), node_ids_.end(), node);
+  return it == node_ids_.end() ? -1 : it - node_ids_.begin();
+#else
+  (void)ptr;
+  return GetNodeCount() == 1 ? 0 : -1;
 #endif
 }
 
@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <vector>
+
 namespace lczero {
 
 class Numa {
@@ -36,11 +38,28 @@ class Numa {
   // Initialize and display statistics about processor configuration.
   static void Init();
 
-  // Bind thread to processor group.
-  static void BindThread(int id);
+  // Bind thread to processor group (Windows). On Linux, with @pin_to_node the
+  // thread is pinned to the CPUs of its NUMA node, otherwise it may run on all
+  // CPUs of the process.
+  static void BindThread(int id, bool pin_to_node = false);
+
+  // Returns the number of NUMA nodes, 1 if unknown.
+  static int GetNodeCount();
+  // Returns the NUMA node which BindThread(@id) binds the thread to.
+  static int GetThreadNode(int id);
+  // Returns the NUMA node holding the memory at @ptr, or -1 if unknown. This is
+  // a system call, so should only be used for sampling. Nodes are numbered
+  // from 0 like for GetThreadNode(), which may differ from the system ids.
+  static int GetMemoryNode(const void* ptr);
 
  private:
   static int threads_per_core_;
+  // CPUs of each NUMA node. Empty if there is just one node.
+  static std::vector<std::vector<int>> node_cpus_;
+  // System ids of the nodes in node_cpus_.
+  static std::vector<int> node_ids_;
+  // CPUs the process was allowed to run on at startup.
+  static std::vector<int> process_cpus_;
 };
 
 }  // namespace lczero
@@ -0,0 +1,86 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace lczero {
+
+// Socket addresses are either Unix domain socket paths, which must contain a
+// '/', or host:port for TCP.
+bool IsTcpAddress(const std::string& address);
+
+// Connected stream socket, in the local (Unix) domain or TCP. Errors are
+// reported by throwing exceptions.
+class StreamSocket {
+ public:
+  // Connects to a server listening at @address.
+  static std::unique_ptr<StreamSocket> Connect(const std::string& address);
+  ~StreamSocket();
+
+  StreamSocket(const StreamSocket&) = delete;
+  StreamSocket& operator=(const StreamSocket&) = delete;
+
+  // Reads exactly @size bytes. Returns false if the peer closed connection
+  // before sending anything.
+  bool Read(void* data, size_t size);
+  // Writes all @size bytes.
+  void Write(const void* data, size_t size);
+
+ private:
+  explicit StreamSocket(int fd) : fd_(fd) {}
+
+  const int fd_;
+
+  friend class StreamSocketServer;
+};
+
+// Listening stream socket, in the local (Unix) domain or TCP.
+class StreamSocketServer {
+ public:
+  // Starts listening at @address, replacing a stale socket file if there is
+  // one. The host part of a TCP address may be empty to listen on all
+  // interfaces.
+  explicit StreamSocketServer(const std::string& address);
+  // Stops listening and removes the socket file, if any.
+  ~StreamSocketServer();
+
+  StreamSocketServer(const StreamSocketServer&) = delete;
+  StreamSocketServer& operator=(const StreamSocketServer&) = delete;
+
+  // Waits for the next client to connect.
+  std::unique_ptr<StreamSocket> Accept();
+
+ private:
+  const std::string address_;
+  int fd_;
+};
+
+}  // namespace lczero
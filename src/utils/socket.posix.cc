@@ -0,0 +1,237 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/socket.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "utils/exception.h"
+
+namespace lczero {
+namespace {
+#ifdef MSG_NOSIGNAL
+// Don't get killed by SIGPIPE when the peer is gone.
+const int kSendFlags = MSG_NOSIGNAL;
+#else
+const int kSendFlags = 0;
+#endif
+
+sockaddr_un MakeUnixAddress(const std::string& path) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw Exception("Socket path is too long: " + path);
+  }
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  return address;
+}
+
+// Resolves host:port. The result has to be freed with freeaddrinfo().
+addrinfo* ResolveTcpAddress(const std::string& address, bool passive) {
+  const auto colon = address.rfind(':');
+  const std::string host = address.substr(0, colon);
+  const std::string port = address.substr(colon + 1);
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (passive) hints.ai_flags = AI_PASSIVE;
+  addrinfo* result = nullptr;
+  const int error = getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                                port.c_str(), &hints, &result);
+  if (error != 0) {
+    throw Exception("Unable to resolve " + address + ": " +
+                    gai_strerror(error));
+  }
+  return result;
+}
+
+int MakeSocket(int family) {
+  const int fd = socket(family, SOCK_STREAM, 0);
+  if (fd < 0) {
+    throw Exception("Unable to create socket: " + std::string(strerror(errno)));
+  }
+#ifdef SO_NOSIGPIPE
+  const int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+  return fd;
+}
+
+// Returns whether @path is a socket file left by a server which didn't exit
+// cleanly, i.e. nobody listens on it anymore.
+bool IsStaleUnixSocket(const std::string& path, const sockaddr_un& address) {
+  struct stat st;
+  if (lstat(path.c_str(), &st) < 0 || !S_ISSOCK(st.st_mode)) return false;
+  const int fd = MakeSocket(AF_UNIX);
+  const bool refused = connect(fd, reinterpret_cast<const sockaddr*>(&address),
+                               sizeof(address)) < 0 &&
+                       errno == ECONNREFUSED;
+  close(fd);
+  return refused;
+}
+
+// Messages are small and latency matters more than throughput.
+void DisableNagle(int fd) {
+  const int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+}  // namespace
+
+bool IsTcpAddress(const std::string& address) {
+  return address.find('/') == std::string::npos &&
+         address.find(':') != std::string::npos;
+}
+
+std::unique_ptr<StreamSocket> StreamSocket::Connect(
+    const std::string& address) {
+  if (IsTcpAddress(address)) {
+    addrinfo* const addresses = ResolveTcpAddress(address, false);
+    std::string error = "no address";
+    for (addrinfo* ai = addresses; ai; ai = ai->ai_next) {
+      const int fd = MakeSocket(ai->ai_family);
+      if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+        freeaddrinfo(addresses);
+        DisableNagle(fd);
+        return std::unique_ptr<StreamSocket>(new StreamSocket(fd));
+      }
+      error = strerror(errno);
+      close(fd);
+    }
+    freeaddrinfo(addresses);
+    throw Exception("Unable to connect to " + address + ": " + error);
+  }
+  const auto unix_address = MakeUnixAddress(address);
+  const int fd = MakeSocket(AF_UNIX);
+  if (connect(fd, reinterpret_cast<const sockaddr*>(&unix_address),
+              sizeof(unix_address)) < 0) {
+    const std::string error = strerror(errno);
+    close(fd);
+    throw Exception("Unable to connect to " + address + ": " + error);
+  }
+  return std::unique_ptr<StreamSocket>(new StreamSocket(fd));
+}
+
+StreamSocket::~StreamSocket() { close(fd_); }
+
+bool StreamSocket::Read(void* data, size_t size) {
+  char* ptr = static_cast<char*>(data);
+  size_t done = 0;
+  while (done < size) {
+    const ssize_t res = recv(fd_, ptr + done, size - done, 0);
+    if (res < 0 && errno == EINTR) continue;
+    if (res < 0) {
+      throw Exception("Socket read failed: " + std::string(strerror(errno)));
+    }
+    if (res == 0) {
+      if (done == 0) return false;
+      throw Exception("Connection closed in the middle of a message.");
+    }
+    done += res;
+  }
+  return true;
+}
+
+void StreamSocket::Write(const void* data, size_t size) {
+  const char* ptr = static_cast<const char*>(data);
+  size_t done = 0;
+  while (done < size) {
+    const ssize_t res = send(fd_, ptr + done, size - done, kSendFlags);
+    if (res < 0 && errno == EINTR) continue;
+    if (res < 0) {
+      throw Exception("Socket write failed: " + std::string(strerror(errno)));
+    }
+    done += res;
+  }
+}
+
+StreamSocketServer::StreamSocketServer(const std::string& address)
+    : address_(address) {
+  if (IsTcpAddress(address)) {
+    addrinfo* const addresses = ResolveTcpAddress(address, true);
+    fd_ = MakeSocket(addresses->ai_family);
+    // Allow restarting a server while old connections are in TIME_WAIT.
+    const int on = 1;
+    setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    const bool ok = bind(fd_, addresses->ai_addr, addresses->ai_addrlen) == 0 &&
+                    listen(fd_, SOMAXCONN) == 0;
+    freeaddrinfo(addresses);
+    if (!ok) {
+      const std::string error = strerror(errno);
+      close(fd_);
+      throw Exception("Unable to listen at " + address + ": " + error);
+    }
+    return;
+  }
+  const auto unix_address = MakeUnixAddress(address);
+  fd_ = MakeSocket(AF_UNIX);
+  auto listen_at_address = [&]() {
+    return bind(fd_, reinterpret_cast<const sockaddr*>(&unix_address),
+                sizeof(unix_address)) == 0 &&
+           listen(fd_, SOMAXCONN) == 0;
+  };
+  bool ok = listen_at_address();
+  int error = errno;
+  // A socket file left by a server which didn't exit cleanly makes bind()
+  // fail. It's only removed if no server listens on it anymore.
+  if (!ok && error == EADDRINUSE && IsStaleUnixSocket(address, unix_address)) {
+    unlink(address.c_str());
+    ok = listen_at_address();
+    error = errno;
+  }
+  if (!ok) {
+    close(fd_);
+    throw Exception("Unable to listen at " + address + ": " + strerror(error));
+  }
+}
+
+StreamSocketServer::~StreamSocketServer() {
+  close(fd_);
+  if (!IsTcpAddress(address_)) unlink(address_.c_str());
+}
+
+std::unique_ptr<StreamSocket> StreamSocketServer::Accept() {
+  while (true) {
+    const int fd = accept(fd_, nullptr, nullptr);
+    if (fd >= 0) {
+      if (IsTcpAddress(address_)) DisableNagle(fd);
+      return std::unique_ptr<StreamSocket>(new StreamSocket(fd));
+    }
+    if (errno != EINTR) {
+      throw Exception("Socket accept failed: " + std::string(strerror(errno)));
+    }
+  }
+}
+
+}  // namespace lczero
@@ -0,0 +1,63 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2020 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/socket.h"
+
+#include "utils/exception.h"
+
+namespace lczero {
+namespace {
+const char kUnsupported[] = "Sockets are not supported on this platform.";
+}  // namespace
+
+bool IsTcpAddress(const std::string& address) {
+  return address.find('/') == std::string::npos &&
+         address.find(':') != std::string::npos;
+}
+
+std::unique_ptr<StreamSocket> StreamSocket::Connect(const std::string&) {
+  throw Exception(kUnsupported);
+}
+
+StreamSocket::~StreamSocket() {}
+
+bool StreamSocket::Read(void*, size_t) { throw Exception(kUnsupported); }
+
+void StreamSocket::Write(const void*, size_t) { throw Exception(kUnsupported); }
+
+StreamSocketServer::StreamSocketServer(const std::string& address)
+    : address_(address), fd_(-1) {
+  throw Exception(kUnsupported);
+}
+
+StreamSocketServer::~StreamSocketServer() {}
+
+std::unique_ptr<StreamSocket> StreamSocketServer::Accept() {
+  throw Exception(kUnsupported);
+}
+
+}  // namespace lczero
@@ -29,6 +29,7 @@
 
 #include <algorithm>
 #include <cctype>
+#include <iomanip>
 #include <sstream>
 #include <vector>
 
@@ -118,4 +119,21 @@ std::vector<std::string> FlowText(const std::string& src, size_t width) {
   return result;
 }
 
+std::string JsonString(const std::string& str) {
+  std::ostringstream oss;
+  oss << '"';
+  for (const char c : str) {
+    if (c == '"' || c == '\\') {
+      oss << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      oss << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+          << static_cast<int>(c) << std::dec;
+    } else {
+      oss << c;
+    }
+  }
+  oss << '"';
+  return oss.str();
+}
+
 }  // namespace lczero
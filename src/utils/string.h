@@ -61,4 +61,7 @@ bool StringsEqualIgnoreCase(const std::string& a, const std::string& b);
 // Flow text into lines of width up to @width.
 std::vector<std::string> FlowText(const std::string& src, size_t width);
 
+// Quotes and escapes @str as a JSON string.
+std::string JsonString(const std::string& str);
+
 }  // namespace lczero